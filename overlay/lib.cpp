@@ -89,7 +89,9 @@ void __cdecl checkForWPF() {
 Pipe::Pipe() {
 	hSocket = INVALID_HANDLE_VALUE;
 	hMemory = NULL;
+	a_ucShmem = NULL;
 	a_ucTexture = NULL;
+	uiFront = uiFrame = 0;
 
 	omMsg.omh.iLength = -1;
 
@@ -107,8 +109,9 @@ void Pipe::release() {
 	if (hMemory) {
 		CloseHandle(hMemory);
 		hMemory = NULL;
-		if (a_ucTexture) {
-			UnmapViewOfFile(a_ucTexture);
+		if (a_ucShmem) {
+			UnmapViewOfFile(a_ucShmem);
+			a_ucShmem = NULL;
 			a_ucTexture = NULL;
 		}
 
@@ -190,8 +193,6 @@ void Pipe::checkMessage(unsigned int width, unsigned int height) {
 		ods("Pipe: SentInitMsg with w h %d %d", uiWidth, uiHeight);
 	}
 
-	std::vector<RECT> blits;
-
 	while (1) {
 		DWORD dwBytesLeft;
 		DWORD dwBytesRead;
@@ -253,7 +254,7 @@ void Pipe::checkMessage(unsigned int width, unsigned int height) {
 
 					release();
 
-					hMemory = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, uiWidth * uiHeight * 4, memname);
+					hMemory = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, OVERLAY_SHMEM_SIZE(uiWidth, uiHeight), memname);
 
 					if (GetLastError() != ERROR_ALREADY_EXISTS) {
 						ods("Pipe: Memory %s(%d) => %ls doesn't exist", omMsg.oms.a_cName, omMsg.omh.iLength, memname);
@@ -269,9 +270,9 @@ void Pipe::checkMessage(unsigned int width, unsigned int height) {
 						break;
 					}
 
-					a_ucTexture = reinterpret_cast<unsigned char *>(MapViewOfFile(hMemory, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+					a_ucShmem = reinterpret_cast<unsigned char *>(MapViewOfFile(hMemory, FILE_MAP_ALL_ACCESS, 0, 0, 0));
 
-					if (a_ucTexture == NULL) {
+					if (a_ucShmem == NULL) {
 						ods("Pipe: Failed to map memory");
 						CloseHandle(hMemory);
 						hMemory = NULL;
@@ -280,15 +281,29 @@ void Pipe::checkMessage(unsigned int width, unsigned int height) {
 
 					MEMORY_BASIC_INFORMATION mbi;
 					memset(&mbi, 0, sizeof(mbi));
-					if ((VirtualQuery(a_ucTexture, &mbi, sizeof(mbi)) == 0) || (mbi.RegionSize < (uiHeight * uiWidth * 4))) {
+					if ((VirtualQuery(a_ucShmem, &mbi, sizeof(mbi)) == 0) || (mbi.RegionSize < OVERLAY_SHMEM_SIZE(uiWidth, uiHeight))) {
 						ods("Pipe: Memory too small");
-						UnmapViewOfFile(a_ucTexture);
+						UnmapViewOfFile(a_ucShmem);
+						CloseHandle(hMemory);
+						a_ucShmem = NULL;
+						hMemory = NULL;
+						break;
+					}
+
+					const OverlayShmemHeader *osh = reinterpret_cast<const OverlayShmemHeader *>(a_ucShmem);
+					if ((osh->uiMagic != OVERLAY_MAGIC_NUMBER) || (osh->uiWidth != uiWidth) || (osh->uiHeight != uiHeight)) {
+						ods("Pipe: Memory header mismatch");
+						UnmapViewOfFile(a_ucShmem);
 						CloseHandle(hMemory);
-						a_ucTexture = NULL;
+						a_ucShmem = NULL;
 						hMemory = NULL;
 						break;
 					}
 
+					uiFront = 0;
+					uiFrame = 0;
+					a_ucTexture = OVERLAY_SHMEM_BUFFER(a_ucShmem, uiFront, uiWidth, uiHeight);
+
 					OverlayMsg om;
 					om.omh.uiMagic = OVERLAY_MAGIC_NUMBER;
 					om.omh.uiType = OVERLAY_MSGTYPE_SHMEM;
@@ -300,24 +315,6 @@ void Pipe::checkMessage(unsigned int width, unsigned int height) {
 					newTexture(uiWidth, uiHeight);
 				}
 				break;
-			case OVERLAY_MSGTYPE_BLIT: {
-					RECT r = {omMsg.omb.x, omMsg.omb.y, omMsg.omb.x + omMsg.omb.w, omMsg.omb.y + omMsg.omb.h};
-
-					std::vector<RECT>::iterator i = blits.begin();
-					while (i != blits.end()) {
-						RECT is;
-						if (::IntersectRect(&is, &r, & *i)) {
-							::UnionRect(&is, &r, & *i);
-							r = is;
-							blits.erase(i);
-							i = blits.begin();
-						} else {
-							++i;
-						}
-					}
-					blits.push_back(r);
-				}
-				break;
 			case OVERLAY_MSGTYPE_ACTIVE: {
 					uiLeft = omMsg.oma.x;
 					uiTop = omMsg.oma.y;
@@ -333,11 +330,40 @@ void Pipe::checkMessage(unsigned int width, unsigned int height) {
 		omMsg.omh.iLength = -1;
 	}
 
-	if (!a_ucTexture)
+	checkFrame();
+}
+
+// Swaps in the newest frame from shared memory, if Mumble published one,
+// and uploads what changed.
+void Pipe::checkFrame() {
+	if (!a_ucShmem)
+		return;
+
+	OverlayShmemHeader *osh = reinterpret_cast<OverlayShmemHeader *>(a_ucShmem);
+	if (! (osh->uiLatest & OVERLAY_SHMEM_DIRTY))
 		return;
 
-	for (std::vector<RECT>::iterator i = blits.begin(); i != blits.end(); ++i)
-		blit((*i).left, (*i).top, (*i).right - (*i).left, (*i).bottom - (*i).top);
+	unsigned int latest = overlayExchange(&osh->uiLatest, uiFront) & OVERLAY_SHMEM_INDEX;
+	if (latest >= OVERLAY_SHMEM_BUFFERS) {
+		ods("Pipe: Invalid frame buffer %u", latest);
+		disconnect();
+		return;
+	}
+
+	uiFront = latest;
+	a_ucTexture = OVERLAY_SHMEM_BUFFER(a_ucShmem, uiFront, uiWidth, uiHeight);
+
+	const OverlayShmemFrame &osf = osh->osf[uiFront];
+	if ((osf.uiFrame == uiFrame + 1) && (osf.uiRects <= OVERLAY_SHMEM_MAX_RECTS)) {
+		for (unsigned int i = 0; i < osf.uiRects; ++i) {
+			const OverlayShmemRect &r = osf.osr[i];
+			if ((r.x + r.w <= uiWidth) && (r.y + r.h <= uiHeight))
+				blit(r.x, r.y, r.w, r.h);
+		}
+	} else {
+		blit(0, 0, uiWidth, uiHeight);
+	}
+	uiFrame = osf.uiFrame;
 }
 
 static void checkHooks(bool preonly) {
@@ -104,8 +104,13 @@ class Pipe {
 	private:
 		HANDLE hSocket;
 		HANDLE hMemory;
+		// The whole shared memory segment; a_ucTexture points into it.
+		unsigned char *a_ucShmem;
+		unsigned int uiFront;
+		unsigned int uiFrame;
 
 		void release();
+		void checkFrame();
 	protected:
 		unsigned int uiWidth, uiHeight;
 		unsigned int uiLeft, uiTop, uiRight, uiBottom;
@@ -31,8 +31,13 @@
 #ifndef MUMBLE_INTERNAL_OVERLAY_H_
 #define MUMBLE_INTERNAL_OVERLAY_H_
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(_InterlockedExchange)
+#endif
+
 // overlay message protocol version number
-#define OVERLAY_MAGIC_NUMBER 0x00000005
+#define OVERLAY_MAGIC_NUMBER 0x00000006
 
 struct OverlayMsgHeader {
 	unsigned int uiMagic;
@@ -51,10 +56,8 @@ struct OverlayMsgShmem {
 	char a_cName[2048];
 };
 
-#define OVERLAY_MSGTYPE_BLIT 2
-struct OverlayMsgBlit {
-	unsigned int x, y, w, h;
-};
+// Message type 2 used to be BLIT. Frames are now handed over through the
+// shared memory buffers described below.
 
 #define OVERLAY_MSGTYPE_ACTIVE 3
 struct OverlayMsgActive {
@@ -86,7 +89,6 @@ struct OverlayMsg {
 		char msgbuffer[1];
 		struct OverlayMsgShmem oms;
 		struct OverlayMsgInit omi;
-		struct OverlayMsgBlit omb;
 		struct OverlayMsgActive oma;
 		struct OverlayMsgPid omp;
 		struct OverlayMsgFps omf;
@@ -94,4 +96,58 @@ struct OverlayMsg {
 	};
 };
 
+// The shared memory segment starts with an OverlayShmemHeader, followed by
+// OVERLAY_SHMEM_BUFFERS frames of uiWidth * uiHeight BGRA pixels.
+//
+// The buffers are handed around as a triple buffer. Mumble paints into a
+// buffer of its own, then swaps it into uiLatest with OVERLAY_SHMEM_DIRTY
+// set. The overlay owns one buffer too, and only looks at uiLatest when
+// the flag is set, swapping its own buffer back in. Neither side ever
+// touches a buffer the other one owns, so the overlay always reads a
+// complete frame and never has to wait.
+//
+// The side that creates the segment starts with buffer 2, uiLatest holds
+// buffer 1 without the flag, and the overlay starts with buffer 0.
+#define OVERLAY_SHMEM_BUFFERS 3
+#define OVERLAY_SHMEM_MAX_RECTS 8
+#define OVERLAY_SHMEM_DIRTY 0x80000000U
+#define OVERLAY_SHMEM_INDEX 0x0000ffffU
+#define OVERLAY_SHMEM_HEADER_SIZE 4096
+#define OVERLAY_SHMEM_SIZE(w, h) (OVERLAY_SHMEM_HEADER_SIZE + OVERLAY_SHMEM_BUFFERS * (w) * (h) * 4)
+#define OVERLAY_SHMEM_BUFFER(base, i, w, h) ((base) + OVERLAY_SHMEM_HEADER_SIZE + (i) * (w) * (h) * 4)
+
+struct OverlayShmemRect {
+	unsigned int x, y, w, h;
+};
+
+struct OverlayShmemFrame {
+	// Sequence number of the frame held in this buffer.
+	unsigned int uiFrame;
+	// What changed since frame uiFrame - 1. An overlay that skipped frames
+	// has to upload the whole buffer instead.
+	unsigned int uiRects;
+	struct OverlayShmemRect osr[OVERLAY_SHMEM_MAX_RECTS];
+};
+
+struct OverlayShmemHeader {
+	unsigned int uiMagic;
+	unsigned int uiWidth, uiHeight;
+	volatile unsigned int uiLatest;
+	struct OverlayShmemFrame osf[OVERLAY_SHMEM_BUFFERS];
+};
+
+// Atomically stores v in *p and returns the previous value, with a full
+// memory barrier on both sides.
+static inline unsigned int overlayExchange(volatile unsigned int *p, unsigned int v) {
+#ifdef _MSC_VER
+	return (unsigned int) _InterlockedExchange((volatile long *) p, (long) v);
+#else
+	unsigned int old;
+	__sync_synchronize();
+	old = __sync_lock_test_and_set(p, v);
+	__sync_synchronize();
+	return old;
+#endif
+}
+
 #endif
@@ -106,9 +106,13 @@ typedef struct _Context {
 	// opengl overlay texture
 	GLuint texture;
 
-	// overlay texture in shared memory
-	unsigned char *a_ucTexture;
+	// overlay texture in shared memory: the mapped segment, and the frame
+	// buffer in it that we currently own
+	unsigned char *a_ucMapped;
 	unsigned int uiMappedLength;
+	unsigned char *a_ucTexture;
+	unsigned int uiFront;
+	unsigned int uiFrame;
 
 	bool bValid;
 	bool bMesa;
@@ -221,8 +225,9 @@ static void newContext(Context * ctx) {
 }
 
 static void releaseMem(Context *ctx) {
-	if (ctx->a_ucTexture) {
-		munmap(ctx->a_ucTexture, ctx->uiMappedLength);
+	if (ctx->a_ucMapped) {
+		munmap(ctx->a_ucMapped, ctx->uiMappedLength);
+		ctx->a_ucMapped = NULL;
 		ctx->a_ucTexture = NULL;
 		ctx->uiMappedLength = 0;
 	}
@@ -272,6 +277,67 @@ static void regenTexture(Context *ctx) {
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)ctx->uiWidth, (GLsizei)ctx->uiHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, ctx->a_ucTexture);
 }
 
+// copy a rectangle of the current frame buffer into the gl-texture
+static void blitTexture(Context *ctx, unsigned int x, unsigned int y, unsigned int w, unsigned int h) {
+	ods("BLIT %d %d %d %d", x, y, w, h);
+	glBindTexture(GL_TEXTURE_2D, ctx->texture);
+
+	if ((x == 0) && (y == 0) && (w == ctx->uiWidth) && (h == ctx->uiHeight)) {
+		ods("Optimzied fullscreen blit");
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)ctx->uiWidth, (GLsizei)ctx->uiHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, ctx->a_ucTexture);
+	} else {
+		// allocate temporary memory
+		unsigned char *ptr = (unsigned char *) malloc(w*h*4);
+		unsigned int row;
+		memset(ptr, 0, w * h * 4);
+
+		// copy overlay texture to temporary memory to adapt to full opengl ui size (overlay at correct place)
+		for (row = 0; row < h; ++row) {
+			const unsigned char *sptr = ctx->a_ucTexture + 4 * ((y+row) * ctx->uiWidth + x);
+			unsigned char *dptr = ptr + 4 * w * row;
+			memcpy(dptr, sptr, w * 4);
+		}
+
+		// copy temporary texture to opengl
+		glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint)x, (GLint)y, (GLint)w, (GLint)h, GL_BGRA, GL_UNSIGNED_BYTE, ptr);
+		free(ptr);
+	}
+}
+
+// swap in the newest frame buffer if mumble published one, and upload what
+// changed since the frame we had
+static void checkFrame(Context *ctx) {
+	if ((ctx->a_ucMapped == NULL) || (ctx->texture == ~0U))
+		return;
+
+	struct OverlayShmemHeader *osh = (struct OverlayShmemHeader *) ctx->a_ucMapped;
+	if (! (osh->uiLatest & OVERLAY_SHMEM_DIRTY))
+		return;
+
+	unsigned int latest = overlayExchange(&osh->uiLatest, ctx->uiFront) & OVERLAY_SHMEM_INDEX;
+	if (latest >= OVERLAY_SHMEM_BUFFERS) {
+		ods("Invalid frame buffer %u", latest);
+		disconnect(ctx);
+		return;
+	}
+
+	ctx->uiFront = latest;
+	ctx->a_ucTexture = OVERLAY_SHMEM_BUFFER(ctx->a_ucMapped, ctx->uiFront, ctx->uiWidth, ctx->uiHeight);
+
+	const struct OverlayShmemFrame *osf = & osh->osf[ctx->uiFront];
+	if ((osf->uiFrame == ctx->uiFrame + 1) && (osf->uiRects <= OVERLAY_SHMEM_MAX_RECTS)) {
+		unsigned int i;
+		for (i = 0; i < osf->uiRects; ++i) {
+			const struct OverlayShmemRect *osr = & osf->osr[i];
+			if ((osr->x + osr->w <= ctx->uiWidth) && (osr->y + osr->h <= ctx->uiHeight))
+				blitTexture(ctx, osr->x, osr->y, osr->w, osr->h);
+		}
+	} else {
+		blitTexture(ctx, 0, 0, ctx->uiWidth, ctx->uiHeight);
+	}
+	ctx->uiFrame = osf->uiFrame;
+}
+
 static void drawOverlay(Context *ctx, unsigned int width, unsigned int height) {
 	// if no socket is active, initialize and connect to socket
 	if (ctx->iSocket == -1) {
@@ -360,17 +426,26 @@ static void drawOverlay(Context *ctx, unsigned int width, unsigned int height) {
 						struct OverlayMsgShmem *oms = (struct OverlayMsgShmem *) & ctx->omMsg.omi;
 						ods("SHMEM %s", oms->a_cName);
 						releaseMem(ctx);
-						int fd = shm_open(oms->a_cName, O_RDONLY, 0600);
+						int fd = shm_open(oms->a_cName, O_RDWR, 0600);
 						if (fd != -1) {
 							struct stat buf;
 							
 							if (fstat(fd, &buf) != -1) {
 								unsigned int buflen = buf.st_size;
-								if (buflen >= ctx->uiWidth * ctx->uiHeight * 4
+								if (buflen >= OVERLAY_SHMEM_SIZE(ctx->uiWidth, ctx->uiHeight)
 								        && buflen < 512 * 1024 * 1024) {
 									ctx->uiMappedLength = buflen;
-									ctx->a_ucTexture = mmap(NULL, (size_t)buflen, PROT_READ, MAP_SHARED, fd, 0);
-									if (ctx->a_ucTexture != MAP_FAILED) {
+									ctx->a_ucMapped = mmap(NULL, (size_t)buflen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+									const struct OverlayShmemHeader *osh = (const struct OverlayShmemHeader *) ctx->a_ucMapped;
+									if ((ctx->a_ucMapped != MAP_FAILED)
+									        && (osh->uiMagic == OVERLAY_MAGIC_NUMBER)
+									        && (osh->uiWidth == ctx->uiWidth)
+									        && (osh->uiHeight == ctx->uiHeight)) {
+										close(fd);
+										ctx->uiFront = 0;
+										ctx->uiFrame = 0;
+										ctx->a_ucTexture = OVERLAY_SHMEM_BUFFER(ctx->a_ucMapped, ctx->uiFront, ctx->uiWidth, ctx->uiHeight);
+
 										// mmap successfull; send a new bodyless sharedmemory overlay message and regenerate the overlay texture
 										struct OverlayMsg om;
 										om.omh.uiMagic = OVERLAY_MAGIC_NUMBER;
@@ -383,6 +458,9 @@ static void drawOverlay(Context *ctx, unsigned int width, unsigned int height) {
 										regenTexture(ctx);
 										continue;
 									}
+									if (ctx->a_ucMapped != MAP_FAILED)
+										munmap(ctx->a_ucMapped, (size_t)buflen);
+									ctx->a_ucMapped = NULL;
 									ctx->a_ucTexture = NULL;
 								}
 								ctx->uiMappedLength = 0;
@@ -394,40 +472,6 @@ static void drawOverlay(Context *ctx, unsigned int width, unsigned int height) {
 						ods("Failed to map memory");
 					}
 					break;
-				// blit overlay message: blit overlay texture from shared memory to gl-texture var
-				case OVERLAY_MSGTYPE_BLIT: {
-						struct OverlayMsgBlit *omb = & ctx->omMsg.omb;
-						ods("BLIT %d %d %d %d", omb->x, omb->y, omb->w, omb->h);
-						if ((ctx->a_ucTexture != NULL) && (ctx->texture != ~0U)) {
-							glBindTexture(GL_TEXTURE_2D, ctx->texture);
-
-							if ((omb->x == 0) && (omb->y == 0) && (omb->w == ctx->uiWidth) && (omb->h == ctx->uiHeight)) {
-								ods("Optimzied fullscreen blit");
-								glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)ctx->uiWidth, (GLsizei)ctx->uiHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, ctx->a_ucTexture);
-							} else {
-								// allocate temporary memory
-								unsigned int x = omb->x;
-								unsigned int y = omb->y;
-								unsigned int w = omb->w;
-								unsigned int h = omb->h;
-								unsigned char *ptr = (unsigned char *) malloc(w*h*4);
-								unsigned int row;
-								memset(ptr, 0, w * h * 4);
-
-								// copy overlay texture to temporary memory to adapt to full opengl ui size (overlay at correct place)
-								for (row = 0; row < h; ++row) {
-									const unsigned char *sptr = ctx->a_ucTexture + 4 * ((y+row) * ctx->uiWidth + x);
-									unsigned char *dptr = ptr + 4 * w * row;
-									memcpy(dptr, sptr, w * 4);
-								}
-
-								// copy temporary texture to opengl
-								glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint)x, (GLint)y, (GLint)w, (GLint)h, GL_BGRA, GL_UNSIGNED_BYTE, ptr);
-								free(ptr);
-							}
-						}
-					}
-					break;
 				case OVERLAY_MSGTYPE_ACTIVE: {
 						struct OverlayMsgActive *oma = & ctx->omMsg.oma;
 						ods("ACTIVE %d %d %d %d", oma->x, oma->y, oma->w, oma->h);
@@ -457,6 +501,8 @@ static void drawOverlay(Context *ctx, unsigned int width, unsigned int height) {
 		}
 	}
 
+	checkFrame(ctx);
+
 	if ((ctx->a_ucTexture == NULL) || (ctx->texture == ~0U))
 		return;
 
@@ -37,7 +37,14 @@ open(my $MH, "murmur_ice/Murmur.h") or die "Could not open murmur_ice/Murmur.h";
 
 sub func($$\@\@\@) {
   my ($class, $func, $wrapargs, $callargs, $implargs) = @_;
-  
+
+  # Calls about a server run in that server's thread, except those that
+  # boot or stop it. The call name is used for profiling.
+  my $target = ", -1";
+  if (($class eq "Server") && ! grep($_ eq $func, qw(isRunning start stop delete id))) {
+    $target = ", QString::fromStdString(current.id.name).toInt()";
+  }
+  $target .= ", \"${class}.${func}\"";
 
   print $I qq'
 void ::Murmur::${class}I::${func}_async('. join(", ", @{$wrapargs}).qq') {
@@ -66,7 +73,7 @@ void ::Murmur::${class}I::${func}_async('. join(", ", @{$wrapargs}).qq') {
 		}
 	}
 #endif
-	ExecEvent *ie = new ExecEvent(boost::bind(&impl_${class}_$func, ' . join(", ", @${callargs}).qq'));
+	ExecEvent *ie = new ExecEvent(boost::bind(&impl_${class}_$func, ' . join(", ", @${callargs}).qq')$target);
 	QCoreApplication::instance()->postEvent(mi, ie);
 }
 ';
@@ -0,0 +1,96 @@
+#!/usr/bin/env python
+# -*- coding: utf-8
+#
+# Checks that getChannels, getTree, getUsers and getChangesSince follow
+# link changes and renames. Run against a test server; it creates and
+# removes a few channels.
+import Ice, sys
+
+Ice.loadSlice('', ['-I' + Ice.getSliceDir(), 'Murmur.ice'])
+import Murmur
+
+ice = Ice.initialize(sys.argv)
+meta = Murmur.MetaPrx.checkedCast(ice.stringToProxy('Meta:tcp -h 127.0.0.1 -p 6502'))
+server = meta.getBootedServers()[0]
+
+failed = False
+
+def check(what, ok):
+  global failed
+  print '%-50s %s' % (what, ok and 'ok' or 'FAILED')
+  if not ok:
+    failed = True
+
+def treeChannels(tree, out):
+  out[tree.c.id] = tree.c
+  for child in tree.children:
+    treeChannels(child, out)
+  return out
+
+def treeUsers(tree, out):
+  for u in tree.users:
+    out[u.session] = u
+  for child in tree.children:
+    treeUsers(child, out)
+  return out
+
+def linksOf(id):
+  channels = server.getChannels()
+  tree = treeChannels(server.getTree(), {})
+  return (sorted(channels[id].links), sorted(tree[id].links))
+
+# Prime the caches, so stale results would show.
+server.getChannels()
+server.getTree()
+seq = server.getChangesSince(0).sequence
+
+a = server.addChannel('journal-a', 0)
+b = server.addChannel('journal-b', 0)
+c = server.addChannel('journal-c', 0)
+
+state = server.getChannelState(a)
+state.links = [b, c]
+server.setChannelState(state)
+
+check('link shows on the peer in getChannels', linksOf(b)[0] == [a])
+check('link shows on the peer in getTree', linksOf(b)[1] == [a])
+changes = server.getChangesSince(seq)
+check('getChangesSince reports both ends of the link', a in changes.channels and b in changes.channels and c in changes.channels)
+seq = changes.sequence
+
+state = server.getChannelState(a)
+state.links = [c]
+server.setChannelState(state)
+
+check('unlink shows on the peer in getChannels', linksOf(b)[0] == [])
+check('unlink shows on the peer in getTree', linksOf(b)[1] == [])
+changes = server.getChangesSince(seq)
+check('getChangesSince reports the unlinked peer', b in changes.channels)
+seq = changes.sequence
+
+server.removeChannel(a)
+check('removing a channel unlinks its peers', linksOf(c) == ([], []))
+changes = server.getChangesSince(seq)
+check('getChangesSince reports the former peer', c in changes.channels and a in changes.removedChannels)
+
+server.removeChannel(b)
+server.removeChannel(c)
+
+registered = [u for u in server.getUsers().values() if u.userid > 0]
+if not registered:
+  print 'Connect a registered user (not SuperUser) to check renames.'
+else:
+  u = registered[0]
+  server.getUsers()
+  server.getTree()
+  raw_input('Rename "%s" from a client (Server > Registered Users), then press enter. ' % u.name)
+  renamed = server.getUsers()[u.session].name
+  check('rename shows in getUsers', renamed != u.name)
+  check('rename shows in getTree', treeUsers(server.getTree(), {})[u.session].name == renamed)
+
+  server.unregisterUser(u.userid)
+  check('unregistration shows in getUsers', server.getUsers()[u.session].userid == -1)
+  check('unregistration shows in getTree', treeUsers(server.getTree(), {})[u.session].userid == -1)
+
+ice.shutdown()
+sys.exit(failed and 1 or 0)
@@ -32,6 +32,7 @@
 
 #include "AudioInput.h"
 
+#include "AudioKernels.h"
 #include "AudioOutput.h"
 #include "CELTCodec.h"
 #include "ServerHandler.h"
@@ -106,6 +107,8 @@ AudioInput::AudioInput() : opusBuffer(g.s.iFramesPerPacket * (SAMPLE_RATE / 100)
 	cCodec = NULL;
 	ceEncoder = NULL;
 
+	psPosition = new PositionSample();
+
 	iSampleRate = SAMPLE_RATE;
 	iFrameSize = SAMPLE_RATE / 100;
 
@@ -128,15 +131,27 @@ AudioInput::AudioInput() : opusBuffer(g.s.iFramesPerPacket * (SAMPLE_RATE / 100)
 
 	sppPreprocess = NULL;
 	sesEcho = NULL;
-	srsMic = srsEcho = NULL;
-	iJitterSeq = 0;
-	iMinBuffered = 1000;
+	rMic = rEcho = NULL;
+	rbEcho = NULL;
+	pfEchoOutput = NULL;
+	iEchoOutputFilled = 0;
+	psEchoFrame = NULL;
+	psSpeakerFrame = NULL;
+	fEchoFill = 0.0f;
+	iEchoFillFrames = 0;
+	iEchoPendingSetup = iEchoBuiltSetup = iEchoBuiltDrift = 0;
+	// Drift corrections are re-evaluated once a second.
+	startTimer(250);
 
 	psMic = new short[iFrameSize];
 	psClean = new short[iFrameSize];
 
 	psSpeaker = NULL;
 
+	bMicLevelsValid = false;
+	sMicPeak = 0;
+	fMicSumSquares = 0.0f;
+
 	iEchoChannels = iMicChannels = 0;
 	iEchoFilled = iMicFilled = 0;
 	eMicFormat = eEchoFormat = SampleFloat;
@@ -174,25 +189,26 @@ AudioInput::~AudioInput() {
 		cCodec->celt_encoder_destroy(ceEncoder);
 	}
 
-	foreach(short *buf, qlEchoFrames)
-		delete [] buf;
-
 	if (sppPreprocess)
 		speex_preprocess_state_destroy(sppPreprocess);
 	if (sesEcho)
 		speex_echo_state_destroy(sesEcho);
 
-	if (srsMic)
-		speex_resampler_destroy(srsMic);
-	if (srsEcho)
-		speex_resampler_destroy(srsEcho);
+	delete rMic;
+	delete rEcho;
+	delete qapEchoPending.fetchAndStoreAcquire(NULL);
+	delete qapEchoRetired.fetchAndStoreAcquire(NULL);
+	delete psPosition;
 
 	delete [] psMic;
 	delete [] psClean;
-	delete [] psSpeaker;
+	delete [] psEchoFrame;
+	delete [] psSpeakerFrame;
+	delete rbEcho;
 
 	delete [] pfMicInput;
 	delete [] pfEchoInput;
+	delete [] pfEchoOutput;
 	delete [] pfOutput;
 }
 
@@ -200,148 +216,81 @@ bool AudioInput::isTransmitting() const {
 	return bPreviousVoice;
 };
 
-#define IN_MIXER_FLOAT(channels) \
-static void inMixerFloat##channels ( float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int N) { \
-  const float * RESTRICT input = reinterpret_cast<const float *>(ipt); \
-  register const float m = 1.0f / static_cast<float>(channels); \
-  Q_UNUSED(N); \
-  for(unsigned int i=0;i<nsamp;++i) {\
-	  register float v= 0.0f; \
-	  for(unsigned int j=0;j<channels;++j) \
-	  	v += input[i*channels+j]; \
-	  buffer[i] = v * m; \
-  } \
+static void inMixerFloat(float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int N) {
+	AudioKernels::downmixFloat(buffer, reinterpret_cast<const float *>(ipt), nsamp, N);
 }
 
-#define IN_MIXER_SHORT(channels) \
-static void inMixerShort##channels ( float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int N) { \
-  const short * RESTRICT input = reinterpret_cast<const short *>(ipt); \
-  register const float m = 1.0f / (32768.f * static_cast<float>(channels)); \
-  Q_UNUSED(N); \
-  for(unsigned int i=0;i<nsamp;++i) {\
-	  register float v= 0.0f; \
-	  for(unsigned int j=0;j<channels;++j) \
-	  	v += static_cast<float>(input[i*channels+j]); \
-	  buffer[i] = v * m; \
-  } \
+static void inMixerShort(float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int N) {
+	AudioKernels::downmixShort(buffer, reinterpret_cast<const short *>(ipt), nsamp, N);
 }
 
-IN_MIXER_FLOAT(1)
-IN_MIXER_FLOAT(2)
-IN_MIXER_FLOAT(3)
-IN_MIXER_FLOAT(4)
-IN_MIXER_FLOAT(5)
-IN_MIXER_FLOAT(6)
-IN_MIXER_FLOAT(7)
-IN_MIXER_FLOAT(8)
-IN_MIXER_FLOAT(N)
-
-IN_MIXER_SHORT(1)
-IN_MIXER_SHORT(2)
-IN_MIXER_SHORT(3)
-IN_MIXER_SHORT(4)
-IN_MIXER_SHORT(5)
-IN_MIXER_SHORT(6)
-IN_MIXER_SHORT(7)
-IN_MIXER_SHORT(8)
-IN_MIXER_SHORT(N)
-
 AudioInput::inMixerFunc AudioInput::chooseMixer(const unsigned int nchan, SampleFormat sf) {
-	inMixerFunc r = NULL;
-	if (sf == SampleFloat) {
-		switch (nchan) {
-			case 1:
-				r = inMixerFloat1;
-				break;
-			case 2:
-				r = inMixerFloat2;
-				break;
-			case 3:
-				r = inMixerFloat3;
-				break;
-			case 4:
-				r = inMixerFloat4;
-				break;
-			case 5:
-				r = inMixerFloat5;
-				break;
-			case 6:
-				r = inMixerFloat6;
-				break;
-			case 7:
-				r = inMixerFloat7;
-				break;
-			case 8:
-				r = inMixerFloat8;
-				break;
-			default:
-				r = inMixerFloatN;
-				break;
-		}
-	} else {
-		switch (nchan) {
-			case 1:
-				r = inMixerShort1;
-				break;
-			case 2:
-				r = inMixerShort2;
-				break;
-			case 3:
-				r = inMixerShort3;
-				break;
-			case 4:
-				r = inMixerShort4;
-				break;
-			case 5:
-				r = inMixerShort5;
-				break;
-			case 6:
-				r = inMixerShort6;
-				break;
-			case 7:
-				r = inMixerShort7;
-				break;
-			case 8:
-				r = inMixerShort8;
-				break;
-			default:
-				r = inMixerShortN;
-				break;
-		}
-	}
-	return r;
+	// The kernels special-case the common channel counts themselves.
+	Q_UNUSED(nchan);
+
+	if (sf == SampleFloat)
+		return inMixerFloat;
+	return inMixerShort;
 }
 
 void AudioInput::initializeMixer() {
-	int err;
+	// Odd until the new setup is complete; see timerEvent().
+	qaiEchoSetup.fetchAndAddOrdered(1);
 
-	if (srsMic)
-		speex_resampler_destroy(srsMic);
-	if (srsEcho)
-		speex_resampler_destroy(srsEcho);
+	delete rMic;
+	delete rEcho;
+	delete qapEchoPending.fetchAndStoreAcquire(NULL);
+	delete qapEchoRetired.fetchAndStoreAcquire(NULL);
 	delete [] pfMicInput;
 	delete [] pfEchoInput;
+	delete [] pfEchoOutput;
 	delete [] pfOutput;
+	delete [] psEchoFrame;
+	delete [] psSpeakerFrame;
+	delete rbEcho;
 
-	if (iMicFreq != iSampleRate)
-		srsMic = speex_resampler_init(1, iMicFreq, iSampleRate, 3, &err);
+	psSpeaker = NULL;
 
 	iMicLength = (iFrameSize * iMicFreq) / iSampleRate;
 
+	rMic = NULL;
+	if (iMicFreq != iSampleRate)
+		rMic = Resampler::create(1, iMicFreq, iSampleRate, iMicLength, g.s.rqResample);
+
 	pfMicInput = new float[iMicLength];
 	pfOutput = new float[iFrameSize * qMax(1U,iEchoChannels)];
 
 	if (iEchoChannels > 0) {
 		bEchoMulti = g.s.bEchoMulti;
-		if (iEchoFreq != iSampleRate)
-			srsEcho = speex_resampler_init(bEchoMulti ? iEchoChannels : 1, iEchoFreq, iSampleRate, 3, &err);
+		const unsigned int chans = bEchoMulti ? iEchoChannels : 1;
+
+		// Without drift, matching rates are a plain copy. Clock drift
+		// against the microphone is absorbed by replacing the resampler
+		// with one for a nudged output rate; see timerEvent().
 		iEchoLength = (iFrameSize * iEchoFreq) / iSampleRate;
+		rEcho = Resampler::create(chans, iEchoFreq, iSampleRate, iEchoLength, g.s.rqResample);
 		iEchoMCLength = bEchoMulti ? iEchoLength * iEchoChannels : iEchoLength;
 		iEchoFrameSize = bEchoMulti ? iFrameSize * iEchoChannels : iFrameSize;
 		pfEchoInput = new float[iEchoMCLength];
+
+		// One input chunk yields about one frame; leave room for a partial
+		// frame carried over plus the drift adjustment.
+		pfEchoOutput = new float[iEchoFrameSize * 3];
+		iEchoOutputFilled = 0;
+		psEchoFrame = new short[iEchoFrameSize];
+		psSpeakerFrame = new short[iEchoFrameSize];
+		rbEcho = new RingBuffer<short>(iEchoFrameSize * 16);
+
+		fEchoFill = 0.0f;
+		iEchoFillFrames = 0;
+		qaiEchoDrift.fetchAndStoreRelease(0);
 	} else {
-		srsEcho = NULL;
+		rEcho = NULL;
 		pfEchoInput = NULL;
+		pfEchoOutput = NULL;
+		psEchoFrame = NULL;
+		psSpeakerFrame = NULL;
+		rbEcho = NULL;
 	}
 
 	imfMic = chooseMixer(iMicChannels, eMicFormat);
@@ -352,6 +301,8 @@ void AudioInput::initializeMixer() {
 
 	bResetProcessor = true;
 
+	qaiEchoSetup.fetchAndAddRelease(1);
+
 	qWarning("AudioInput: Initialized mixer for %d channel %d hz mic and %d channel %d hz echo", iMicChannels, iMicFreq, iEchoChannels, iEchoFreq);
 }
 
@@ -379,47 +330,28 @@ void AudioInput::addMic(const void *data, unsigned int nsamp) {
 			iMicFilled = 0;
 
 			// If needed resample frame
-			float *ptr = srsMic ? pfOutput : pfMicInput;
+			float *ptr = rMic ? pfOutput : pfMicInput;
 
-			if (srsMic) {
-				spx_uint32_t inlen = iMicLength;
-				spx_uint32_t outlen = iFrameSize;
-				speex_resampler_process_float(srsMic, 0, pfMicInput, &inlen, pfOutput, &outlen);
+			if (rMic) {
+				unsigned int inlen = iMicLength;
+				unsigned int outlen = iFrameSize;
+				rMic->process(pfMicInput, inlen, pfOutput, outlen);
 			}
 
-			// Convert float to 16bit PCM
-			const float mul = 32768.f;
-			for (int j = 0; j < iFrameSize; ++j)
-				psMic[j] = static_cast<short>(qBound(-32768.f, (ptr[j] * mul), 32767.f));
+			// Convert float to 16bit PCM, measuring the microphone level on the way
+			AudioKernels::floatToShortLevels(psMic, ptr, iFrameSize, sMicPeak, fMicSumSquares);
+			bMicLevelsValid = true;
 
 			// If we have echo chancellation enabled...
 			if (iEchoChannels > 0) {
-				short *echo = NULL;
-
-				{
-					QMutexLocker l(&qmEcho);
-
-					if (qlEchoFrames.isEmpty()) {
-						iJitterSeq = 0;
-						iMinBuffered = 1000;
-					} else {
-						// Compensate for drift between the microphone and the echo source
-						iMinBuffered = qMin(iMinBuffered, qlEchoFrames.count());
-
-						if ((iJitterSeq > 100) && (iMinBuffered > 1)) {
-							iJitterSeq = 0;
-							iMinBuffered = 1000;
-							delete [] qlEchoFrames.takeFirst();
-						}
-						echo = qlEchoFrames.takeFirst();
-					}
-				}
-
-				if (echo) {
-					// We have echo data for the current frame, remember that
-					delete [] psSpeaker;
-					psSpeaker = echo;
-				}
+				const unsigned int buffered = rbEcho->available() / iEchoFrameSize;
+
+				adjustEchoDrift(buffered);
+
+				// We have echo data for the current frame, remember that. If the
+				// echo source is late, keep using the previous frame.
+				if (rbEcho->read(psSpeakerFrame, iEchoFrameSize))
+					psSpeaker = psSpeakerFrame;
 			}
 
 			// Encode and send frame
@@ -435,15 +367,14 @@ void AudioInput::addEcho(const void *data, unsigned int nsamp) {
 
 		if (bEchoMulti) {
 			const unsigned int samples = left * iEchoChannels;
+			float *dst = pfEchoInput + iEchoFilled * iEchoChannels;
 
 			if (eEchoFormat == SampleFloat) {
-				for (unsigned int i=0;i<samples;++i)
-					pfEchoInput[i] = reinterpret_cast<const float *>(data)[i];
+				memcpy(dst, data, samples * sizeof(float));
 			}
 			else {
 				// 16bit PCM -> float
-				for (unsigned int i=0;i<samples;++i)
-					pfEchoInput[i] = static_cast<float>(reinterpret_cast<const short *>(data)[i]) * (1.0f / 32768.f);
+				AudioKernels::downmixShort(dst, reinterpret_cast<const short *>(data), samples, 1);
 			}
 		} else {
 			// Mix echo channels (converts 16bit PCM -> float if needed)
@@ -466,31 +397,104 @@ void AudioInput::addEcho(const void *data, unsigned int nsamp) {
 
 			iEchoFilled = 0;
 
-			// Resample if necessary
-			float *ptr = srsEcho ? pfOutput : pfEchoInput;
+			const unsigned int chans = bEchoMulti ? iEchoChannels : 1;
 
-			if (srsEcho) {
-				spx_uint32_t inlen = iEchoLength;
-				spx_uint32_t outlen = iFrameSize;
-				speex_resampler_process_interleaved_float(srsEcho, pfEchoInput, &inlen, pfOutput, &outlen);
+			// Pick up a resampler built for the latest drift correction.
+			// The one it replaces is deleted on the main thread.
+			Resampler *r = qapEchoPending.fetchAndStoreAcquire(NULL);
+			if (r) {
+				if (iEchoPendingSetup == qaiEchoSetup.fetchAndAddRelaxed(0))
+					qSwap(r, rEcho);
+				qapEchoRetired.fetchAndStoreRelease(r);
 			}
 
-			short *outbuff = new short[iEchoFrameSize];
+			unsigned int inlen = iEchoLength;
+			unsigned int outlen = iFrameSize * 3 - iEchoOutputFilled;
+			rEcho->process(pfEchoInput, inlen, pfEchoOutput + iEchoOutputFilled * chans, outlen);
+			iEchoOutputFilled += outlen;
 
-			// float -> 16bit PCM
-			const float mul = 32768.f;
-			for (unsigned int j=0;j<iEchoFrameSize;++j)
-				outbuff[j] = static_cast<short>(ptr[j] * mul);
+			while (iEchoOutputFilled >= static_cast<unsigned int>(iFrameSize)) {
+				// float -> 16bit PCM
+				AudioKernels::floatToShort(psEchoFrame, pfEchoOutput, iEchoFrameSize);
 
-			// Push frame into the echo chancellers jitter buffer
-			QMutexLocker l(&qmEcho);
+				// Push frame into the echo chancellers jitter buffer. If it is
+				// full, the microphone has stalled and the frame is useless anyway.
+				rbEcho->write(psEchoFrame, iEchoFrameSize);
 
-			iJitterSeq = qMin(iJitterSeq + 1,10000U);
-			qlEchoFrames.append(outbuff);
+				iEchoOutputFilled -= iFrameSize;
+				memmove(pfEchoOutput, pfEchoOutput + iEchoFrameSize, iEchoOutputFilled * chans * sizeof(float));
+			}
 		}
 	}
 }
 
+// Called by addMic() for every microphone frame with the number of echo
+// frames that were queued. The microphone and the playback device run off
+// different clocks, so that number slowly drifts. Rather than dropping
+// frames, steer the echo resampler's output rate to keep the queue at
+// about one and a half frames.
+void AudioInput::adjustEchoDrift(unsigned int buffered) {
+	// A queue this long means the microphone stalled for a while;
+	// skip ahead instead of waiting for the drift correction.
+	if (buffered > 8) {
+		rbEcho->skip((buffered - 2) * iEchoFrameSize);
+		buffered = 2;
+		fEchoFill = 2.0f;
+	}
+
+	fEchoFill = fEchoFill * 0.99f + static_cast<float>(buffered) * 0.01f;
+
+	// Re-evaluate once a second; each change has a new resampler built.
+	if (++iEchoFillFrames < 100)
+		return;
+	iEchoFillFrames = 0;
+
+	// 10 Hz per frame of error, capped at 0.5% of the sample rate.
+	const int limit = static_cast<int>(iSampleRate) / 200;
+	const int drift = qBound(-limit, iroundf((fEchoFill - 1.5f) * 10.0f), limit);
+	qaiEchoDrift.fetchAndStoreRelease(drift);
+}
+
+/**
+ * Runs on the main thread. Builds the echo resampler for a changed drift
+ * correction there, as that allocates and calculates a new filter, and
+ * deletes the one addEcho() swapped out.
+ */
+void AudioInput::timerEvent(QTimerEvent *) {
+	delete qapEchoRetired.fetchAndStoreAcquire(NULL);
+
+	// Wait until addEcho() has picked up the previous one.
+	if (qapEchoPending.fetchAndAddOrdered(0))
+		return;
+
+	const int setup = qaiEchoSetup.fetchAndAddAcquire(0);
+	if ((setup & 1) || (iEchoChannels == 0))
+		return;
+
+	// initializeMixer() starts every setup without drift correction.
+	if (setup != iEchoBuiltSetup) {
+		iEchoBuiltSetup = setup;
+		iEchoBuiltDrift = 0;
+	}
+
+	const int drift = qaiEchoDrift.fetchAndAddAcquire(0);
+	if (drift == iEchoBuiltDrift)
+		return;
+
+	const unsigned int chans = bEchoMulti ? iEchoChannels : 1;
+	Resampler *r = Resampler::create(chans, iEchoFreq, static_cast<unsigned int>(static_cast<int>(iSampleRate) - drift), iEchoLength, g.s.rqResample);
+
+	// The setup may have changed while this was built.
+	if (qaiEchoSetup.fetchAndAddAcquire(0) != setup) {
+		delete r;
+		return;
+	}
+
+	iEchoBuiltDrift = drift;
+	iEchoPendingSetup = setup;
+	qapEchoPending.fetchAndStoreRelease(r);
+}
+
 void AudioInput::adjustBandwidth(int bitspersec, int &bitrate, int &frames) {
 	frames = g.s.iFramesPerPacket;
 	bitrate = g.s.iQuality;
@@ -714,7 +718,6 @@ int AudioInput::encodeCELTFrame(short *psSource, EncodingOutputBuffer& buffer) {
 
 void AudioInput::encodeAudioFrame() {
 	int iArg;
-	int i;
 	float sum;
 	short max;
 
@@ -725,20 +728,18 @@ void AudioInput::encodeAudioFrame() {
 	if (! bRunning)
 		return;
 
-	sum=1.0f;
-	max = 1;
-	for (i=0;i<iFrameSize;i++) {
-		sum += static_cast<float>(psMic[i] * psMic[i]);
-		max = std::max(static_cast<short>(abs(psMic[i])), max);
-	}
-	dPeakMic = qMax(20.0f*log10f(sqrtf(sum / static_cast<float>(iFrameSize)) / 32768.0f), -96.0f);
-	dMaxMic = max;
+	// addMic() measures the level while converting; backends that
+	// fill psMic directly leave it to us.
+	if (! bMicLevelsValid)
+		AudioKernels::shortLevels(psMic, iFrameSize, sMicPeak, fMicSumSquares);
+	bMicLevelsValid = false;
+
+	dPeakMic = qMax(20.0f*log10f(sqrtf((1.0f + fMicSumSquares) / static_cast<float>(iFrameSize)) / 32768.0f), -96.0f);
+	dMaxMic = qMax<short>(sMicPeak, 1);
 
 	if (psSpeaker && (iEchoChannels > 0)) {
-		sum=1.0f;
-		for (i=0;i<iFrameSize;i++)
-			sum += static_cast<float>(psSpeaker[i] * psSpeaker[i]);
-		dPeakSpeaker = qMax(20.0f*log10f(sqrtf(sum / static_cast<float>(iFrameSize)) / 32768.0f), -96.0f);
+		AudioKernels::shortLevels(psSpeaker, iFrameSize, max, sum);
+		dPeakSpeaker = qMax(20.0f*log10f(sqrtf((1.0f + sum) / static_cast<float>(iFrameSize)) / 32768.0f), -96.0f);
 	} else {
 		dPeakSpeaker = 0.0;
 	}
@@ -760,10 +761,8 @@ void AudioInput::encodeAudioFrame() {
 		psSource = psMic;
 	}
 
-	sum=1.0f;
-	for (i=0;i<iFrameSize;i++)
-		sum += static_cast<float>(psSource[i] * psSource[i]);
-	float micLevel = sqrtf(sum / static_cast<float>(iFrameSize));
+	AudioKernels::shortLevels(psSource, iFrameSize, max, sum);
+	float micLevel = sqrtf((1.0f + sum) / static_cast<float>(iFrameSize));
 	dPeakSignal = qMax(20.0f*log10f(micLevel / 32768.0f), -96.0f);
 
 	spx_int32_t prob = 0;
@@ -974,10 +973,11 @@ void AudioInput::flushCheck(const QByteArray &frame, bool terminator) {
 		}
 	}
 
-	if (g.s.bTransmitPosition && g.p && ! g.bCenterPosition && g.p->fetch()) {
-		pds << g.p->fPosition[0];
-		pds << g.p->fPosition[1];
-		pds << g.p->fPosition[2];
+	PositionSample &ps = *psPosition;
+	if (g.s.bTransmitPosition && g.p && ! g.bCenterPosition && g.p->sample(ps)) {
+		pds << ps.fPosition[0];
+		pds << ps.fPosition[1];
+		pds << ps.fPosition[2];
 	}
 
 	sendAudioFrame(data, pds);
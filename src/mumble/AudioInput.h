@@ -36,12 +36,13 @@
 #include <speex/speex.h>
 #include <speex/speex_echo.h>
 #include <speex/speex_preprocess.h>
-#include <speex/speex_resampler.h>
 #include <QtCore/QObject>
 #include <QtCore/QThread>
 #include <vector>
 
 #include "Audio.h"
+#include "Resampler.h"
+#include "RingBuffer.h"
 #include "Settings.h"
 #include "Timer.h"
 #include "Message.h"
@@ -50,6 +51,7 @@ class AudioInput;
 class CELTCodec;
 struct CELTEncoder;
 struct OpusEncoder;
+struct PositionSample;
 typedef boost::shared_ptr<AudioInput> AudioInputPtr;
 
 class AudioInputRegistrar {
@@ -85,12 +87,34 @@ class AudioInput : public QThread {
 		typedef enum { SampleShort, SampleFloat } SampleFormat;
 		typedef void (*inMixerFunc)(float * RESTRICT, const void * RESTRICT, unsigned int, unsigned int);
 	private:
-		SpeexResamplerState *srsMic, *srsEcho;
-
-		QMutex qmEcho;
-		QList<short *> qlEchoFrames;
-		unsigned int iJitterSeq;
-		int iMinBuffered;
+		Resampler *rMic, *rEcho;
+
+		/// Echo reference frames, written by addEcho() and read by addMic().
+		RingBuffer<short> *rbEcho;
+		/// Resampled echo signal not yet forming a complete frame.
+		float *pfEchoOutput;
+		unsigned int iEchoOutputFilled;
+		short *psEchoFrame;
+		short *psSpeakerFrame;
+
+		/// Smoothed number of echo frames queued when addMic() needs one.
+		float fEchoFill;
+		int iEchoFillFrames;
+		/// Echo resampler output rate adjustment in Hz, requested by addMic()
+		/// to compensate for clock drift.
+		QAtomicInt qaiEchoDrift;
+		/// Echo resampler for the latest drift, built on the main thread by
+		/// timerEvent() and swapped in by addEcho().
+		QAtomicPointer<Resampler> qapEchoPending;
+		/// Echo resampler swapped out by addEcho(), deleted on the main thread.
+		QAtomicPointer<Resampler> qapEchoRetired;
+		/// Bumped by initializeMixer() before and after it changes the echo
+		/// setup, so resamplers built for an older setup are discarded.
+		QAtomicInt qaiEchoSetup;
+		/// Setup qapEchoPending was built for.
+		int iEchoPendingSetup;
+		/// Main thread only: setup and drift of the last resampler built.
+		int iEchoBuiltSetup, iEchoBuiltDrift;
 
 		unsigned int iMicFilled, iEchoFilled;
 		inMixerFunc imfMic, imfEcho;
@@ -139,11 +163,20 @@ class AudioInput : public QThread {
 		short *psSpeaker;
 		short *psClean;
 
+		/// Peak and sum of squares of psMic, valid if bMicLevelsValid is set.
+		bool bMicLevelsValid;
+		short sMicPeak;
+		float fMicSumSquares;
+
 		float *pfMicInput;
 		float *pfEchoInput;
 		float *pfOutput;
 
+		void adjustEchoDrift(unsigned int buffered);
+
 		std::vector<short> opusBuffer;
+		/// Last positions read from the plugin, kept while the poller is publishing.
+		PositionSample *psPosition;
 
 		void encodeAudioFrame();
 		void addMic(const void *data, unsigned int nsamp);
@@ -161,6 +194,7 @@ class AudioInput : public QThread {
 		void flushCheck(const QByteArray &, bool terminator);
 
 		void initializeMixer();
+		void timerEvent(QTimerEvent *) Q_DECL_OVERRIDE;
 
 		static void adjustBandwidth(int bitspersec, int &bitrate, int &frames);
 	signals:
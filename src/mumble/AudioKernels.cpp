@@ -0,0 +1,274 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// The kernels are also built into the benchmarks in src/tests, so they only
+// depend on QtCore and the RESTRICT define from compiler.pri, not on the
+// precompiled header.
+#include <QtCore/QtGlobal>
+
+#include <string.h>
+
+#include "AudioKernels.h"
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE
+#include <xmmintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define MUMBLE_AUDIOKERNELS_SSE2
+#endif
+
+void AudioKernels::mixMonoRamp(float * RESTRICT out, const float * RESTRICT in, unsigned int nsamp, unsigned int nchan, const float * RESTRICT gain, const float * RESTRICT inc) {
+	unsigned int i = 0;
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE
+	if (nchan == 2) {
+		// Stereo is by far the most common layout, so handle two frames
+		// (four output samples) per iteration.
+		const float i0 = inc ? inc[0] : 0.0f;
+		const float i1 = inc ? inc[1] : 0.0f;
+		__m128 g = _mm_setr_ps(gain[0], gain[1], gain[0] + i0, gain[1] + i1);
+		const __m128 step = _mm_setr_ps(2.0f * i0, 2.0f * i1, 2.0f * i0, 2.0f * i1);
+
+		for (; i + 2 <= nsamp; i += 2) {
+			const __m128 v = _mm_setr_ps(in[i], in[i], in[i+1], in[i+1]);
+			float *o = out + i * 2;
+			_mm_storeu_ps(o, _mm_add_ps(_mm_loadu_ps(o), _mm_mul_ps(v, g)));
+			g = _mm_add_ps(g, step);
+		}
+	} else if (nchan >= 4) {
+		const unsigned int nvec = nchan & ~3U;
+		for (; i < nsamp; ++i) {
+			const __m128 v = _mm_set1_ps(in[i]);
+			const __m128 fi = _mm_set1_ps(static_cast<float>(i));
+			float *o = out + i * nchan;
+			unsigned int c = 0;
+			for (; c < nvec; c += 4) {
+				__m128 g = _mm_loadu_ps(gain + c);
+				if (inc)
+					g = _mm_add_ps(g, _mm_mul_ps(_mm_loadu_ps(inc + c), fi));
+				_mm_storeu_ps(o + c, _mm_add_ps(_mm_loadu_ps(o + c), _mm_mul_ps(v, g)));
+			}
+			for (; c < nchan; ++c)
+				o[c] += in[i] * (inc ? (gain[c] + inc[c] * static_cast<float>(i)) : gain[c]);
+		}
+	}
+#endif
+
+	for (; i < nsamp; ++i) {
+		const float v = in[i];
+		float *o = out + i * nchan;
+		for (unsigned int c = 0; c < nchan; ++c)
+			o[c] += v * (inc ? (gain[c] + inc[c] * static_cast<float>(i)) : gain[c]);
+	}
+}
+
+void AudioKernels::accumulate(float * RESTRICT out, const float * RESTRICT in, unsigned int nsamp, float gain) {
+	unsigned int i = 0;
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE
+	const __m128 g = _mm_set1_ps(gain);
+	for (; i + 4 <= nsamp; i += 4)
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+#endif
+
+	for (; i < nsamp; ++i)
+		out[i] += in[i] * gain;
+}
+
+void AudioKernels::clip(float *buffer, unsigned int nsamp) {
+	unsigned int i = 0;
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE
+	const __m128 lo = _mm_set1_ps(-1.0f);
+	const __m128 hi = _mm_set1_ps(1.0f);
+	for (; i + 4 <= nsamp; i += 4)
+		_mm_storeu_ps(buffer + i, _mm_min_ps(hi, _mm_max_ps(lo, _mm_loadu_ps(buffer + i))));
+#endif
+
+	for (; i < nsamp; ++i)
+		buffer[i] = qBound(-1.0f, buffer[i], 1.0f);
+}
+
+void AudioKernels::floatToShort(short * RESTRICT out, const float * RESTRICT in, unsigned int nsamp) {
+	unsigned int i = 0;
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE2
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	const __m128 lo = _mm_set1_ps(-32768.0f);
+	const __m128 hi = _mm_set1_ps(32767.0f);
+	for (; i + 8 <= nsamp; i += 8) {
+		const __m128 a = _mm_min_ps(hi, _mm_max_ps(lo, _mm_mul_ps(_mm_loadu_ps(in + i), scale)));
+		const __m128 b = _mm_min_ps(hi, _mm_max_ps(lo, _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale)));
+		const __m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
+	}
+#endif
+
+	for (; i < nsamp; ++i)
+		out[i] = static_cast<short>(qBound(-32768.f, (in[i] * 32768.f), 32767.f));
+}
+
+void AudioKernels::floatToShortLevels(short * RESTRICT out, const float * RESTRICT in, unsigned int nsamp, short &peak, float &sumsq) {
+	unsigned int i = 0;
+	float sum = 0.0f;
+	float mx = 0.0f;
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE2
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	const __m128 lo = _mm_set1_ps(-32768.0f);
+	const __m128 hi = _mm_set1_ps(32767.0f);
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 vsum = _mm_setzero_ps();
+	__m128 vmax = _mm_setzero_ps();
+	for (; i + 4 <= nsamp; i += 4) {
+		// Truncate first, so the levels are those of the s16 output.
+		const __m128i iv = _mm_cvttps_epi32(_mm_min_ps(hi, _mm_max_ps(lo, _mm_mul_ps(_mm_loadu_ps(in + i), scale))));
+		const __m128 v = _mm_cvtepi32_ps(iv);
+		vsum = _mm_add_ps(vsum, _mm_mul_ps(v, v));
+		vmax = _mm_max_ps(vmax, _mm_and_ps(v, absmask));
+		const __m128i packed = _mm_packs_epi32(iv, iv);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), packed);
+	}
+	float tmp[4];
+	_mm_storeu_ps(tmp, vsum);
+	sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+	_mm_storeu_ps(tmp, vmax);
+	mx = qMax(qMax(tmp[0], tmp[1]), qMax(tmp[2], tmp[3]));
+#endif
+
+	for (; i < nsamp; ++i) {
+		const short v = static_cast<short>(qBound(-32768.f, (in[i] * 32768.f), 32767.f));
+		const float f = static_cast<float>(v);
+		out[i] = v;
+		sum += f * f;
+		mx = qMax(mx, qAbs(f));
+	}
+
+	peak = static_cast<short>(qMin(mx, 32767.f));
+	sumsq = sum;
+}
+
+void AudioKernels::shortLevels(const short *in, unsigned int nsamp, short &peak, float &sumsq) {
+	unsigned int i = 0;
+	float sum = 0.0f;
+	float mx = 0.0f;
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE2
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 vsum = _mm_setzero_ps();
+	__m128 vmax = _mm_setzero_ps();
+	for (; i + 8 <= nsamp; i += 8) {
+		const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+		// Sign extend to 32 bits by unpacking into the high half and shifting back.
+		const __m128 a = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+		const __m128 b = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+		vsum = _mm_add_ps(vsum, _mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)));
+		vmax = _mm_max_ps(vmax, _mm_max_ps(_mm_and_ps(a, absmask), _mm_and_ps(b, absmask)));
+	}
+	float tmp[4];
+	_mm_storeu_ps(tmp, vsum);
+	sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+	_mm_storeu_ps(tmp, vmax);
+	mx = qMax(qMax(tmp[0], tmp[1]), qMax(tmp[2], tmp[3]));
+#endif
+
+	for (; i < nsamp; ++i) {
+		const float f = static_cast<float>(in[i]);
+		sum += f * f;
+		mx = qMax(mx, qAbs(f));
+	}
+
+	peak = static_cast<short>(qMin(mx, 32767.f));
+	sumsq = sum;
+}
+
+void AudioKernels::downmixFloat(float * RESTRICT out, const float * RESTRICT in, unsigned int nsamp, unsigned int nchan) {
+	if (nchan == 1) {
+		memcpy(out, in, nsamp * sizeof(float));
+		return;
+	}
+
+	unsigned int i = 0;
+	const float m = 1.0f / static_cast<float>(nchan);
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE
+	if (nchan == 2) {
+		const __m128 half = _mm_set1_ps(0.5f);
+		for (; i + 4 <= nsamp; i += 4) {
+			const __m128 a = _mm_loadu_ps(in + i * 2);
+			const __m128 b = _mm_loadu_ps(in + i * 2 + 4);
+			const __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			const __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(left, right), half));
+		}
+	}
+#endif
+
+	for (; i < nsamp; ++i) {
+		float v = 0.0f;
+		for (unsigned int j = 0; j < nchan; ++j)
+			v += in[i * nchan + j];
+		out[i] = v * m;
+	}
+}
+
+void AudioKernels::downmixShort(float * RESTRICT out, const short * RESTRICT in, unsigned int nsamp, unsigned int nchan) {
+	unsigned int i = 0;
+	const float m = 1.0f / (32768.f * static_cast<float>(nchan));
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE2
+	const __m128 vm = _mm_set1_ps(m);
+	if (nchan == 1) {
+		for (; i + 8 <= nsamp; i += 8) {
+			const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+			const __m128 a = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+			const __m128 b = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+			_mm_storeu_ps(out + i, _mm_mul_ps(a, vm));
+			_mm_storeu_ps(out + i + 4, _mm_mul_ps(b, vm));
+		}
+	} else if (nchan == 2) {
+		const __m128i ones = _mm_set1_epi16(1);
+		for (; i + 4 <= nsamp; i += 4) {
+			// madd sums each left/right pair into a 32-bit integer.
+			const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 2));
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_madd_epi16(s, ones)), vm));
+		}
+	}
+#endif
+
+	for (; i < nsamp; ++i) {
+		float v = 0.0f;
+		for (unsigned int j = 0; j < nchan; ++j)
+			v += static_cast<float>(in[i * nchan + j]);
+		out[i] = v * m;
+	}
+}
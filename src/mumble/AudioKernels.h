@@ -0,0 +1,73 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MUMBLE_AUDIOKERNELS_H_
+#define MUMBLE_MUMBLE_AUDIOKERNELS_H_
+
+// Small, allocation free DSP helpers shared by the realtime audio threads.
+//
+// Every kernel has a plain C++ implementation; on x86 an SSE version is
+// used instead. We only rely on SSE1 here, as our 32-bit Windows builds
+// are compiled with -arch:SSE.
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 1))
+# define MUMBLE_AUDIOKERNELS_SSE
+#endif
+
+namespace AudioKernels {
+	/// Mix a mono buffer into an interleaved buffer with nchan channels.
+	/// Channel c of sample i receives in[i] * (gain[c] + inc[c] * i).
+	/// Pass NULL for inc to mix with a constant gain.
+	void mixMonoRamp(float * RESTRICT out, const float * RESTRICT in, unsigned int nsamp, unsigned int nchan, const float * RESTRICT gain, const float * RESTRICT inc);
+
+	/// out[i] += in[i] * gain
+	void accumulate(float * RESTRICT out, const float * RESTRICT in, unsigned int nsamp, float gain);
+
+	/// Clamp a float buffer to [-1, 1] in place.
+	void clip(float *buffer, unsigned int nsamp);
+
+	/// Convert float samples in [-1, 1] to saturated signed 16-bit samples.
+	void floatToShort(short * RESTRICT out, const float * RESTRICT in, unsigned int nsamp);
+
+	/// Same as floatToShort(), but also returns the largest absolute value and
+	/// the sum of squares of the converted samples, saving a second pass.
+	void floatToShortLevels(short * RESTRICT out, const float * RESTRICT in, unsigned int nsamp, short &peak, float &sumsq);
+
+	/// Largest absolute value and sum of squares of a signed 16-bit buffer.
+	void shortLevels(const short *in, unsigned int nsamp, short &peak, float &sumsq);
+
+	/// Average nchan interleaved float channels into a mono buffer.
+	void downmixFloat(float * RESTRICT out, const float * RESTRICT in, unsigned int nsamp, unsigned int nchan);
+
+	/// Average nchan interleaved signed 16-bit channels into a mono float buffer in [-1, 1].
+	void downmixShort(float * RESTRICT out, const short * RESTRICT in, unsigned int nsamp, unsigned int nchan);
+}
+
+#endif
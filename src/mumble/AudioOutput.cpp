@@ -34,6 +34,7 @@
 #include "AudioOutput.h"
 
 #include "AudioInput.h"
+#include "AudioKernels.h"
 #include "AudioOutputSample.h"
 #include "AudioOutputSpeech.h"
 #include "User.h"
@@ -104,6 +105,9 @@ AudioOutput::AudioOutput()
     : fSpeakers(NULL)
     , fSpeakerVolume(NULL)
     , bSpeakerPositional(NULL)
+    , fListenerSpeakers(NULL)
+    , iListenerSerial(0)
+    , psListener(new PositionSample())
     
     , eSampleFormat(SampleFloat)
     
@@ -117,7 +121,8 @@ AudioOutput::AudioOutput()
     , qrwlOutputs()
     , qmOutputs() {
 	
-	// Nothing
+	memset(fListener, 0, sizeof(fListener));
+	memset(fGainSettings, 0, sizeof(fGainSettings));
 }
 
 AudioOutput::~AudioOutput() {
@@ -128,6 +133,8 @@ AudioOutput::~AudioOutput() {
 	delete [] fSpeakers;
 	delete [] fSpeakerVolume;
 	delete [] bSpeakerPositional;
+	delete [] fListenerSpeakers;
+	delete psListener;
 }
 
 // Here's the theory.
@@ -225,10 +232,6 @@ void AudioOutput::removeBuffer(AudioOutputUser *aop) {
 }
 
 AudioOutputSample *AudioOutput::playSample(const QString &filename, bool loop) {
-	SoundFile *handle = AudioOutputSample::loadSndfile(filename);
-	if (handle == NULL)
-		return NULL;
-
 	while ((iMixerFreq == 0) && isAlive()) {
 		QThread::yieldCurrentThread();
 	}
@@ -236,8 +239,20 @@ AudioOutputSample *AudioOutput::playSample(const QString &filename, bool loop) {
 	if (! iMixerFreq)
 		return NULL;
 
+	// Short samples are decoded once per file and mixer rate and then
+	// played from memory; anything else is streamed from disk.
+	AudioOutputSample *aos;
+	const QVector<float> pcm = AudioOutputSample::decodedSample(filename, iMixerFreq);
+	if (! pcm.isEmpty()) {
+		aos = new AudioOutputSample(filename, pcm, loop);
+	} else {
+		SoundFile *handle = AudioOutputSample::loadSndfile(filename);
+		if (handle == NULL)
+			return NULL;
+		aos = new AudioOutputSample(filename, handle, loop, iMixerFreq);
+	}
+
 	QWriteLocker locker(&qrwlOutputs);
-	AudioOutputSample *aos = new AudioOutputSample(filename, handle, loop, iMixerFreq);
 	qmOutputs.insert(NULL, aos);
 
 	return aos;
@@ -248,12 +263,17 @@ void AudioOutput::initializeMixer(const unsigned int *chanmasks, bool forceheadp
 	delete[] fSpeakers;
 	delete[] bSpeakerPositional;
 	delete[] fSpeakerVolume;
+	delete[] fListenerSpeakers;
 
 	fSpeakers = new float[iChannels * 3];
+	fListenerSpeakers = new float[iChannels * 3];
 	bSpeakerPositional = new bool[iChannels];
 	fSpeakerVolume = new float[iChannels];
 
 	memset(fSpeakers, 0, sizeof(float) * iChannels * 3);
+	memset(fListenerSpeakers, 0, sizeof(float) * iChannels * 3);
+	// Force updateListener() to rotate the new speaker layout.
+	iListenerSerial = 0;
 	memset(bSpeakerPositional, 0, sizeof(bool) * iChannels);
 
 	for (unsigned int i=0;i<iChannels;++i)
@@ -361,6 +381,92 @@ void AudioOutput::initializeMixer(const unsigned int *chanmasks, bool forceheadp
 	qWarning("AudioOutput: Initialized %d channel %d hz mixer", iChannels, iMixerFreq);
 }
 
+// Recalculates the listener basis and rotates the speakers to match it.
+// Plugins only report new positions a few times a second, so most mixer
+// callbacks can skip the trigonometry below and reuse the last result.
+void AudioOutput::updateListener(const PositionSample &ps) {
+	// The attenuation settings can change at any time from the
+	// configuration dialog, and the cached gains depend on them as well.
+	const float settings[4] = { g.s.fAudioMinDistance, g.s.fAudioMaxDistance, g.s.fAudioMaxDistVolume, g.s.fAudioBloom };
+	const bool settingsChanged = (memcmp(fGainSettings, settings, sizeof(settings)) != 0);
+	memcpy(fGainSettings, settings, sizeof(settings));
+
+	if ((iListenerSerial != 0) && ! settingsChanged
+	        && (memcmp(fListener, ps.fCameraPosition, sizeof(float) * 3) == 0)
+	        && (memcmp(fListener + 3, ps.fCameraFront, sizeof(float) * 3) == 0)
+	        && (memcmp(fListener + 6, ps.fCameraTop, sizeof(float) * 3) == 0))
+		return;
+
+	float front[3] = { ps.fCameraFront[0], ps.fCameraFront[1], ps.fCameraFront[2] };
+	float top[3] = { ps.fCameraTop[0], ps.fCameraTop[1], ps.fCameraTop[2] };
+
+	memcpy(fListener, ps.fCameraPosition, sizeof(float) * 3);
+	memcpy(fListener + 3, front, sizeof(front));
+	memcpy(fListener + 6, top, sizeof(top));
+
+	// Front vector is dominant; if it's zero we presume all is zero.
+
+	float flen = sqrtf(front[0]*front[0]+front[1]*front[1]+front[2]*front[2]);
+
+	if (flen > 0.0f) {
+		front[0] *= (1.0f / flen);
+		front[1] *= (1.0f / flen);
+		front[2] *= (1.0f / flen);
+
+		float tlen = sqrtf(top[0]*top[0]+top[1]*top[1]+top[2]*top[2]);
+
+		if (tlen > 0.0f) {
+			top[0] *= (1.0f / tlen);
+			top[1] *= (1.0f / tlen);
+			top[2] *= (1.0f / tlen);
+		} else {
+			top[0] = 0.0f;
+			top[1] = 1.0f;
+			top[2] = 0.0f;
+		}
+
+		if (std::abs<float>(front[0] * top[0] + front[1] * top[1] + front[2] * top[2]) > 0.01f) {
+			// Not perpendicular. Assume Y up and rotate 90 degrees.
+
+			float azimuth = 0.0f;
+			if ((front[0] != 0.0f) || (front[2] != 0.0f))
+				azimuth = atan2f(front[2], front[0]);
+			float inclination = acosf(front[1]) - static_cast<float>(M_PI) / 2.0f;
+
+			top[0] = sinf(inclination)*cosf(azimuth);
+			top[1] = cosf(inclination);
+			top[2] = sinf(inclination)*sinf(azimuth);
+		}
+	} else {
+		front[0] = 0.0f;
+		front[1] = 0.0f;
+		front[2] = 1.0f;
+
+		top[0] = 0.0f;
+		top[1] = 1.0f;
+		top[2] = 0.0f;
+	}
+
+	// Calculate right vector as front X top
+	float right[3] = {top[1]*front[2] - top[2]*front[1], top[2]*front[0] - top[0]*front[2], top[0]*front[1] - top[1] * front[0] };
+
+	/*
+				qWarning("Front: %f %f %f", front[0], front[1], front[2]);
+				qWarning("Top: %f %f %f", top[0], top[1], top[2]);
+				qWarning("Right: %f %f %f", right[0], right[1], right[2]);
+	*/
+	// Rotate speakers to match orientation
+	for (unsigned int i=0;i<iChannels;++i) {
+		fListenerSpeakers[3*i+0] = fSpeakers[3*i+0] * right[0] + fSpeakers[3*i+1] * top[0] + fSpeakers[3*i+2] * front[0];
+		fListenerSpeakers[3*i+1] = fSpeakers[3*i+0] * right[1] + fSpeakers[3*i+1] * top[1] + fSpeakers[3*i+2] * front[1];
+		fListenerSpeakers[3*i+2] = fSpeakers[3*i+0] * right[2] + fSpeakers[3*i+1] * top[2] + fSpeakers[3*i+2] * front[2];
+	}
+
+	// 0 marks cached gains as invalid, so skip it when wrapping.
+	if (++iListenerSerial == 0)
+		iListenerSerial = 1;
+}
+
 bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 	QList<AudioOutputUser *> qlMix;
 	QList<AudioOutputUser *> qlDel;
@@ -403,8 +509,9 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 	}
 
 	if (! qlMix.isEmpty()) {
-		STACKVAR(float, speaker, iChannels*3);
 		STACKVAR(float, svol, iChannels);
+		STACKVAR(float, gain, iChannels);
+		STACKVAR(float, inc, iChannels);
 
 		STACKVAR(float, fOutput, iChannels * nsamp);
 		float *output = (eSampleFormat == SampleFloat) ? reinterpret_cast<float *>(outbuff) : fOutput;
@@ -412,78 +519,19 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 
 		memset(output, 0, sizeof(float) * nsamp * iChannels);
 
-		boost::shared_array<float> recbuff;
+		STACKVAR(float, recbuff, nsamp);
 		if (recorder) {
-			recbuff = boost::shared_array<float>(new float[nsamp]);
-			memset(recbuff.get(), 0, sizeof(float) * nsamp);
+			memset(recbuff, 0, sizeof(float) * nsamp);
 			recorder->prepareBufferAdds();
 		}
 
 		for (unsigned int i=0;i<iChannels;++i)
 			svol[i] = mul * fSpeakerVolume[i];
 
-		if (g.s.bPositionalAudio && (iChannels > 1) && g.p->fetch() && (g.bPosTest || g.p->fCameraPosition[0] != 0 || g.p->fCameraPosition[1] != 0 || g.p->fCameraPosition[2] != 0)) {
-
-			float front[3] = { g.p->fCameraFront[0], g.p->fCameraFront[1], g.p->fCameraFront[2] };
-			float top[3] = { g.p->fCameraTop[0], g.p->fCameraTop[1], g.p->fCameraTop[2] };
-
-			// Front vector is dominant; if it's zero we presume all is zero.
-
-			float flen = sqrtf(front[0]*front[0]+front[1]*front[1]+front[2]*front[2]);
-
-			if (flen > 0.0f) {
-				front[0] *= (1.0f / flen);
-				front[1] *= (1.0f / flen);
-				front[2] *= (1.0f / flen);
-
-				float tlen = sqrtf(top[0]*top[0]+top[1]*top[1]+top[2]*top[2]);
+		PositionSample &ps = *psListener;
+		if (g.s.bPositionalAudio && (iChannels > 1) && g.p->sample(ps, g.s.bPositionalSmoothing) && (g.bPosTest || ps.fCameraPosition[0] != 0 || ps.fCameraPosition[1] != 0 || ps.fCameraPosition[2] != 0)) {
 
-				if (tlen > 0.0f) {
-					top[0] *= (1.0f / tlen);
-					top[1] *= (1.0f / tlen);
-					top[2] *= (1.0f / tlen);
-				} else {
-					top[0] = 0.0f;
-					top[1] = 1.0f;
-					top[2] = 0.0f;
-				}
-
-				if (std::abs<float>(front[0] * top[0] + front[1] * top[1] + front[2] * top[2]) > 0.01f) {
-					// Not perpendicular. Assume Y up and rotate 90 degrees.
-
-					float azimuth = 0.0f;
-					if ((front[0] != 0.0f) || (front[2] != 0.0f))
-						azimuth = atan2f(front[2], front[0]);
-					float inclination = acosf(front[1]) - static_cast<float>(M_PI) / 2.0f;
-
-					top[0] = sinf(inclination)*cosf(azimuth);
-					top[1] = cosf(inclination);
-					top[2] = sinf(inclination)*sinf(azimuth);
-				}
-			} else {
-				front[0] = 0.0f;
-				front[1] = 0.0f;
-				front[2] = 1.0f;
-
-				top[0] = 0.0f;
-				top[1] = 1.0f;
-				top[2] = 0.0f;
-			}
-
-			// Calculate right vector as front X top
-			float right[3] = {top[1]*front[2] - top[2]*front[1], top[2]*front[0] - top[0]*front[2], top[0]*front[1] - top[1] * front[0] };
-
-			/*
-						qWarning("Front: %f %f %f", front[0], front[1], front[2]);
-						qWarning("Top: %f %f %f", top[0], top[1], top[2]);
-						qWarning("Right: %f %f %f", right[0], right[1], right[2]);
-			*/
-			// Rotate speakers to match orientation
-			for (unsigned int i=0;i<iChannels;++i) {
-				speaker[3*i+0] = fSpeakers[3*i+0] * right[0] + fSpeakers[3*i+1] * top[0] + fSpeakers[3*i+2] * front[0];
-				speaker[3*i+1] = fSpeakers[3*i+0] * right[1] + fSpeakers[3*i+1] * top[1] + fSpeakers[3*i+2] * front[1];
-				speaker[3*i+2] = fSpeakers[3*i+0] * right[2] + fSpeakers[3*i+1] * top[2] + fSpeakers[3*i+2] * front[2];
-			}
+			updateListener(ps);
 			validListener = true;
 		}
 
@@ -509,19 +557,12 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 				AudioOutputSpeech *aos = qobject_cast<AudioOutputSpeech *>(aop);
 
 				if (aos) {
-					for (unsigned int i = 0; i < nsamp; ++i) {
-						recbuff[i] += pfBuffer[i] * volumeAdjustment;
-					}
+					AudioKernels::accumulate(recbuff, pfBuffer, nsamp, volumeAdjustment);
 
 					if (!recorder->isInMixDownMode()) {
-						if (aos) {
-							recorder->addBuffer(aos->p, recbuff, nsamp);
-						} else {
-							// this should be unreachable
-							Q_ASSERT(false);
-						}
-						recbuff = boost::shared_array<float>(new float[nsamp]);
-						memset(recbuff.get(), 0, sizeof(float) * nsamp);
+						// The recorder copies the data, so the buffer can be reused right away.
+						recorder->addBuffer(aos->p, recbuff, nsamp);
+						memset(recbuff, 0, sizeof(float) * nsamp);
 					}
 
 					// Don't add the local audio to the real output
@@ -532,43 +573,51 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 			}
 
 			if (validListener && ((aop->fPos[0] != 0.0f) || (aop->fPos[1] != 0.0f) || (aop->fPos[2] != 0.0f))) {
-				float dir[3] = { aop->fPos[0] - g.p->fCameraPosition[0], aop->fPos[1] - g.p->fCameraPosition[1], aop->fPos[2] - g.p->fCameraPosition[2] };
-				float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
-				if (len > 0.0f) {
-					dir[0] /= len;
-					dir[1] /= len;
-					dir[2] /= len;
-				}
-				/*
-								qWarning("Voice pos: %f %f %f", aop->fPos[0], aop->fPos[1], aop->fPos[2]);
-								qWarning("Voice dir: %f %f %f", dir[0], dir[1], dir[2]);
-				*/
 				if (! aop->pfVolume) {
 					aop->pfVolume = new float[nchan];
 					for (unsigned int s=0;s<nchan;++s)
 						aop->pfVolume[s] = -1.0;
 				}
+				if (! aop->pfGain)
+					aop->pfGain = new float[nchan];
+
+				// The speaker gains only depend on the source position relative to the
+				// listener, so only recalculate them when either of those moved.
+				if ((aop->iGainSerial != iListenerSerial) || (memcmp(aop->fGainPos, aop->fPos, sizeof(aop->fPos)) != 0)) {
+					float dir[3] = { aop->fPos[0] - fListener[0], aop->fPos[1] - fListener[1], aop->fPos[2] - fListener[2] };
+					float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+					if (len > 0.0f) {
+						dir[0] /= len;
+						dir[1] /= len;
+						dir[2] /= len;
+					}
+					for (unsigned int s=0;s<nchan;++s) {
+						const float dot = bSpeakerPositional[s] ? dir[0] * fListenerSpeakers[s*3+0] + dir[1] * fListenerSpeakers[s*3+1] + dir[2] * fListenerSpeakers[s*3+2] : 1.0f;
+						aop->pfGain[s] = calcGain(dot, len);
+					}
+					memcpy(aop->fGainPos, aop->fPos, sizeof(aop->fPos));
+					aop->iGainSerial = iListenerSerial;
+				}
+
+				bool audible = false;
+				bool ramp = false;
 				for (unsigned int s=0;s<nchan;++s) {
-					const float dot = bSpeakerPositional[s] ? dir[0] * speaker[s*3+0] + dir[1] * speaker[s*3+1] + dir[2] * speaker[s*3+2] : 1.0f;
-					const float str = svol[s] * calcGain(dot, len) * volumeAdjustment;
-					float * RESTRICT o = output + s;
+					const float str = svol[s] * aop->pfGain[s] * volumeAdjustment;
 					const float old = (aop->pfVolume[s] >= 0.0f) ? aop->pfVolume[s] : str;
-					const float inc = (str - old) / static_cast<float>(nsamp);
+					gain[s] = old;
+					inc[s] = (str - old) / static_cast<float>(nsamp);
 					aop->pfVolume[s] = str;
-					/*
-										qWarning("%d: Pos %f %f %f : Dot %f Len %f Str %f", s, speaker[s*3+0], speaker[s*3+1], speaker[s*3+2], dot, len, str);
-					*/
 					if ((old >= 0.00000001f) || (str >= 0.00000001f))
-						for (unsigned int i=0;i<nsamp;++i)
-							o[i*nchan] += pfBuffer[i] * (old + inc*static_cast<float>(i));
+						audible = true;
+					if (old != str)
+						ramp = true;
 				}
+				if (audible)
+					AudioKernels::mixMonoRamp(output, pfBuffer, nsamp, nchan, gain, ramp ? inc : NULL);
 			} else {
-				for (unsigned int s=0;s<nchan;++s) {
-					const float str = svol[s] * volumeAdjustment;
-					float * RESTRICT o = output + s;
-					for (unsigned int i=0;i<nsamp;++i)
-						o[i*nchan] += pfBuffer[i] * str;
-				}
+				for (unsigned int s=0;s<nchan;++s)
+					gain[s] = svol[s] * volumeAdjustment;
+				AudioKernels::mixMonoRamp(output, pfBuffer, nsamp, nchan, gain, NULL);
 			}
 		}
 
@@ -578,11 +627,9 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 
 		// Clip
 		if (eSampleFormat == SampleFloat)
-			for (unsigned int i=0;i<nsamp*iChannels;i++)
-				output[i] = qBound(-1.0f, output[i], 1.0f);
+			AudioKernels::clip(output, nsamp * iChannels);
 		else
-			for (unsigned int i=0;i<nsamp*iChannels;i++)
-				reinterpret_cast<short *>(outbuff)[i] = static_cast<short>(qBound(-32768.f, (output[i] * 32768.f), 32767.f));
+			AudioKernels::floatToShort(reinterpret_cast<short *>(outbuff), output, nsamp * iChannels);
 	}
 
 	qrwlOutputs.unlock();
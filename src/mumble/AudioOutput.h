@@ -70,6 +70,7 @@ class AudioOutput;
 class ClientUser;
 class AudioOutputUser;
 class AudioOutputSample;
+struct PositionSample;
 
 typedef boost::shared_ptr<AudioOutput> AudioOutputPtr;
 
@@ -102,6 +103,19 @@ class AudioOutput : public QThread {
 		float *fSpeakers;
 		float *fSpeakerVolume;
 		bool *bSpeakerPositional;
+		/// Speaker positions rotated into the current listener orientation.
+		float *fListenerSpeakers;
+		/// Camera position, front and top vectors the listener basis was computed from.
+		float fListener[9];
+		/// Minimum and maximum distance, volume at maximum distance and bloom
+		/// the cached gains were computed with.
+		float fGainSettings[4];
+		/// Bumped whenever the listener moves; AudioOutputUser gain caches compare against it.
+		unsigned int iListenerSerial;
+		/// Last positions read from the plugin, kept while the poller is publishing.
+		PositionSample *psListener;
+
+		void updateListener(const PositionSample &ps);
 	protected:
 		enum { SampleShort, SampleFloat } eSampleFormat;
 		volatile bool bRunning;
@@ -34,6 +34,24 @@
 #include "AudioOutputSample.h"
 
 #include "Audio.h"
+#include "Resampler.h"
+
+/// A notification sample decoded and resampled for one mixer rate, along
+/// with the state of the file it was decoded from.
+struct DecodedSample {
+	QDateTime qdtModified;
+	qint64 iSize;
+	QVector<float> qvPCM;
+};
+
+typedef QPair<QString, unsigned int> DecodedSampleKey;
+
+// Memory budget for decoded samples, in bytes. Files that would take more
+// than a quarter of it are streamed from disk instead.
+static const int iDecodedCacheSize = 16 * 1024 * 1024;
+
+static QMutex qmDecoded;
+static QCache<DecodedSampleKey, DecodedSample> qcDecoded(iDecodedCacheSize);
 
 SoundFile::SoundFile(const QString &fname) {
 	siInfo.frames = 0;
@@ -70,6 +88,10 @@ int SoundFile::samplerate() const {
 	return siInfo.samplerate;
 }
 
+sf_count_t SoundFile::frames() const {
+	return siInfo.frames;
+}
+
 int SoundFile::error() const {
 	return sf_error(sfFile);
 }
@@ -143,6 +165,8 @@ AudioOutputSample::AudioOutputSample(const QString &name, SoundFile *psndfile, b
 
 	sfHandle = psndfile;
 	iOutSampleRate = freq;
+	iPCMPos = 0;
+	srs = NULL;
 
 	// Check if the file is good
 	if (sfHandle->channels() <= 0 || sfHandle->channels() > 2) {
@@ -173,6 +197,16 @@ AudioOutputSample::AudioOutputSample(const QString &name, SoundFile *psndfile, b
 	bEof = false;
 }
 
+AudioOutputSample::AudioOutputSample(const QString &name, const QVector<float> &pcm, bool loop) : AudioOutputUser(name), qvPCM(pcm) {
+	sfHandle = NULL;
+	srs = NULL;
+	iOutSampleRate = 0;
+	iPCMPos = 0;
+	iLastConsume = iBufferFilled = 0;
+	bLoop = loop;
+	bEof = false;
+}
+
 AudioOutputSample::~AudioOutputSample() {
 	if (srs)
 		speex_resampler_destroy(srs);
@@ -207,6 +241,84 @@ SoundFile* AudioOutputSample::loadSndfile(const QString &filename) {
 	return sf;
 }
 
+QVector<float> AudioOutputSample::decodedSample(const QString &filename, unsigned int freq) {
+	const QFileInfo fi(filename);
+	const DecodedSampleKey key(filename, freq);
+
+	{
+		QMutexLocker lock(&qmDecoded);
+		const DecodedSample *ds = qcDecoded.object(key);
+		if (ds && (ds->qdtModified == fi.lastModified()) && (ds->iSize == fi.size()))
+			return ds->qvPCM;
+	}
+
+	SoundFile sf(filename);
+	if (! sf.isOpen() || (sf.error() != SF_ERR_NO_ERROR) || (sf.channels() <= 0) || (sf.channels() > 2) || (sf.samplerate() <= 0) || (sf.frames() <= 0))
+		return QVector<float>();
+
+	const unsigned int rate = static_cast<unsigned int>(sf.samplerate());
+	const qint64 outframes = sf.frames() * freq / rate + 1;
+	if (outframes * static_cast<qint64>(sizeof(float)) > iDecodedCacheSize / 4)
+		return QVector<float>();
+
+	const int channels = sf.channels();
+	QVector<float> in(static_cast<int>(sf.frames()) * channels);
+	sf_count_t read = sf.read(in.data(), in.size());
+	if (read <= 0)
+		return QVector<float>();
+
+	// Mix down to mono in place, as the streaming path does.
+	const int frames = static_cast<int>(read / channels);
+	if (channels == 2)
+		for (int i = 0; i < frames; ++i)
+			in[i] = (in[i*2] + in[i*2 + 1]) * 0.5f;
+	in.resize(frames);
+
+	QVector<float> pcm;
+	if (rate == freq) {
+		pcm = in;
+	} else {
+		// This runs once per file, so the best filter is affordable. Pad the
+		// input with silence to flush the filter and drop its delay from the
+		// start of the output.
+		Resampler *r = Resampler::create(1, rate, freq, 4096, Resampler::HighQuality);
+		const unsigned int latency = r->inputLatency();
+		in.resize(frames + static_cast<int>(latency));
+
+		unsigned int left = static_cast<unsigned int>(in.size());
+		const unsigned int total = static_cast<unsigned int>(static_cast<qint64>(left) * freq / rate + 1);
+		pcm.resize(static_cast<int>(total));
+
+		// The resampler takes the file a chunk at a time.
+		const float *src = in.constData();
+		unsigned int outlen = 0;
+		while ((left > 0) && (outlen < total)) {
+			unsigned int inlen = left;
+			unsigned int produced = total - outlen;
+			r->process(src, inlen, pcm.data() + outlen, produced);
+			if (! inlen && ! produced)
+				break;
+			src += inlen;
+			left -= inlen;
+			outlen += produced;
+		}
+		delete r;
+
+		const int skip = qMin(static_cast<int>(static_cast<qint64>(latency) * freq / rate), static_cast<int>(outlen));
+		pcm = pcm.mid(skip, static_cast<int>(outlen) - skip);
+	}
+
+	DecodedSample *ds = new DecodedSample();
+	ds->qdtModified = fi.lastModified();
+	ds->iSize = fi.size();
+	ds->qvPCM = pcm;
+
+	QMutexLocker lock(&qmDecoded);
+	qcDecoded.insert(key, ds, pcm.size() * static_cast<int>(sizeof(float)));
+
+	return pcm;
+}
+
 QString AudioOutputSample::browseForSndfile(QString defaultpath) {
 	QString file = QFileDialog::getOpenFileName(NULL, tr("Choose sound file"), defaultpath, QLatin1String("*.wav *.ogg *.ogv *.oga *.flac"));
 	if (! file.isEmpty()) {
@@ -223,6 +335,36 @@ QString AudioOutputSample::browseForSndfile(QString defaultpath) {
 }
 
 bool AudioOutputSample::needSamples(unsigned int snum) {
+	if (! sfHandle) {
+		// Decoded sample: copy straight from the shared PCM.
+		resizeBuffer(snum);
+
+		const float *pcm = qvPCM.constData();
+		const unsigned int size = static_cast<unsigned int>(qvPCM.size());
+		unsigned int done = 0;
+		while (done < snum) {
+			if (iPCMPos >= size) {
+				if (! bLoop || (size == 0))
+					break;
+				iPCMPos = 0;
+			}
+			const unsigned int n = qMin(snum - done, size - iPCMPos);
+			memcpy(pfBuffer + done, pcm + iPCMPos, sizeof(float) * n);
+			done += n;
+			iPCMPos += n;
+		}
+
+		if (done < snum) {
+			memset(pfBuffer + done, 0, sizeof(float) * (snum - done));
+			if (! bEof) {
+				emit playbackFinished();
+				bEof = true;
+			}
+			return false;
+		}
+		return true;
+	}
+
 	// Forward the buffer
 	for (unsigned int i=iLastConsume;i<iBufferFilled;++i)
 		pfBuffer[i-iLastConsume]=pfBuffer[i];
@@ -36,6 +36,7 @@
 #include <speex/speex_resampler.h>
 #include <QtCore/QObject>
 #include <QtCore/QFile>
+#include <QtCore/QVector>
 
 #include "AudioOutputUser.h"
 
@@ -58,6 +59,7 @@ class SoundFile : public QObject {
 
 		int channels() const;
 		int samplerate() const;
+		sf_count_t frames() const;
 		int error() const ;
 		QString strError() const;
 		bool isOpen() const;
@@ -78,15 +80,22 @@ class AudioOutputSample : public AudioOutputUser {
 
 		SoundFile *sfHandle;
 
+		/// Mono PCM at the mixer rate, shared with the sample cache. Played
+		/// instead of sfHandle when the file was decoded up front.
+		QVector<float> qvPCM;
+		unsigned int iPCMPos;
+
 		bool bLoop;
 		bool bEof;
 	signals:
 		void playbackFinished();
 	public:
 		static SoundFile* loadSndfile(const QString &filename);
+		static QVector<float> decodedSample(const QString &filename, unsigned int freq);
 		static QString browseForSndfile(QString defaultpath=QString());
 		virtual bool needSamples(unsigned int snum) Q_DECL_OVERRIDE;
 		AudioOutputSample(const QString &name, SoundFile *psndfile, bool repeat, unsigned int freq);
+		AudioOutputSample(const QString &name, const QVector<float> &pcm, bool repeat);
 		~AudioOutputSample() Q_DECL_OVERRIDE;
 };
 
@@ -44,7 +44,6 @@
 #endif
 
 AudioOutputSpeech::AudioOutputSpeech(ClientUser *user, unsigned int freq, MessageHandler::UDPMessageType type) : AudioOutputUser(user->qsName) {
-	int err;
 	p = user;
 	umtType = type;
 	iMixerFreq = freq;
@@ -83,10 +82,10 @@ AudioOutputSpeech::AudioOutputSpeech(ClientUser *user, unsigned int freq, Messag
 		iOutputSize *= 2;
 	}
 
-	srs = NULL;
+	rResampler = NULL;
 	fResamplerBuffer = NULL;
 	if (iMixerFreq != iSampleRate) {
-		srs = speex_resampler_init(bStereo ? 2 : 1, iSampleRate, iMixerFreq, 3, &err);
+		rResampler = Resampler::create(bStereo ? 2 : 1, iSampleRate, iMixerFreq, iAudioBufferSize / (bStereo ? 2 : 1), g.s.rqResample);
 		fResamplerBuffer = new float[iAudioBufferSize];
 	}
 
@@ -122,8 +121,7 @@ AudioOutputSpeech::~AudioOutputSpeech() {
 		speex_decoder_destroy(dsSpeex);
 	}
 
-	if (srs)
-		speex_resampler_destroy(srs);
+	delete rResampler;
 
 	jitter_buffer_destroy(jbJitter);
 
@@ -206,7 +204,7 @@ bool AudioOutputSpeech::needSamples(unsigned int snum) {
 		int decodedSamples = iFrameSize;
 		resizeBuffer(iBufferFilled + iOutputSize);
 
-		pOut = (srs) ? fResamplerBuffer : (pfBuffer + iBufferFilled);
+		pOut = rResampler ? fResamplerBuffer : (pfBuffer + iBufferFilled);
 
 		if (! bLastAlive) {
 			memset(pOut, 0, iFrameSize * sizeof(float));
@@ -400,10 +398,10 @@ bool AudioOutputSpeech::needSamples(unsigned int snum) {
 			}
 		}
 nextframe:
-		spx_uint32_t inlen = decodedSamples;
-		spx_uint32_t outlen = static_cast<unsigned int>(ceilf(static_cast<float>(decodedSamples * iMixerFreq) / static_cast<float>(iSampleRate)));
-		if (srs && bLastAlive)
-			speex_resampler_process_float(srs, 0, fResamplerBuffer, &inlen, pfBuffer + iBufferFilled, &outlen);
+		unsigned int inlen = decodedSamples;
+		unsigned int outlen = static_cast<unsigned int>(ceilf(static_cast<float>(decodedSamples * iMixerFreq) / static_cast<float>(iSampleRate)));
+		if (rResampler && bLastAlive)
+			rResampler->process(fResamplerBuffer, inlen, pfBuffer + iBufferFilled, outlen);
 		iBufferFilled += outlen;
 	}
 
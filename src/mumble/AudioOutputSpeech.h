@@ -34,7 +34,6 @@
 
 #include <stdint.h>
 #include <speex/speex.h>
-#include <speex/speex_resampler.h>
 #include <speex/speex_jitter.h>
 #include <celt.h>
 
@@ -42,6 +41,7 @@
 
 #include "AudioOutputUser.h"
 #include "Message.h"
+#include "Resampler.h"
 
 class CELTCodec;
 class ClientUser;
@@ -68,7 +68,7 @@ class AudioOutputSpeech : public AudioOutputUser {
 		float *fFadeOut;
 		float *fResamplerBuffer;
 
-		SpeexResamplerState *srs;
+		Resampler *rResampler;
 
 		QMutex qmJitter;
 		JitterBuffer *jbJitter;
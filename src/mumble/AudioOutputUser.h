@@ -48,6 +48,12 @@ class AudioOutputUser : public QObject {
 		float *pfBuffer;
 		float *pfVolume;
 		float fPos[3];
+
+		/// Positional gain per speaker, as calculated for fGainPos.
+		float *pfGain;
+		float fGainPos[3];
+		/// Listener serial pfGain was calculated for; 0 if invalid.
+		unsigned int iGainSerial;
 		virtual bool needSamples(unsigned int snum) = 0;
 };
 
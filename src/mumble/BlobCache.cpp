@@ -0,0 +1,184 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "mumble_pch.hpp"
+
+#include "BlobCache.h"
+
+BlobCache::BlobCache(const QString &path, qint64 limit) : qdPath(path) {
+	uiStamp = 0;
+	iLimit = 0;
+	memset(&sStats, 0, sizeof(sStats));
+
+	if (! qdPath.exists() && ! QDir::root().mkpath(qdPath.absolutePath()))
+		qWarning("BlobCache: Failed to create %s", qPrintable(qdPath.absolutePath()));
+
+	// Oldest first, so the previous session's most recent blobs are evicted last.
+	foreach(const QFileInfo &qfi, qdPath.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed)) {
+		const QString &name = qfi.fileName();
+		if (name.endsWith(QLatin1String(".tmp"))) {
+			QFile::remove(qfi.absoluteFilePath());
+			continue;
+		}
+
+		const QByteArray &hash = QByteArray::fromHex(name.toLatin1());
+		if ((name.length() != 40) || (hash.size() != 20))
+			continue;
+
+		Entry &e = qhFiles[hash];
+		e.iSize = qfi.size();
+		e.uiStamp = 0;
+		touch(hash, e);
+		sStats.iBytes += e.iSize;
+	}
+
+	setLimit(limit);
+}
+
+QString BlobCache::fileName(const QByteArray &hash) const {
+	return qdPath.absoluteFilePath(QString::fromLatin1(hash.toHex()));
+}
+
+void BlobCache::setLimit(qint64 limit) {
+	iLimit = qMax(limit, Q_INT64_C(0));
+	qcMemory.setMaxCost(static_cast<int>(qMin(iLimit / 8, static_cast<qint64>(INT_MAX))));
+	evict();
+}
+
+qint64 BlobCache::limit() const {
+	return iLimit;
+}
+
+bool BlobCache::contains(const QByteArray &hash) const {
+	return qhFiles.contains(hash) || qcMemory.contains(hash);
+}
+
+void BlobCache::touch(const QByteArray &hash, Entry &e) {
+	if (e.uiStamp != 0)
+		qmLRU.remove(e.uiStamp);
+	e.uiStamp = ++uiStamp;
+	qmLRU.insert(e.uiStamp, hash);
+}
+
+QByteArray BlobCache::value(const QByteArray &hash) {
+	QHash<QByteArray, Entry>::iterator i = qhFiles.find(hash);
+
+	QByteArray *cached = qcMemory.object(hash);
+	if (cached) {
+		++sStats.uiMemoryHits;
+		if (i != qhFiles.end())
+			touch(hash, *i);
+		return *cached;
+	}
+
+	if (i == qhFiles.end()) {
+		++sStats.uiMisses;
+		return QByteArray();
+	}
+
+	QFile f(fileName(hash));
+	QByteArray qba;
+	// Blobs outlive their files once handed out, so they are always copied.
+	if (f.open(QIODevice::ReadOnly))
+		qba = f.readAll();
+
+	if (qba.isEmpty()) {
+		qWarning("BlobCache: Dropping unreadable blob %s", hash.toHex().constData());
+		qmLRU.remove(i->uiStamp);
+		sStats.iBytes -= i->iSize;
+		qhFiles.erase(i);
+		QFile::remove(f.fileName());
+		++sStats.uiMisses;
+		return QByteArray();
+	}
+
+	++sStats.uiFileHits;
+	touch(hash, *i);
+	qcMemory.insert(hash, new QByteArray(qba), qba.size());
+	return qba;
+}
+
+void BlobCache::insert(const QByteArray &hash, const QByteArray &data) {
+	if (hash.isEmpty() || data.isEmpty())
+		return;
+
+	QHash<QByteArray, Entry>::iterator i = qhFiles.find(hash);
+	if (i == qhFiles.end()) {
+		const QString &fname = fileName(hash);
+		const QString &tmpname = fname + QLatin1String(".tmp");
+
+		QFile f(tmpname);
+		if (! f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			qWarning("BlobCache: Failed to open %s for writing", qPrintable(tmpname));
+			return;
+		}
+		const bool ok = (f.write(data) == data.size());
+		f.close();
+
+		QFile::remove(fname);
+		if (! ok || ! QFile::rename(tmpname, fname)) {
+			qWarning("BlobCache: Failed to store blob in %s", qPrintable(fname));
+			QFile::remove(tmpname);
+			return;
+		}
+
+		i = qhFiles.insert(hash, Entry());
+		i->iSize = data.size();
+		i->uiStamp = 0;
+		sStats.iBytes += i->iSize;
+	}
+	touch(hash, *i);
+	qcMemory.insert(hash, new QByteArray(data), data.size());
+
+	evict();
+}
+
+void BlobCache::evict() {
+	while ((sStats.iBytes > iLimit) && ! qmLRU.isEmpty()) {
+		const QByteArray hash = qmLRU.begin().value();
+		qmLRU.erase(qmLRU.begin());
+
+		QHash<QByteArray, Entry>::iterator i = qhFiles.find(hash);
+		sStats.iBytes -= i->iSize;
+		sStats.iEvictedBytes += i->iSize;
+		++sStats.uiEvictions;
+		qhFiles.erase(i);
+
+		qcMemory.remove(hash);
+		QFile::remove(fileName(hash));
+	}
+}
+
+BlobCache::Statistics BlobCache::statistics() const {
+	Statistics s = sStats;
+	s.iFiles = qhFiles.count();
+	s.iMemoryBytes = qcMemory.totalCost();
+	return s;
+}
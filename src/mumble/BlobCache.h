@@ -0,0 +1,95 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MUMBLE_BLOBCACHE_H_
+#define MUMBLE_MUMBLE_BLOBCACHE_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QCache>
+#include <QtCore/QDir>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+
+/// Size-bounded cache for textures, comments and channel descriptions
+/// received from servers, keyed by their SHA1.
+///
+/// Blobs are stored one file per hash in a directory next to the database
+/// and read back into memory on lookup. Recently used blobs are also kept in
+/// memory, so repeated lookups (e.g. while UserModel paints tooltips) never
+/// touch the disk. When the directory outgrows its budget, the least
+/// recently used blobs are deleted.
+class BlobCache {
+	private:
+		Q_DISABLE_COPY(BlobCache)
+	public:
+		struct Statistics {
+			quint64 uiMemoryHits;
+			quint64 uiFileHits;
+			quint64 uiMisses;
+			quint64 uiEvictions;
+			qint64 iEvictedBytes;
+			int iFiles;
+			qint64 iBytes;
+			int iMemoryBytes;
+		};
+	protected:
+		struct Entry {
+			qint64 iSize;
+			quint64 uiStamp;
+		};
+
+		QDir qdPath;
+		QCache<QByteArray, QByteArray> qcMemory;
+		QHash<QByteArray, Entry> qhFiles;
+		/// Stored blobs, least recently used first.
+		QMap<quint64, QByteArray> qmLRU;
+		quint64 uiStamp;
+		qint64 iLimit;
+		Statistics sStats;
+
+		QString fileName(const QByteArray &hash) const;
+		void touch(const QByteArray &hash, Entry &e);
+		void evict();
+	public:
+		BlobCache(const QString &path, qint64 limit);
+
+		/// Sets the budget of the file store in bytes. An eighth of it is
+		/// used for the in-memory tier.
+		void setLimit(qint64 limit);
+		qint64 limit() const;
+
+		QByteArray value(const QByteArray &hash);
+		void insert(const QByteArray &hash, const QByteArray &data);
+		bool contains(const QByteArray &hash) const;
+
+		Statistics statistics() const;
+};
+
+#endif
@@ -32,6 +32,7 @@
 
 #include "Database.h"
 
+#include "BlobCache.h"
 #include "Global.h"
 #include "Message.h"
 #include "Net.h"
@@ -61,6 +62,8 @@ static bool execQueryAndLogFailure(QSqlQuery &query, const QString &queryString)
 }
 
 
+BlobCache *Database::bcBlobs = NULL;
+
 Database::Database() {
 	QSqlDatabase db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"));
 	QSettings qs;
@@ -139,9 +142,18 @@ Database::Database() {
 	execQueryAndLogFailure(query, QLatin1String("CREATE UNIQUE INDEX IF NOT EXISTS `comments_comment` ON `comments`(`who`, `comment`)"));
 	execQueryAndLogFailure(query, QLatin1String("CREATE INDEX IF NOT EXISTS `comments_seen` ON `comments`(`seen`)"));
 
-	execQueryAndLogFailure(query, QLatin1String("CREATE TABLE IF NOT EXISTS `blobs` (`hash` TEXT, `data` BLOB, `seen` DATE)"));
-	execQueryAndLogFailure(query, QLatin1String("CREATE UNIQUE INDEX IF NOT EXISTS `blobs_hash` ON `blobs`(`hash`)"));
-	execQueryAndLogFailure(query, QLatin1String("CREATE INDEX IF NOT EXISTS `blobs_seen` ON `blobs`(`seen`)"));
+	bcBlobs = new BlobCache(fi.absolutePath() + QLatin1String("/blobs"), static_cast<qint64>(g.s.iBlobCacheSize) * 1024 * 1024);
+
+	// Blobs used to live in the database; move them to the blob cache, oldest first.
+	if (db.tables().contains(QLatin1String("blobs"))) {
+		query.setForwardOnly(true);
+		if (execQueryAndLogFailure(query, QLatin1String("SELECT `hash`, `data` FROM `blobs` ORDER BY `seen`"))) {
+			while (query.next())
+				bcBlobs->insert(query.value(0).toByteArray(), query.value(1).toByteArray());
+		}
+		query.setForwardOnly(false);
+		execQueryAndLogFailure(query, QLatin1String("DROP TABLE `blobs`"));
+	}
 
 	execQueryAndLogFailure(query, QLatin1String("CREATE TABLE IF NOT EXISTS `tokens` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `digest` BLOB, `token` TEXT)"));
 	execQueryAndLogFailure(query, QLatin1String("CREATE INDEX IF NOT EXISTS `tokens_host_port` ON `tokens`(`digest`)"));
@@ -175,7 +187,6 @@ Database::Database() {
 	execQueryAndLogFailure(query, QLatin1String("CREATE UNIQUE INDEX IF NOT EXISTS `pingcache_host_port` ON `pingcache`(`hostname`,`port`)"));
 
 	execQueryAndLogFailure(query, QLatin1String("DELETE FROM `comments` WHERE `seen` < datetime('now', '-1 years')"));
-	execQueryAndLogFailure(query, QLatin1String("DELETE FROM `blobs` WHERE `seen` < datetime('now', '-1 months')"));
 
 	execQueryAndLogFailure(query, QLatin1String("VACUUM"));
 
@@ -193,6 +204,12 @@ Database::Database() {
 }
 
 Database::~Database() {
+	const BlobCache::Statistics &bs = bcBlobs->statistics();
+	qWarning("Database: Blob cache %d files, %lld bytes; %llu memory hits, %llu file hits, %llu misses, %llu evictions (%lld bytes)",
+	         bs.iFiles, bs.iBytes, bs.uiMemoryHits, bs.uiFileHits, bs.uiMisses, bs.uiEvictions, bs.iEvictedBytes);
+	delete bcBlobs;
+	bcBlobs = NULL;
+
 	QSqlQuery query;
 	execQueryAndLogFailure(query, QLatin1String("PRAGMA journal_mode = DELETE"));
 	execQueryAndLogFailure(query, QLatin1String("VACUUM"));
@@ -395,33 +412,15 @@ void Database::setSeenComment(const QString &hash, const QByteArray &commenthash
 }
 
 QByteArray Database::blob(const QByteArray &hash) {
-	QSqlQuery query;
-
-	query.prepare(QLatin1String("SELECT `data` FROM `blobs` WHERE `hash` = ?"));
-	query.addBindValue(hash);
-	execQueryAndLogFailure(query);
-	if (query.next()) {
-		QByteArray qba = query.value(0).toByteArray();
-
-		query.prepare(QLatin1String("UPDATE `blobs` SET `seen` = datetime('now') WHERE `hash` = ?"));
-		query.addBindValue(hash);
-		execQueryAndLogFailure(query);
-
-		return qba;
-	}
-	return QByteArray();
+	return bcBlobs->value(hash);
 }
 
 void Database::setBlob(const QByteArray &hash, const QByteArray &data) {
-	if (hash.isEmpty() || data.isEmpty())
-		return;
-
-	QSqlQuery query;
+	bcBlobs->insert(hash, data);
+}
 
-	query.prepare(QLatin1String("REPLACE INTO `blobs` (`hash`, `data`, `seen`) VALUES (?, ?, datetime('now'))"));
-	query.addBindValue(hash);
-	query.addBindValue(data);
-	execQueryAndLogFailure(query);
+BlobCache *Database::blobCache() {
+	return bcBlobs;
 }
 
 QStringList Database::getTokens(const QByteArray &digest) {
@@ -33,6 +33,8 @@
 
 #include "Settings.h"
 
+class BlobCache;
+
 struct FavoriteServer {
 	QString qsName;
 	QString qsUsername;
@@ -46,6 +48,8 @@ class Database : public QObject {
 	private:
 		Q_OBJECT
 		Q_DISABLE_COPY(Database)
+	protected:
+		static BlobCache *bcBlobs;
 	public:
 		Database();
 		~Database() Q_DECL_OVERRIDE;
@@ -74,6 +78,7 @@ class Database : public QObject {
 
 		static QByteArray blob(const QByteArray &hash);
 		static void setBlob(const QByteArray &hash, const QByteArray &blob);
+		static BlobCache *blobCache();
 
 		static QStringList getTokens(const QByteArray &digest);
 		static void setTokens(const QByteArray &digest, QStringList &tokens);
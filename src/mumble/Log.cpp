@@ -49,6 +49,50 @@ static ConfigWidget *LogConfigDialogNew(Settings &st) {
 
 static ConfigRegistrar registrar(4000, LogConfigDialogNew);
 
+// Decoded log images kept around for painting, in bytes.
+static const int iDecodedImageBudget = 32 * 1024 * 1024;
+// Encoded log images held before images no longer in the document are
+// dropped, in bytes.
+static const int iImagePruneBytes = 8 * 1024 * 1024;
+
+// Payload of a data: URL, or an empty array if url is not one.
+static QByteArray dataUrlPayload(const QString &url) {
+	if (! url.startsWith(QLatin1String("data:"), Qt::CaseInsensitive))
+		return QByteArray();
+
+	int comma = url.indexOf(QLatin1Char(','));
+	if (comma < 0)
+		return QByteArray();
+
+	QString header = url.mid(5, comma - 5);
+	QByteArray data = QByteArray::fromPercentEncoding(url.mid(comma + 1).toLatin1());
+	if (header.endsWith(QLatin1String(";base64"), Qt::CaseInsensitive))
+		return QByteArray::fromBase64(data);
+	return data;
+}
+
+// Limits for preparing a single message on the worker. Images beyond them
+// are left out of the message.
+static const int iPrepareBudgetMsec = 2000;
+static const int iPrepareBudgetBytes = 4 * 1024 * 1024;
+
+class LogPrepareTask : public QRunnable {
+	protected:
+		Log *lLog;
+		QString qsHtml;
+		QSharedPointer<PreparedMessage> spPrepared;
+		QSize qsMax;
+	public:
+		LogPrepareTask(Log *l, const QString &html, const QSharedPointer<PreparedMessage> &pm, const QSize &max)
+			: lLog(l), qsHtml(html), spPrepared(pm), qsMax(max) {}
+
+		void run() Q_DECL_OVERRIDE {
+			Log::prepare(qsHtml, spPrepared.data(), qsMax);
+			spPrepared->qaiReady.fetchAndStoreRelease(1);
+			QCoreApplication::postEvent(lLog, new LogMessagePreparedEvent());
+		}
+};
+
 LogConfig::LogConfig(Settings &st) : ConfigWidget(st) {
 	setupUi(this);
 
@@ -124,6 +168,7 @@ void LogConfig::load(const Settings &r) {
 	}
 
 	qsbMaxBlocks->setValue(r.iMaxLogBlocks);
+	qcbLogArchive->setChecked(r.bLogArchive);
 
 #ifdef USE_NO_TTS
 	qtwMessages->hideColumn(ColTTS);
@@ -155,6 +200,7 @@ void LogConfig::save() const {
 		s.qmMessageSounds[mt] = i->text(ColStaticSoundPath);
 	}
 	s.iMaxLogBlocks = qsbMaxBlocks->value();
+	s.bLogArchive = qcbLogArchive->isChecked();
 
 #ifndef USE_NO_TTS
 	s.iTTSVolume=qsVolume->value();
@@ -217,6 +263,7 @@ void LogConfig::browseForAudioFile() {
 }
 
 Log::Log(QObject *p) : QObject(p) {
+	qtpPrepare.setMaxThreadCount(2);
 	tts=new TextToSpeech(this);
 	tts->setVolume(g.s.iTTSVolume);
 	uiLastId = 0;
@@ -392,6 +439,67 @@ QString Log::imageToImg(QImage img) {
 	return QString();
 }
 
+/**
+ * Runs on a worker thread. Decodes the data: images of a message, scales
+ * those larger than maxSize down, and replaces them by logimage: URLs so the
+ * GUI thread never parses or decodes the image data itself. Images past the
+ * per-message time or size budget, or that fail to decode, are dropped.
+ */
+void Log::prepare(const QString &html, PreparedMessage *pm, const QSize &maxSize) {
+	QElapsedTimer timer;
+	timer.start();
+
+	QRegExp qr(QLatin1String("(<img[^>]*\\bsrc\\s*=\\s*)([\"'])(data:[^\"']*)\\2"), Qt::CaseInsensitive);
+	QString out;
+	int pos = 0;
+	int bytes = 0;
+	int idx;
+
+	while ((idx = qr.indexIn(html, pos)) != -1) {
+		out.append(html.mid(pos, idx - pos));
+		pos = idx + qr.matchedLength();
+
+		QByteArray payload = dataUrlPayload(qr.cap(3));
+		bytes += payload.size();
+
+		QImage qi;
+		if ((bytes <= iPrepareBudgetBytes) && (timer.elapsed() <= iPrepareBudgetMsec)) {
+			QBuffer qb(&payload);
+			qb.open(QIODevice::ReadOnly);
+			QImageReader qir(&qb);
+			QSize size = qir.size();
+			bool scale = size.isValid() && ((size.width() > maxSize.width()) || (size.height() > maxSize.height()));
+			if (scale)
+				qir.setScaledSize(size.scaled(maxSize, Qt::KeepAspectRatio));
+			qi = qir.read();
+
+			if (scale && ! qi.isNull()) {
+				payload.clear();
+				QBuffer qbs(&payload);
+				qbs.open(QIODevice::WriteOnly);
+				qi.save(&qbs, "PNG");
+			}
+		}
+
+		if (qi.isNull()) {
+			out.append(Qt::escape(tr("[image omitted]")));
+			continue;
+		}
+
+		PreparedMessage::Image img;
+		img.qsName = LogDocument::imageName(payload);
+		img.qbaEncoded = payload;
+		img.qiDecoded = qi;
+		pm->qlImages << img;
+
+		out.append(qr.cap(1) + qr.cap(2) + img.qsName + qr.cap(2));
+	}
+	out.append(html.mid(pos));
+
+	pm->qsHtml = out;
+	pm->qsPlain = QTextDocumentFragment::fromHtml(out).toPlainText();
+}
+
 QString Log::validHtml(const QString &html, bool allowReplacement, QTextCursor *tc) {
 	QDesktopWidget dw;
 	LogDocument qtd;
@@ -459,6 +567,33 @@ QString Log::validHtml(const QString &html, bool allowReplacement, QTextCursor *
 	}
 
 	if (tc) {
+		// Formats are never freed by a QTextDocument, so inline images
+		// must not end up in the log as data: URLs. Hand them to the log
+		// document's image store and refer to them by hash instead.
+		LogDocument *ld = qobject_cast<LogDocument *>(tc->document());
+		if (ld) {
+			QList<QPair<QTextCursor, QTextImageFormat> > images;
+			for (QTextBlock qtb = qtd.begin(); qtb != qtd.end(); qtb = qtb.next()) {
+				for (QTextBlock::iterator qtbi = qtb.begin(); qtbi != qtb.end(); ++qtbi) {
+					const QTextFragment &qtf = qtbi.fragment();
+					if (! qtf.charFormat().isImageFormat())
+						continue;
+					QTextImageFormat qtif = qtf.charFormat().toImageFormat();
+					QByteArray payload = dataUrlPayload(qtif.name());
+					if (payload.isEmpty())
+						continue;
+					qtif.setName(ld->addImage(payload));
+
+					QTextCursor qtc(&qtd);
+					qtc.setPosition(qtf.position(), QTextCursor::MoveAnchor);
+					qtc.setPosition(qtf.position() + qtf.length(), QTextCursor::KeepAnchor);
+					images << qMakePair(qtc, qtif);
+				}
+			}
+			for (int i = 0; i < images.count(); ++i)
+				images[i].first.setCharFormat(images.at(i).second);
+		}
+
 		QTextCursor tcNew(&qtd);
 		tcNew.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
 		tc->insertFragment(tcNew.selection());
@@ -478,7 +613,45 @@ void Log::log(MsgType mt, const QString &console, const QString &terse, bool own
 		return;
 	}
 
-	QString plain = QTextDocumentFragment::fromHtml(console).toPlainText();
+	PendingMessage pm;
+	pm.mt = mt;
+	pm.dt = dt;
+	pm.qsConsole = console;
+	pm.qsTerse = terse;
+	pm.bOwnMessage = ownMessage;
+	pm.spPrepared = QSharedPointer<PreparedMessage>(new PreparedMessage());
+
+	if (console.contains(QLatin1String("data:"), Qt::CaseInsensitive)) {
+		// Inline images are decoded on a worker; everything logged after
+		// this message waits for it to keep the order.
+		qtpPrepare.start(new LogPrepareTask(this, console, pm.spPrepared, QSize(g.s.iMaxImageWidth, g.s.iMaxImageHeight)));
+	} else {
+		pm.spPrepared->qsHtml = console;
+		pm.spPrepared->qsPlain = QTextDocumentFragment::fromHtml(console).toPlainText();
+		pm.spPrepared->qaiReady.fetchAndStoreRelease(1);
+	}
+
+	qlPending << pm;
+	flushPending();
+}
+
+void Log::flushPending() {
+	while (! qlPending.isEmpty() && qlPending.first().spPrepared->qaiReady.fetchAndAddAcquire(0))
+		output(qlPending.takeFirst());
+}
+
+void Log::customEvent(QEvent *evt) {
+	if (evt->type() == LogMessagePreparedEvent::Type)
+		flushPending();
+}
+
+void Log::output(const PendingMessage &pm) {
+	const MsgType mt = pm.mt;
+	const QDateTime &dt = pm.dt;
+	const QString &console = pm.spPrepared->qsHtml;
+	const QString &terse = pm.qsTerse;
+	const bool ownMessage = pm.bOwnMessage;
+	QString plain = pm.spPrepared->qsPlain;
 
 	quint32 flags = g.s.qmMessages.value(mt);
 
@@ -509,10 +682,22 @@ void Log::log(MsgType mt, const QString &console, const QString &terse, bool own
 			tc.insertBlock();
 		}
 		tc.insertHtml(Log::msgColor(QString::fromLatin1("[%1] ").arg(Qt::escape(dt.time().toString())), Log::Time));
+
+		LogDocument *ld = qobject_cast<LogDocument *>(tlog->document());
+		if (ld)
+			foreach(const PreparedMessage::Image &img, pm.spPrepared->qlImages)
+				ld->addImage(img.qsName, img.qbaEncoded, img.qiDecoded);
+
 		validHtml(console, true, &tc);
 		tc.movePosition(QTextCursor::End);
 		g.mw->qteLog->setTextCursor(tc);
 
+		if (ld)
+			ld->pruneImages();
+
+		if (g.s.bLogArchive)
+			archive(dt, plain);
+
 		if (scroll || ownMessage)
 			tlog->scrollLogToBottom();
 		else
@@ -524,7 +709,7 @@ void Log::log(MsgType mt, const QString &console, const QString &terse, bool own
 
 	// Message notification with balloon tooltips
 	if ((flags & Settings::LogBalloon) && !(g.mw->isActiveWindow() && g.mw->qdwLog->isVisible()))
-		postNotification(mt, console, plain);
+		postNotification(mt, pm.qsConsole, plain);
 
 	// Don't make any noise if we are self deafened (Unless it is the sound for activating self deaf)
 	if (g.s.bDeaf && mt != Log::SelfDeaf)
@@ -584,6 +769,28 @@ void Log::log(MsgType mt, const QString &console, const QString &terse, bool own
 		tts->say(terse);
 }
 
+void Log::archive(const QDateTime &dt, const QString &plain) {
+	if (! qfArchive.isOpen() || (qdArchive != dt.date())) {
+		qfArchive.close();
+		qdArchive = dt.date();
+
+		QDir dir(g.qdBasePath.absoluteFilePath(QLatin1String("ChatLogs")));
+		if (! dir.exists() && ! QDir::root().mkpath(dir.absolutePath())) {
+			qWarning("Log: Failed to create %s", qPrintable(dir.absolutePath()));
+			return;
+		}
+
+		qfArchive.setFileName(dir.absoluteFilePath(qdArchive.toString(QLatin1String("yyyy-MM-dd")) + QLatin1String(".txt")));
+		if (! qfArchive.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+			qWarning("Log: Failed to open %s", qPrintable(qfArchive.fileName()));
+			return;
+		}
+	}
+
+	qfArchive.write(QString::fromLatin1("[%1] %2\n").arg(dt.time().toString(), plain).toUtf8());
+	qfArchive.flush();
+}
+
 // Post a notification using the MainWindow's QSystemTrayIcon.
 void Log::postQtNotification(MsgType mt, const QString &plain) {
 	if (g.mw->qstiIcon->isSystemTrayAvailable() && g.mw->qstiIcon->supportsMessages()) {
@@ -608,7 +815,10 @@ LogDocument::LogDocument(QObject *p)
 	: QTextDocument(p)
 	, m_allowHTTPResources(true)
 	, m_valid(true)
-	, m_onlyLoadDataURLs(false) {
+	, m_onlyLoadDataURLs(false)
+	, m_imageBytes(0)
+	, m_pruneBytes(iImagePruneBytes)
+	, m_decodedImages(iDecodedImageBudget) {
 }
 
 QVariant LogDocument::loadResource(int type, const QUrl &url) {
@@ -617,6 +827,22 @@ QVariant LogDocument::loadResource(int type, const QUrl &url) {
 		return QLatin1String("No external resources allowed.");
 	}
 
+	if (url.scheme() == QLatin1String("logimage")) {
+		// Deliberately not added as a document resource, those are never
+		// freed either.
+		const QString name = url.toString();
+		QPixmap *cached = m_decodedImages.object(name);
+		if (cached)
+			return *cached;
+
+		QImage qi;
+		qi.loadFromData(m_images.value(name));
+		QPixmap pm = QPixmap::fromImage(qi);
+		qint64 cost = static_cast<qint64>(pm.width()) * pm.height() * 4 + 1;
+		m_decodedImages.insert(name, new QPixmap(pm), static_cast<int>(qMin(cost, static_cast<qint64>(iDecodedImageBudget) + 1)));
+		return pm;
+	}
+
 	if (url.scheme() != QLatin1String("data") && g.s.iMaxImageSize <= 0) {
 		m_valid = false;
 		return QLatin1String("Image download disabled.");
@@ -675,6 +901,70 @@ bool LogDocument::isValid() {
 	return m_valid;
 }
 
+QString LogDocument::imageName(const QByteArray &encoded) {
+	return QLatin1String("logimage:") + QString::fromLatin1(QCryptographicHash::hash(encoded, QCryptographicHash::Sha1).toHex());
+}
+
+// Stores an encoded inline image and returns the URL to show it with.
+QString LogDocument::addImage(const QByteArray &encoded) {
+	QString name = imageName(encoded);
+	addImage(name, encoded, QImage());
+	return name;
+}
+
+// Stores an image prepared by Log::prepare(), seeding the pixmap cache with
+// its decoded form when given.
+void LogDocument::addImage(const QString &name, const QByteArray &encoded, const QImage &decoded) {
+	if (! m_images.contains(name)) {
+		m_images.insert(name, encoded);
+		m_imageBytes += encoded.size();
+	}
+
+	if (! decoded.isNull() && ! m_decodedImages.contains(name)) {
+		qint64 cost = static_cast<qint64>(decoded.width()) * decoded.height() * 4 + 1;
+		m_decodedImages.insert(name, new QPixmap(QPixmap::fromImage(decoded)), static_cast<int>(qMin(cost, static_cast<qint64>(iDecodedImageBudget) + 1)));
+	}
+}
+
+// Drops images that are no longer referenced once the store has grown
+// past its threshold, e.g. because their messages were trimmed by the
+// maximum block count.
+void LogDocument::pruneImages() {
+	if (m_imageBytes <= m_pruneBytes)
+		return;
+
+	QSet<QString> used;
+	for (QTextBlock qtb = begin(); qtb != end(); qtb = qtb.next()) {
+		for (QTextBlock::iterator qtbi = qtb.begin(); qtbi != qtb.end(); ++qtbi) {
+			const QTextCharFormat qcf = qtbi.fragment().charFormat();
+			if (qcf.isImageFormat())
+				used.insert(qcf.toImageFormat().name());
+		}
+	}
+
+	QHash<QString, QByteArray>::iterator i = m_images.begin();
+	while (i != m_images.end()) {
+		if (used.contains(i.key())) {
+			++i;
+		} else {
+			m_imageBytes -= i.value().size();
+			m_decodedImages.remove(i.key());
+			i = m_images.erase(i);
+		}
+	}
+
+	// Everything left is still on screen; don't rescan on every message.
+	m_pruneBytes = qMax(iImagePruneBytes, m_imageBytes * 2);
+}
+
+void LogDocument::clear() {
+	QTextDocument::clear();
+	m_images.clear();
+	m_imageBytes = 0;
+	m_pruneBytes = iImagePruneBytes;
+	m_decodedImages.clear();
+}
+
 void LogDocument::receivedHead() {
 	QNetworkReply *rep = qobject_cast<QNetworkReply *>(sender());
 	if (rep->url().scheme() != QLatin1String("data")) {
@@ -736,3 +1026,7 @@ void LogDocument::finished() {
 LogDocumentResourceAddedEvent::LogDocumentResourceAddedEvent()
 	: QEvent(LogDocumentResourceAddedEvent::Type) {
 }
+
+LogMessagePreparedEvent::LogMessagePreparedEvent()
+	: QEvent(LogMessagePreparedEvent::Type) {
+}
@@ -32,7 +32,13 @@
 #ifndef MUMBLE_MUMBLE_LOG_H_
 #define MUMBLE_MUMBLE_LOG_H_
 
+#include <QtCore/QCache>
 #include <QtCore/QDate>
+#include <QtCore/QFile>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImage>
+#include <QtGui/QPixmap>
 #include <QtGui/QTextCursor>
 #include <QtGui/QTextDocument>
 
@@ -65,6 +71,21 @@ class LogConfig : public ConfigWidget, public Ui::LogConfig {
 class ClientUser;
 class Channel;
 
+/// Message HTML made ready for the log by Log::prepare(). Inline images
+/// are decoded, downsized and replaced by logimage: URLs.
+struct PreparedMessage {
+	QString qsHtml;
+	QString qsPlain;
+	struct Image {
+		QString qsName;
+		QByteArray qbaEncoded;
+		QImage qiDecoded;
+	};
+	QList<Image> qlImages;
+	/// Set by the worker once the fields above are complete.
+	QAtomicInt qaiReady;
+};
+
 class Log : public QObject {
 		friend class LogConfig;
 	private:
@@ -86,6 +107,28 @@ class Log : public QObject {
 		TextToSpeech *tts;
 		unsigned int uiLastId;
 		QDate qdDate;
+		/// Daily plain text file messages are appended to when
+		/// Settings::bLogArchive is set, and the day it belongs to.
+		QFile qfArchive;
+		QDate qdArchive;
+		void archive(const QDateTime &dt, const QString &plain);
+
+		/// Messages waiting to be output in the order they were logged,
+		/// possibly still being prepared on qtpPrepare.
+		struct PendingMessage {
+			MsgType mt;
+			QDateTime dt;
+			QString qsConsole;
+			QString qsTerse;
+			bool bOwnMessage;
+			QSharedPointer<PreparedMessage> spPrepared;
+		};
+		QList<PendingMessage> qlPending;
+		QThreadPool qtpPrepare;
+		void flushPending();
+		void output(const PendingMessage &pm);
+		void customEvent(QEvent *evt) Q_DECL_OVERRIDE;
+
 		static const QStringList allowedSchemes();
 		void postNotification(MsgType mt, const QString &console, const QString &plain);
 		void postQtNotification(MsgType mt, const QString &plain);
@@ -95,6 +138,7 @@ class Log : public QObject {
 		void setIgnore(MsgType t, int ignore = 1 << 30);
 		void clearIgnore();
 		static QString validHtml(const QString &html, bool allowReplacement = false, QTextCursor *tc = NULL);
+		static void prepare(const QString &html, PreparedMessage *pm, const QSize &maxSize);
 		static QString imageToImg(const QByteArray &format, const QByteArray &image);
 		static QString imageToImg(QImage img);
 		static QString msgColor(const QString &text, LogColorType t);
@@ -114,6 +158,11 @@ class LogDocument : public QTextDocument {
 		void setAllowHTTPResources(bool allowHttpResources);
 		void setOnlyLoadDataURLs(bool onlyLoadDataURLs);
 		bool isValid();
+		static QString imageName(const QByteArray &encoded);
+		QString addImage(const QByteArray &encoded);
+		void addImage(const QString &name, const QByteArray &encoded, const QImage &decoded);
+		void pruneImages();
+		void clear() Q_DECL_OVERRIDE;
 	public slots:
 		void receivedHead();
 		void finished();
@@ -121,6 +170,13 @@ class LogDocument : public QTextDocument {
 		bool m_allowHTTPResources;
 		bool m_valid;
 		bool m_onlyLoadDataURLs;
+		/// Encoded inline images, keyed by the logimage: URL messages refer
+		/// to them by. Decoded pixmaps are only kept for recently painted
+		/// images.
+		QHash<QString, QByteArray> m_images;
+		int m_imageBytes;
+		int m_pruneBytes;
+		QCache<QString, QPixmap> m_decodedImages;
 };
 
 class LogDocumentResourceAddedEvent : public QEvent {
@@ -130,4 +186,12 @@ class LogDocumentResourceAddedEvent : public QEvent {
 		LogDocumentResourceAddedEvent();
 };
 
+/// Posted to Log by the worker that finished preparing a message.
+class LogMessagePreparedEvent : public QEvent {
+	public:
+		static const QEvent::Type Type = static_cast<QEvent::Type>(20146);
+
+		LogMessagePreparedEvent();
+};
+
 #endif
@@ -2709,6 +2709,10 @@ void MainWindow::serverConnected() {
 
 	qtvUsers->setRowHidden(0, QModelIndex(), false);
 
+	// The initial channel and user states are loaded in one go when
+	// ServerSync arrives.
+	pmModel->beginBulkLoad();
+
 	g.bAllowHTML = true;
 	g.uiMessageLength = 5000;
 	g.uiImageLength = 131072;
@@ -2788,6 +2792,7 @@ void MainWindow::serverDisconnected(QAbstractSocket::SocketError err, QString re
 	qlChannelActions.clear();
 	qlUserActions.clear();
 
+	pmModel->endBulkLoad();
 	pmModel->removeAll();
 	qtvUsers->setRowHidden(0, QModelIndex(), true);
 
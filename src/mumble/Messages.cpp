@@ -127,6 +127,7 @@ void MainWindow::msgServerSync(const MumbleProto::ServerSync &msg) {
 			g.l->log(Log::Information, tr("Welcome message: %1").arg(str));
 		}
 	}
+	pmModel->endBulkLoad();
 	pmModel->ensureSelfVisible();
 	pmModel->recheckLinks();
 
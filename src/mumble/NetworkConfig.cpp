@@ -34,6 +34,8 @@
 
 #include "NetworkConfig.h"
 
+#include "BlobCache.h"
+#include "Database.h"
 #include "Global.h"
 #include "MainWindow.h"
 #include "OSInfo.h"
@@ -83,6 +85,13 @@ void NetworkConfig::load(const Settings &r) {
 
 	loadCheckBox(qcbImageDownload, r.iMaxImageSize <= 0);
 
+	qsbBlobCache->setValue(r.iBlobCacheSize);
+	if (Database::blobCache()) {
+		const BlobCache::Statistics &bs = Database::blobCache()->statistics();
+		qlBlobCacheStats->setText(tr("%1 entries, %2 KiB used, %3 evicted").arg(bs.iFiles).arg(bs.iBytes / 1024).arg(bs.uiEvictions));
+		qlBlobCacheStats->setToolTip(tr("%1 memory hits, %2 disk hits, %3 misses").arg(bs.uiMemoryHits).arg(bs.uiFileHits).arg(bs.uiMisses));
+	}
+
 	loadCheckBox(qcbAutoUpdate, r.bUpdateCheck);
 	loadCheckBox(qcbPluginUpdate, r.bPluginCheck);
 	loadCheckBox(qcbUsage, r.bUsage);
@@ -112,6 +121,8 @@ void NetworkConfig::save() const {
 		s.iMaxImageSize = s.ciDefaultMaxImageSize;
 	}
 
+	s.iBlobCacheSize = qsbBlobCache->value();
+
 	s.bUpdateCheck=qcbAutoUpdate->isChecked();
 	s.bPluginCheck=qcbPluginUpdate->isChecked();
 	s.bUsage=qcbUsage->isChecked();
@@ -161,6 +172,8 @@ bool NetworkConfig::TcpModeEnabled() {
 
 void NetworkConfig::accept() const {
 	NetworkConfig::SetupProxy();
+	if (Database::blobCache())
+		Database::blobCache()->setLimit(static_cast<qint64>(g.s.iBlobCacheSize) * 1024 * 1024);
 }
 
 bool NetworkConfig::expert(bool b) {
@@ -171,6 +184,9 @@ bool NetworkConfig::expert(bool b) {
 
 	qgbMisc->setVisible(b); // For now Misc only contains elements visible in expert mode
 	qcbImageDownload->setVisible(b);
+	qlBlobCache->setVisible(b);
+	qsbBlobCache->setVisible(b);
+	qlBlobCacheStats->setVisible(b);
 	qcbSuppressIdentity->setVisible(b);
 
 	return true;
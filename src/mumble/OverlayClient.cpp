@@ -58,6 +58,7 @@ OverlayClient::OverlayClient(QLocalSocket *socket, QObject *p)
 
 	omMsg.omh.iLength = -1;
 	smMem = NULL;
+	uiBack = uiLatest = uiFrame = 0;
 	uiWidth = uiHeight = 0;
 
 	uiPid = ~0ULL;
@@ -418,15 +419,23 @@ void OverlayClient::readyReadMsgInit(unsigned int length) {
 	uiHeight = omi->uiHeight;
 	qrLast = QRect();
 
+	for (int i=0;i<OVERLAY_SHMEM_BUFFERS;++i)
+		qiBuffers[i] = QImage();
 	delete smMem;
 
-	smMem = new SharedMemory2(this, uiWidth * uiHeight * 4);
+	smMem = new SharedMemory2(this, OVERLAY_SHMEM_SIZE(uiWidth, uiHeight));
 	if (! smMem->data()) {
 		qWarning() << "OverlayClient: Failed to create shared memory" << uiWidth << uiHeight;
 		delete smMem;
 		smMem = NULL;
 		return;
 	}
+	for (int i=0;i<OVERLAY_SHMEM_BUFFERS;++i)
+		qiBuffers[i] = QImage(OVERLAY_SHMEM_BUFFER(smMem->data(), i, uiWidth, uiHeight), uiWidth, uiHeight, QImage::Format_ARGB32_Premultiplied);
+
+	// The buffers have to be set up before the overlay gets to map them.
+	setupRender();
+
 	QByteArray key = smMem->name().toUtf8();
 	key.append(static_cast<char>(0));
 
@@ -438,8 +447,6 @@ void OverlayClient::readyReadMsgInit(unsigned int length) {
 	memcpy(om.oms.a_cName, key.constData(), key.length());
 	qlsSocket->write(om.headerbuffer, sizeof(OverlayMsgHeader) + om.omh.iLength);
 
-	setupRender();
-
 	Overlay *o = static_cast<Overlay *>(parent());
 	QTimer::singleShot(0, o, SLOT(updateOverlay()));
 }
@@ -589,15 +596,19 @@ void OverlayClient::setupRender() {
 
 	smMem->erase();
 
-	OverlayMsg om;
-	om.omh.uiMagic = OVERLAY_MAGIC_NUMBER;
-	om.omh.uiType = OVERLAY_MSGTYPE_BLIT;
-	om.omh.iLength = sizeof(OverlayMsgBlit);
-	om.omb.x = 0;
-	om.omb.y = 0;
-	om.omb.w = uiWidth;
-	om.omb.h = uiHeight;
-	qlsSocket->write(om.headerbuffer, sizeof(OverlayMsgHeader) + sizeof(OverlayMsgBlit));
+	OverlayShmemHeader *osh = reinterpret_cast<OverlayShmemHeader *>(smMem->data());
+	osh->uiMagic = OVERLAY_MAGIC_NUMBER;
+	osh->uiWidth = uiWidth;
+	osh->uiHeight = uiHeight;
+	osh->uiLatest = 1;
+	uiLatest = 1;
+	uiBack = 2;
+	uiFrame = 0;
+	for (int i=0;i<OVERLAY_SHMEM_BUFFERS;++i)
+		qrStale[i] = QRegion();
+
+	// Hand over the empty frame, so the overlay starts from a known state.
+	publish(QList<QRect>() << QRect(0, 0, uiWidth, uiHeight));
 
 	reset();
 }
@@ -610,12 +621,12 @@ bool OverlayClient::update() {
 	updateFPS();
 	updateTime();
 
-	if (qlsSocket->bytesToWrite() > 1024) {
+	// The frames no longer go through the socket, so a client that stopped
+	// reading shows as a frame it never picked up.
+	const OverlayShmemHeader *osh = reinterpret_cast<const OverlayShmemHeader *>(smMem->data());
+	if (osh->uiLatest & OVERLAY_SHMEM_DIRTY)
 		return (t.elapsed() <= 5000000ULL);
-	} else {
-		t.restart();
-		return true;
-	}
+	return true;
 }
 
 void OverlayClient::changed(const QList<QRectF> &region) {
@@ -626,6 +637,81 @@ void OverlayClient::changed(const QList<QRectF> &region) {
 	QMetaObject::invokeMethod(this, "render", Qt::QueuedConnection);
 }
 
+// Past this many separate rectangles, a single bounding rectangle is
+// cheaper to paint and upload than the bookkeeping is worth.
+#define MAX_DAMAGE_RECTS OVERLAY_SHMEM_MAX_RECTS
+
+// Clips the changed areas to the screen and merges the ones that overlap,
+// so that no pixel is painted or uploaded twice.
+static QList<QRect> damageRects(const QList<QRectF> &region, const QRect &screen) {
+	QList<QRect> rects;
+	QRect bounds;
+
+	foreach(const QRectF &rf, region) {
+		QRect r = rf.toAlignedRect().intersected(screen);
+		if (r.isEmpty())
+			continue;
+
+		int i = 0;
+		while (i < rects.count()) {
+			if (rects.at(i).intersects(r)) {
+				r |= rects.takeAt(i);
+				i = 0;
+			} else {
+				++i;
+			}
+		}
+		rects.append(r);
+		bounds |= r;
+	}
+
+	if (rects.count() > MAX_DAMAGE_RECTS) {
+		rects.clear();
+		rects.append(bounds);
+	}
+	return rects;
+}
+
+/**
+ * Hands the back buffer to the overlay as the next frame, and takes back
+ * whichever buffer the overlay isn't using.
+ *
+ * @param rects What changed since the previous frame.
+ */
+void OverlayClient::publish(const QList<QRect> &rects) {
+	OverlayShmemHeader *osh = reinterpret_cast<OverlayShmemHeader *>(smMem->data());
+	OverlayShmemFrame *osf = & osh->osf[uiBack];
+
+	osf->uiFrame = ++uiFrame;
+	osf->uiRects = 0;
+	QRegion damage;
+	foreach(const QRect &r, rects) {
+		OverlayShmemRect *osr = & osf->osr[osf->uiRects++];
+		osr->x = r.x();
+		osr->y = r.y();
+		osr->w = r.width();
+		osr->h = r.height();
+		damage |= r;
+	}
+
+	for (unsigned int i=0;i<OVERLAY_SHMEM_BUFFERS;++i) {
+		if (i == uiBack)
+			continue;
+		qrStale[i] |= damage;
+		if (qrStale[i].rectCount() > MAX_DAMAGE_RECTS)
+			qrStale[i] = qrStale[i].boundingRect();
+	}
+	qrStale[uiBack] = QRegion();
+
+	uiLatest = uiBack;
+	const unsigned int previous = overlayExchange(&osh->uiLatest, uiBack | OVERLAY_SHMEM_DIRTY);
+	uiBack = previous & OVERLAY_SHMEM_INDEX;
+
+	// Only time frames that replace one the client already took.
+	if (! (previous & OVERLAY_SHMEM_DIRTY))
+		t.restart();
+}
+
 void OverlayClient::render() {
 	const QList<QRectF> region = qlDirty;
 	qlDirty.clear();
@@ -634,53 +720,38 @@ void OverlayClient::render() {
 		return;
 
 	QRect active;
-	QRectF dirtyf;
 
 	if (region.isEmpty())
 		return;
 
-	foreach(const QRectF &r, region) {
-		dirtyf |= r;
-	}
-
-
-	QRect dirty = dirtyf.toAlignedRect();
-	dirty = dirty.intersected(QRect(0,0,uiWidth, uiHeight));
-
-	if ((dirty.width() <= 0) || (dirty.height() <= 0))
+	const QList<QRect> rects = damageRects(region, QRect(0, 0, uiWidth, uiHeight));
+	if (rects.isEmpty())
 		return;
 
-	QRect target = dirty;
-	target.moveTo(0,0);
-
-	QImage img(reinterpret_cast<unsigned char *>(smMem->data()), uiWidth, uiHeight, QImage::Format_ARGB32_Premultiplied);
-	QImage qi(target.size(), QImage::Format_ARGB32_Premultiplied);
-	qi.fill(0);
-
-	QPainter p;
-	p.begin(&qi);
-	p.setRenderHints(p.renderHints(), false);
-	p.setCompositionMode(QPainter::CompositionMode_SourceOver);
-	qgs.render(&p, target, dirty, Qt::IgnoreAspectRatio);
-	p.end();
+	// The back buffer last held an older frame. Bring it up to date from
+	// the latest one, except where it is about to be repainted anyway.
+	QImage &img = qiBuffers[uiBack];
+	const QImage &latest = qiBuffers[uiLatest];
+	QRegion damage;
+	foreach(const QRect &r, rects)
+		damage |= r;
+	foreach(const QRect &r, (qrStale[uiBack] - damage).rects()) {
+		for (int y = r.top(); y <= r.bottom(); ++y)
+			memcpy(img.scanLine(y) + r.x() * 4, latest.constScanLine(y) + r.x() * 4, r.width() * 4);
+	}
 
-	p.begin(&img);
+	QPainter p(&img);
 	p.setRenderHints(p.renderHints(), false);
-	p.setCompositionMode(QPainter::CompositionMode_Source);
-	p.drawImage(dirty.x(), dirty.y(), qi);
+	foreach(const QRect &r, rects) {
+		p.setClipRect(r);
+		p.setCompositionMode(QPainter::CompositionMode_Source);
+		p.fillRect(r, Qt::transparent);
+		p.setCompositionMode(QPainter::CompositionMode_SourceOver);
+		qgs.render(&p, r, r, Qt::IgnoreAspectRatio);
+	}
 	p.end();
 
-	if (dirty.isValid()) {
-		OverlayMsg om;
-		om.omh.uiMagic = OVERLAY_MAGIC_NUMBER;
-		om.omh.uiType = OVERLAY_MSGTYPE_BLIT;
-		om.omh.iLength = sizeof(OverlayMsgBlit);
-		om.omb.x = dirty.x();
-		om.omb.y = dirty.y();
-		om.omb.w = dirty.width();
-		om.omb.h = dirty.height();
-		qlsSocket->write(om.headerbuffer, sizeof(OverlayMsgHeader) + sizeof(OverlayMsgBlit));
-	}
+	publish(rects);
 
 	if (qgpiCursor->isVisible()) {
 		active = QRect(0,0,uiWidth,uiHeight);
@@ -54,7 +54,16 @@ class OverlayClient : public QObject {
 		OverlayMsg omMsg;
 		QLocalSocket *qlsSocket;
 		SharedMemory2 *smMem;
+		/// The frame buffers in smMem, so the scene can be painted straight into them.
+		QImage qiBuffers[OVERLAY_SHMEM_BUFFERS];
+		/// For each buffer, what changed in the frames published since it was last painted.
+		QRegion qrStale[OVERLAY_SHMEM_BUFFERS];
+		/// The buffer being painted, and the one published last.
+		unsigned int uiBack, uiLatest;
+		/// Sequence number of the last published frame.
+		unsigned int uiFrame;
 		QRect qrLast;
+		/// Time since the oldest frame the client hasn't picked up yet was published.
 		Timer t;
 
 		float framesPerSecond;
@@ -80,6 +89,7 @@ class OverlayClient : public QObject {
 		bool bDelete;
 
 		void setupRender();
+		void publish(const QList<QRect> &rects);
 		void setupScene(bool show);
 
 		bool eventFilter(QObject *, QEvent *) Q_DECL_OVERRIDE;
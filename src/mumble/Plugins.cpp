@@ -46,6 +46,14 @@
 extern HWND MumbleHWNDForQWidget(QWidget *w);
 #endif
 
+// How often a running process list is compared to the last one.
+#define SCAN_INTERVAL 1000
+// How often unlinked plugins are retried when no processes came or went,
+// for plugins that link through shared memory rather than a process.
+#define PROBE_INTERVAL Q_UINT64_C(5000000)
+// How often the poller looks for a newly linked plugin.
+#define IDLE_POLL_INTERVAL 500
+
 static ConfigWidget *PluginConfigDialogNew(Settings &st) {
 	return new PluginConfig(st);
 }
@@ -216,15 +224,183 @@ void PluginConfig::on_qtwPlugins_currentItemChanged(QTreeWidgetItem *current, QT
 	}
 }
 
+#ifdef Q_OS_LINUX
+// Name a process the way Process32Next() would, i.e. the file name of the
+// executable without its path. Wine keeps the Windows path in argv[0], so
+// both separators are accepted. Kernel threads have no command line and
+// fall back to their comm name.
+static std::wstring processName(const QString &pid) {
+	QFile qf(QString::fromLatin1("/proc/%1/cmdline").arg(pid));
+	QByteArray qba;
+	if (qf.open(QIODevice::ReadOnly))
+		qba = qf.read(4096);
+	qf.close();
+
+	int end = qba.indexOf('\0');
+	if (end >= 0)
+		qba.truncate(end);
+	int sep = qMax(qba.lastIndexOf('/'), qba.lastIndexOf('\\'));
+	if (sep >= 0)
+		qba = qba.mid(sep + 1);
+
+	if (qba.isEmpty()) {
+		qf.setFileName(QString::fromLatin1("/proc/%1/comm").arg(pid));
+		if (qf.open(QIODevice::ReadOnly))
+			qba = qf.readAll().trimmed();
+	}
+
+	return QString::fromLocal8Bit(qba).toStdWString();
+}
+#endif
+
+ProcessScanner::ProcessScanner(QObject *p) : QThread(p) {
+	iGeneration = 0;
+	bRunning = true;
+#ifdef Q_OS_LINUX
+	uiScans = 0;
+#endif
+}
+
+ProcessScanner::~ProcessScanner() {
+	stop();
+	wait();
+}
+
+void ProcessScanner::stop() {
+	QMutexLocker lock(&qmSleep);
+	bRunning = false;
+	qwcSleep.wakeAll();
+}
+
+int ProcessScanner::generation() const {
+	QMutexLocker lock(&qmProcesses);
+	return iGeneration;
+}
+
+ProcessMap ProcessScanner::processes(int *generation) const {
+	QMutexLocker lock(&qmProcesses);
+	if (generation)
+		*generation = iGeneration;
+	return pmProcesses;
+}
+
+/**
+ * Fills pids with the running processes. Returns false if there is no way
+ * to list processes on this platform.
+ */
+bool ProcessScanner::scan(ProcessMap &pids) {
+#if defined(Q_OS_WIN)
+	PROCESSENTRY32 pe;
+
+	pe.dwSize = sizeof(pe);
+	HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	if (hSnap != INVALID_HANDLE_VALUE) {
+		BOOL ok = Process32First(hSnap, &pe);
+
+		while (ok) {
+			pids.insert(std::pair<std::wstring, unsigned long long int>(std::wstring(pe.szExeFile), pe.th32ProcessID));
+			ok = Process32Next(hSnap, &pe);
+		}
+		CloseHandle(hSnap);
+	}
+	return true;
+#elif defined(Q_OS_LINUX)
+	// Only processes we haven't seen before get their command line read.
+	// A process can exec() without changing its pid, so every name is
+	// read again now and then.
+	bool refresh = ((++uiScans % 10) == 0);
+
+	QHash<unsigned long long int, std::wstring> names;
+	QDir qd(QLatin1String("/proc"), QString(), QDir::Unsorted, QDir::Dirs | QDir::NoDotAndDotDot);
+	foreach(const QString &entry, qd.entryList()) {
+		bool ok;
+		unsigned long long int pid = entry.toULongLong(&ok);
+		if (! ok)
+			continue;
+
+		QHash<unsigned long long int, std::wstring>::const_iterator i = qhNames.constFind(pid);
+		std::wstring name = (refresh || i == qhNames.constEnd()) ? processName(entry) : i.value();
+		if (name.empty())
+			continue;
+
+		names.insert(pid, name);
+		pids.insert(std::pair<std::wstring, unsigned long long int>(name, pid));
+	}
+	qhNames = names;
+	return true;
+#else
+	Q_UNUSED(pids);
+	return false;
+#endif
+}
+
+void ProcessScanner::run() {
+	forever {
+		ProcessMap pids;
+		if (! scan(pids))
+			return;
+
+		{
+			QMutexLocker lock(&qmProcesses);
+			if (pids != pmProcesses) {
+				pmProcesses.swap(pids);
+				++iGeneration;
+			}
+		}
+
+		QMutexLocker lock(&qmSleep);
+		if (bRunning)
+			qwcSleep.wait(&qmSleep, SCAN_INTERVAL);
+		if (! bRunning)
+			return;
+	}
+}
+
+PluginPoller::PluginPoller(Plugins *plugins) : QThread() {
+	p = plugins;
+	bRunning = true;
+}
+
+PluginPoller::~PluginPoller() {
+	stop();
+	wait();
+}
+
+void PluginPoller::stop() {
+	QMutexLocker lock(&qmSleep);
+	bRunning = false;
+	qwcSleep.wakeAll();
+}
+
+void PluginPoller::wake() {
+	QMutexLocker lock(&qmSleep);
+	qwcSleep.wakeAll();
+}
+
+void PluginPoller::run() {
+	forever {
+		bool linked = p->fetch();
+
+		QMutexLocker lock(&qmSleep);
+		if (bRunning)
+			qwcSleep.wait(&qmSleep, linked ? 1000 / qBound(1, g.s.iPositionalPollRate, 1000) : IDLE_POLL_INTERVAL);
+		if (! bRunning)
+			return;
+	}
+}
+
 Plugins::Plugins(QObject *p) : QObject(p) {
 	QTimer *timer=new QTimer(this);
 	timer->setObjectName(QLatin1String("Timer"));
 	timer->start(500);
 	locked = prevlocked = NULL;
 	bValid = false;
-	iPluginTry = 0;
+	iProbedGeneration = -1;
 	for (int i=0;i<3;i++)
-		fPosition[i]=fFront[i]=fTop[i]= 0.0;
+		fPosition[i]=fFront[i]=fTop[i]=fCameraPosition[i]=fCameraFront[i]=fCameraTop[i] = 0.0f;
+	memset(&psPrevious, 0, sizeof(psPrevious));
+	memset(&psCurrent, 0, sizeof(psCurrent));
+	bSampleValid = false;
 	QMetaObject::connectSlotsByName(this);
 
 #ifdef QT_NO_DEBUG
@@ -267,9 +443,17 @@ Plugins::Plugins(QObject *p) : QObject(p) {
 
 	AdjustTokenPrivileges(hToken, FALSE, &tp, sizeof(TOKEN_PRIVILEGES), &tpPrevious, &cbPrevious);
 #endif
+
+	psScanner = new ProcessScanner();
+	psScanner->start(QThread::LowestPriority);
+
+	ppPoller = new PluginPoller(this);
+	ppPoller->start();
 }
 
 Plugins::~Plugins() {
+	delete ppPoller;
+	delete psScanner;
 	clearPlugins();
 
 #ifdef Q_OS_WIN
@@ -295,6 +479,7 @@ void Plugins::rescanPlugins() {
 	QWriteLocker lock(&g.p->qrwlPlugins);
 	prevlocked = locked = NULL;
 	bValid = false;
+	iProbedGeneration = -1;
 
 	QDir qd(qsSystemPlugins, QString(), QDir::Name, QDir::Files | QDir::Readable);
 #ifdef QT_NO_DEBUG
@@ -349,7 +534,95 @@ void Plugins::rescanPlugins() {
 	}
 }
 
+/**
+ * Asks the linked plugin for new positions and hands them to the audio
+ * threads. Called on the poller thread only.
+ */
 bool Plugins::fetch() {
+	bool ok = poll();
+	publish(ok);
+	return ok;
+}
+
+void Plugins::publish(bool valid) {
+	PositionSample ps;
+	memcpy(ps.fPosition, fPosition, sizeof(fPosition));
+	memcpy(ps.fFront, fFront, sizeof(fFront));
+	memcpy(ps.fTop, fTop, sizeof(fTop));
+	memcpy(ps.fCameraPosition, fCameraPosition, sizeof(fCameraPosition));
+	memcpy(ps.fCameraFront, fCameraFront, sizeof(fCameraFront));
+	memcpy(ps.fCameraTop, fCameraTop, sizeof(fCameraTop));
+	ps.uiTime = tSamples.elapsed();
+	ps.bValid = valid;
+
+	// An odd sequence number tells readers a write is in progress.
+	qaiSampleSeq.fetchAndAddOrdered(1);
+	psPrevious = bSampleValid ? psCurrent : ps;
+	psCurrent = ps;
+	bSampleValid = valid;
+	qaiSampleSeq.fetchAndAddRelease(1);
+}
+
+static inline void lerp3(float *out, const float *a, const float *b, float t) {
+	for (int i=0;i<3;++i)
+		out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+/**
+ * Copies the latest positions into ps without blocking, so it is safe to
+ * call from the audio callbacks. With interpolate set, the positions trail
+ * the plugin by one poll interval and move smoothly between samples.
+ *
+ * If the poller is in the middle of publishing a sample, ps is left as it
+ * is, so callers should pass the sample they got last time.
+ *
+ * @return Whether a plugin is linked and ps holds valid positions.
+ */
+bool Plugins::sample(PositionSample &ps, bool interpolate) const {
+	PositionSample prev, cur;
+	bool valid = false;
+	bool read = false;
+
+	// The poller may be preempted halfway through publish(), so don't
+	// wait for it.
+	for (int i=0;i<4;++i) {
+		int seq = qaiSampleSeq.fetchAndAddAcquire(0);
+		if (seq & 1)
+			continue;
+		prev = psPrevious;
+		cur = psCurrent;
+		valid = bSampleValid;
+		if (qaiSampleSeq.fetchAndAddOrdered(0) == seq) {
+			read = true;
+			break;
+		}
+	}
+
+	if (! read)
+		return ps.bValid;
+
+	ps = cur;
+	ps.bValid = valid;
+	if (! valid)
+		return false;
+
+	if (interpolate && (ps.uiTime > prev.uiTime)) {
+		const quint64 interval = ps.uiTime - prev.uiTime;
+		const quint64 now = tSamples.elapsed();
+		const quint64 target = (now > interval) ? now - interval : 0;
+		const float t = (target <= prev.uiTime) ? 0.0f : qMin(1.0f, static_cast<float>(target - prev.uiTime) / static_cast<float>(interval));
+
+		lerp3(ps.fPosition, prev.fPosition, ps.fPosition, t);
+		lerp3(ps.fFront, prev.fFront, ps.fFront, t);
+		lerp3(ps.fTop, prev.fTop, ps.fTop, t);
+		lerp3(ps.fCameraPosition, prev.fCameraPosition, ps.fCameraPosition, t);
+		lerp3(ps.fCameraFront, prev.fCameraFront, ps.fCameraFront, t);
+		lerp3(ps.fCameraTop, prev.fCameraTop, ps.fCameraTop, t);
+	}
+	return true;
+}
+
+bool Plugins::poll() {
 	if (g.bPosTest) {
 		fPosition[0] = fPosition[1] = fPosition[2] = 0.0f;
 		fFront[0] = 0.0f;
@@ -406,8 +679,6 @@ bool Plugins::fetch() {
 }
 
 void Plugins::on_Timer_timeout() {
-	fetch();
-
 	QReadLocker lock(&qrwlPlugins);
 
 	if (prevlocked) {
@@ -454,41 +725,28 @@ void Plugins::on_Timer_timeout() {
 	if (! g.s.bTransmitPosition)
 		return;
 
-	lock.unlock();
-	QWriteLocker wlock(&qrwlPlugins);
-
-	if (qlPlugins.isEmpty())
+	// Plugins are only retried when processes came or went, or after a
+	// while for those that don't look at the process list at all.
+	if ((psScanner->generation() == iProbedGeneration) && (tProbe.elapsed() < PROBE_INTERVAL))
 		return;
 
-	++iPluginTry;
-	if (iPluginTry >= qlPlugins.count())
-		iPluginTry = 0;
-
-	std::multimap<std::wstring, unsigned long long int> pids;
-#ifdef Q_OS_WIN
-	PROCESSENTRY32 pe;
-
-	pe.dwSize = sizeof(pe);
-	HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-	if (hSnap != INVALID_HANDLE_VALUE) {
-		BOOL ok = Process32First(hSnap, &pe);
+	lock.unlock();
+	QWriteLocker wlock(&qrwlPlugins);
 
-		while (ok) {
-			pids.insert(std::pair<std::wstring, unsigned long long int>(std::wstring(pe.szExeFile), pe.th32ProcessID));
-			ok = Process32Next(hSnap, &pe);
-		}
-		CloseHandle(hSnap);
-	}
-#endif
+	const ProcessMap pids = psScanner->processes(&iProbedGeneration);
+	tProbe.restart();
 
-	PluginInfo *pi = qlPlugins.at(iPluginTry);
-	if (pi->enabled) {
+	foreach(PluginInfo *pi, qlPlugins) {
+		if (! pi->enabled)
+			continue;
 		if (pi->p2 ? pi->p2->trylock(pids) : pi->p->trylock()) {
 			pi->shortname = QString::fromStdWString(pi->p->shortname);
 			g.l->log(Log::Information, tr("%1 linked.").arg(Qt::escape(pi->shortname)));
 			pi->locked = true;
 			bUnlink = false;
 			locked = pi;
+			ppPoller->wake();
+			break;
 		}
 	}
 }
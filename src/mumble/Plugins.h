@@ -31,15 +31,21 @@
 #ifndef MUMBLE_MUMBLE_PLUGINS_H_
 #define MUMBLE_MUMBLE_PLUGINS_H_
 
+#include <QtCore/QHash>
 #include <QtCore/QObject>
 #include <QtCore/QMutex>
 #include <QtCore/QReadWriteLock>
+#include <QtCore/QThread>
 #include <QtCore/QUrl>
+#include <QtCore/QWaitCondition>
+#include <map>
+#include <string>
 #ifdef Q_OS_WIN
 #include <windows.h>
 #endif
 
 #include "ConfigDialog.h"
+#include "Timer.h"
 
 #include "ui_Plugins.h"
 
@@ -68,6 +74,69 @@ class PluginConfig : public ConfigWidget, public Ui::PluginConfig {
 
 struct PluginFetchMeta;
 
+typedef std::multimap<std::wstring, unsigned long long int> ProcessMap;
+
+/// Keeps a list of running processes up to date on a background thread, so
+/// that probing plugins doesn't have to walk the process table itself.
+class ProcessScanner : public QThread {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(ProcessScanner)
+	protected:
+		mutable QMutex qmProcesses;
+		ProcessMap pmProcesses;
+		int iGeneration;
+
+		QMutex qmSleep;
+		QWaitCondition qwcSleep;
+		bool bRunning;
+
+		bool scan(ProcessMap &pids);
+#ifdef Q_OS_LINUX
+		QHash<unsigned long long int, std::wstring> qhNames;
+		unsigned int uiScans;
+#endif
+	public:
+		ProcessScanner(QObject *p = NULL);
+		~ProcessScanner() Q_DECL_OVERRIDE;
+		void run() Q_DECL_OVERRIDE;
+		void stop();
+
+		int generation() const;
+		ProcessMap processes(int *generation = NULL) const;
+};
+
+class Plugins;
+
+/// Calls Plugins::fetch() at the configured rate, so that a slow plugin
+/// never holds up the audio threads.
+class PluginPoller : public QThread {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(PluginPoller)
+	protected:
+		Plugins *p;
+		QMutex qmSleep;
+		QWaitCondition qwcSleep;
+		bool bRunning;
+	public:
+		PluginPoller(Plugins *plugins);
+		~PluginPoller() Q_DECL_OVERRIDE;
+		void run() Q_DECL_OVERRIDE;
+		void stop();
+		void wake();
+};
+
+/// Positions reported by the linked plugin, in the plugin's coordinates.
+struct PositionSample {
+	float fPosition[3], fFront[3], fTop[3];
+	float fCameraPosition[3], fCameraFront[3], fCameraTop[3];
+	/// When the sample was fetched, in microseconds of Plugins::tSamples.
+	quint64 uiTime;
+	/// Whether a plugin was linked and the positions are meaningful.
+	bool bValid;
+};
+
 class Plugins : public QObject {
 		friend class PluginConfig;
 	private:
@@ -80,7 +149,23 @@ class Plugins : public QObject {
 		PluginInfo *locked;
 		PluginInfo *prevlocked;
 		void clearPlugins();
-		int iPluginTry;
+		ProcessScanner *psScanner;
+		int iProbedGeneration;
+		Timer tProbe;
+
+		PluginPoller *ppPoller;
+		bool bValid;
+		float fPosition[3], fFront[3], fTop[3];
+		float fCameraPosition[3], fCameraFront[3], fCameraTop[3];
+		bool poll();
+
+		// The last two samples, handed to the audio threads through a
+		// sequence lock. Only the poller thread writes them.
+		Timer tSamples;
+		mutable QAtomicInt qaiSampleSeq;
+		PositionSample psPrevious, psCurrent;
+		bool bSampleValid;
+		void publish(bool valid);
 		QMap<QString, PluginFetchMeta> qmPluginFetchMeta;
 		QString qsSystemPlugins;
 		QString qsUserPlugins;
@@ -92,13 +177,11 @@ class Plugins : public QObject {
 	public:
 		std::string ssContext, ssContextSent;
 		std::wstring swsIdentity, swsIdentitySent;
-		bool bValid;
 		bool bUnlink;
-		float fPosition[3], fFront[3], fTop[3];
-		float fCameraPosition[3], fCameraFront[3], fCameraTop[3];
 
 		Plugins(QObject *p = NULL);
 		~Plugins() Q_DECL_OVERRIDE;
+		bool sample(PositionSample &ps, bool interpolate = false) const;
 	public slots:
 		void on_Timer_timeout();
 		void rescanPlugins();
@@ -0,0 +1,377 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Also built into the resampler benchmark in src/tests, so like the audio
+// kernels this doesn't use the precompiled header.
+#define _USE_MATH_DEFINES
+
+#include <QtCore/QtGlobal>
+
+#include <math.h>
+#include <string.h>
+
+#include <speex/speex_resampler.h>
+
+#include "Resampler.h"
+
+#include "AudioKernels.h"
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE
+#include <xmmintrin.h>
+#endif
+
+/// Passthrough used when no conversion is needed.
+class CopyResampler : public Resampler {
+	public:
+		CopyResampler(unsigned int channels) : Resampler(channels) {
+		}
+
+		void process(const float *in, unsigned int &inlen, float *out, unsigned int &outlen) Q_DECL_OVERRIDE {
+			const unsigned int n = qMin(inlen, outlen);
+			memcpy(out, in, n * uiChannels * sizeof(float));
+			inlen = outlen = n;
+		}
+
+		unsigned int inputLatency() const Q_DECL_OVERRIDE {
+			return 0;
+		}
+
+		const char *name() const Q_DECL_OVERRIDE {
+			return "copy";
+		}
+};
+
+/// Windowed sinc polyphase filter for a fixed ratio L/M.
+///
+/// For every one of the L phases a filter of iTaps coefficients is
+/// precalculated, so each output sample is a single dot product over
+/// the input history.
+class PolyphaseResampler : public Resampler {
+	private:
+		Q_DISABLE_COPY(PolyphaseResampler)
+	protected:
+		unsigned int uiUp, uiDown;
+		unsigned int uiTaps;
+		/// uiUp filters of uiTaps coefficients each.
+		float *pfFilter;
+
+		/// Per-channel input history; uiFilled frames are valid.
+		float **ppfHistory;
+		unsigned int uiHistorySize;
+		unsigned int uiFilled;
+
+		/// First input frame of the next output's window, and its phase.
+		unsigned int uiPos;
+		unsigned int uiPhase;
+
+		/// Whole and fractional input frames to advance per output frame.
+		unsigned int uiStep;
+		unsigned int uiStepFrac;
+
+		static float dot(const float *a, const float *b, unsigned int n);
+		static double besselI0(double x);
+	public:
+		PolyphaseResampler(unsigned int channels, unsigned int up, unsigned int down, unsigned int maxframes, Quality quality);
+		~PolyphaseResampler() Q_DECL_OVERRIDE;
+
+		void process(const float *in, unsigned int &inlen, float *out, unsigned int &outlen) Q_DECL_OVERRIDE;
+		unsigned int inputLatency() const Q_DECL_OVERRIDE;
+		const char *name() const Q_DECL_OVERRIDE;
+};
+
+/// Wrapper around the Speex resampler, which supports arbitrary and
+/// adjustable ratios.
+class SpeexResampler : public Resampler {
+	private:
+		Q_DISABLE_COPY(SpeexResampler)
+	protected:
+		SpeexResamplerState *srs;
+	public:
+		SpeexResampler(unsigned int channels, unsigned int inrate, unsigned int outrate, Quality quality);
+		~SpeexResampler() Q_DECL_OVERRIDE;
+
+		void process(const float *in, unsigned int &inlen, float *out, unsigned int &outlen) Q_DECL_OVERRIDE;
+		bool setRate(unsigned int inrate, unsigned int outrate) Q_DECL_OVERRIDE;
+		unsigned int inputLatency() const Q_DECL_OVERRIDE;
+		const char *name() const Q_DECL_OVERRIDE;
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b) {
+	while (b) {
+		const unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+Resampler *Resampler::create(unsigned int channels, unsigned int inrate, unsigned int outrate, unsigned int maxframes, Quality quality, bool variable) {
+	if (variable)
+		return new SpeexResampler(channels, inrate, outrate, quality);
+
+	if (inrate == outrate)
+		return new CopyResampler(channels);
+
+	const unsigned int g = gcd(inrate, outrate);
+	const unsigned int up = outrate / g;
+	const unsigned int down = inrate / g;
+
+	// Every phase has its own filter, so odd ratios such as 44100:22050.5
+	// would need huge tables. Those are left to Speex.
+	if (up <= 512)
+		return new PolyphaseResampler(channels, up, down, maxframes, quality);
+
+	return new SpeexResampler(channels, inrate, outrate, quality);
+}
+
+Resampler::Resampler(unsigned int channels) : uiChannels(channels) {
+}
+
+Resampler::~Resampler() {
+}
+
+bool Resampler::setRate(unsigned int, unsigned int) {
+	return false;
+}
+
+unsigned int Resampler::channels() const {
+	return uiChannels;
+}
+
+PolyphaseResampler::PolyphaseResampler(unsigned int channels, unsigned int up, unsigned int down, unsigned int maxframes, Quality quality) : Resampler(channels), uiUp(up), uiDown(down) {
+	float rolloff;
+	double beta;
+
+	switch (quality) {
+		case LowLatency:
+			uiTaps = 16;
+			rolloff = 0.85f;
+			beta = 6.0;
+			break;
+		case HighQuality:
+			uiTaps = 96;
+			rolloff = 0.95f;
+			beta = 10.0;
+			break;
+		case Balanced:
+		default:
+			uiTaps = 40;
+			rolloff = 0.91f;
+			beta = 8.0;
+			break;
+	}
+
+	// When decimating, the lowpass has to be below the output Nyquist
+	// rate, so stretch the filter to keep the same transition band.
+	double cutoff = rolloff;
+	if (down > up) {
+		cutoff = rolloff * static_cast<double>(up) / static_cast<double>(down);
+		uiTaps = qMin(static_cast<unsigned int>(ceil(uiTaps * static_cast<double>(down) / static_cast<double>(up))), 512U);
+		uiTaps = (uiTaps + 3) & ~3U;
+	}
+
+	pfFilter = new float[uiUp * uiTaps];
+
+	const double half = static_cast<double>(uiTaps) / 2.0;
+	const double i0beta = besselI0(beta);
+	for (unsigned int p = 0; p < uiUp; ++p) {
+		float *h = pfFilter + p * uiTaps;
+		const double frac = static_cast<double>(p) / static_cast<double>(uiUp);
+		double sum = 0.0;
+		for (unsigned int k = 0; k < uiTaps; ++k) {
+			// Distance from the output instant to input frame k of the window
+			const double t = static_cast<double>(k) - (half - 1.0) - frac;
+			const double x = M_PI * cutoff * t;
+			const double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(x) / x;
+			const double r = t / half;
+			const double w = (fabs(r) >= 1.0) ? 0.0 : besselI0(beta * sqrt(1.0 - r * r)) / i0beta;
+			h[k] = static_cast<float>(sinc * w);
+			sum += sinc * w;
+		}
+		for (unsigned int k = 0; k < uiTaps; ++k)
+			h[k] = static_cast<float>(h[k] / sum);
+	}
+
+	uiStep = uiDown / uiUp;
+	uiStepFrac = uiDown % uiUp;
+
+	// Between calls at most a window and one step of history is kept, so
+	// this fits any chunk of up to maxframes.
+	uiHistorySize = uiTaps + uiStep + 1 + qMax(maxframes, 1U);
+	ppfHistory = new float *[uiChannels];
+	for (unsigned int c = 0; c < uiChannels; ++c)
+		ppfHistory[c] = new float[uiHistorySize];
+
+	// Start with a full window of silence, so the number of output frames
+	// always matches the ratio exactly and callers asking for a fixed frame
+	// size get it from the very first call.
+	uiFilled = uiTaps;
+	for (unsigned int c = 0; c < uiChannels; ++c)
+		memset(ppfHistory[c], 0, uiTaps * sizeof(float));
+
+	uiPos = 0;
+	uiPhase = 0;
+}
+
+PolyphaseResampler::~PolyphaseResampler() {
+	for (unsigned int c = 0; c < uiChannels; ++c)
+		delete [] ppfHistory[c];
+	delete [] ppfHistory;
+	delete [] pfFilter;
+}
+
+double PolyphaseResampler::besselI0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 50; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+float PolyphaseResampler::dot(const float *a, const float *b, unsigned int n) {
+	unsigned int i = 0;
+	float sum = 0.0f;
+
+#ifdef MUMBLE_AUDIOKERNELS_SSE
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	for (; i + 4 <= n; i += 4)
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	float tmp[4];
+	_mm_storeu_ps(tmp, _mm_add_ps(acc0, acc1));
+	sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+#endif
+
+	for (; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+void PolyphaseResampler::process(const float *in, unsigned int &inlen, float *out, unsigned int &outlen) {
+	// Append as much of the new input as the history has room for.
+	inlen = qMin(inlen, uiHistorySize - uiFilled);
+	for (unsigned int c = 0; c < uiChannels; ++c) {
+		float * RESTRICT h = ppfHistory[c] + uiFilled;
+		const float * RESTRICT s = in + c;
+		for (unsigned int i = 0; i < inlen; ++i)
+			h[i] = s[i * uiChannels];
+	}
+	uiFilled += inlen;
+
+	// Emit every output whose window is complete.
+	unsigned int produced = 0;
+	while ((produced < outlen) && (uiPos + uiTaps <= uiFilled)) {
+		const float *h = pfFilter + uiPhase * uiTaps;
+		float *o = out + produced * uiChannels;
+		for (unsigned int c = 0; c < uiChannels; ++c)
+			o[c] = dot(h, ppfHistory[c] + uiPos, uiTaps);
+
+		++produced;
+
+		// For integer ratios uiStepFrac is 0 and the phase never changes.
+		uiPos += uiStep;
+		uiPhase += uiStepFrac;
+		if (uiPhase >= uiUp) {
+			uiPhase -= uiUp;
+			++uiPos;
+		}
+	}
+
+	// Drop history that no future window will need.
+	const unsigned int drop = qMin(uiPos, uiFilled);
+	if (drop > 0) {
+		for (unsigned int c = 0; c < uiChannels; ++c)
+			memmove(ppfHistory[c], ppfHistory[c] + drop, (uiFilled - drop) * sizeof(float));
+		uiFilled -= drop;
+		uiPos -= drop;
+	}
+
+	outlen = produced;
+}
+
+unsigned int PolyphaseResampler::inputLatency() const {
+	return uiTaps / 2;
+}
+
+const char *PolyphaseResampler::name() const {
+	return "polyphase";
+}
+
+SpeexResampler::SpeexResampler(unsigned int channels, unsigned int inrate, unsigned int outrate, Quality quality) : Resampler(channels) {
+	int err;
+	int q;
+
+	switch (quality) {
+		case LowLatency:
+			q = 1;
+			break;
+		case HighQuality:
+			q = 8;
+			break;
+		case Balanced:
+		default:
+			q = 3;
+			break;
+	}
+
+	srs = speex_resampler_init(channels, inrate, outrate, q, &err);
+}
+
+SpeexResampler::~SpeexResampler() {
+	speex_resampler_destroy(srs);
+}
+
+void SpeexResampler::process(const float *in, unsigned int &inlen, float *out, unsigned int &outlen) {
+	spx_uint32_t il = inlen;
+	spx_uint32_t ol = outlen;
+	speex_resampler_process_interleaved_float(srs, in, &il, out, &ol);
+	inlen = il;
+	outlen = ol;
+}
+
+bool SpeexResampler::setRate(unsigned int inrate, unsigned int outrate) {
+	return speex_resampler_set_rate(srs, inrate, outrate) == RESAMPLER_ERR_SUCCESS;
+}
+
+unsigned int SpeexResampler::inputLatency() const {
+	return static_cast<unsigned int>(speex_resampler_get_input_latency(srs));
+}
+
+const char *SpeexResampler::name() const {
+	return "speex";
+}
@@ -0,0 +1,73 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MUMBLE_RESAMPLER_H_
+#define MUMBLE_MUMBLE_RESAMPLER_H_
+
+/// Sample rate converter for interleaved float audio.
+///
+/// Use create() to get the best implementation for a conversion: a plain
+/// copy when the rates match, a polyphase FIR filter for fixed rational
+/// ratios such as 44.1 kHz <-> 48 kHz or 48 kHz <-> 96 kHz, and the Speex
+/// resampler when the ratio has to be adjustable at runtime.
+class Resampler {
+	public:
+		enum Quality { LowLatency, Balanced, HighQuality };
+
+		/// Returns a new resampler; the caller owns it. All buffers are sized
+		/// here for chunks of up to maxframes input frames, so process() never
+		/// allocates. If variable is set, the returned resampler supports setRate().
+		static Resampler *create(unsigned int channels, unsigned int inrate, unsigned int outrate, unsigned int maxframes, Quality quality, bool variable = false);
+
+		virtual ~Resampler();
+
+		/// Converts up to inlen frames from in into at most outlen frames in out.
+		/// On return, inlen and outlen hold the number of frames consumed and
+		/// produced. Chunks larger than the maxframes passed to create() may
+		/// only be consumed in part.
+		virtual void process(const float *in, unsigned int &inlen, float *out, unsigned int &outlen) = 0;
+
+		/// Changes the conversion ratio. Returns false if not supported. This may
+		/// recalculate and reallocate the filter, so not for realtime threads.
+		virtual bool setRate(unsigned int inrate, unsigned int outrate);
+
+		/// Delay introduced by the filter, in input frames.
+		virtual unsigned int inputLatency() const = 0;
+
+		/// Short human readable description, for diagnostics.
+		virtual const char *name() const = 0;
+
+		unsigned int channels() const;
+	protected:
+		unsigned int uiChannels;
+		Resampler(unsigned int channels);
+};
+
+#endif
@@ -0,0 +1,143 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MUMBLE_RINGBUFFER_H_
+#define MUMBLE_MUMBLE_RINGBUFFER_H_
+
+#include <QtCore/QAtomicInt>
+
+#include <cstring>
+
+/// Single producer, single consumer ring buffer for the audio threads.
+///
+/// Storage is allocated once in the constructor, and neither side ever
+/// locks, so it is safe to use from realtime callbacks. Exactly one
+/// thread may call write() and exactly one thread may call read().
+template <typename T>
+class RingBuffer {
+	private:
+		Q_DISABLE_COPY(RingBuffer)
+	protected:
+		T *ptBuffer;
+		unsigned int uiCapacity;
+		/// Total number of elements ever written and read. Their difference
+		/// is the fill level; both wrap around together.
+		QAtomicInt qaiWritten;
+		QAtomicInt qaiRead;
+
+		void copyIn(unsigned int pos, const T *data, unsigned int count) {
+			const unsigned int first = qMin(count, uiCapacity - pos);
+			memcpy(ptBuffer + pos, data, first * sizeof(T));
+			memcpy(ptBuffer, data + first, (count - first) * sizeof(T));
+		}
+
+		void copyOut(unsigned int pos, T *data, unsigned int count) const {
+			const unsigned int first = qMin(count, uiCapacity - pos);
+			memcpy(data, ptBuffer + pos, first * sizeof(T));
+			memcpy(data + first, ptBuffer, (count - first) * sizeof(T));
+		}
+	public:
+		/// The capacity is rounded up to a power of two, so the positions
+		/// stay consistent when the counters wrap around.
+		RingBuffer(unsigned int capacity) : ptBuffer(NULL), uiCapacity(1), qaiWritten(0), qaiRead(0) {
+			while (uiCapacity < capacity)
+				uiCapacity <<= 1;
+			ptBuffer = new T[uiCapacity];
+		}
+
+		~RingBuffer() {
+			delete [] ptBuffer;
+		}
+
+		unsigned int capacity() const {
+			return uiCapacity;
+		}
+
+		/// Number of elements that can be read. Callable from either side.
+		unsigned int available() {
+			const unsigned int r = static_cast<unsigned int>(qaiRead.fetchAndAddAcquire(0));
+			return static_cast<unsigned int>(qaiWritten.fetchAndAddAcquire(0)) - r;
+		}
+
+		/// Number of elements that can be written. Callable from either side.
+		unsigned int space() {
+			return uiCapacity - available();
+		}
+
+		/// Appends count elements, or nothing at all if they do not fit.
+		bool write(const T *data, unsigned int count) {
+			const unsigned int w = static_cast<unsigned int>(qaiWritten.fetchAndAddAcquire(0));
+			const unsigned int r = static_cast<unsigned int>(qaiRead.fetchAndAddAcquire(0));
+			if (uiCapacity - (w - r) < count)
+				return false;
+
+			copyIn(w & (uiCapacity - 1), data, count);
+			qaiWritten.fetchAndAddRelease(static_cast<int>(count));
+			return true;
+		}
+
+		/// Appends count zeroed elements, or nothing at all if they do not fit.
+		bool writeZero(unsigned int count) {
+			const unsigned int w = static_cast<unsigned int>(qaiWritten.fetchAndAddAcquire(0));
+			const unsigned int r = static_cast<unsigned int>(qaiRead.fetchAndAddAcquire(0));
+			if (uiCapacity - (w - r) < count)
+				return false;
+
+			const unsigned int pos = w & (uiCapacity - 1);
+			const unsigned int first = qMin(count, uiCapacity - pos);
+			memset(ptBuffer + pos, 0, first * sizeof(T));
+			memset(ptBuffer, 0, (count - first) * sizeof(T));
+			qaiWritten.fetchAndAddRelease(static_cast<int>(count));
+			return true;
+		}
+
+		/// Removes count elements into data, or nothing at all if fewer are available.
+		bool read(T *data, unsigned int count) {
+			const unsigned int r = static_cast<unsigned int>(qaiRead.fetchAndAddAcquire(0));
+			const unsigned int w = static_cast<unsigned int>(qaiWritten.fetchAndAddAcquire(0));
+			if ((w - r) < count)
+				return false;
+
+			copyOut(r & (uiCapacity - 1), data, count);
+			qaiRead.fetchAndAddRelease(static_cast<int>(count));
+			return true;
+		}
+
+		/// Drops up to count elements from the read side and returns how many were dropped.
+		unsigned int skip(unsigned int count) {
+			const unsigned int r = static_cast<unsigned int>(qaiRead.fetchAndAddAcquire(0));
+			const unsigned int w = static_cast<unsigned int>(qaiWritten.fetchAndAddAcquire(0));
+			count = qMin(count, w - r);
+			qaiRead.fetchAndAddRelease(static_cast<int>(count));
+			return count;
+		}
+};
+
+#endif
@@ -336,6 +336,8 @@ Settings::Settings() {
 	bEcho = false;
 	bEchoMulti = true;
 
+	rqResample = Resampler::Balanced;
+
 	bExclusiveInput = false;
 	bExclusiveOutput = false;
 
@@ -344,6 +346,8 @@ Settings::Settings() {
 
 	bPositionalAudio = true;
 	bPositionalHeadphone = false;
+	iPositionalPollRate = 50;
+	bPositionalSmoothing = false;
 	fAudioMinDistance = 1.0f;
 	fAudioMaxDistance = 15.0f;
 	fAudioMaxDistVolume = 0.80f;
@@ -371,6 +375,7 @@ Settings::Settings() {
 	iMaxImageSize = ciDefaultMaxImageSize;
 	iMaxImageWidth = 1024; // Allow 1024x1024 resolution
 	iMaxImageHeight = 1024;
+	iBlobCacheSize = 64;
 	bSuppressIdentity = false;
 	qsSslCiphers = MumbleSSL::defaultOpenSSLCipherString();
 
@@ -407,7 +412,8 @@ Settings::Settings() {
 	
 	requireRestartToApply = false;
 
-	iMaxLogBlocks = 0;
+	iMaxLogBlocks = 10000;
+	bLogArchive = false;
 
 	bShortcutEnable = true;
 	bSuppressMacEventTapWarning = false;
@@ -605,10 +611,13 @@ void Settings::load(QSettings* settings_ptr) {
 	SAVELOAD(fAudioBloom, "audio/bloom");
 	SAVELOAD(bEcho, "audio/echo");
 	SAVELOAD(bEchoMulti, "audio/echomulti");
+	LOADENUM(rqResample, "audio/resampler");
 	SAVELOAD(bExclusiveInput, "audio/exclusiveinput");
 	SAVELOAD(bExclusiveOutput, "audio/exclusiveoutput");
 	SAVELOAD(bPositionalAudio, "audio/positional");
 	SAVELOAD(bPositionalHeadphone, "audio/headphone");
+	SAVELOAD(iPositionalPollRate, "audio/positionalpollrate");
+	SAVELOAD(bPositionalSmoothing, "audio/positionalsmoothing");
 	SAVELOAD(qsAudioInput, "audio/input");
 	SAVELOAD(qsAudioOutput, "audio/output");
 	SAVELOAD(bWhisperFriends, "audio/whisperfriends");
@@ -660,6 +669,7 @@ void Settings::load(QSettings* settings_ptr) {
 	SAVELOAD(qsProxyUsername, "net/proxyusername");
 	SAVELOAD(qsProxyPassword, "net/proxypassword");
 	SAVELOAD(iMaxImageSize, "net/maximagesize");
+	SAVELOAD(iBlobCacheSize, "net/blobcachesize");
 	SAVELOAD(iMaxImageWidth, "net/maximagewidth");
 	SAVELOAD(iMaxImageHeight, "net/maximageheight");
 	SAVELOAD(qsServicePrefix, "net/serviceprefix");
@@ -707,6 +717,7 @@ void Settings::load(QSettings* settings_ptr) {
 	SAVELOAD(bShowTransmitModeComboBox, "ui/transmitmodecombobox");
 	SAVELOAD(bHighContrast, "ui/HighContrast");
 	SAVELOAD(iMaxLogBlocks, "ui/MaxLogBlocks");
+	SAVELOAD(bLogArchive, "ui/LogArchive");
 
 	// PTT Button window
 	SAVELOAD(bShowPTTButtonWindow, "ui/showpttbuttonwindow");
@@ -914,10 +925,13 @@ void Settings::save() {
 	SAVELOAD(fAudioBloom, "audio/bloom");
 	SAVELOAD(bEcho, "audio/echo");
 	SAVELOAD(bEchoMulti, "audio/echomulti");
+	SAVELOAD(rqResample, "audio/resampler");
 	SAVELOAD(bExclusiveInput, "audio/exclusiveinput");
 	SAVELOAD(bExclusiveOutput, "audio/exclusiveoutput");
 	SAVELOAD(bPositionalAudio, "audio/positional");
 	SAVELOAD(bPositionalHeadphone, "audio/headphone");
+	SAVELOAD(iPositionalPollRate, "audio/positionalpollrate");
+	SAVELOAD(bPositionalSmoothing, "audio/positionalsmoothing");
 	SAVELOAD(qsAudioInput, "audio/input");
 	SAVELOAD(qsAudioOutput, "audio/output");
 	SAVELOAD(bWhisperFriends, "audio/whisperfriends");
@@ -968,6 +982,7 @@ void Settings::save() {
 	SAVELOAD(qsProxyUsername, "net/proxyusername");
 	SAVELOAD(qsProxyPassword, "net/proxypassword");
 	SAVELOAD(iMaxImageSize, "net/maximagesize");
+	SAVELOAD(iBlobCacheSize, "net/blobcachesize");
 	SAVELOAD(iMaxImageWidth, "net/maximagewidth");
 	SAVELOAD(iMaxImageHeight, "net/maximageheight");
 	SAVELOAD(qsServicePrefix, "net/serviceprefix");
@@ -1013,6 +1028,7 @@ void Settings::save() {
 	SAVELOAD(bShowTransmitModeComboBox, "ui/transmitmodecombobox");
 	SAVELOAD(bHighContrast, "ui/HighContrast");
 	SAVELOAD(iMaxLogBlocks, "ui/MaxLogBlocks");
+	SAVELOAD(bLogArchive, "ui/LogArchive");
 
 	// PTT Button window
 	SAVELOAD(bShowPTTButtonWindow, "ui/showpttbuttonwindow");
@@ -43,6 +43,8 @@
 #include <QtNetwork/QSslCertificate>
 #include <QtNetwork/QSslKey>
 
+#include "Resampler.h"
+
 // Global helper classes to spread variables around across threads
 // especially helpful to initialize things like the stored
 // preference for audio transmission, since the GUI elements
@@ -225,8 +227,11 @@ struct Settings {
 	bool bExclusiveInput, bExclusiveOutput;
 	bool bEcho;
 	bool bEchoMulti;
+	Resampler::Quality rqResample;
 	bool bPositionalAudio;
 	bool bPositionalHeadphone;
+	int iPositionalPollRate;
+	bool bPositionalSmoothing;
 	float fAudioMinDistance, fAudioMaxDistance, fAudioMaxDistVolume, fAudioBloom;
 	QMap<QString, bool> qmPositionalAudioPlugins;
 
@@ -250,6 +255,7 @@ struct Settings {
 
 	enum MessageLog { LogNone = 0x00, LogConsole = 0x01, LogTTS = 0x02, LogBalloon = 0x04, LogSoundfile = 0x08};
 	int iMaxLogBlocks;
+	bool bLogArchive;
 	QMap<int, QString> qmMessageSounds;
 	QMap<int, quint32> qmMessages;
 
@@ -322,6 +328,8 @@ struct Settings {
 	int iMaxImageSize;
 	int iMaxImageWidth;
 	int iMaxImageHeight;
+	/// Disk budget for cached textures, comments and descriptions in MiB.
+	int iBlobCacheSize;
 	KeyPair kpCertificate;
 	bool bSuppressIdentity;
 
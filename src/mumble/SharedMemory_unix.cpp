@@ -50,10 +50,11 @@ SharedMemory2::SharedMemory2(QObject *p, unsigned int minsize, const QString &me
 	d = new SharedMemory2Private();
 	d->iShmemFD = -1;
 
-	int prot = PROT_READ;
+	// Both sides write to the segment, since the reader hands buffers
+	// back through its header.
+	int prot = PROT_READ | PROT_WRITE;
 
 	if (memname.isEmpty()) {
-		prot |= PROT_WRITE;
 		for (int i=0;i<100;++i) {
 			qsName = QString::fromLatin1("/MumbleOverlayMemory%1").arg(++uiIndex);
 			d->iShmemFD=shm_open(qsName.toUtf8().constData(), O_RDWR|O_CREAT|O_EXCL, 0600);
@@ -69,7 +70,7 @@ SharedMemory2::SharedMemory2(QObject *p, unsigned int minsize, const QString &me
 		}
 	} else {
 		qsName = memname;
-		d->iShmemFD=shm_open(qsName.toUtf8().constData(), O_RDONLY, 0600);
+		d->iShmemFD=shm_open(qsName.toUtf8().constData(), O_RDWR, 0600);
 	}
 	if (d->iShmemFD == -1) {
 		qWarning() << "SharedMemory2: Failed to open shared memory segment" << qsName;
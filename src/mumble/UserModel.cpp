@@ -68,21 +68,6 @@ ModelItem::ModelItem(ClientUser *p) {
 	iUsers = 0;
 }
 
-ModelItem::ModelItem(ModelItem *i) {
-	// Create a shallow clone
-	this->cChan = i->cChan;
-	this->pUser = i->pUser;
-	this->parent = i->parent;
-	this->bCommentSeen = i->bCommentSeen;
-
-	if (pUser)
-		c_qhUsers.insert(pUser, this);
-	else if (cChan)
-		c_qhChannels.insert(cChan, this);
-
-	iUsers = i->iUsers;
-}
-
 ModelItem::~ModelItem() {
 	Q_ASSERT(qlChildren.count() == 0);
 
@@ -92,15 +77,6 @@ ModelItem::~ModelItem() {
 		c_qhUsers.remove(pUser);
 }
 
-void ModelItem::wipe() {
-	foreach(ModelItem *i, qlChildren) {
-		i->wipe();
-		delete i;
-	}
-	qlChildren.clear();
-	iUsers = 0;
-}
-
 ModelItem *ModelItem::child(int idx) const {
 	if (! validRow(idx))
 		return NULL;
@@ -153,43 +129,65 @@ int ModelItem::rows() const {
 	return qlChildren.count();
 }
 
-int ModelItem::insertIndex(Channel *c) const {
-	QList<Channel*> qlpc;
-	ModelItem *item;
+// Children are kept as two sorted blocks, users and channels, ordered by
+// bUsersTop. These helpers see the list as it would be without row skip,
+// so that an item can be re-sorted among its current siblings.
 
-	int ocount = 0;
+static inline const ModelItem *childAt(const QList<ModelItem *> &children, int skip, int row) {
+	return children.at(((skip >= 0) && (row >= skip)) ? row + 1 : row);
+}
 
-	foreach(item, qlChildren) {
-		if (item->cChan) {
-			if (item->cChan != c) {
-				qlpc << item->cChan;
-			}
-		} else
-			ocount++;
+// First row of the second block.
+static int blockBoundary(const QList<ModelItem *> &children, int skip, int count) {
+	int lo = 0, hi = count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if ((childAt(children, skip, mid)->pUser != NULL) == ModelItem::bUsersTop)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	qlpc << c;
-	qSort(qlpc.begin(), qlpc.end(), Channel::lessThan);
-	return qlpc.indexOf(c) + (bUsersTop ? ocount : 0);
+	return lo;
 }
 
-int ModelItem::insertIndex(ClientUser *p) const {
-	QList<ClientUser*> qlclientuser;
-	ModelItem *item;
-
-	int ocount = 0;
+int ModelItem::insertIndex(Channel *c, int skip) const {
+	int count = qlChildren.count() - ((skip >= 0) ? 1 : 0);
+	int boundary = blockBoundary(qlChildren, skip, count);
+	int lo = bUsersTop ? boundary : 0;
+	int hi = bUsersTop ? count : boundary;
 
-	foreach(item, qlChildren) {
-		if (item->pUser) {
-			if (item->pUser != p)
-				qlclientuser << item->pUser;
-		} else
-			ocount++;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (Channel::lessThan(childAt(qlChildren, skip, mid)->cChan, c))
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	return lo;
+}
+
+int ModelItem::insertIndex(ClientUser *p, int skip) const {
+	int count = qlChildren.count() - ((skip >= 0) ? 1 : 0);
+	int boundary = blockBoundary(qlChildren, skip, count);
+	int lo = bUsersTop ? 0 : boundary;
+	int hi = bUsersTop ? boundary : count;
 
-	qlclientuser << p;
-	qSort(qlclientuser.begin(), qlclientuser.end(), ClientUser::lessThan);
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (ClientUser::lessThan(childAt(qlChildren, skip, mid)->pUser, p))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
 
-	return qlclientuser.indexOf(p) + (bUsersTop ? 0 : ocount);
+bool ModelItem::lessThan(const ModelItem *first, const ModelItem *second) {
+	if ((first->pUser != NULL) != (second->pUser != NULL))
+		return (first->pUser != NULL) == bUsersTop;
+	if (first->pUser)
+		return ClientUser::lessThan(first->pUser, second->pUser);
+	return Channel::lessThan(first->cChan, second->cChan);
 }
 
 QString ModelItem::hash() const {
@@ -242,6 +240,7 @@ UserModel::UserModel(QObject *p) : QAbstractItemModel(p) {
 	uiSessionComment = 0;
 	iChannelDescription = -1;
 	bClicked = false;
+	bBulkLoad = false;
 
 	miRoot = new ModelItem(Channel::get(0));
 }
@@ -272,7 +271,7 @@ QModelIndex UserModel::index(int row, int column, const QModelIndex &p) const {
 		item = static_cast<ModelItem *>(p.internalPointer());
 	}
 
-	if (! item)
+	if (! item || bBulkLoad)
 		return idx;
 
 	if (! item->validRow(row))
@@ -287,7 +286,7 @@ QModelIndex UserModel::index(ClientUser *p, int column) const {
 	ModelItem *item = ModelItem::c_qhUsers.value(p);
 	Q_ASSERT(p);
 	Q_ASSERT(item);
-	if (!p || ! item)
+	if (!p || ! item || bBulkLoad)
 		return QModelIndex();
 	QModelIndex idx=createIndex(item->rowOfSelf(), column, item);
 	return idx;
@@ -297,13 +296,15 @@ QModelIndex UserModel::index(Channel *c, int column) const {
 	ModelItem *item = ModelItem::c_qhChannels.value(c);
 	Q_ASSERT(c);
 	Q_ASSERT(item);
-	if (!item || !c)
+	if (!item || !c || (bBulkLoad && (item != miRoot)))
 		return QModelIndex();
 	QModelIndex idx=createIndex(item->rowOfSelf(), column, item);
 	return idx;
 }
 
 QModelIndex UserModel::index(ModelItem *item) const {
+	if (bBulkLoad && (item != miRoot))
+		return QModelIndex();
 	return createIndex(item->rowOfSelf(), 0, item);
 }
 
@@ -331,7 +332,7 @@ int UserModel::rowCount(const QModelIndex &p) const {
 	else
 		item = static_cast<ModelItem *>(p.internalPointer());
 
-	if (! item || (p.column() != 0))
+	if (! item || (p.column() != 0) || bBulkLoad)
 		return 0;
 
 	val = item->rows();
@@ -679,78 +680,46 @@ QVariant UserModel::headerData(int section, Qt::Orientation orientation,
 	return QVariant();
 }
 
-void UserModel::recursiveClone(const ModelItem *old, ModelItem *item, QModelIndexList &from, QModelIndexList &to) {
-	if (old->qlChildren.isEmpty())
-		return;
-
-	beginInsertRows(index(item), 0, old->qlChildren.count());
-
-	for (int i=0;i<old->qlChildren.count();++i) {
-		ModelItem *o = old->qlChildren.at(i);
-		ModelItem *mi = new ModelItem(o);
-		mi->parent = item;
-
-		item->qlChildren << mi;
+ModelItem *UserModel::moveItem(ModelItem *oldparent, ModelItem *newparent, ModelItem *item) {
+	if (bBulkLoad) {
+		// Nothing is shown yet, so just relink; endBulkLoad() sorts. A user
+		// moved right after being added is found at the end of the list.
+		oldparent->qlChildren.removeAt(oldparent->qlChildren.lastIndexOf(item));
+		item->parent = newparent;
+		newparent->qlChildren.append(item);
 
-		from << createIndex(i, 0, o);
-		from << createIndex(i, 1, o);
-		to << createIndex(i, 0, mi);
-		to << createIndex(i, 1, mi);
+		if (item->cChan) {
+			oldparent->cChan->removeChannel(item->cChan);
+			newparent->cChan->addChannel(item->cChan);
+		} else {
+			newparent->cChan->addClientUser(item->pUser);
+		}
+		return item;
 	}
 
-	endInsertRows();
-
-	for (int i=0;i<old->qlChildren.count();++i)
-		recursiveClone(old->qlChildren.at(i), item->qlChildren.at(i), from, to);
-}
-
-ModelItem *UserModel::moveItem(ModelItem *oldparent, ModelItem *newparent, ModelItem *item) {
-	// Here's the idea. We insert the item, update persistent indexes, THEN remove it.
-
 	int oldrow = oldparent->qlChildren.indexOf(item);
 	int newrow = -1;
+	int skip = (oldparent == newparent) ? oldrow : -1;
 
 	if (item->cChan)
-		newrow = newparent->insertIndex(item->cChan);
+		newrow = newparent->insertIndex(item->cChan, skip);
 	else
-		newrow = newparent->insertIndex(item->pUser);
+		newrow = newparent->insertIndex(item->pUser, skip);
 
 	if ((oldparent == newparent) && (newrow == oldrow)) {
 		emit dataChanged(index(item),index(item));
 		return item;
 	}
 
-	// Shallow clone
-	ModelItem *t = new ModelItem(item);
-
-	// Store the index if it's "active".
-	// The selection is stored as "from"-"to" pairs, so if we move up in the same channel,
-	// we'd move only "from" and select half the channel.
-
-	QTreeView *v=g.mw->qtvUsers;
-	QItemSelectionModel *sel=v->selectionModel();
-	QPersistentModelIndex active;
-	QModelIndex oindex = createIndex(oldrow, 0, item);
-	if (sel->isSelected(oindex) || (oindex == v->currentIndex())) {
-		active = index(item);
-		v->clearSelection();
-		v->setCurrentIndex(QModelIndex());
-	}
+	// newrow is counted without the item itself, beginMoveRows wants the
+	// row it lands in front of before the item is taken out.
+	int destrow = ((oldparent == newparent) && (newrow > oldrow)) ? newrow + 1 : newrow;
 
-	bool expanded = v->isExpanded(index(item));
-
-	if (newparent == oldparent) {
-		// Mangle rows. newrow needs to be pre-remove. oldrow needs to be postremove.
-		if (oldrow >= newrow) {
-			oldrow++;
-		} else {
-			newrow++;
-		}
-	}
+	beginMoveRows(index(oldparent), oldrow, oldrow, index(newparent), destrow);
 
-	beginInsertRows(index(newparent), newrow, newrow);
-	t->parent = newparent;
-	newparent->qlChildren.insert(newrow, t);
+	oldparent->qlChildren.removeAt(oldrow);
+	newparent->qlChildren.insert(newrow, item);
+	item->parent = newparent;
 
 	if (item->cChan) {
 		oldparent->cChan->removeChannel(item->cChan);
@@ -759,36 +728,15 @@ ModelItem *UserModel::moveItem(ModelItem *oldparent, ModelItem *newparent, Model
 		newparent->cChan->addClientUser(item->pUser);
 	}
 
-	endInsertRows();
-
-
-	QModelIndexList from, to;
-	from << createIndex(oldrow, 0, item);
-	from << createIndex(oldrow, 1, item);
-	to << createIndex(newrow, 0, t);
-	to << createIndex(newrow, 1, t);
+	endMoveRows();
 
-	recursiveClone(item, t, from, to);
-
-	changePersistentIndexList(from, to);
-
-	beginRemoveRows(index(oldparent), oldrow, oldrow);
-	oldparent->qlChildren.removeAt(oldrow);
-	endRemoveRows();
-
-	item->wipe();
-	delete item;
-
-	if (active.isValid()) {
-		sel->select(active, QItemSelectionModel::SelectCurrent);
-		v->setCurrentIndex(active);
-	}
-	if (expanded)
-		v->expand(index(t));
-	return t;
+	return item;
 }
 
 void UserModel::expandAll(Channel *c) {
+	if (bBulkLoad)
+		return;
+
 	QStack<Channel *> chans;
 
 	while (c) {
@@ -802,6 +750,9 @@ void UserModel::expandAll(Channel *c) {
 }
 
 void UserModel::collapseEmpty(Channel *c) {
+	if (bBulkLoad)
+		return;
+
 	while (c) {
 		ModelItem *mi = ModelItem::c_qhChannels.value(c);
 		if (mi->iUsers == 0)
@@ -813,7 +764,7 @@ void UserModel::collapseEmpty(Channel *c) {
 }
 
 void UserModel::ensureSelfVisible() {
-	if (! g.uiSession)
+	if (! g.uiSession || bBulkLoad)
 		return;
 
 	g.mw->qtvUsers->scrollTo(index(ClientUser::get(g.uiSession)));
@@ -865,12 +816,17 @@ ClientUser *UserModel::addUser(unsigned int id, const QString &name) {
 
 	item->parent = citem;
 
-	int row = citem->insertIndex(p);
+	if (bBulkLoad) {
+		citem->qlChildren.append(item);
+		c->addClientUser(p);
+	} else {
+		int row = citem->insertIndex(p);
 
-	beginInsertRows(index(citem), row, row);
-	citem->qlChildren.insert(row, item);
-	c->addClientUser(p);
-	endInsertRows();
+		beginInsertRows(index(citem), row, row);
+		citem->qlChildren.insert(row, item);
+		c->addClientUser(p);
+		endInsertRows();
+	}
 
 	while (citem) {
 		citem->iUsers++;
@@ -891,10 +847,12 @@ void UserModel::removeUser(ClientUser *p) {
 
 	int row = citem->qlChildren.indexOf(item);
 
-	beginRemoveRows(index(citem), row, row);
+	if (! bBulkLoad)
+		beginRemoveRows(index(citem), row, row);
 	c->removeUser(p);
 	citem->qlChildren.removeAt(row);
-	endRemoveRows();
+	if (! bBulkLoad)
+		endRemoveRows();
 
 	p->cChannel = NULL;
 
@@ -1153,6 +1111,12 @@ Channel *UserModel::addChannel(int id, Channel *p, const QString &name) {
 
 	item->parent = citem;
 
+	if (bBulkLoad) {
+		p->addChannel(c);
+		citem->qlChildren.append(item);
+		return c;
+	}
+
 	int row = citem->insertIndex(c);
 
 	beginInsertRows(index(citem), row, row);
@@ -1187,11 +1151,13 @@ void UserModel::removeChannel(Channel *c) {
 
 	int row = citem->rowOf(c);
 
-	beginRemoveRows(index(citem), row, row);
+	if (! bBulkLoad)
+		beginRemoveRows(index(citem), row, row);
 	p->removeChannel(c);
 	citem->qlChildren.removeAt(row);
 	qsLinked.remove(c);
-	endRemoveRows();
+	if (! bBulkLoad)
+		endRemoveRows();
 
 	Channel::remove(c);
 
@@ -1259,6 +1225,58 @@ void UserModel::removeAll() {
 	updateOverlay();
 }
 
+/**
+ * Starts buffering the initial server state. Until endBulkLoad(), the model
+ * shows only the root channel, without children, and hands out no indexes
+ * below it. Users and channels added meanwhile are appended to their parents
+ * unsorted and without row signals, instead of being sorted in one at a time.
+ */
+void UserModel::beginBulkLoad() {
+	if (bBulkLoad)
+		return;
+
+	beginResetModel();
+	bBulkLoad = true;
+	endResetModel();
+}
+
+/**
+ * Sorts everything added since beginBulkLoad() in one pass, publishes it as
+ * a single model reset and applies the channel expansion setting to it.
+ */
+void UserModel::endBulkLoad() {
+	if (! bBulkLoad)
+		return;
+
+	beginResetModel();
+	sortChildren(miRoot);
+	bBulkLoad = false;
+	endResetModel();
+
+	if (g.s.ceExpand != Settings::NoChannels)
+		expandLoaded(miRoot);
+
+	updateOverlay();
+}
+
+void UserModel::sortChildren(ModelItem *item) {
+	qSort(item->qlChildren.begin(), item->qlChildren.end(), ModelItem::lessThan);
+	foreach(ModelItem *i, item->qlChildren)
+		if (i->cChan)
+			sortChildren(i);
+}
+
+void UserModel::expandLoaded(ModelItem *item) {
+	// A channel holds users somewhere below it exactly when expandAll() on
+	// one of its occupied descendants would have expanded it.
+	if ((g.s.ceExpand == Settings::AllChannels) || (item->iUsers > 0))
+		g.mw->qtvUsers->setExpanded(index(item), true);
+
+	foreach(ModelItem *i, item->qlChildren)
+		if (i->cChan)
+			expandLoaded(i);
+}
+
 ClientUser *UserModel::getUser(const QModelIndex &idx) const {
 	if (! idx.isValid())
 		return NULL;
@@ -63,7 +63,6 @@ public:
 
 	ModelItem(Channel *c);
 	ModelItem(ClientUser *p);
-	ModelItem(ModelItem *);
 	~ModelItem();
 
 	ModelItem *child(int idx) const;
@@ -75,10 +74,10 @@ public:
 	int rowOf(ClientUser *p) const;
 	int rowOfSelf() const;
 	int rows() const;
-	int insertIndex(Channel *c) const;
-	int insertIndex(ClientUser *p) const;
+	int insertIndex(Channel *c, int skip = -1) const;
+	int insertIndex(ClientUser *p, int skip = -1) const;
+	static bool lessThan(const ModelItem *, const ModelItem *);
 	QString hash() const;
-	void wipe();
 };
 
 class UserModel : public QAbstractItemModel {
@@ -101,8 +100,13 @@ class UserModel : public QAbstractItemModel {
 		QMap<QString, ClientUser *> qmHashes;
 
 		bool bClicked;
+		/// Set between beginBulkLoad() and endBulkLoad(). The view then sees
+		/// the root channel without children, and tree mutations append
+		/// without sorting and without row signals.
+		bool bBulkLoad;
 
-		void recursiveClone(const ModelItem *old, ModelItem *item, QModelIndexList &from, QModelIndexList &to);
+		void sortChildren(ModelItem *item);
+		void expandLoaded(ModelItem *item);
 		ModelItem *moveItem(ModelItem *oldparent, ModelItem *newparent, ModelItem *item);
 
 		QString stringIndex(const QModelIndex &index) const;
@@ -159,6 +163,9 @@ class UserModel : public QAbstractItemModel {
 
 		void removeAll();
 
+		void beginBulkLoad();
+		void endBulkLoad();
+
 		void expandAll(Channel *c);
 		void collapseEmpty(Channel *c);
 
@@ -41,24 +41,12 @@
 
 #include "../Timer.h"
 
-VoiceRecorder::RecordBuffer::RecordBuffer(
-		int recordInfoIndex_,
-		boost::shared_array<float> buffer_,
-		int samples_,
-		quint64 absoluteStartSample_)
-
-	: recordInfoIndex(recordInfoIndex_)
-	, buffer(buffer_)
-	, samples(samples_)
-	, absoluteStartSample(absoluteStartSample_) {
-	
-	// Nothing
-}
-
-VoiceRecorder::RecordInfo::RecordInfo(const QString& userName_)
+VoiceRecorder::RecordInfo::RecordInfo(const QString& userName_, unsigned int capacity)
     : userName(userName_)
     , soundFile(NULL)
-    , lastWrittenAbsoluteSample(0) {
+    , lastWrittenAbsoluteSample(0)
+    , samples(capacity)
+    , chunks(1024) {
 }
 
 VoiceRecorder::RecordInfo::~RecordInfo() {
@@ -70,6 +58,13 @@ VoiceRecorder::RecordInfo::~RecordInfo() {
 
 VoiceRecorder::VoiceRecorder(QObject *p, const Config& config)
     : QThread(p)
+    , m_audioTracks(NULL)
+    , m_pendingTracks(NULL)
+    , m_retiredTracks(NULL)
+    , m_trackRequests(1024)
+    , m_publishedTracks(0)
+    , m_writeBufferSize(static_cast<unsigned int>(qMax(config.sampleRate, 1)))
+    , m_droppedSamples(0)
     , m_recordUser(new RecordUser())
     , m_timestamp(new Timer())
 	, m_config(config)
@@ -78,12 +73,25 @@ VoiceRecorder::VoiceRecorder(QObject *p, const Config& config)
     , m_recordingStartTime(QDateTime::currentDateTime())
     , m_absoluteSampleEstimation(0) {
 	
-	// Nothing
+	// One second, which is also the largest block of silence written at once.
+	m_writeBuffer.reset(new float[m_writeBufferSize]);
+
+	// The mixdown or local user track is needed right away, so create it
+	// before the audio thread gets to see us.
+	m_recordInfo.insert(0, boost::make_shared<RecordInfo>(
+	                        m_config.mixDownMode ? QLatin1String("Mixdown") : m_recordUser->qsName,
+	                        m_writeBufferSize * 4));
+	m_audioTracks = new RecordInfoMap(m_recordInfo);
+	m_publishedTracks = m_recordInfo.count();
 }
 
 VoiceRecorder::~VoiceRecorder() {
 	stop();
 	wait();
+
+	delete m_audioTracks;
+	delete m_pendingTracks.fetchAndStoreAcquire(NULL);
+	delete m_retiredTracks.fetchAndStoreAcquire(NULL);
 }
 
 QString VoiceRecorder::sanitizeFilenameOrPathComponent(const QString &str) const {
@@ -316,6 +324,83 @@ bool VoiceRecorder::ensureFileIsOpenedFor(SF_INFO& soundFileInfo, boost::shared_
 	return true;
 }
 
+void VoiceRecorder::writeSilence(RecordInfo *ri, quint64 samples) {
+	memset(m_writeBuffer.get(), 0, m_writeBufferSize * sizeof(float));
+
+	while (samples > 0 && !m_abort) {
+		const sf_count_t n = static_cast<sf_count_t>(qMin(samples, static_cast<quint64>(m_writeBufferSize)));
+		sf_write_float(ri->soundFile, m_writeBuffer.get(), n);
+		ri->lastWrittenAbsoluteSample += n;
+		samples -= n;
+	}
+}
+
+void VoiceRecorder::createRequestedTracks() {
+	int index;
+	while (m_trackRequests.read(&index, 1)) {
+		// addBuffer keeps asking until the track shows up on its side.
+		if (m_recordInfo.contains(index))
+			continue;
+
+		QString userName;
+		{
+			QReadLocker lock(&ClientUser::c_qrwlUsers);
+			const ClientUser *p = ClientUser::c_qmUsers.value(static_cast<unsigned int>(index));
+			if (p)
+				userName = p->qsName;
+		}
+
+		// The user left before we got to it.
+		if (userName.isEmpty())
+			continue;
+
+		m_recordInfo.insert(index, boost::make_shared<RecordInfo>(userName, m_writeBufferSize * 4));
+	}
+
+	// Only hand over a new table once the audio thread took the last one. It
+	// retires its old table before taking the pending one, so once pending is
+	// empty the retired table can be freed.
+	if (m_pendingTracks.fetchAndAddOrdered(0) != NULL)
+		return;
+
+	delete m_retiredTracks.fetchAndStoreAcquire(NULL);
+
+	// Tracks are never removed, so a count mismatch means new ones.
+	if (m_publishedTracks != m_recordInfo.count()) {
+		m_publishedTracks = m_recordInfo.count();
+		m_pendingTracks.fetchAndStoreRelease(new RecordInfoMap(m_recordInfo));
+	}
+}
+
+bool VoiceRecorder::drainTrack(SF_INFO& soundFileInfo, boost::shared_ptr<RecordInfo>& ri) {
+	const qint64 heuristicSilenceThreshold = m_config.sampleRate / 10; // 100ms
+
+	RecordChunk chunk;
+	while (!m_abort && ri->chunks.read(&chunk, 1)) {
+		// Create the file for this RecordInfo instance if it's not yet open.
+		if (!ensureFileIsOpenedFor(soundFileInfo, ri)) {
+			return false;
+		}
+
+		const qint64 missingSamples = chunk.absoluteStartSample - ri->lastWrittenAbsoluteSample;
+		if (missingSamples > heuristicSilenceThreshold) {
+			writeSilence(ri.get(), missingSamples);
+		}
+
+		// Write the audio data and update the timestamp in |ri|.
+		unsigned int rest = chunk.samples;
+		while (rest > 0) {
+			const unsigned int n = qMin(rest, m_writeBufferSize);
+			ri->samples.read(m_writeBuffer.get(), n);
+			sf_write_float(ri->soundFile, m_writeBuffer.get(), n);
+			rest -= n;
+		}
+		ri->lastWrittenAbsoluteSample += chunk.samples;
+	}
+
+	return true;
+}
+
 void VoiceRecorder::run() {
 	Q_ASSERT(!m_recording);
 	
@@ -327,75 +412,42 @@ void VoiceRecorder::run() {
 	m_recording = true;
 	emit recording_started();
 	
-	forever {
-		// Sleep until there is new data for us to process.
+	bool finished = false;
+	while (!finished) {
+		// The audio thread never signals us, so poll for new data. The track
+		// buffers hold several seconds, so this is plenty.
 		m_sleepLock.lock();
-		m_sleepCondition.wait(&m_sleepLock);
+		m_sleepCondition.wait(&m_sleepLock, 100);
+		m_sleepLock.unlock();
 
 		if (!m_recording || m_abort || (g.sh && g.sh->uiVersion < 0201003)) {
-			m_sleepLock.unlock();
-			break;
+			// Write out what is still queued, unless told not to.
+			finished = true;
 		}
 
-		while (!m_abort && !m_recordBuffer.isEmpty()) {
-			boost::shared_ptr<RecordBuffer> rb;
-			{
-				QMutexLocker l(&m_bufferLock);
-				rb = m_recordBuffer.takeFirst();
-			}
-			
-			// Create the file for this RecordInfo instance if it's not yet open.
-			
-			Q_ASSERT(m_recordInfo.contains(rb->recordInfoIndex));
-			boost::shared_ptr<RecordInfo> ri = m_recordInfo.value(rb->recordInfoIndex);
-			
-			if (!ensureFileIsOpenedFor(soundFileInfo, ri)) {
-				return;
-			}
+		createRequestedTracks();
 
-			const qint64 missingSamples = rb->absoluteStartSample - ri->lastWrittenAbsoluteSample;
-			
-			static const qint64 heuristicSilenceThreshold = m_config.sampleRate / 10; // 100ms
-			if (missingSamples > heuristicSilenceThreshold) {
-				static const qint64 maxSamplesPerIteration = m_config.sampleRate * 1; // 1s
-				
-				const bool requeue = missingSamples > maxSamplesPerIteration;
-				
-				// Write |missingSamples| samples of silence up to |maxSamplesPerIteration|
-				const float buffer[1024] = {};
-				
-				const qint64 silenceToWrite = std::min(missingSamples, maxSamplesPerIteration);
-				qint64 rest = silenceToWrite;
-				
-				for (; rest > 1024; rest -= 1024)
-					sf_write_float(ri->soundFile, buffer, 1024);
-
-				if (rest > 0)
-					sf_write_float(ri->soundFile, buffer, rest);
-				
-				ri->lastWrittenAbsoluteSample += silenceToWrite;
-				
-				if (requeue) {
-					// Requeue the writing for this buffer to keep thread responsive
-					QMutexLocker l(&m_bufferLock);
-					m_recordBuffer.prepend(rb);
-					continue;
-				}
+		foreach(boost::shared_ptr<RecordInfo> ri, m_recordInfo) {
+			if (!drainTrack(soundFileInfo, ri)) {
+				return;
 			}
-
-			// Write the audio buffer and update the timestamp in |ri|.
-			sf_write_float(ri->soundFile, rb->buffer.get(), rb->samples);
-			ri->lastWrittenAbsoluteSample += rb->samples;
 		}
 
-		m_sleepLock.unlock();
+		const int dropped = m_droppedSamples.fetchAndStoreRelaxed(0);
+		if (dropped > 0) {
+			qWarning() << "VoiceRecorder: dropped" << dropped << "samples, disk writes are too slow";
+		}
 	}
 	
 	m_recording = false;
-	{
-		QMutexLocker l(&m_bufferLock);
-		m_recordInfo.clear();
-		m_recordBuffer.clear();
+
+	// The audio thread may still be looking at the tracks, so only close
+	// the files here and leave freeing the tracks to the destructor.
+	foreach(boost::shared_ptr<RecordInfo> ri, m_recordInfo) {
+		if (ri->soundFile) {
+			sf_close(ri->soundFile);
+			ri->soundFile = NULL;
+		}
 	}
 	
 	emit recording_stopped();
@@ -414,10 +466,17 @@ void VoiceRecorder::prepareBufferAdds() {
 	// Should be ms accurat
 	m_absoluteSampleEstimation =
 	        (m_timestamp->elapsed() / 1000) * (m_config.sampleRate / 1000);
+
+	// Swap in the newest track table. Retire the old one before taking the
+	// pending one, see createRequestedTracks.
+	if (m_pendingTracks.fetchAndAddOrdered(0) != NULL) {
+		m_retiredTracks.fetchAndStoreRelease(m_audioTracks);
+		m_audioTracks = m_pendingTracks.fetchAndStoreAcquire(NULL);
+	}
 }
 
 void VoiceRecorder::addBuffer(const ClientUser *clientUser,
-                              boost::shared_array<float> buffer,
+                              const float *buffer,
                               int samples) {
 	
 	Q_ASSERT(!m_config.mixDownMode || clientUser == NULL);
@@ -425,28 +484,27 @@ void VoiceRecorder::addBuffer(const ClientUser *clientUser,
 	if (!m_recording)
 		return;
 	
-	// Create a new RecordInfo object if this is a new user.
 	const int index = indexForUser(clientUser);
 	
-	if (!m_recordInfo.contains(index)) {
-		boost::shared_ptr<RecordInfo> ri = boost::make_shared<RecordInfo>(
-		            m_config.mixDownMode ? QLatin1String("Mixdown")
-		                                 : clientUser->qsName);
-		
-		m_recordInfo.insert(index, ri);
+	RecordInfoMap::const_iterator it = m_audioTracks->constFind(index);
+	if (it == m_audioTracks->constEnd()) {
+		// New user. Creating the track means allocating its buffers, so ask
+		// the recorder thread to do it and drop the data until it is there.
+		// A full request ring just means we ask again with the next buffer.
+		m_trackRequests.write(&index, 1);
+		return;
 	}
+	RecordInfo *ri = it.value().get();
 
-	{
-		// Save the buffer in |qlRecordBuffer|.
-		QMutexLocker l(&m_bufferLock);
-		boost::shared_ptr<RecordBuffer> rb = boost::make_shared<RecordBuffer>(
-		            index, buffer, samples, m_absoluteSampleEstimation);
-		
-		m_recordBuffer << rb;
+	// The rings only fill up if the recorder thread fell seconds behind.
+	// Drop the data then; the gap gets padded with silence on disk.
+	if (ri->chunks.space() == 0 || !ri->samples.write(buffer, static_cast<unsigned int>(samples))) {
+		m_droppedSamples.fetchAndAddRelaxed(samples);
+		return;
 	}
 
-	// Tell the main loop that we have new audio data.
-	m_sleepCondition.wakeAll();
+	const RecordChunk chunk = { m_absoluteSampleEstimation, static_cast<unsigned int>(samples) };
+	ri->chunks.write(&chunk, 1);
 }
 
 quint64 VoiceRecorder::getElapsedTime() const {
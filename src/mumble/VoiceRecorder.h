@@ -34,11 +34,13 @@
 #define MUMBLE_MUMBLE_VOICERECORDER_H_
 
 #ifndef Q_MOC_RUN
+# include <boost/scoped_array.hpp>
 # include <boost/scoped_ptr.hpp>
-# include <boost/shared_array.hpp>
 #endif
 
 #include <sndfile.h>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
 #include <QtCore/QDateTime>
 #include <QtCore/QHash>
 #include <QtCore/QMutex>
@@ -46,6 +48,8 @@
 #include <QtCore/QThread>
 #include <QtCore/QWaitCondition>
 
+#include "RingBuffer.h"
+
 class ClientUser;
 class RecordUser;
 class Timer;
@@ -84,6 +88,10 @@ namespace VoiceRecorderFormat {
 /// which is then encoded using one of the formats of VoiceRecordingFormat::Format
 /// and written to disk.
 ///
+/// Every track has its own preallocated ring buffers, so addBuffer neither
+/// allocates nor locks. Tracks are created by the recorder thread, which also
+/// polls the rings and does all encoding and file I/O.
+///
 class VoiceRecorder : public QThread {
 		Q_OBJECT
 	public:
@@ -117,13 +125,16 @@ class VoiceRecorder : public QThread {
 		void stop(bool force = false);
 
 		/// Remembers the current time for a set of coming addBuffer calls
+		/// and picks up tracks the recorder thread created since the last call.
 		void prepareBufferAdds();
 		
-		/// Adds an audio buffer which contains |samples| audio samples to the recorder.
+		/// Copies |samples| audio samples from |buffer| into the recorder.
 		/// The audio data will be assumed to be recorded at the time
-		/// prepareBufferAdds was last called.
+		/// prepareBufferAdds was last called. Must only be called from the
+		/// audio output thread. Data for a user without a track is dropped
+		/// until the recorder thread has created one.
 		/// @param clientUser User for which to add the audio data. NULL in mixdown mode.
-		void addBuffer(const ClientUser *clientUser, boost::shared_array<float> buffer, int samples);
+		void addBuffer(const ClientUser *clientUser, const float *buffer, int samples);
 		
 		/// Returns the elapsed time since the recording started.
 		quint64 getElapsedTime() const;
@@ -144,30 +155,18 @@ signals:
 		
 	private:
 		
-		/// Stores information about a recording buffer.
-		struct RecordBuffer {
-			/// Constructs a new RecordBuffer object.
-			RecordBuffer(int recordInfoIndex_,
-			             boost::shared_array<float> buffer_,
-			             int samples_,
-			             quint64 absoluteStartSample_);
-
-			/// Hashmap index for the user
-			const int recordInfoIndex;
-
-			/// The buffer.
-			boost::shared_array<float> buffer;
-
-			/// The number of samples in the buffer.
-			int samples;
-
-			/// Absolute sample number at the start of this buffer
+		/// Describes a run of samples queued in a track's sample ring.
+		struct RecordChunk {
+			/// Absolute sample number at the start of this chunk
 			quint64 absoluteStartSample;
+
+			/// The number of samples in the chunk.
+			unsigned int samples;
 		};
 
 		/// Stores the recording state for one user.
 		struct RecordInfo {
-			RecordInfo(const QString& userName_);
+			RecordInfo(const QString& userName_, unsigned int capacity);
 			~RecordInfo();
 
 			/// Name of the user being recorded
@@ -178,6 +177,12 @@ signals:
 
 			/// The last absolute sample we wrote for this users
 			quint64 lastWrittenAbsoluteSample;
+
+			/// Audio data not yet written to disk.
+			RingBuffer<float> samples;
+
+			/// Timestamps for the data in |samples|, one per addBuffer call.
+			RingBuffer<RecordChunk> chunks;
 		};
 
 		typedef QHash< int, boost::shared_ptr<RecordInfo> > RecordInfoMap;
@@ -197,12 +202,42 @@ signals:
 		/// Opens the file for the given recording information
 		/// Helper function for run method. Will abort recording on failure.
 		bool ensureFileIsOpenedFor(SF_INFO &soundFileInfo, boost::shared_ptr<RecordInfo> &ri);
+
+		/// Creates tracks for the users addBuffer asked for and hands the new
+		/// track table to the audio thread. Helper function for run method.
+		void createRequestedTracks();
+
+		/// Writes all queued chunks of the given track to its file.
+		/// Helper function for run method. Returns false if recording was aborted.
+		bool drainTrack(SF_INFO &soundFileInfo, boost::shared_ptr<RecordInfo> &ri);
+
+		/// Appends |samples| samples of silence to the file of the given track.
+		void writeSilence(RecordInfo *ri, quint64 samples);
 		
 		/// Hash which maps the |uiSession| of all users for which we have to keep a recording state to the corresponding RecordInfo object.
+		/// Owned by the recorder thread.
 		RecordInfoMap m_recordInfo;
 
-		/// List containing all unprocessed RecordBuffer objects.
-		QList< boost::shared_ptr<RecordBuffer> > m_recordBuffer;
+		/// The audio thread's copy of |m_recordInfo|. Only the audio thread touches it.
+		RecordInfoMap *m_audioTracks;
+
+		/// Newer copy of |m_recordInfo| waiting for the audio thread to pick it up,
+		/// and the copy it replaced, which the recorder thread frees.
+		QAtomicPointer<RecordInfoMap> m_pendingTracks;
+		QAtomicPointer<RecordInfoMap> m_retiredTracks;
+
+		/// Indices of users addBuffer found no track for.
+		RingBuffer<int> m_trackRequests;
+
+		/// Number of tracks in the last table handed to the audio thread.
+		int m_publishedTracks;
+
+		/// Scratch buffer of |m_writeBufferSize| samples used by the recorder thread.
+		boost::scoped_array<float> m_writeBuffer;
+		unsigned int m_writeBufferSize;
+
+		/// Samples dropped because the recorder thread fell behind.
+		QAtomicInt m_droppedSamples;
 
 		/// The user which is used to record local audio.
 		boost::scoped_ptr<RecordUser> m_recordUser;
@@ -210,10 +245,7 @@ signals:
 		/// High precision timer for buffer timestamps.
 		boost::scoped_ptr<Timer> m_timestamp;
 
-		/// Protects the buffer list |qlRecordBuffer|.
-		QMutex m_bufferLock;
-
-		/// Wait condition and mutex to block until there is new data.
+		/// Wait condition and mutex the recorder thread sleeps on between polls.
 		QMutex m_sleepLock;
 		QWaitCondition m_sleepCondition;
 
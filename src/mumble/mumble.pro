@@ -98,6 +98,7 @@ HEADERS *= BanEditor.h \
     AudioOutputSample.h \
     AudioOutputSpeech.h \
     AudioOutputUser.h \
+    AudioKernels.h \
     CELTCodec.h \
     CustomElements.h \
     MainWindow.h \
@@ -108,10 +109,13 @@ HEADERS *= BanEditor.h \
     TextToSpeech.h \
     Settings.h \
     Database.h \
+    BlobCache.h \
     VersionCheck.h \
     Global.h \
     UserModel.h \
     Audio.h \
+    Resampler.h \
+    RingBuffer.h \
     ConfigDialog.h \
     Plugins.h \
     PTTButtonWidget.h \
@@ -162,6 +166,8 @@ SOURCES *= BanEditor.cpp \
     AudioOutputSample.cpp \
     AudioOutputSpeech.cpp \
     AudioOutputUser.cpp \
+    AudioKernels.cpp \
+    Resampler.cpp \
     main.cpp \
     CELTCodec.cpp \
     CustomElements.cpp \
@@ -171,6 +177,7 @@ SOURCES *= BanEditor.cpp \
     ConnectDialog.cpp \
     Settings.cpp \
     Database.cpp \
+    BlobCache.cpp \
     VersionCheck.cpp \
     Global.cpp \
     UserModel.cpp \
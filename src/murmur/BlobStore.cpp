@@ -0,0 +1,302 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "BlobStore.h"
+
+#include "Message.h"
+
+BlobStore::Entry::Entry() {
+	bText = false;
+	bResident = false;
+	bSpilled = false;
+	iRefs = 0;
+	iSize = 0;
+	uiStamp = 0;
+	uiSpillStamp = 0;
+}
+
+BlobStore::BlobStore() {
+	uiStamp = 0;
+	iCacheLimit = 8 * 1024 * 1024;
+	iSpillLimit = 64 * 1024 * 1024;
+	iResidentBytes = iCachedBytes = iSpilledBytes = 0;
+	bSpill = false;
+}
+
+void BlobStore::setLimits(qint64 cache, qint64 spill) {
+	QMutexLocker lock(&qmMutex);
+
+	iCacheLimit = qMax(cache, Q_INT64_C(0));
+	iSpillLimit = qMax(spill, Q_INT64_C(0));
+	evict();
+}
+
+void BlobStore::setSpillPath(const QString &path) {
+	QMutexLocker lock(&qmMutex);
+
+	bSpill = false;
+	if (path.isEmpty())
+		return;
+
+	qdSpill = QDir(path);
+	if (! qdSpill.exists() && ! qdSpill.mkpath(QLatin1String("."))) {
+		qWarning("BlobStore: Failed to create spill directory %s", qPrintable(path));
+		return;
+	}
+	bSpill = true;
+
+	// Oldest first, so that the spill order resumes where the last run left it.
+	foreach(const QFileInfo &qfi, qdSpill.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed)) {
+		const QString &name = qfi.fileName();
+		if (name.endsWith(QLatin1String(".tmp"))) {
+			QFile::remove(qfi.absoluteFilePath());
+			continue;
+		}
+
+		const QByteArray &hash = QByteArray::fromHex(name.toLatin1());
+		if ((hash.size() != 20) || (name.length() != 40) || qhEntries.contains(hash))
+			continue;
+
+		Entry &e = qhEntries[hash];
+		e.iSize = static_cast<int>(qfi.size());
+		e.bSpilled = true;
+		e.uiSpillStamp = ++uiStamp;
+		qmSpilled.insert(e.uiSpillStamp, hash);
+		iSpilledBytes += e.iSize;
+	}
+	evict();
+}
+
+QString BlobStore::spillFile(const QByteArray &hash) const {
+	return qdSpill.absoluteFilePath(QString::fromLatin1(hash.toHex()));
+}
+
+BlobStore::Entry &BlobStore::acquire(const QByteArray &hash, int size) {
+	Entry &e = qhEntries[hash];
+	if ((e.iRefs == 0) && (e.uiStamp != 0)) {
+		qmCached.remove(e.uiStamp);
+		iCachedBytes -= e.iSize;
+		e.uiStamp = 0;
+	}
+	if (! e.bResident) {
+		e.iSize = size;
+		e.bResident = true;
+		iResidentBytes += e.iSize;
+	}
+	++e.iRefs;
+	return e;
+}
+
+QByteArray BlobStore::intern(QByteArray &data) {
+	const QByteArray &hash = sha1(data);
+
+	QMutexLocker lock(&qmMutex);
+
+	Entry &e = acquire(hash, data.size());
+	if (! e.qbaData.isNull())
+		data = e.qbaData;
+	else
+		e.qbaData = data;
+	return hash;
+}
+
+QByteArray BlobStore::intern(QString &text) {
+	const QByteArray &utf8 = text.toUtf8();
+	const QByteArray &hash = sha1(utf8);
+
+	QMutexLocker lock(&qmMutex);
+
+	Entry &e = acquire(hash, utf8.size());
+	e.bText = true;
+	if (! e.qsText.isNull())
+		text = e.qsText;
+	else
+		e.qsText = text;
+	return hash;
+}
+
+void BlobStore::release(const QByteArray &hash) {
+	QMutexLocker lock(&qmMutex);
+
+	QHash<QByteArray, Entry>::iterator i = qhEntries.find(hash);
+	if ((i == qhEntries.end()) || (i->iRefs <= 0))
+		return;
+
+	if (--i->iRefs == 0) {
+		iCachedBytes += i->iSize;
+		touch(hash, *i);
+		evict();
+	}
+}
+
+bool BlobStore::value(const QByteArray &hash, QByteArray &data) {
+	QMutexLocker lock(&qmMutex);
+
+	QHash<QByteArray, Entry>::iterator i = qhEntries.find(hash);
+	if (i == qhEntries.end())
+		return false;
+
+	Entry &e = *i;
+	if (! e.bResident) {
+		if (! load(hash, e)) {
+			qWarning("BlobStore: Discarding unreadable blob %s", hash.toHex().constData());
+			unspill(hash, e);
+			qhEntries.erase(i);
+			return false;
+		}
+		e.bResident = true;
+		iResidentBytes += e.iSize;
+		iCachedBytes += e.iSize;
+	}
+
+	if (e.qbaData.isNull())
+		e.qbaData = e.qsText.toUtf8();
+	data = e.qbaData;
+
+	if (e.bSpilled) {
+		qmSpilled.remove(e.uiSpillStamp);
+		e.uiSpillStamp = ++uiStamp;
+		qmSpilled.insert(e.uiSpillStamp, hash);
+	}
+	if (e.iRefs == 0) {
+		touch(hash, e);
+		evict();
+	}
+	return true;
+}
+
+void BlobStore::touch(const QByteArray &hash, Entry &e) {
+	if (e.uiStamp != 0)
+		qmCached.remove(e.uiStamp);
+	e.uiStamp = ++uiStamp;
+	qmCached.insert(e.uiStamp, hash);
+}
+
+bool BlobStore::load(const QByteArray &hash, Entry &e) {
+	if (! e.bSpilled)
+		return false;
+
+	QFile f(spillFile(hash));
+	if (! f.open(QIODevice::ReadOnly))
+		return false;
+
+	const QByteArray &data = f.readAll();
+	if (sha1(data) != hash)
+		return false;
+
+	e.qbaData = data;
+	e.iSize = data.size();
+	if (e.bText)
+		e.qsText = QString::fromUtf8(data);
+	return true;
+}
+
+void BlobStore::spill(const QByteArray &hash, Entry &e) {
+	if (! bSpill || e.bSpilled || (e.iSize > iSpillLimit))
+		return;
+
+	const QString &fname = spillFile(hash);
+	const QString &tmpname = fname + QLatin1String(".tmp");
+
+	QFile f(tmpname);
+	if (! f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qWarning("BlobStore: Failed to open %s for writing", qPrintable(tmpname));
+		return;
+	}
+
+	const QByteArray &data = e.qbaData.isNull() ? e.qsText.toUtf8() : e.qbaData;
+	const bool ok = (f.write(data) == data.size());
+	f.close();
+
+	QFile::remove(fname);
+	if (! ok || ! QFile::rename(tmpname, fname)) {
+		qWarning("BlobStore: Failed to spill blob to %s", qPrintable(fname));
+		QFile::remove(tmpname);
+		return;
+	}
+
+	e.bSpilled = true;
+	e.uiSpillStamp = ++uiStamp;
+	qmSpilled.insert(e.uiSpillStamp, hash);
+	iSpilledBytes += e.iSize;
+}
+
+void BlobStore::unspill(const QByteArray &hash, Entry &e) {
+	if (! e.bSpilled)
+		return;
+
+	QFile::remove(spillFile(hash));
+	qmSpilled.remove(e.uiSpillStamp);
+	iSpilledBytes -= e.iSize;
+	e.bSpilled = false;
+	e.uiSpillStamp = 0;
+}
+
+void BlobStore::evict() {
+	while ((iCachedBytes > iCacheLimit) && ! qmCached.isEmpty()) {
+		const QByteArray hash = qmCached.begin().value();
+		qmCached.erase(qmCached.begin());
+
+		QHash<QByteArray, Entry>::iterator i = qhEntries.find(hash);
+		Entry &e = *i;
+		e.uiStamp = 0;
+		iCachedBytes -= e.iSize;
+		iResidentBytes -= e.iSize;
+
+		spill(hash, e);
+
+		e.bResident = false;
+		e.qbaData = QByteArray();
+		e.qsText = QString();
+		if (! e.bSpilled)
+			qhEntries.erase(i);
+	}
+
+	while ((iSpilledBytes > iSpillLimit) && ! qmSpilled.isEmpty()) {
+		const QByteArray hash = qmSpilled.begin().value();
+
+		QHash<QByteArray, Entry>::iterator i = qhEntries.find(hash);
+		Entry &e = *i;
+		unspill(hash, e);
+		if (! e.bResident)
+			qhEntries.erase(i);
+	}
+}
+
+void BlobStore::statistics(int &entries, qint64 &resident, qint64 &cached, qint64 &spilled) const {
+	QMutexLocker lock(&qmMutex);
+
+	entries = qhEntries.count();
+	resident = iResidentBytes;
+	cached = iCachedBytes;
+	spilled = iSpilledBytes;
+}
@@ -0,0 +1,117 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_BLOBSTORE_H_
+#define MUMBLE_MURMUR_BLOBSTORE_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDir>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+/// Process-wide, content-addressed store for user textures, user comments
+/// and channel descriptions.
+///
+/// Blobs are keyed by their SHA1 (the same hash that is sent to clients) and
+/// reference counted by the users and channels holding them. Interning a blob
+/// that is already known hands out the stored copy, so identical avatars and
+/// comments share a single buffer across all virtual servers.
+///
+/// Blobs nobody references any longer are kept as a cache, bounded by a
+/// memory budget in least-recently-used order. Entries pushed out of memory
+/// are written to the spill directory (if one is configured), which is itself
+/// bounded and survives restarts. A cached or spilled blob lets authenticate
+/// skip loading a texture whose hash the database already knows.
+class BlobStore {
+	private:
+		Q_DISABLE_COPY(BlobStore)
+	protected:
+		struct Entry {
+			QByteArray qbaData;
+			QString qsText;
+			bool bText;
+			bool bResident;
+			bool bSpilled;
+			int iRefs;
+			int iSize;
+			quint64 uiStamp;
+			quint64 uiSpillStamp;
+			Entry();
+		};
+
+		mutable QMutex qmMutex;
+		QHash<QByteArray, Entry> qhEntries;
+		/// Unreferenced resident entries, oldest first.
+		QMap<quint64, QByteArray> qmCached;
+		/// Spilled entries, oldest first.
+		QMap<quint64, QByteArray> qmSpilled;
+		quint64 uiStamp;
+
+		qint64 iCacheLimit, iSpillLimit;
+		qint64 iResidentBytes, iCachedBytes, iSpilledBytes;
+		QDir qdSpill;
+		bool bSpill;
+
+		Entry &acquire(const QByteArray &hash, int size);
+		void touch(const QByteArray &hash, Entry &e);
+		void spill(const QByteArray &hash, Entry &e);
+		void unspill(const QByteArray &hash, Entry &e);
+		bool load(const QByteArray &hash, Entry &e);
+		void evict();
+		QString spillFile(const QByteArray &hash) const;
+	public:
+		BlobStore();
+
+		/// Sets the memory budget for unreferenced blobs and the size
+		/// limit of the spill directory, both in bytes.
+		void setLimits(qint64 cache, qint64 spill);
+		/// Sets the spill directory. An empty path disables spilling.
+		/// Blobs left behind by a previous run are picked up again.
+		void setSpillPath(const QString &path);
+
+		/// Interns @p data, replacing it with the stored copy if the blob
+		/// is already known, and takes a reference on it.
+		/// @return The SHA1 of the blob.
+		QByteArray intern(QByteArray &data);
+		QByteArray intern(QString &text);
+		/// Drops a reference taken by intern().
+		void release(const QByteArray &hash);
+
+		/// Looks up a blob without taking a reference, reloading it from
+		/// the spill directory if needed.
+		/// @return false if the blob is unknown.
+		bool value(const QByteArray &hash, QByteArray &data);
+
+		void statistics(int &entries, qint64 &resident, qint64 &cached, qint64 &spilled) const;
+};
+
+#endif
@@ -34,6 +34,7 @@
 
 #include "Connection.h"
 #include "Message.h"
+#include "Metrics.h"
 #include "Server.h"
 #include "ServerUser.h"
 #include "ServerDB.h"
@@ -338,7 +339,16 @@ void MurmurDBus::authenticateSlot(int &res, QString &uname, int sessionId, const
 
 #define CHANNEL_SETUP_VAR(var) CHANNEL_SETUP_VAR2(cChannel,var)
 
+// Times the incoming call for the metrics and the slow handler log.
+#define DBUS_TIMER(name, server_id) \
+  static const int iMetricsLabel = Metrics::label(Metrics::DBusCall, name); \
+  HandlerTimer htCall(iMetricsLabel, server_id)
+
+#define MURMUR_DBUS_TIMER(x) DBUS_TIMER("Murmur." x, server->iServerNum)
+#define META_DBUS_TIMER(x) DBUS_TIMER("Meta." x, -1)
+
 void MurmurDBus::getPlayers(QList<PlayerInfoExtended> &a) {
+	MURMUR_DBUS_TIMER("getPlayers");
 	a.clear();
 	foreach(ServerUser *p, server->qhUsers) {
 		if (static_cast<ServerUser *>(p)->sState == ServerUser::Authenticated)
@@ -347,6 +357,7 @@ void MurmurDBus::getPlayers(QList<PlayerInfoExtended> &a) {
 }
 
 void MurmurDBus::getChannels(QList<ChannelInfo> &a) {
+	MURMUR_DBUS_TIMER("getChannels");
 	a.clear();
 	QQueue<Channel *> q;
 	q << server->qhChannels.value(0);
@@ -359,6 +370,7 @@ void MurmurDBus::getChannels(QList<ChannelInfo> &a) {
 }
 
 void MurmurDBus::kickPlayer(unsigned int session, const QString &reason, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("kickPlayer");
 	PLAYER_SETUP;
 	Connection *c = server->qhUsers.value(session);
 	if (!c)
@@ -372,11 +384,13 @@ void MurmurDBus::kickPlayer(unsigned int session, const QString &reason, const Q
 }
 
 void MurmurDBus::getPlayerState(unsigned int session, const QDBusMessage &msg, PlayerInfo &pi) {
+	MURMUR_DBUS_TIMER("getPlayerState");
 	PLAYER_SETUP;
 	pi = PlayerInfo(pUser);
 }
 
 void MurmurDBus::setPlayerState(const PlayerInfo &npi, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("setPlayerState");
 	PLAYER_SETUP_VAR(npi.session);
 	CHANNEL_SETUP_VAR(npi.channel);
 	PlayerInfo pi(pUser);
@@ -385,18 +399,21 @@ void MurmurDBus::setPlayerState(const PlayerInfo &npi, const QDBusMessage &msg)
 }
 
 void MurmurDBus::sendMessage(unsigned int session, const QString &text, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("sendMessage");
 	PLAYER_SETUP;
 
 	server->sendTextMessage(NULL, pUser, false, text);
 }
 
 void MurmurDBus::sendMessageChannel(int id, bool tree, const QString &text, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("sendMessageChannel");
 	CHANNEL_SETUP_VAR(id);
 
 	server->sendTextMessage(cChannel, NULL, tree, text);
 }
 
 void MurmurDBus::addChannel(const QString &name, int chanparent, const QDBusMessage &msg, int &newid) {
+	MURMUR_DBUS_TIMER("addChannel");
 	CHANNEL_SETUP_VAR(chanparent);
 
 	Channel *nc = server->addChannel(cChannel, name);
@@ -411,6 +428,7 @@ void MurmurDBus::addChannel(const QString &name, int chanparent, const QDBusMess
 }
 
 void MurmurDBus::removeChannel(int id, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("removeChannel");
 	CHANNEL_SETUP_VAR(id);
 	if (!cChannel->cParent) {
 		qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.channel", "Invalid channel id"));
@@ -420,11 +438,13 @@ void MurmurDBus::removeChannel(int id, const QDBusMessage &msg) {
 }
 
 void MurmurDBus::getChannelState(int id, const QDBusMessage &msg, ChannelInfo &state) {
+	MURMUR_DBUS_TIMER("getChannelState");
 	CHANNEL_SETUP_VAR(id);
 	state = ChannelInfo(cChannel);
 }
 
 void MurmurDBus::setChannelState(const ChannelInfo &nci, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("setChannelState");
 	CHANNEL_SETUP_VAR(nci.id);
 	CHANNEL_SETUP_VAR2(cParent, nci.parent);
 
@@ -441,6 +461,7 @@ void MurmurDBus::setChannelState(const ChannelInfo &nci, const QDBusMessage &msg
 }
 
 void MurmurDBus::getACL(int id, const QDBusMessage &msg, QList<ACLInfo> &acls, QList<GroupInfo> &groups, bool &inherit) {
+	MURMUR_DBUS_TIMER("getACL");
 	CHANNEL_SETUP_VAR(id);
 
 	QStack<Channel *> chans;
@@ -497,6 +518,7 @@ void MurmurDBus::getACL(int id, const QDBusMessage &msg, QList<ACLInfo> &acls, Q
 }
 
 void MurmurDBus::setACL(int id, const QList<ACLInfo> &acls, const QList<GroupInfo> &groups, bool inherit, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("setACL");
 	CHANNEL_SETUP_VAR(id);
 
 	Group *g;
@@ -541,6 +563,7 @@ void MurmurDBus::setACL(int id, const QList<ACLInfo> &acls, const QList<GroupInf
 }
 
 void MurmurDBus::getBans(QList<BanInfo> &bi) {
+	MURMUR_DBUS_TIMER("getBans");
 	bi.clear();
 	foreach(const Ban &b, server->qlBans) {
 		if (! b.haAddress.isV6())
@@ -549,9 +572,11 @@ void MurmurDBus::getBans(QList<BanInfo> &bi) {
 }
 
 void MurmurDBus::setBans(const QList<BanInfo> &, const QDBusMessage &) {
+	MURMUR_DBUS_TIMER("setBans");
 }
 
 void MurmurDBus::getPlayerNames(const QList<int> &ids, const QDBusMessage &, QStringList &names) {
+	MURMUR_DBUS_TIMER("getPlayerNames");
 	names.clear();
 	foreach(int id, ids) {
 		names << server->getUserName(id);
@@ -559,6 +584,7 @@ void MurmurDBus::getPlayerNames(const QList<int> &ids, const QDBusMessage &, QSt
 }
 
 void MurmurDBus::getPlayerIds(const QStringList &names, const QDBusMessage &, QList<int> &ids) {
+	MURMUR_DBUS_TIMER("getPlayerIds");
 	ids.clear();
 	foreach(QString name, names) {
 		ids << server->getUserID(name);
@@ -566,6 +592,7 @@ void MurmurDBus::getPlayerIds(const QStringList &names, const QDBusMessage &, QL
 }
 
 void MurmurDBus::registerPlayer(const QString &name, const QDBusMessage &msg, int &id) {
+	MURMUR_DBUS_TIMER("registerPlayer");
 	QMap<int, QString> info;
 	info.insert(ServerDB::User_Name, name);
 	id = server->registerUser(info);
@@ -576,6 +603,7 @@ void MurmurDBus::registerPlayer(const QString &name, const QDBusMessage &msg, in
 }
 
 void MurmurDBus::unregisterPlayer(int id, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("unregisterPlayer");
 	if (! server->unregisterUser(id)) {
 		qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.playerid", "Invalid player id"));
 		return;
@@ -583,6 +611,7 @@ void MurmurDBus::unregisterPlayer(int id, const QDBusMessage &msg) {
 }
 
 void MurmurDBus::getRegistration(int id, const QDBusMessage &msg, RegisteredPlayer &user) {
+	MURMUR_DBUS_TIMER("getRegistration");
 	QMap<int, QString> info = server->getRegistration(id);
 	if (info.isEmpty()) {
 		qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.playerid", "Invalid player id"));
@@ -595,6 +624,7 @@ void MurmurDBus::getRegistration(int id, const QDBusMessage &msg, RegisteredPlay
 }
 
 void MurmurDBus::setRegistration(int id, const QString &name, const QString &email, const QString &pw, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("setRegistration");
 	RegisteredPlayer user;
 	user.id = id;
 	user.name = name;
@@ -604,6 +634,7 @@ void MurmurDBus::setRegistration(int id, const QString &name, const QString &ema
 }
 
 void MurmurDBus::updateRegistration(const RegisteredPlayer &user, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("updateRegistration");
 	QMap<int, QString> info;
 
 	if (! user.name.isEmpty())
@@ -622,6 +653,7 @@ void MurmurDBus::updateRegistration(const RegisteredPlayer &user, const QDBusMes
 }
 
 void MurmurDBus::getTexture(int id, const QDBusMessage &msg, QByteArray &texture) {
+	MURMUR_DBUS_TIMER("getTexture");
 	if (! server->isUserId(id)) {
 		qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.playerid", "Invalid player id"));
 		return;
@@ -630,6 +662,7 @@ void MurmurDBus::getTexture(int id, const QDBusMessage &msg, QByteArray &texture
 }
 
 void MurmurDBus::setTexture(int id, const QByteArray &texture, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("setTexture");
 	if (! server->isUserId(id)) {
 		qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.playerid", "Invalid player id"));
 		return;
@@ -641,6 +674,7 @@ void MurmurDBus::setTexture(int id, const QByteArray &texture, const QDBusMessag
 }
 
 void MurmurDBus::getRegisteredPlayers(const QString &filter, QList<RegisteredPlayer> &users) {
+	MURMUR_DBUS_TIMER("getRegisteredPlayers");
 	users.clear();
 	QMap<int, QString > l = server->getRegisteredUsers(filter);
 	QMap<int, QString >::const_iterator i;
@@ -653,6 +687,7 @@ void MurmurDBus::getRegisteredPlayers(const QString &filter, QList<RegisteredPla
 }
 
 void MurmurDBus::verifyPassword(int id, const QString &pw, const QDBusMessage &msg, bool &ok) {
+	MURMUR_DBUS_TIMER("verifyPassword");
 	QList<int> ids;
 	ids << id;
 	QStringList names;
@@ -676,6 +711,7 @@ void MurmurDBus::verifyPassword(int id, const QString &pw, const QDBusMessage &m
 #endif
 
 void MurmurDBus::setAuthenticator(const QDBusObjectPath &path, bool reentrant, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("setAuthenticator");
 	if (! qsAuthPath.isNull() || ! qsAuthService.isNull())
 		removeAuthenticator();
 	server->connectAuthenticator(this);
@@ -699,6 +735,7 @@ void MurmurDBus::setAuthenticator(const QDBusObjectPath &path, bool reentrant, c
 }
 
 void MurmurDBus::setTemporaryGroups(int channel, int userid, const QStringList &groups, const QDBusMessage &msg) {
+	MURMUR_DBUS_TIMER("setTemporaryGroups");
 	CHANNEL_SETUP_VAR(channel);
 
 	server->setTempGroups(userid, 0, cChannel, groups);
@@ -809,6 +846,7 @@ void MetaDBus::stopped(Server *s) {
 }
 
 void MetaDBus::start(int server_id, const QDBusMessage &msg) {
+	META_DBUS_TIMER("start");
 	if (meta->qhServers.contains(server_id)) {
 		MurmurDBus::qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.booted", "Server already booted"));
 	} else if (! ServerDB::serverExists(server_id)) {
@@ -819,6 +857,7 @@ void MetaDBus::start(int server_id, const QDBusMessage &msg) {
 }
 
 void MetaDBus::stop(int server_id, const QDBusMessage &msg) {
+	META_DBUS_TIMER("stop");
 	if (! meta->qhServers.contains(server_id)) {
 		MurmurDBus::qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.booted", "Server not booted"));
 	} else {
@@ -827,10 +866,12 @@ void MetaDBus::stop(int server_id, const QDBusMessage &msg) {
 }
 
 void MetaDBus::newServer(int &server_id) {
+	META_DBUS_TIMER("newServer");
 	server_id = ServerDB::addServer();
 }
 
 void MetaDBus::deleteServer(int server_id, const QDBusMessage &msg) {
+	META_DBUS_TIMER("deleteServer");
 	if (meta->qhServers.contains(server_id)) {
 		MurmurDBus::qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.booted", "Server is running"));
 	} else if (! ServerDB::serverExists(server_id)) {
@@ -841,18 +882,22 @@ void MetaDBus::deleteServer(int server_id, const QDBusMessage &msg) {
 }
 
 void MetaDBus::getBootedServers(QList<int> &server_list) {
+	META_DBUS_TIMER("getBootedServers");
 	server_list = meta->qhServers.keys();
 }
 
 void MetaDBus::getAllServers(QList<int> &server_list) {
+	META_DBUS_TIMER("getAllServers");
 	server_list = ServerDB::getAllServers();
 }
 
 void MetaDBus::isBooted(int server_id, bool &booted) {
+	META_DBUS_TIMER("isBooted");
 	booted = meta->qhServers.contains(server_id);
 }
 
 void MetaDBus::getConf(int server_id, const QString &key, const QDBusMessage &msg, QString &value) {
+	META_DBUS_TIMER("getConf");
 	if (! ServerDB::serverExists(server_id)) {
 		MurmurDBus::qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.server", "Invalid server id"));
 	} else {
@@ -861,17 +906,21 @@ void MetaDBus::getConf(int server_id, const QString &key, const QDBusMessage &ms
 }
 
 void MetaDBus::setConf(int server_id, const QString &key, const QString &value, const QDBusMessage &msg) {
+	META_DBUS_TIMER("setConf");
 	if (! ServerDB::serverExists(server_id)) {
 		MurmurDBus::qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.server", "Invalid server id"));
 	} else {
 		ServerDB::setConf(server_id, key, value);
 		Server *s = meta->qhServers.value(server_id);
-		if (s)
+		if (s && (s->thread() != thread()))
+			QCoreApplication::instance()->postEvent(s, new ExecEvent(boost::bind(&Server::setLiveConf, s, key, value)));
+		else if (s)
 			s->setLiveConf(key, value);
 	}
 }
 
 void MetaDBus::getAllConf(int server_id, const QDBusMessage &msg, ConfigMap &values) {
+	META_DBUS_TIMER("getAllConf");
 	if (! ServerDB::serverExists(server_id)) {
 		MurmurDBus::qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.server", "Invalid server id"));
 	} else {
@@ -880,6 +929,7 @@ void MetaDBus::getAllConf(int server_id, const QDBusMessage &msg, ConfigMap &val
 }
 
 void MetaDBus::getLog(int server_id, int min_offset, int max_offset, const QDBusMessage &msg, QList<LogEntry> &entries) {
+	META_DBUS_TIMER("getLog");
 	if (! ServerDB::serverExists(server_id)) {
 		MurmurDBus::qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.server", "Invalid server id"));
 	} else {
@@ -892,10 +942,12 @@ void MetaDBus::getLog(int server_id, int min_offset, int max_offset, const QDBus
 }
 
 void MetaDBus::getDefaultConf(ConfigMap &values) {
+	META_DBUS_TIMER("getDefaultConf");
 	values = Meta::mp.qmConfig;
 }
 
 void MetaDBus::setSuperUserPassword(int server_id, const QString &pw, const QDBusMessage &msg) {
+	META_DBUS_TIMER("setSuperUserPassword");
 	if (! ServerDB::serverExists(server_id)) {
 		MurmurDBus::qdbc.send(msg.createErrorReply("net.sourceforge.mumble.Error.server", "Invalid server id"));
 	} else {
@@ -904,10 +956,17 @@ void MetaDBus::setSuperUserPassword(int server_id, const QString &pw, const QDBu
 }
 
 void MetaDBus::quit() {
+	META_DBUS_TIMER("quit");
 	qCritical("Quit requested from D-Bus");
 	QCoreApplication::instance()->quit();
 }
 
 void MetaDBus::getVersion(int &major, int &minor, int &patch, QString &text) {
+	META_DBUS_TIMER("getVersion");
 	Meta::getVersion(major, minor, patch, text);
 }
+
+void MetaDBus::getMetrics(QString &text) {
+	META_DBUS_TIMER("getMetrics");
+	text = QString::fromUtf8(Metrics::prometheus());
+}
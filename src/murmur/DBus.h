@@ -251,6 +251,7 @@ class MetaDBus : public QDBusAbstractAdaptor {
 		void setSuperUserPassword(int server_id, const QString &pw, const QDBusMessage &);
 		void getLog(int server_id, int min_offset, int max_offset, const QDBusMessage &, QList<LogEntry> &entries);
 		void getVersion(int &major, int &minor, int &patch, QString &string);
+		void getMetrics(QString &text);
 		void quit();
 	signals:
 		void started(int server_id);
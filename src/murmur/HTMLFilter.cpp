@@ -0,0 +1,425 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Also built into the TextFilter benchmark in src/tests, so this doesn't
+// use the precompiled header.
+#include <QtCore/QString>
+#include <QtCore/QVarLengthArray>
+
+#include <string.h>
+
+#include "HTMLFilter.h"
+
+static inline bool isValidChar(uint c) {
+	if (c < 0x20)
+		return (c == 0x9) || (c == 0xa) || (c == 0xd);
+	if (c < 0xd800)
+		return true;
+	if (c < 0xe000)
+		return false;
+	return (c != 0xfffe) && (c != 0xffff) && (c <= 0x10ffff);
+}
+
+static inline bool isNameStart(QChar c) {
+	return c.isLetter() || (c == QLatin1Char('_')) || (c == QLatin1Char(':'));
+}
+
+static inline bool isNameChar(QChar c) {
+	return c.isLetterOrNumber() || (c == QLatin1Char('-')) || (c == QLatin1Char('.')) || (c == QLatin1Char('_')) || (c == QLatin1Char(':')) || (c.unicode() == 0xb7);
+}
+
+static inline bool isSpace(QChar c) {
+	const ushort u = c.unicode();
+	return (u == 0x20) || (u == 0x9) || (u == 0xa) || (u == 0xd);
+}
+
+static inline bool equals(const QChar *p, int len, const char *s) {
+	int i;
+	for (i = 0; i < len; ++i)
+		if (! s[i] || (p[i].unicode() != static_cast<unsigned char>(s[i])))
+			return false;
+	return s[i] == 0;
+}
+
+static inline bool startsWith(const QChar *p, int avail, const char *s) {
+	for (int i = 0; s[i]; ++i)
+		if ((i >= avail) || (p[i].unicode() != static_cast<unsigned char>(s[i])))
+			return false;
+	return true;
+}
+
+/// Finds @p s at or after @p from, returning its position or -1.
+static int find(const QChar *p, int n, int from, const char *s) {
+	const ushort first = static_cast<unsigned char>(s[0]);
+	for (int i = from; i < n; ++i)
+		if ((p[i].unicode() == first) && startsWith(p + i, n - i, s))
+			return i;
+	return -1;
+}
+
+static inline int skipSpace(const QChar *p, int n, int i) {
+	while ((i < n) && isSpace(p[i]))
+		++i;
+	return i;
+}
+
+static inline int scanName(const QChar *p, int n, int i) {
+	if ((i >= n) || ! isNameStart(p[i]))
+		return i;
+	++i;
+	while ((i < n) && isNameChar(p[i]))
+		++i;
+	return i;
+}
+
+/// Parses the entity or character reference starting at p[i] == '&'.
+/// On success, advances @p i past the ';' and stores the character in @p ucs.
+static bool scanReference(const QChar *p, int n, int &i, uint &ucs) {
+	int j = i + 1;
+	if ((j < n) && (p[j] == QLatin1Char('#'))) {
+		++j;
+		uint base = 10;
+		if ((j < n) && (p[j] == QLatin1Char('x'))) {
+			base = 16;
+			++j;
+		}
+		const int start = j;
+		ucs = 0;
+		for (; (j < n) && (p[j] != QLatin1Char(';')); ++j) {
+			const ushort d = p[j].unicode();
+			uint v;
+			if ((d >= '0') && (d <= '9'))
+				v = d - '0';
+			else if ((base == 16) && (d >= 'a') && (d <= 'f'))
+				v = d - 'a' + 10;
+			else if ((base == 16) && (d >= 'A') && (d <= 'F'))
+				v = d - 'A' + 10;
+			else
+				return false;
+			ucs = ucs * base + v;
+			if (ucs > 0x10ffff)
+				return false;
+		}
+		if ((j >= n) || (j == start) || ! isValidChar(ucs))
+			return false;
+	} else {
+		const int start = j;
+		while ((j < n) && (j - start < 5) && (p[j] != QLatin1Char(';')))
+			++j;
+		if ((j >= n) || (p[j] != QLatin1Char(';')))
+			return false;
+		const QChar *name = p + start;
+		const int len = j - start;
+		if (equals(name, len, "amp"))
+			ucs = '&';
+		else if (equals(name, len, "lt"))
+			ucs = '<';
+		else if (equals(name, len, "gt"))
+			ucs = '>';
+		else if (equals(name, len, "quot"))
+			ucs = '"';
+		else if (equals(name, len, "apos"))
+			ucs = '\'';
+		else
+			return false;
+	}
+	i = j + 1;
+	return true;
+}
+
+typedef QVarLengthArray<int, 32> NameList;
+
+/// Whether @p a and @p b, given as (offset, length) into p, are the same name.
+static inline bool sameName(const QChar *p, int a, int alen, int b, int blen) {
+	return (alen == blen) && (memcmp(p + a, p + b, alen * sizeof(QChar)) == 0);
+}
+
+/// Checks that the prefix of the qualified name at p[off], if it has one, is
+/// "xml" or declared in @p prefixes, which holds (offset, length) pairs.
+/// Attributes may also use the "xmlns" prefix to declare one.
+static bool prefixDeclared(const QChar *p, int off, int len, const NameList &prefixes, bool attribute) {
+	int colon = 0;
+	while ((colon < len) && (p[off + colon] != QLatin1Char(':')))
+		++colon;
+	if (colon == len)
+		return true;
+	if (equals(p + off, colon, "xml") || (attribute && equals(p + off, colon, "xmlns")))
+		return true;
+	for (int k = 0; k < prefixes.size(); k += 2)
+		if (sameName(p, prefixes[k], prefixes[k + 1], off, colon))
+			return true;
+	return false;
+}
+
+/// Plain text sink that collapses whitespace the way QString::simplified() does.
+class PlainText {
+	protected:
+		QString *qsOut;
+		bool bSpace;
+	public:
+		PlainText(QString *out) : qsOut(out), bSpace(false) {
+		}
+		inline void append(QChar c) {
+			if (c.isSpace()) {
+				bSpace = true;
+				return;
+			}
+			if (bSpace && ! qsOut->isEmpty())
+				qsOut->append(QLatin1Char(' '));
+			bSpace = false;
+			qsOut->append(c);
+		}
+		inline void append(uint ucs) {
+			if (ucs > 0xffff) {
+				append(QChar(QChar::highSurrogate(ucs)));
+				append(QChar(QChar::lowSurrogate(ucs)));
+			} else {
+				append(QChar(static_cast<ushort>(ucs)));
+			}
+		}
+		inline void space() {
+			bSpace = true;
+		}
+};
+
+/// Scans @p html in a single pass. Character data is passed to @p plain if
+/// given; the characters taken up by img src attributes (including the
+/// whitespace before them) are added to @p stripped if given.
+static bool scan(const QString &html, PlainText *plain, int *stripped) {
+	const QChar *p = html.unicode();
+	const int n = html.length();
+
+	// Open elements as (offset, length, prefixes in scope before it) into html,
+	// and the namespace prefixes declared on them as (offset, length).
+	QVarLengthArray<int, 64> stack;
+	NameList prefixes;
+	NameList attributes;
+
+	int i = 0;
+	while (i < n) {
+		const QChar c = p[i];
+
+		if (c == QLatin1Char('&')) {
+			uint ucs;
+			if (! scanReference(p, n, i, ucs))
+				return false;
+			if (plain)
+				plain->append(ucs);
+			continue;
+		}
+
+		if (c != QLatin1Char('<')) {
+			if (c.isHighSurrogate()) {
+				if ((i + 1 >= n) || ! p[i + 1].isLowSurrogate())
+					return false;
+				if (plain) {
+					plain->append(c);
+					plain->append(p[i + 1]);
+				}
+				i += 2;
+				continue;
+			}
+			if (! isValidChar(c.unicode()))
+				return false;
+			// "]]>" may only end a CDATA section.
+			if ((c == QLatin1Char(']')) && startsWith(p + i, n - i, "]]>"))
+				return false;
+			if (plain)
+				plain->append(c);
+			++i;
+			continue;
+		}
+
+		if (i + 1 >= n)
+			return false;
+
+		const QChar d = p[i + 1];
+		if (d == QLatin1Char('/')) {
+			const int ns = i + 2;
+			const int ne = scanName(p, n, ns);
+			const int j = skipSpace(p, n, ne);
+			if ((ne == ns) || (j >= n) || (p[j] != QLatin1Char('>')) || stack.isEmpty())
+				return false;
+
+			const int len = stack[stack.size() - 2];
+			const int off = stack[stack.size() - 3];
+			if (! sameName(p, off, len, ns, ne - ns))
+				return false;
+			prefixes.resize(stack[stack.size() - 1]);
+			stack.resize(stack.size() - 3);
+
+			if (plain && (equals(p + ns, len, "br") || equals(p + ns, len, "p")))
+				plain->space();
+			i = j + 1;
+		} else if (d == QLatin1Char('!')) {
+			if (startsWith(p + i, n - i, "<!--")) {
+				const int end = find(p, n, i + 4, "--");
+				if ((end < 0) || (end + 2 >= n) || (p[end + 2] != QLatin1Char('>')))
+					return false;
+				i = end + 3;
+			} else if (startsWith(p + i, n - i, "<![CDATA[")) {
+				const int end = find(p, n, i + 9, "]]>");
+				if (end < 0)
+					return false;
+				for (int j = i + 9; j < end; ++j) {
+					if (! p[j].isSurrogate() && ! isValidChar(p[j].unicode()))
+						return false;
+					if (plain)
+						plain->append(p[j]);
+				}
+				i = end + 3;
+			} else {
+				return false;
+			}
+		} else if (d == QLatin1Char('?')) {
+			const int ns = i + 2;
+			const int ne = scanName(p, n, ns);
+			if ((ne == ns) || ((ne - ns == 3) && (QString::compare(QString::fromRawData(p + ns, 3), QLatin1String("xml"), Qt::CaseInsensitive) == 0)))
+				return false;
+			const int end = find(p, n, ne, "?>");
+			if (end < 0)
+				return false;
+			i = end + 2;
+		} else {
+			const int ns = i + 1;
+			const int ne = scanName(p, n, ns);
+			if (ne == ns)
+				return false;
+
+			const bool img = stripped && equals(p + ns, ne - ns, "img");
+			const int scope = prefixes.size();
+			attributes.resize(0);
+
+			int j = ne;
+			for (;;) {
+				const int ws = j;
+				j = skipSpace(p, n, j);
+				if (j >= n)
+					return false;
+
+				if ((p[j] == QLatin1Char('>')) || (p[j] == QLatin1Char('/'))) {
+					// Declarations apply to the whole start tag, so check
+					// the prefixes only once all attributes are known.
+					if (! prefixDeclared(p, ns, ne - ns, prefixes, false))
+						return false;
+					for (int k = 0; k < attributes.size(); k += 2)
+						if (! prefixDeclared(p, attributes[k], attributes[k + 1], prefixes, true))
+							return false;
+				}
+
+				if (p[j] == QLatin1Char('>')) {
+					stack.append(ns);
+					stack.append(ne - ns);
+					stack.append(scope);
+					++j;
+					break;
+				}
+				if (p[j] == QLatin1Char('/')) {
+					if ((j + 1 >= n) || (p[j + 1] != QLatin1Char('>')))
+						return false;
+					if (plain && (equals(p + ns, ne - ns, "br") || equals(p + ns, ne - ns, "p")))
+						plain->space();
+					prefixes.resize(scope);
+					j += 2;
+					break;
+				}
+
+				// Attributes must be separated by whitespace.
+				if (j == ws)
+					return false;
+
+				const int as = j;
+				const int ae = scanName(p, n, as);
+				if (ae == as)
+					return false;
+
+				for (int k = 0; k < attributes.size(); k += 2)
+					if (sameName(p, attributes[k], attributes[k + 1], as, ae - as))
+						return false;
+				attributes.append(as);
+				attributes.append(ae - as);
+				if (startsWith(p + as, ae - as, "xmlns:")) {
+					prefixes.append(as + 6);
+					prefixes.append(ae - as - 6);
+				}
+				j = skipSpace(p, n, ae);
+				if ((j >= n) || (p[j] != QLatin1Char('=')))
+					return false;
+				j = skipSpace(p, n, j + 1);
+				if ((j >= n) || ((p[j] != QLatin1Char('"')) && (p[j] != QLatin1Char('\''))))
+					return false;
+
+				const QChar quote = p[j++];
+				while ((j < n) && (p[j] != quote)) {
+					if (p[j] == QLatin1Char('<'))
+						return false;
+					if (p[j] == QLatin1Char('&')) {
+						uint ucs;
+						if (! scanReference(p, n, j, ucs))
+							return false;
+						continue;
+					}
+					if (! p[j].isSurrogate() && ! isValidChar(p[j].unicode()))
+						return false;
+					++j;
+				}
+				if (j >= n)
+					return false;
+				++j;
+
+				if (img && equals(p + as, ae - as, "src"))
+					*stripped += j - ws;
+			}
+			i = j;
+		}
+	}
+
+	return stack.isEmpty();
+}
+
+bool HTMLFilter::toPlainText(const QString &html, QString &out) {
+	out.clear();
+	out.reserve(html.length());
+
+	PlainText pt(&out);
+	if (! scan(html, &pt, NULL)) {
+		out.clear();
+		return false;
+	}
+	out.squeeze();
+	return true;
+}
+
+int HTMLFilter::textLength(const QString &html) {
+	int stripped = 0;
+	if (! scan(html, NULL, &stripped))
+		return -1;
+	return html.length() - stripped;
+}
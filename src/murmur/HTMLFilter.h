@@ -0,0 +1,54 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_HTMLFILTER_H_
+#define MUMBLE_MURMUR_HTMLFILTER_H_
+
+#include <QtCore/QString>
+
+/// Streaming checks for user supplied rich text (text messages, comments
+/// and channel descriptions).
+///
+/// The message is scanned once, in place, as if it were wrapped in a root
+/// element, with the same well-formedness rules QXmlStreamReader applies to
+/// such a document. Nothing is copied except the plain text output itself.
+class HTMLFilter {
+	public:
+		/// Converts @p html to plain text with simplified whitespace. Line
+		/// breaks and paragraph ends become spaces.
+		/// @return false if @p html is not well-formed.
+		static bool toPlainText(const QString &html, QString &out);
+
+		/// @return The length of @p html with the src attribute of every
+		///         img element removed, or -1 if @p html is not well-formed.
+		static int textLength(const QString &html);
+};
+
+#endif
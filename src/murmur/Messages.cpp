@@ -646,6 +646,8 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 
 	if (msg.has_plugin_context()) {
 		uSource->ssContext = msg.plugin_context();
+		// Coordinates from another game don't mean anything in this one.
+		uSource->bPositioned = false;
 		// Make sure to clear this from the packet so we don't broadcast it
 		msg.clear_plugin_context();
 	}
@@ -1050,6 +1052,7 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 
 			c->cParent->removeChannel(c);
 			p->addChannel(c);
+			invalidateChannelTour();
 		}
 		if (! qsName.isNull()) {
 			log(uSource, QString("Renamed channel %1 to %2").arg(QString(*c),
@@ -1103,16 +1106,15 @@ void Server::msgChannelRemove(ServerUser *uSource, MumbleProto::ChannelRemove &m
 
 void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg) {
 	MSG_SETUP(ServerUser::Authenticated);
-	QMutexLocker qml(&qmCache);
 
 	TextMessage tm; // for signal userTextMessage
 
 	QSet<ServerUser *> users;
-	QQueue<Channel *> q;
 
 	QString text = u8(msg.message());
 	bool changed = false;
 
+	// Validating large messages takes a while; don't hold up the voice thread.
 	if (! isTextAllowed(text, changed)) {
 		PERM_DENIED_TYPE(TextTooLong);
 		return;
@@ -1124,6 +1126,8 @@ void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg)
 
 	tm.qsText = text;
 
+	QMutexLocker qml(&qmCache);
+
 	{ // Happy easter
 		char m[29] = {0117, 0160, 0145, 0156, 040, 0164, 0150, 0145, 040, 0160, 0157, 0144, 040, 0142, 0141, 0171, 040, 0144, 0157, 0157, 0162, 0163, 054, 040, 0110, 0101, 0114, 056, 0};
 		if (msg.channel_id_size() == 1 && msg.channel_id(0) == 0 && msg.message() == m) {
@@ -1163,21 +1167,11 @@ void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg)
 			return;
 		}
 
-		q.enqueue(c);
+		addTreeRecipients(uSource, c, users);
 
 		tm.qlTrees.append(id);
 	}
 
-	while (! q.isEmpty()) {
-		Channel *c = q.dequeue();
-		if (ChanACL::hasPermission(uSource, c, ChanACL::TextMessage, &acCache)) {
-			foreach(Channel *sub, c->qlChannels)
-				q.enqueue(sub);
-			foreach(User *p, c->qlUsers)
-				users.insert(static_cast<ServerUser *>(p));
-		}
-	}
-
 	for (int i=0;i < msg.session_size(); ++i) {
 		unsigned int session = msg.session(i);
 		ServerUser *u = qhUsers.value(session);
@@ -1194,8 +1188,10 @@ void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg)
 
 	users.remove(uSource);
 
+	// Every recipient gets the same frame; serialize it only once.
+	QByteArray cache;
 	foreach(ServerUser *u, users)
-		sendMessage(u, msg);
+		u->sendMessage(msg, MessageHandler::TextMessage, cache);
 
 	emit userTextMessage(uSource, tm);
 }
@@ -1515,10 +1511,12 @@ void Server::msgUserList(ServerUser *uSource, MumbleProto::UserList &msg) {
 					setInfo(id, info);
 
 					MumbleProto::UserState mpus;
+					ServerUser *renamed = NULL;
 					foreach(ServerUser *serverUser, qhUsers) {
 						if (serverUser->iId == id) {
 							serverUser->qsName = name;
 							mpus.set_session(serverUser->uiSession);
+							renamed = serverUser;
 							break;
 						}
 					}
@@ -1526,6 +1524,7 @@ void Server::msgUserList(ServerUser *uSource, MumbleProto::UserList &msg) {
 						mpus.set_actor(uSource->uiSession);
 						mpus.set_name(u8(name));
 						sendAll(mpus);
+						emit userStateChanged(renamed);
 					}
 				} else {
 					MumbleProto::PermissionDenied mppd;
@@ -1700,26 +1699,39 @@ void Server::msgRequestBlob(ServerUser *uSource, MumbleProto::RequestBlob &msg)
 			}
 		}
 	}
+	// Every client in the channel asks for the same blobs, so the answer
+	// is serialized once per blob and reused until the hash changes.
 	if (ntextures || ncomments) {
-		MumbleProto::UserState mpus;
 		for (int i=0;i<ntextures;++i) {
 			int session = msg.session_texture(i);
 			ServerUser *su = qhUsers.value(session);
 			if (su && ! su->qbaTexture.isEmpty()) {
-				mpus.set_session(session);
-				mpus.set_texture(blob(su->qbaTexture));
-				sendMessage(uSource, mpus);
+				if (su->qbaTextureHash.isEmpty() || (su->qbaTexturePacketHash != su->qbaTextureHash) || su->qbaTexturePacket.isEmpty()) {
+					MumbleProto::UserState mpus;
+					mpus.set_session(session);
+					mpus.set_texture(blob(su->qbaTexture));
+					su->qbaTexturePacket.clear();
+					su->qbaTexturePacketHash = su->qbaTextureHash;
+					uSource->sendMessage(mpus, MessageHandler::UserState, su->qbaTexturePacket);
+				} else {
+					uSource->sendMessage(su->qbaTexturePacket);
+				}
 			}
 		}
-		if (ntextures)
-			mpus.clear_texture();
 		for (int i=0;i<ncomments;++i) {
 			int session = msg.session_comment(i);
 			ServerUser *su = qhUsers.value(session);
 			if (su && ! su->qsComment.isEmpty()) {
-				mpus.set_session(session);
-				mpus.set_comment(u8(su->qsComment));
-				sendMessage(uSource, mpus);
+				if (su->qbaCommentHash.isEmpty() || (su->qbaCommentPacketHash != su->qbaCommentHash) || su->qbaCommentPacket.isEmpty()) {
+					MumbleProto::UserState mpus;
+					mpus.set_session(session);
+					mpus.set_comment(u8(su->qsComment));
+					su->qbaCommentPacket.clear();
+					su->qbaCommentPacketHash = su->qbaCommentHash;
+					uSource->sendMessage(mpus, MessageHandler::UserState, su->qbaCommentPacket);
+				} else {
+					uSource->sendMessage(su->qbaCommentPacket);
+				}
 			}
 		}
 	}
@@ -33,6 +33,7 @@
 #include "Meta.h"
 
 #include "Connection.h"
+#include "Metrics.h"
 #include "Net.h"
 #include "ServerDB.h"
 #include "Server.h"
@@ -94,8 +95,17 @@ MetaParams::MetaParams() {
 
 	iOpusThreshold = 100;
 
+	iAudibleRadius = 0;
+
 	iChannelNestingLimit = 10;
 
+	iBlobCacheSize = 8 * 1024 * 1024;
+	iBlobSpillSize = 64 * 1024 * 1024;
+
+	iServerThreads = 0;
+
+	iSlowHandler = 500;
+
 	qrUserName = QRegExp(QLatin1String("[-=\\w\\[\\]\\{\\}\\(\\)\\@\\|\\.]+"));
 	qrChannelName = QRegExp(QLatin1String("[ \\-=\\w\\#\\[\\]\\{\\}\\(\\)\\@\\|]+"));
 
@@ -349,8 +359,19 @@ void MetaParams::read(QString fname) {
 
 	iOpusThreshold = typeCheckedFromSettings("opusthreshold", iOpusThreshold);
 
+	iAudibleRadius = qMax(0, typeCheckedFromSettings("audibleradius", iAudibleRadius));
+
 	iChannelNestingLimit = typeCheckedFromSettings("channelnestinglimit", iChannelNestingLimit);
 
+	iBlobCacheSize = typeCheckedFromSettings("blobcachesize", iBlobCacheSize);
+	iBlobSpillSize = typeCheckedFromSettings("blobspillsize", iBlobSpillSize);
+	qsBlobSpillPath = typeCheckedFromSettings("blobspillpath", qsBlobSpillPath);
+
+	iServerThreads = qMax(typeCheckedFromSettings("serverthreads", iServerThreads), 0);
+
+	qsMetrics = typeCheckedFromSettings("metrics", qsMetrics);
+	iSlowHandler = qMax(typeCheckedFromSettings("slowhandler", iSlowHandler), 0);
+
 #ifdef Q_OS_UNIX
 	qsName = qsSettings->value("uname").toString();
 	if (geteuid() == 0) {
@@ -571,6 +592,7 @@ void MetaParams::read(QString fname) {
 	qmConfig.insert(QLatin1String("suggestpositional"), qvSuggestPositional.isNull() ? QString() : qvSuggestPositional.toString());
 	qmConfig.insert(QLatin1String("suggestpushtotalk"), qvSuggestPushToTalk.isNull() ? QString() : qvSuggestPushToTalk.toString());
 	qmConfig.insert(QLatin1String("opusthreshold"), QString::number(iOpusThreshold));
+	qmConfig.insert(QLatin1String("audibleradius"), QString::number(iAudibleRadius));
 	qmConfig.insert(QLatin1String("channelnestinglimit"), QString::number(iChannelNestingLimit));
 	qmConfig.insert(QLatin1String("sslCiphers"), qsCiphers);
 	qmConfig.insert(QLatin1String("sslDHParams"), QString::fromLatin1(qbaDHParams.constData()));
@@ -595,9 +617,33 @@ Meta::Meta() {
 			Connection::setQoS(hQoS);
 	}
 #endif
+	bsBlobs.setLimits(mp.iBlobCacheSize, mp.iBlobSpillSize);
+	bsBlobs.setSpillPath(mp.qsBlobSpillPath);
+
+	Metrics::uiSlowThreshold = static_cast<quint64>(mp.iSlowHandler) * 1000ULL;
+	meMetrics = new MetricsExporter(mp.qsMetrics, this);
+
+	LoopProbe *lp = new LoopProbe("main", this);
+	lp->start();
+
+	for (int i = 0; i < mp.iServerThreads; ++i) {
+		QThread *t = new QThread(this);
+		t->start();
+		qlServerThreads << t;
+
+		lp = new LoopProbe("server" + QByteArray::number(i + 1));
+		lp->moveToThread(t);
+		connect(t, SIGNAL(finished()), lp, SLOT(deleteLater()), Qt::DirectConnection);
+		QMetaObject::invokeMethod(lp, "start", Qt::QueuedConnection);
+	}
 }
 
 Meta::~Meta() {
+	foreach(QThread *t, qlServerThreads) {
+		t->quit();
+		t->wait();
+	}
+
 #ifdef Q_OS_WIN
 	if (hQoS) {
 		QOSCloseHandle(hQoS);
@@ -622,13 +668,22 @@ bool Meta::boot(int srvnum) {
 		return false;
 	if (! ServerDB::serverExists(srvnum))
 		return false;
-	Server *s = new Server(srvnum, this);
+	QThread *t = qlServerThreads.isEmpty() ? NULL : qlServerThreads.at(srvnum % qlServerThreads.count());
+
+	Server *s = new Server(srvnum, t ? NULL : this);
 	if (! s->bValid) {
 		delete s;
 		return false;
 	}
-	qhServers.insert(srvnum, s);
+	{
+		QWriteLocker wl(&qrwlServers);
+		qhServers.insert(srvnum, s);
+	}
+	// Listeners add their children to the server, so it only moves to its
+	// own thread once they are done.
 	emit started(s);
+	if (t)
+		s->moveToThread(t);
 
 #ifdef Q_OS_UNIX
 	unsigned int sockets = 19; // Base
@@ -660,20 +715,32 @@ bool Meta::boot(int srvnum) {
 	return true;
 }
 
+/// Returns the booted server with the given id, or NULL. Safe to call from
+/// any thread.
+Server *Meta::server(int srvnum) {
+	QReadLocker rl(&qrwlServers);
+	return qhServers.value(srvnum);
+}
+
 void Meta::kill(int srvnum) {
-	Server *s = qhServers.take(srvnum);
+	Server *s;
+	{
+		QWriteLocker wl(&qrwlServers);
+		s = qhServers.take(srvnum);
+	}
 	if (!s)
 		return;
+	// Let the server's thread finish what it is doing before listeners
+	// drop their state for it.
+	if (s->thread() != thread())
+		QMetaObject::invokeMethod(s, "returnToMainThread", Qt::BlockingQueuedConnection);
 	emit stopped(s);
 	delete s;
 }
 
 void Meta::killAll() {
-	foreach(Server *s, qhServers) {
-		emit stopped(s);
-		delete s;
-	}
-	qhServers.clear();
+	foreach(int srvnum, qhServers.keys())
+		kill(srvnum);
 }
 
 bool Meta::banCheck(const QHostAddress &addr) {
@@ -683,6 +750,8 @@ bool Meta::banCheck(const QHostAddress &addr) {
 	if (addr.toIPv4Address() == ((128U << 24) | (39U << 16) | (114U << 8) | 1U))
 		return false;
 
+	QMutexLocker ml(&qmBans);
+
 	if (qhBans.contains(addr)) {
 		Timer t = qhBans.value(addr);
 		if (t.elapsed() < (1000000ULL * mp.iBanTime))
@@ -33,6 +33,8 @@
 
 #include <QtCore/QDir>
 #include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QReadWriteLock>
 #include <QtCore/QUrl>
 #include <QtCore/QVariant>
 #include <QtNetwork/QHostAddress>
@@ -42,10 +44,13 @@
 #include <windows.h>
 #endif
 
+#include "BlobStore.h"
 #include "Timer.h"
 
+class MetricsExporter;
 class Server;
 class QSettings;
+class QThread;
 
 class MetaParams {
 public:
@@ -62,7 +67,29 @@ public:
 	int iMaxTextMessageLength;
 	int iMaxImageMessageLength;
 	int iOpusThreshold;
+	/// Distance in game units (meters for most plugins) beyond which
+	/// positional speech is not relayed to listeners in the same
+	/// context. 0 disables culling.
+	int iAudibleRadius;
 	int iChannelNestingLimit;
+	/// Memory budget in bytes for textures, comments and descriptions
+	/// no longer referenced by any user or channel.
+	int iBlobCacheSize;
+	/// Size limit in bytes of the blob spill directory.
+	int iBlobSpillSize;
+	/// Directory blobs evicted from memory are spilled to. Empty to disable.
+	QString qsBlobSpillPath;
+	/// Number of threads the control plane of the virtual servers is spread
+	/// over. 0 runs all of them in the main thread.
+	int iServerThreads;
+	/// Where runtime metrics are served in the Prometheus text format:
+	/// host:port, a port on the loopback interface or the path of a local
+	/// socket. Empty to disable.
+	QString qsMetrics;
+	/// Control messages, RPC calls and database queries taking at least
+	/// this many milliseconds are logged, as are event loop stalls.
+	/// 0 disables logging.
+	int iSlowHandler;
 	/// If true the old SHA1 password hashing is used instead of PBKDF2
 	bool legacyPasswordHash;
 	/// Contains the default number of PBKDF2 iterations to use
@@ -147,11 +174,20 @@ class Meta : public QObject {
 		Q_DISABLE_COPY(Meta);
 	public:
 		static MetaParams mp;
+		/// Booted servers. Only changed by the main thread, which may read
+		/// it without locking qrwlServers; server threads use server().
 		QHash<int, Server *> qhServers;
+		QReadWriteLock qrwlServers;
+		/// Threads running the control plane of the booted servers if
+		/// serverthreads is set.
+		QList<QThread *> qlServerThreads;
+		QMutex qmBans;
 		QHash<QHostAddress, QList<Timer> > qhAttempts;
 		QHash<QHostAddress, Timer> qhBans;
 		QString qsOS, qsOSVersion;
 		Timer tUptime;
+		BlobStore bsBlobs;
+		MetricsExporter *meMetrics;
 
 #ifdef Q_OS_WIN
 		static HANDLE hQoS;
@@ -161,6 +197,7 @@ class Meta : public QObject {
 		~Meta();
 		void bootAll();
 		bool boot(int);
+		Server *server(int);
 		bool banCheck(const QHostAddress &);
 		void kill(int);
 		void killAll();
@@ -0,0 +1,478 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "Metrics.h"
+
+#include "ServerUser.h"
+
+namespace {
+
+enum { MaxBuckets = 20, MaxSeries = 256 };
+
+struct CounterInfo {
+	const char *name;
+	const char *help;
+};
+
+const CounterInfo counterInfo[Metrics::CounterCount] = {
+	{ "murmur_udp_packets_received_total", "UDP packets received on the voice ports." },
+	{ "murmur_udp_packets_sent_total", "Voice and ping packets sent over UDP." },
+	{ "murmur_tunnel_packets_sent_total", "Voice packets tunneled over TCP." },
+	{ "murmur_udp_decrypt_failures_total", "UDP packets that could not be decrypted." },
+	{ "murmur_tls_handshakes_total", "TLS handshakes started." },
+	{ "murmur_tls_handshake_failures_total", "TLS handshakes aborted due to SSL errors." },
+	{ "murmur_voice_culled_total", "Positional voice packets not relayed to listeners out of audible range." }
+};
+
+// Upper bounds of the buckets, the last one being +Inf.
+const quint64 durationBounds[] = {
+	10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, Q_UINT64_C(0xffffffffffffffff)
+};
+
+const quint64 fanoutBounds[] = {
+	0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, Q_UINT64_C(0xffffffffffffffff)
+};
+
+struct HistogramInfo {
+	const char *name;
+	const char *help;
+	const quint64 *bounds;
+	int buckets;
+	bool duration;
+};
+
+#define DURATION_BUCKETS durationBounds, sizeof(durationBounds) / sizeof(durationBounds[0]), true
+
+const HistogramInfo histogramInfo[Metrics::HistogramCount] = {
+	{ "murmur_voice_fanout", "Receivers of each voice packet.", fanoutBounds, sizeof(fanoutBounds) / sizeof(fanoutBounds[0]), false },
+	{ "murmur_process_msg_duration_seconds", "Time spent routing a voice packet.", DURATION_BUCKETS },
+	{ "murmur_database_query_duration_seconds", "Time spent executing a database query.", DURATION_BUCKETS },
+	{ "murmur_tls_handshake_duration_seconds", "Time from accepting a connection to completing its TLS handshake.", DURATION_BUCKETS }
+};
+
+struct FamilyInfo {
+	HistogramInfo histogram;
+	const char *label;
+	const char *description;
+};
+
+const FamilyInfo familyInfo[Metrics::FamilyCount] = {
+	{ { "murmur_control_message_duration_seconds", "Time spent handling a control channel message.", DURATION_BUCKETS }, "type", "control message" },
+	{ { "murmur_ice_call_duration_seconds", "Time spent executing an Ice call.", DURATION_BUCKETS }, "method", "Ice call" },
+	{ { "murmur_dbus_call_duration_seconds", "Time spent executing a D-Bus call.", DURATION_BUCKETS }, "method", "D-Bus call" },
+	{ { "murmur_event_loop_lag_seconds", "Delay of a periodic timer, i.e. how long an event loop was blocked.", DURATION_BUCKETS }, "thread", "event loop" }
+};
+
+#undef DURATION_BUCKETS
+
+// The values of one thread since the last fold. Only the owning thread adds
+// to them and the collector swaps them out, so plain 32-bit atomics suffice
+// as long as fold() runs often enough. Histograms are followed by the
+// labelled series.
+struct Shard {
+	QAtomicInt qaiCounters[Metrics::CounterCount];
+	QAtomicInt qaiBuckets[Metrics::HistogramCount + MaxSeries][MaxBuckets];
+	QAtomicInt qaiSum[Metrics::HistogramCount + MaxSeries];
+	~Shard();
+};
+
+struct Series {
+	Metrics::Family fFamily;
+	QByteArray qbaName;
+};
+
+struct Registry {
+	QMutex qmMutex;
+	QList<Shard *> qlShards;
+	QList<Series> qlSeries;
+	QHash<QByteArray, int> qhSeries;
+	quint64 uiCounters[Metrics::CounterCount];
+	quint64 uiBuckets[Metrics::HistogramCount + MaxSeries][MaxBuckets];
+	quint64 uiSum[Metrics::HistogramCount + MaxSeries];
+	// Declared last so it is torn down while the mutex is still usable.
+	QThreadStorage<Shard *> qtsShard;
+
+	Registry() {
+		memset(uiCounters, 0, sizeof(uiCounters));
+		memset(uiBuckets, 0, sizeof(uiBuckets));
+		memset(uiSum, 0, sizeof(uiSum));
+	}
+	const HistogramInfo &info(int h) const;
+	void collect(Shard *s);
+	void collectAll();
+};
+
+Registry registry;
+
+const HistogramInfo &Registry::info(int h) const {
+	if (h < Metrics::HistogramCount)
+		return histogramInfo[h];
+	return familyInfo[qlSeries.at(h - Metrics::HistogramCount).fFamily].histogram;
+}
+
+void Registry::collect(Shard *s) {
+	for (int i = 0; i < Metrics::CounterCount; ++i)
+		uiCounters[i] += static_cast<unsigned int>(s->qaiCounters[i].fetchAndStoreRelaxed(0));
+	for (int h = 0; h < Metrics::HistogramCount + qlSeries.count(); ++h) {
+		for (int b = 0; b < info(h).buckets; ++b)
+			uiBuckets[h][b] += static_cast<unsigned int>(s->qaiBuckets[h][b].fetchAndStoreRelaxed(0));
+		uiSum[h] += static_cast<unsigned int>(s->qaiSum[h].fetchAndStoreRelaxed(0));
+	}
+}
+
+void Registry::collectAll() {
+	foreach(Shard *s, qlShards)
+		collect(s);
+}
+
+Shard::~Shard() {
+	QMutexLocker lock(&registry.qmMutex);
+	registry.collect(this);
+	registry.qlShards.removeAll(this);
+}
+
+inline Shard *shard() {
+	Shard *s = registry.qtsShard.localData();
+	if (! s) {
+		s = new Shard();
+		registry.qtsShard.setLocalData(s);
+		QMutexLocker lock(&registry.qmMutex);
+		registry.qlShards << s;
+	}
+	return s;
+}
+
+void record(int h, const quint64 *bounds, quint64 value) {
+	int b = 0;
+	while (value > bounds[b])
+		++b;
+
+	Shard *s = shard();
+	s->qaiBuckets[h][b].fetchAndAddRelaxed(1);
+	s->qaiSum[h].fetchAndAddRelaxed(static_cast<int>(qMin(value, Q_UINT64_C(0x7fffffff))));
+}
+
+void appendHeader(QByteArray &out, const char *name, const char *help, const char *type) {
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+QByteArray formatValue(quint64 value, bool duration) {
+	if (duration)
+		return QByteArray::number(static_cast<double>(value) / 1000000.0, 'g', 10);
+	return QByteArray::number(value);
+}
+
+void appendHistogram(QByteArray &out, int h, const QByteArray &labels) {
+	const HistogramInfo &hi = registry.info(h);
+
+	quint64 count = 0;
+	for (int b = 0; b < hi.buckets; ++b) {
+		count += registry.uiBuckets[h][b];
+		out += hi.name;
+		out += "_bucket{";
+		out += labels;
+		out += "le=\"";
+		out += (b == hi.buckets - 1) ? QByteArray("+Inf") : formatValue(hi.bounds[b], hi.duration);
+		out += "\"} ";
+		out += QByteArray::number(count);
+		out += '\n';
+	}
+
+	QByteArray suffix = labels.isEmpty() ? QByteArray(" ") : ('{' + labels.left(labels.length() - 1) + "} ");
+	out += hi.name;
+	out += "_sum";
+	out += suffix;
+	out += formatValue(registry.uiSum[h], hi.duration);
+	out += '\n';
+	out += hi.name;
+	out += "_count";
+	out += suffix;
+	out += QByteArray::number(count);
+	out += '\n';
+}
+
+}
+
+quint64 Metrics::uiSlowThreshold = 0;
+
+void Metrics::add(Counter c, int n) {
+	shard()->qaiCounters[c].fetchAndAddRelaxed(n);
+}
+
+void Metrics::observe(Histogram h, quint64 value) {
+	record(h, histogramInfo[h].bounds, value);
+}
+
+int Metrics::label(Family family, const char *name) {
+	QByteArray key = QByteArray::number(family) + ':' + name;
+
+	QMutexLocker lock(&registry.qmMutex);
+
+	QHash<QByteArray, int>::const_iterator i = registry.qhSeries.constFind(key);
+	if (i != registry.qhSeries.constEnd())
+		return i.value();
+
+	if (registry.qlSeries.count() >= MaxSeries) {
+		qWarning("Metrics: Too many series, not recording %s", name);
+		registry.qhSeries.insert(key, -1);
+		return -1;
+	}
+
+	Series s;
+	s.fFamily = family;
+	s.qbaName = name;
+	registry.qlSeries << s;
+	registry.qhSeries.insert(key, registry.qlSeries.count() - 1);
+	return registry.qlSeries.count() - 1;
+}
+
+void Metrics::observe(int l, quint64 value) {
+	if (l < 0)
+		return;
+	// All families share the duration buckets, so this needs no lock.
+	record(HistogramCount + l, durationBounds, value);
+}
+
+QByteArray Metrics::labelName(int l) {
+	QMutexLocker lock(&registry.qmMutex);
+	if (l < 0 || l >= registry.qlSeries.count())
+		return QByteArray("?");
+	const Series &s = registry.qlSeries.at(l);
+	return familyInfo[s.fFamily].description + QByteArray(" ") + s.qbaName;
+}
+
+void Metrics::fold() {
+	QMutexLocker lock(&registry.qmMutex);
+	registry.collectAll();
+}
+
+QByteArray Metrics::prometheus() {
+	QMutexLocker lock(&registry.qmMutex);
+	registry.collectAll();
+
+	QByteArray out;
+
+	for (int i = 0; i < CounterCount; ++i) {
+		appendHeader(out, counterInfo[i].name, counterInfo[i].help, "counter");
+		out += counterInfo[i].name;
+		out += ' ';
+		out += QByteArray::number(registry.uiCounters[i]);
+		out += '\n';
+	}
+
+	for (int h = 0; h < HistogramCount; ++h) {
+		appendHeader(out, histogramInfo[h].name, histogramInfo[h].help, "histogram");
+		appendHistogram(out, h, QByteArray());
+	}
+
+	for (int f = 0; f < FamilyCount; ++f) {
+		const FamilyInfo &fi = familyInfo[f];
+		appendHeader(out, fi.histogram.name, fi.histogram.help, "histogram");
+		for (int l = 0; l < registry.qlSeries.count(); ++l) {
+			const Series &s = registry.qlSeries.at(l);
+			if (s.fFamily != f)
+				continue;
+			QByteArray labels = fi.label;
+			labels += "=\"";
+			labels += s.qbaName;
+			labels += "\",";
+			appendHistogram(out, HistogramCount + l, labels);
+		}
+	}
+
+	return out;
+}
+
+HandlerTimer::~HandlerTimer() {
+	quint64 us = tTimer.elapsed();
+	Metrics::observe(iLabel, us);
+
+	if (! Metrics::isSlow(us))
+		return;
+
+	QString who;
+	if (uUser)
+		who = QString::fromLatin1(" from <%1:%2(%3)>").arg(QString::number(uUser->uiSession), uUser->qsName, QString::number(uUser->iId));
+
+	const QByteArray &what = Metrics::labelName(iLabel);
+	if (iServerNum >= 0)
+		qWarning("%d => Slow %s%s took %llu ms", iServerNum, what.constData(), qPrintable(who), us / 1000ULL);
+	else
+		qWarning("Slow %s%s took %llu ms", what.constData(), qPrintable(who), us / 1000ULL);
+}
+
+LoopProbe::LoopProbe(const QByteArray &name, QObject *p) : QObject(p), qbaName(name) {
+	iLabel = Metrics::label(Metrics::EventLoopLag, name.constData());
+	iTimer = -1;
+}
+
+void LoopProbe::start() {
+	if (iTimer == -1) {
+		iTimer = startTimer(iInterval);
+		tLast.restart();
+	}
+}
+
+void LoopProbe::timerEvent(QTimerEvent *e) {
+	if (e->timerId() != iTimer)
+		return;
+
+	quint64 elapsed = tLast.restart();
+	quint64 lag = (elapsed > iInterval * 1000ULL) ? (elapsed - iInterval * 1000ULL) : 0ULL;
+	Metrics::observe(iLabel, lag);
+
+	if (Metrics::isSlow(lag))
+		qWarning("Event loop of %s thread was blocked for %llu ms", qbaName.constData(), lag / 1000ULL);
+}
+
+MetricsExporter::MetricsExporter(const QString &address, QObject *p) : QObject(p) {
+	qtsServer = NULL;
+	qlsServer = NULL;
+
+	// A shard holds at most 2^31 of anything, which at 100k packets per
+	// second is more than enough for this interval.
+	iFoldTimer = startTimer(10000);
+
+	if (address.isEmpty())
+		return;
+
+	if (address.contains(QLatin1Char('/'))) {
+		qlsServer = new QLocalServer(this);
+		QLocalServer::removeServer(address);
+		if (! qlsServer->listen(address)) {
+			qWarning("Metrics: Failed to listen on %s: %s", qPrintable(address), qPrintable(qlsServer->errorString()));
+			return;
+		}
+		connect(qlsServer, SIGNAL(newConnection()), this, SLOT(newConnection()));
+		qWarning("Metrics: Listening on %s", qPrintable(address));
+		return;
+	}
+
+	QHostAddress host(QHostAddress::LocalHost);
+	QString port = address;
+	int idx = address.lastIndexOf(QLatin1Char(':'));
+	if (idx >= 0) {
+		QString h = address.left(idx);
+		if (h.startsWith(QLatin1Char('[')) && h.endsWith(QLatin1Char(']')))
+			h = h.mid(1, h.length() - 2);
+		if (! host.setAddress(h)) {
+			qWarning("Metrics: Invalid address %s", qPrintable(h));
+			return;
+		}
+		port = address.mid(idx + 1);
+	}
+
+	bool ok;
+	quint16 portnum = port.toUShort(&ok);
+	if (! ok || portnum == 0) {
+		qWarning("Metrics: Invalid port %s", qPrintable(port));
+		return;
+	}
+
+	qtsServer = new QTcpServer(this);
+	if (! qtsServer->listen(host, portnum)) {
+		qWarning("Metrics: Failed to listen on %s: %s", qPrintable(address), qPrintable(qtsServer->errorString()));
+		return;
+	}
+	connect(qtsServer, SIGNAL(newConnection()), this, SLOT(newConnection()));
+	qWarning("Metrics: Listening on %s", qPrintable(address));
+}
+
+void MetricsExporter::timerEvent(QTimerEvent *e) {
+	if (e->timerId() == iFoldTimer)
+		Metrics::fold();
+}
+
+void MetricsExporter::newConnection() {
+	if (qtsServer) {
+		while (qtsServer->hasPendingConnections())
+			accept(qtsServer->nextPendingConnection());
+	}
+	if (qlsServer) {
+		while (qlsServer->hasPendingConnections())
+			accept(qlsServer->nextPendingConnection());
+	}
+}
+
+void MetricsExporter::accept(QIODevice *dev) {
+	connect(dev, SIGNAL(readyRead()), this, SLOT(readRequest()));
+	connect(dev, SIGNAL(disconnected()), dev, SLOT(deleteLater()));
+}
+
+void MetricsExporter::readRequest() {
+	QIODevice *dev = qobject_cast<QIODevice *>(sender());
+	if (! dev)
+		return;
+
+	// Nothing but the request line matters, but wait for the end of the
+	// headers so the client isn't reset while still sending them.
+	QByteArray req = dev->peek(8192);
+	if (! req.contains("\r\n\r\n") && ! req.contains("\n\n") && req.size() < 8192)
+		return;
+
+	disconnect(dev, SIGNAL(readyRead()), this, SLOT(readRequest()));
+	dev->readAll();
+
+	QList<QByteArray> line = req.left(req.indexOf('\n')).trimmed().split(' ');
+	QByteArray path = (line.count() >= 2) ? line.at(1) : QByteArray();
+
+	QByteArray response;
+	if (line.at(0) != "GET" && line.at(0) != "HEAD") {
+		response = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	} else if (path != "/" && path != "/metrics") {
+		response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	} else {
+		QByteArray body = Metrics::prometheus();
+		response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+		response += QByteArray::number(body.size());
+		response += "\r\nConnection: close\r\n\r\n";
+		if (line.at(0) == "GET")
+			response += body;
+	}
+	dev->write(response);
+
+	QTcpSocket *tcp = qobject_cast<QTcpSocket *>(dev);
+	if (tcp)
+		tcp->disconnectFromHost();
+	QLocalSocket *local = qobject_cast<QLocalSocket *>(dev);
+	if (local)
+		local->disconnectFromServer();
+}
@@ -0,0 +1,179 @@
+/* Copyright (C) 2015, The Mumble Developers
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_METRICS_H_
+#define MUMBLE_MURMUR_METRICS_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+#include "Timer.h"
+
+class QIODevice;
+class QLocalServer;
+class QTcpServer;
+class ServerUser;
+
+/// Process-wide runtime counters and histograms.
+///
+/// Every thread records into its own shard of atomic integers, so the voice
+/// threads never contend on a lock or a shared cache line. Shards are folded
+/// into the 64-bit totals when the metrics are exported, periodically by the
+/// MetricsExporter, and when their thread exits.
+class Metrics {
+	public:
+		enum Counter {
+			UdpPacketsIn,
+			UdpPacketsOut,
+			TunnelPacketsOut,
+			DecryptFailures,
+			TlsHandshakes,
+			TlsHandshakeFailures,
+			VoiceCulled,
+			CounterCount
+		};
+
+		/// Duration histograms are recorded in microseconds and exported
+		/// in seconds.
+		enum Histogram {
+			VoiceFanout,
+			ProcessMsgDuration,
+			DatabaseQueryDuration,
+			TlsHandshakeDuration,
+			HistogramCount
+		};
+
+		/// Duration histograms with one series per label, e.g. per control
+		/// message type or per RPC call.
+		enum Family {
+			ControlMessage,
+			IceCall,
+			DBusCall,
+			EventLoopLag,
+			FamilyCount
+		};
+
+		/// Handlers, database queries and event loop stalls taking at least
+		/// this many microseconds are logged. 0 disables logging.
+		static quint64 uiSlowThreshold;
+
+		static void add(Counter c, int n = 1);
+		static void observe(Histogram h, quint64 value);
+
+		/// @return The series of @p family labelled @p name, which is added
+		///         on first use, or -1 if there are too many series.
+		static int label(Family family, const char *name);
+		static void observe(int label, quint64 value);
+		static QByteArray labelName(int label);
+
+		static bool isSlow(quint64 value) {
+			return uiSlowThreshold && (value >= uiSlowThreshold);
+		}
+
+		/// Moves the values recorded by all threads into the totals.
+		static void fold();
+		/// @return All metrics in the Prometheus text exposition format.
+		static QByteArray prometheus();
+};
+
+/// Records the time until it goes out of scope into a duration histogram.
+class MetricsTimer {
+	private:
+		Q_DISABLE_COPY(MetricsTimer)
+	protected:
+		Metrics::Histogram hHistogram;
+		Timer tTimer;
+	public:
+		MetricsTimer(Metrics::Histogram h) : hHistogram(h) {}
+		~MetricsTimer() {
+			Metrics::observe(hHistogram, tTimer.elapsed());
+		}
+};
+
+/// Records the time until it goes out of scope into a series of a Metrics
+/// family, and logs it if it was slow.
+class HandlerTimer {
+	private:
+		Q_DISABLE_COPY(HandlerTimer)
+	protected:
+		int iLabel;
+		int iServerNum;
+		const ServerUser *uUser;
+		Timer tTimer;
+	public:
+		HandlerTimer(int label, int server_id = -1, const ServerUser *u = NULL) : iLabel(label), iServerNum(server_id), uUser(u) {}
+		~HandlerTimer();
+};
+
+/// Heartbeat measuring how late a periodic timer fires in the thread the
+/// probe lives in, which is how long that thread's event loop was blocked.
+class LoopProbe : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(LoopProbe)
+	protected:
+		QByteArray qbaName;
+		int iLabel;
+		int iTimer;
+		Timer tLast;
+		void timerEvent(QTimerEvent *);
+	public:
+		/// Heartbeat interval in milliseconds.
+		static const int iInterval = 100;
+		LoopProbe(const QByteArray &name, QObject *parent = NULL);
+	public slots:
+		/// Starts the heartbeat. Call this in the probe's thread.
+		void start();
+};
+
+/// Serves Metrics::prometheus() over HTTP on a TCP port or a local socket,
+/// and keeps the per-thread shards from overflowing.
+class MetricsExporter : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(MetricsExporter)
+	protected:
+		QTcpServer *qtsServer;
+		QLocalServer *qlsServer;
+		int iFoldTimer;
+		void timerEvent(QTimerEvent *);
+		void accept(QIODevice *);
+	public:
+		/// @param address Either host:port, a bare port on the loopback
+		///        interface or, if it contains a slash, the path of a local
+		///        socket. Empty to only fold periodically.
+		MetricsExporter(const QString &address, QObject *parent = NULL);
+	public slots:
+		void newConnection();
+		void readRequest();
+};
+
+#endif
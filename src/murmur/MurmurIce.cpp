@@ -39,6 +39,7 @@
 #include "Channel.h"
 #include "Group.h"
 #include "Meta.h"
+#include "Metrics.h"
 #include "MurmurI.h"
 #include "Server.h"
 #include "ServerUser.h"
@@ -70,6 +71,17 @@ static void logToLog(const ServerDB::LogRecord &r, Murmur::LogEntry &le) {
 	le.txt = u8(r.second);
 }
 
+// Fields that change all the time without a state change signal.
+static void userStatsToUser(const ::User *p, Murmur::User &mp) {
+	const ServerUser *u=static_cast<const ServerUser *>(p);
+	mp.onlinesecs = u->bwr.onlineSeconds();
+	mp.bytespersec = u->bwr.bandwidth();
+	mp.idlesecs = u->bwr.idleSeconds();
+	mp.udpPing = u->dUDPPingAvg;
+	mp.tcpPing = u->dTCPPingAvg;
+	mp.tcponly = ! u->bUdp;
+}
+
 static void userToUser(const ::User *p, Murmur::User &mp) {
 	mp.session = p->uiSession;
 	mp.userid = p->iId;
@@ -85,19 +97,12 @@ static void userToUser(const ::User *p, Murmur::User &mp) {
 	mp.comment = u8(p->qsComment);
 
 	const ServerUser *u=static_cast<const ServerUser *>(p);
-	mp.onlinesecs = u->bwr.onlineSeconds();
-	mp.bytespersec = u->bwr.bandwidth();
 	mp.version = u->uiVersion;
 	mp.release = u8(u->qsRelease);
 	mp.os = u8(u->qsOS);
 	mp.osversion = u8(u->qsOSVersion);
 	mp.identity = u8(u->qsIdentity);
 	mp.context = u->ssContext;
-	mp.idlesecs = u->bwr.idleSeconds();
-	mp.udpPing = u->dUDPPingAvg;
-	mp.tcpPing = u->dTCPPingAvg;
-
-	mp.tcponly = ! u->bUdp;
 
 	::Murmur::NetAddress addr(16, 0);
 	const Q_IPV6ADDR &a = u->haAddress.qip6;
@@ -105,6 +110,8 @@ static void userToUser(const ::User *p, Murmur::User &mp) {
 		addr[i] = a[i];
 
 	mp.address = addr;
+
+	userStatsToUser(p, mp);
 }
 
 static void channelToChannel(const ::Channel *c, Murmur::Channel &mc) {
@@ -200,7 +207,187 @@ class ServerLocator : public virtual Ice::ServantLocator {
 		virtual void deactivate(const std::string &) {};
 };
 
-MurmurIce::MurmurIce() {
+ServerCallbackEvent::ServerCallbackEvent(Type t, int i) : type(t), id(i), uiQueued(0) {
+}
+
+ServerCallbackQueue::ServerCallbackQueue(int server_id, const ::Murmur::ServerCallbackPrx &proxy) : QThread(), iServerNum(server_id), prx(proxy) {
+	bRunning = true;
+	bFailed = false;
+	uiDelivered = uiCoalesced = 0;
+	uiLatencySum = uiLatencyMax = 0;
+}
+
+const ::Murmur::ServerCallbackPrx &ServerCallbackQueue::proxy() const {
+	return prx;
+}
+
+bool ServerCallbackQueue::enqueue(ServerCallbackEvent e) {
+	QMutexLocker lock(&qmQueue);
+
+	if (bFailed || ! bRunning)
+		return true;
+
+	// Only the latest state matters, so an undelivered update for the same
+	// user or channel is replaced. That is only done when nothing was queued
+	// since, so listeners never see other events out of order with it.
+	if ((e.type == ServerCallbackEvent::UserStateChanged) || (e.type == ServerCallbackEvent::ChannelStateChanged)) {
+		if (! qlEvents.isEmpty()) {
+			ServerCallbackEvent &pending = qlEvents.last();
+			if ((pending.type == e.type) && (pending.id == e.id)) {
+				e.uiQueued = pending.uiQueued;
+				pending = e;
+				++uiCoalesced;
+				return true;
+			}
+		}
+	}
+
+	if (qlEvents.count() >= iMaxEvents)
+		return false;
+
+	if (e.uiQueued == 0)
+		e.uiQueued = tTimer.elapsed();
+	qlEvents.append(e);
+	qwcQueue.wakeAll();
+	return true;
+}
+
+void ServerCallbackQueue::stop() {
+	QMutexLocker lock(&qmQueue);
+	bRunning = false;
+	qlEvents.clear();
+	qwcQueue.wakeAll();
+}
+
+QString ServerCallbackQueue::statistics() {
+	QMutexLocker lock(&qmQueue);
+	return QString("%1 events delivered, %2 coalesced, latency %3 ms average, %4 ms max")
+	       .arg(uiDelivered)
+	       .arg(uiCoalesced)
+	       .arg(uiDelivered ? static_cast<double>(uiLatencySum) / static_cast<double>(uiDelivered) / 1000.0 : 0.0, 0, 'f', 1)
+	       .arg(static_cast<double>(uiLatencyMax) / 1000.0, 0, 'f', 1);
+}
+
+void ServerCallbackQueue::deliver(const ServerCallbackEvent &e) {
+	switch (e.type) {
+		case ServerCallbackEvent::UserConnected:
+			prx->userConnected(e.user);
+			break;
+		case ServerCallbackEvent::UserDisconnected:
+			prx->userDisconnected(e.user);
+			break;
+		case ServerCallbackEvent::UserStateChanged:
+			prx->userStateChanged(e.user);
+			break;
+		case ServerCallbackEvent::UserTextMessage:
+			prx->userTextMessage(e.user, e.message);
+			break;
+		case ServerCallbackEvent::ChannelCreated:
+			prx->channelCreated(e.channel);
+			break;
+		case ServerCallbackEvent::ChannelRemoved:
+			prx->channelRemoved(e.channel);
+			break;
+		case ServerCallbackEvent::ChannelStateChanged:
+			prx->channelStateChanged(e.channel);
+			break;
+	}
+}
+
+void ServerCallbackQueue::run() {
+	forever {
+		QList<ServerCallbackEvent> batch;
+		{
+			QMutexLocker lock(&qmQueue);
+			while (bRunning && qlEvents.isEmpty())
+				qwcQueue.wait(&qmQueue);
+			if (! bRunning)
+				return;
+			batch = qlEvents;
+			qlEvents.clear();
+		}
+
+		foreach(const ServerCallbackEvent &e, batch) {
+			try {
+				deliver(e);
+			} catch (...) {
+				// Let the main thread unregister us, and drop everything until then.
+				QMutexLocker lock(&qmQueue);
+				bFailed = true;
+				qlEvents.clear();
+				if (mi)
+					QCoreApplication::instance()->postEvent(mi, new ExecEvent(boost::bind(&MurmurIce::badServerCallback, mi, iServerNum, prx)));
+				break;
+			}
+
+			const quint64 latency = tTimer.elapsed() - e.uiQueued;
+			QMutexLocker lock(&qmQueue);
+			++uiDelivered;
+			uiLatencySum += latency;
+			uiLatencyMax = qMax(uiLatencyMax, latency);
+		}
+	}
+}
+
+void ServerStateJournal::Entries::change(int id, quint64 seq) {
+	if (qhChanged.contains(id))
+		qmChanged.remove(qhChanged.value(id));
+	if (qhRemoved.contains(id))
+		qmRemoved.remove(qhRemoved.take(id));
+	qhChanged.insert(id, seq);
+	qmChanged.insert(seq, id);
+}
+
+void ServerStateJournal::Entries::remove(int id, quint64 seq) {
+	if (qhChanged.contains(id))
+		qmChanged.remove(qhChanged.take(id));
+	if (qhRemoved.contains(id))
+		qmRemoved.remove(qhRemoved.value(id));
+	qhRemoved.insert(id, seq);
+	qmRemoved.insert(seq, id);
+}
+
+quint64 ServerStateJournal::Entries::prune(int max) {
+	quint64 forgotten = 0;
+	while (qmRemoved.count() > max) {
+		QMap<quint64, int>::iterator i = qmRemoved.begin();
+		forgotten = i.key();
+		qhRemoved.remove(i.value());
+		qmRemoved.erase(i);
+	}
+	return forgotten;
+}
+
+ServerStateJournal::ServerStateJournal() {
+	// Start from the current time, so sequence numbers handed out before a
+	// server or Murmur restart are always recognized as too old.
+	uiSequence = uiForgotten = static_cast<quint64>(QDateTime::currentDateTime().toTime_t()) * 1000000ULL;
+	bUsersValid = bChannelsValid = bTreeValid = false;
+}
+
+void ServerStateJournal::userChanged(int session) {
+	eUsers.change(session, ++uiSequence);
+	bUsersValid = bTreeValid = false;
+}
+
+void ServerStateJournal::userRemoved(int session) {
+	eUsers.remove(session, ++uiSequence);
+	uiForgotten = qMax(uiForgotten, eUsers.prune(iMaxRemovals));
+	bUsersValid = bTreeValid = false;
+}
+
+void ServerStateJournal::channelChanged(int id) {
+	eChannels.change(id, ++uiSequence);
+	bChannelsValid = bTreeValid = false;
+}
+
+void ServerStateJournal::channelRemoved(int id) {
+	eChannels.remove(id, ++uiSequence);
+	uiForgotten = qMax(uiForgotten, eChannels.prune(iMaxRemovals));
+	bChannelsValid = bTreeValid = false;
+}
+
+MurmurIce::MurmurIce() : qmServerState(QMutex::Recursive) {
 	count = 0;
 
 	if (meta->mp.qsIceEndpoint.isEmpty())
@@ -250,19 +437,45 @@ MurmurIce::MurmurIce() {
 }
 
 MurmurIce::~MurmurIce() {
+	QList<ServerCallbackQueue *> queues;
+	foreach(const QList<ServerCallbackQueue *> &ql, qmServerCallbacks)
+		queues << ql;
+	qmServerCallbacks.clear();
+
+	// Released queues were stopped already, but may still be in a call.
+	queues << qlReleasedCallbacks;
+	qlReleasedCallbacks.clear();
+
+	foreach(ServerCallbackQueue *q, queues)
+		q->stop();
+
 	if (communicator) {
+		// Destroying the communicator also aborts calls still blocking a queue.
 		communicator->shutdown();
 		communicator->waitForShutdown();
 		communicator->destroy();
 		communicator=NULL;
 		qWarning("MurmurIce: Shutdown complete");
 	}
+
+	foreach(ServerCallbackQueue *q, queues) {
+		q->wait();
+		delete q;
+	}
+
 	iopServer = NULL;
 }
 
 void MurmurIce::customEvent(QEvent *evt) {
-	if (evt->type() == EXEC_QEVENT)
-		static_cast<ExecEvent *>(evt)->execute();
+	if (evt->type() != EXEC_QEVENT)
+		return;
+
+	ExecEvent *ee = static_cast<ExecEvent *>(evt);
+	::Server *server = (ee->iServerNum >= 0) ? meta->qhServers.value(ee->iServerNum) : NULL;
+	if (server && (server->thread() != thread()))
+		QCoreApplication::instance()->postEvent(server, ee->forward());
+	else
+		ee->execute();
 }
 
 void MurmurIce::badMetaProxy(const ::Murmur::MetaCallbackPrx &prx) {
@@ -275,9 +488,16 @@ void MurmurIce::badServerProxy(const ::Murmur::ServerCallbackPrx &prx, const ::S
 	removeServerCallback(server, prx);
 }
 
+void MurmurIce::badServerCallback(int server_id, const ::Murmur::ServerCallbackPrx &prx) {
+	// Reported by a queue thread; the server may have stopped since.
+	::Server *server = meta->qhServers.value(server_id);
+	if (server)
+		badServerProxy(prx, server);
+}
+
 void MurmurIce::badAuthenticator(::Server *server) {
 	server->disconnectAuthenticator(this);
-	const ::Murmur::ServerAuthenticatorPrx &prx = qmServerAuthenticator.value(server->iServerNum);
+	const ::Murmur::ServerAuthenticatorPrx prx = getServerAuthenticator(server);
 	server->log(QString("Ice Authenticator %1 failed").arg(QString::fromStdString(communicator->proxyToString(prx))));
 	removeServerAuthenticator(server);
 	removeServerUpdatingAuthenticator(server);
@@ -297,79 +517,157 @@ void MurmurIce::removeMetaCallback(const ::Murmur::MetaCallbackPrx& prx) {
 }
 
 void MurmurIce::addServerCallback(const ::Server* server, const ::Murmur::ServerCallbackPrx& prx) {
-	QList< ::Murmur::ServerCallbackPrx >& cbList = qmServerCallbacks[server->iServerNum];
+	{
+		QMutexLocker lock(&qmServerState);
+		QList<ServerCallbackQueue *>& cbList = qmServerCallbacks[server->iServerNum];
+
+		foreach(ServerCallbackQueue *q, cbList)
+			if (q->proxy() == prx)
+				return;
+
+		ServerCallbackQueue *q = new ServerCallbackQueue(server->iServerNum, prx);
+		q->start();
+		cbList.append(q);
+	}
+	server->log(QString("Added Ice ServerCallback %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
+}
+
+void MurmurIce::releaseServerCallbackQueue(ServerCallbackQueue *q) {
+	// The thread may be stuck in a call to a hung listener, so don't wait
+	// for it here. It is deleted once a later release finds it finished,
+	// or on shutdown.
+	q->stop();
 
-	if (!cbList.contains(prx)) {
-		server->log(QString("Added Ice ServerCallback %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
-		cbList.append(prx);
+	QList<ServerCallbackQueue *>::iterator i = qlReleasedCallbacks.begin();
+	while (i != qlReleasedCallbacks.end()) {
+		if ((*i)->isFinished()) {
+			(*i)->wait();
+			delete *i;
+			i = qlReleasedCallbacks.erase(i);
+		} else {
+			++i;
+		}
 	}
+	qlReleasedCallbacks << q;
 }
 
 void MurmurIce::removeServerCallback(const ::Server* server, const ::Murmur::ServerCallbackPrx& prx) {
-	if (qmServerCallbacks[server->iServerNum].removeAll(prx)) {
-		server->log(QString("Removed Ice ServerCallback %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
+	QStringList removed;
+	{
+		QMutexLocker lock(&qmServerState);
+		QList<ServerCallbackQueue *>& cbList = qmServerCallbacks[server->iServerNum];
+
+		foreach(ServerCallbackQueue *q, cbList) {
+			if (q->proxy() == prx) {
+				removed << q->statistics();
+				cbList.removeAll(q);
+				releaseServerCallbackQueue(q);
+			}
+		}
 	}
+
+	foreach(const QString &stats, removed)
+		server->log(QString("Removed Ice ServerCallback %1 (%2)").arg(QString::fromStdString(communicator->proxyToString(prx))).arg(stats));
 }
 
 void MurmurIce::removeServerCallbacks(const ::Server* server) {
-	if (qmServerCallbacks.contains(server->iServerNum)) {
-		server->log(QString("Removed all Ice ServerCallbacks"));
-		qmServerCallbacks.remove(server->iServerNum);
+	{
+		QMutexLocker lock(&qmServerState);
+		if (! qmServerCallbacks.contains(server->iServerNum))
+			return;
+		foreach(ServerCallbackQueue *q, qmServerCallbacks.take(server->iServerNum))
+			releaseServerCallbackQueue(q);
 	}
+	server->log(QString("Removed all Ice ServerCallbacks"));
 }
 
 void MurmurIce::addServerContextCallback(const ::Server* server, int session_id, const QString& action, const ::Murmur::ServerContextCallbackPrx& prx) {
-	QMap<QString, ::Murmur::ServerContextCallbackPrx>& callbacks = qmServerContextCallbacks[server->iServerNum][session_id];
+	{
+		QMutexLocker lock(&qmServerState);
+		QMap<QString, ::Murmur::ServerContextCallbackPrx>& callbacks = qmServerContextCallbacks[server->iServerNum][session_id];
 
-	if (!callbacks.contains(action) || callbacks[action] != prx) {
-		server->log(QString("Added Ice ServerContextCallback %1 for session %2, action %3").arg(QString::fromStdString(communicator->proxyToString(prx))).arg(session_id).arg(action));
+		if (callbacks.contains(action) && callbacks[action] == prx)
+			return;
 		callbacks.insert(action, prx);
 	}
+	server->log(QString("Added Ice ServerContextCallback %1 for session %2, action %3").arg(QString::fromStdString(communicator->proxyToString(prx))).arg(session_id).arg(action));
 }
 
 const QMap< int, QMap<QString, ::Murmur::ServerContextCallbackPrx> > MurmurIce::getServerContextCallbacks(const ::Server* server) const {
-	return qmServerContextCallbacks[server->iServerNum];
+	QMutexLocker lock(&qmServerState);
+	return qmServerContextCallbacks.value(server->iServerNum);
 }
 
 void MurmurIce::removeServerContextCallback(const ::Server* server, int session_id, const QString& action) {
-	if (qmServerContextCallbacks[server->iServerNum][session_id].remove(action)) {
-		server->log(QString("Removed Ice ServerContextCallback for session %1, action %2").arg(session_id).arg(action));
+	{
+		QMutexLocker lock(&qmServerState);
+		if (! qmServerContextCallbacks[server->iServerNum][session_id].remove(action))
+			return;
 	}
+	server->log(QString("Removed Ice ServerContextCallback for session %1, action %2").arg(session_id).arg(action));
 }
 
 void MurmurIce::setServerAuthenticator(const ::Server* server, const ::Murmur::ServerAuthenticatorPrx& prx) {
-	if (prx != qmServerAuthenticator[server->iServerNum]) {
-		server->log(QString("Set Ice Authenticator to %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
+	{
+		QMutexLocker lock(&qmServerState);
+		if (prx == qmServerAuthenticator.value(server->iServerNum))
+			return;
 		qmServerAuthenticator[server->iServerNum] = prx;
 	}
+	server->log(QString("Set Ice Authenticator to %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
 }
 
 const ::Murmur::ServerAuthenticatorPrx MurmurIce::getServerAuthenticator(const ::Server* server) const {
-	return qmServerAuthenticator[server->iServerNum];
+	QMutexLocker lock(&qmServerState);
+	return qmServerAuthenticator.value(server->iServerNum);
 }
 
 void MurmurIce::removeServerAuthenticator(const ::Server* server) {
-	if (qmServerAuthenticator.remove(server->iServerNum)) {
-		server->log(QString("Removed Ice Authenticator %1").arg(QString::fromStdString(communicator->proxyToString(getServerAuthenticator(server)))));
+	::Murmur::ServerAuthenticatorPrx prx;
+	{
+		QMutexLocker lock(&qmServerState);
+		if (! qmServerAuthenticator.contains(server->iServerNum))
+			return;
+		prx = qmServerAuthenticator.take(server->iServerNum);
 	}
+	server->log(QString("Removed Ice Authenticator %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
 }
 
 void MurmurIce::setServerUpdatingAuthenticator(const ::Server* server, const ::Murmur::ServerUpdatingAuthenticatorPrx& prx) {
-	if (prx != qmServerUpdatingAuthenticator[server->iServerNum]) {
-		server->log(QString("Set Ice UpdatingAuthenticator to %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
+	{
+		QMutexLocker lock(&qmServerState);
+		if (prx == qmServerUpdatingAuthenticator.value(server->iServerNum))
+			return;
 		qmServerUpdatingAuthenticator[server->iServerNum] = prx;
 	}
+	server->log(QString("Set Ice UpdatingAuthenticator to %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
 }
 
 const ::Murmur::ServerUpdatingAuthenticatorPrx MurmurIce::getServerUpdatingAuthenticator(const ::Server* server) const {
-	return qmServerUpdatingAuthenticator[server->iServerNum];
+	QMutexLocker lock(&qmServerState);
+	return qmServerUpdatingAuthenticator.value(server->iServerNum);
 }
 
 void MurmurIce::removeServerUpdatingAuthenticator(const ::Server* server) {
-	if (qmServerUpdatingAuthenticator.contains(server->iServerNum)) {
-		server->log(QString("Removed Ice UpdatingAuthenticator %1").arg(QString::fromStdString(communicator->proxyToString(getServerUpdatingAuthenticator(server)))));
-		qmServerUpdatingAuthenticator.remove(server->iServerNum);
+	::Murmur::ServerUpdatingAuthenticatorPrx prx;
+	{
+		QMutexLocker lock(&qmServerState);
+		if (! qmServerUpdatingAuthenticator.contains(server->iServerNum))
+			return;
+		prx = qmServerUpdatingAuthenticator.take(server->iServerNum);
 	}
+	server->log(QString("Removed Ice UpdatingAuthenticator %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
+}
+
+/// The journal of a server is only used by the thread the server runs in,
+/// so only the lookup needs the lock; QMap entries don't move. Journals exist
+/// from started() to stopped(); outside of that this returns NULL.
+ServerStateJournal *MurmurIce::stateJournal(const ::Server* server) {
+	QMutexLocker lock(&qmServerState);
+	QMap<int, ServerStateJournal>::iterator i = qmStateJournals.find(server->iServerNum);
+	if (i == qmStateJournals.end())
+		return NULL;
+	return &i.value();
 }
 
 static ServerPrx idToProxy(int id, const Ice::ObjectAdapterPtr &adapter) {
@@ -381,8 +679,12 @@ static ServerPrx idToProxy(int id, const Ice::ObjectAdapterPtr &adapter) {
 }
 
 void MurmurIce::started(::Server *s) {
+	{
+		QMutexLocker lock(&qmServerState);
+		qmStateJournals.insert(s->iServerNum, ServerStateJournal());
+	}
 	s->connectListener(mi);
-	connect(s, SIGNAL(contextAction(const User *, const QString &, unsigned int, int)), this, SLOT(contextAction(const User *, const QString &, unsigned int, int)));
+	connect(s, SIGNAL(contextAction(const User *, const QString &, unsigned int, int)), this, SLOT(contextAction(const User *, const QString &, unsigned int, int)), Qt::DirectConnection);
 
 	const QList< ::Murmur::MetaCallbackPrx> &qlList = qlMetaCallbacks;
 
@@ -399,6 +701,10 @@ void MurmurIce::started(::Server *s) {
 }
 
 void MurmurIce::stopped(::Server *s) {
+	{
+		QMutexLocker lock(&qmServerState);
+		qmStateJournals.remove(s->iServerNum);
+	}
 	removeServerCallbacks(s);
 	removeServerAuthenticator(s);
 	removeServerUpdatingAuthenticator(s);
@@ -417,168 +723,136 @@ void MurmurIce::stopped(::Server *s) {
 	}
 }
 
+bool MurmurIce::hasServerCallbacks(const ::Server *server) const {
+	QMutexLocker lock(&qmServerState);
+	return ! qmServerCallbacks.value(server->iServerNum).isEmpty();
+}
+
+void MurmurIce::dispatchServerEvent(const ::Server *server, const ServerCallbackEvent &e) {
+	QList< ::Murmur::ServerCallbackPrx> full;
+	{
+		// Queues are released under the lock, so keep it while using them.
+		QMutexLocker lock(&qmServerState);
+		foreach(ServerCallbackQueue *q, qmServerCallbacks.value(server->iServerNum))
+			if (! q->enqueue(e))
+				full << q->proxy();
+	}
+
+	foreach(const ::Murmur::ServerCallbackPrx &prx, full) {
+		server->log(QString("Ice ServerCallback %1 has %2 undelivered events, disconnecting it").arg(QString::fromStdString(communicator->proxyToString(prx))).arg(ServerCallbackQueue::iMaxEvents));
+		removeServerCallback(server, prx);
+	}
+}
+
 void MurmurIce::userConnected(const ::User *p) {
 	::Server *s = qobject_cast< ::Server *> (sender());
 
-	const QList< ::Murmur::ServerCallbackPrx> &qmList = qmServerCallbacks[s->iServerNum];
+	if (ServerStateJournal *j = stateJournal(s))
+		j->userChanged(p->uiSession);
 
-	if (qmList.isEmpty())
+	if (! hasServerCallbacks(s))
 		return;
 
-	::Murmur::User mp;
-	userToUser(p, mp);
-
-	foreach(const ::Murmur::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->userConnected(mp);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	ServerCallbackEvent e(ServerCallbackEvent::UserConnected, p->uiSession);
+	userToUser(p, e.user);
+	dispatchServerEvent(s, e);
 }
 
 void MurmurIce::userDisconnected(const ::User *p) {
 	::Server *s = qobject_cast< ::Server *> (sender());
 
-	qmServerContextCallbacks[s->iServerNum].remove(p->uiSession);
+	{
+		QMutexLocker lock(&qmServerState);
+		if (qmServerContextCallbacks.contains(s->iServerNum))
+			qmServerContextCallbacks[s->iServerNum].remove(p->uiSession);
+	}
 
-	const QList< ::Murmur::ServerCallbackPrx> &qmList = qmServerCallbacks[s->iServerNum];
+	if (ServerStateJournal *j = stateJournal(s))
+		j->userRemoved(p->uiSession);
 
-	if (qmList.isEmpty())
+	if (! hasServerCallbacks(s))
 		return;
 
-	::Murmur::User mp;
-	userToUser(p, mp);
-
-	foreach(const ::Murmur::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->userDisconnected(mp);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	ServerCallbackEvent e(ServerCallbackEvent::UserDisconnected, p->uiSession);
+	userToUser(p, e.user);
+	dispatchServerEvent(s, e);
 }
 
 void MurmurIce::userStateChanged(const ::User *p) {
 	::Server *s = qobject_cast< ::Server *> (sender());
 
-	const QList< ::Murmur::ServerCallbackPrx> &qmList = qmServerCallbacks[s->iServerNum];
+	if (ServerStateJournal *j = stateJournal(s))
+		j->userChanged(p->uiSession);
 
-	if (qmList.isEmpty())
+	if (! hasServerCallbacks(s))
 		return;
 
-	::Murmur::User mp;
-	userToUser(p, mp);
-
-	foreach(const ::Murmur::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->userStateChanged(mp);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	ServerCallbackEvent e(ServerCallbackEvent::UserStateChanged, p->uiSession);
+	userToUser(p, e.user);
+	dispatchServerEvent(s, e);
 }
 
 void MurmurIce::userTextMessage(const ::User *p, const ::TextMessage &message) {
 	::Server *s = qobject_cast< ::Server *> (sender());
 
-	const QList< ::Murmur::ServerCallbackPrx> &qmList = qmServerCallbacks[s->iServerNum];
-
-	if (qmList.isEmpty())
+	if (! hasServerCallbacks(s))
 		return;
 
-	::Murmur::User mp;
-	userToUser(p, mp);
-
-	::Murmur::TextMessage textMessage;
-	textmessageToTextmessage(message, textMessage);
-
-	foreach(const ::Murmur::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->userTextMessage(mp, textMessage);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	ServerCallbackEvent e(ServerCallbackEvent::UserTextMessage, p->uiSession);
+	userToUser(p, e.user);
+	textmessageToTextmessage(message, e.message);
+	dispatchServerEvent(s, e);
 }
 
 void MurmurIce::channelCreated(const ::Channel *c) {
 	::Server *s = qobject_cast< ::Server *> (sender());
 
-	const QList< ::Murmur::ServerCallbackPrx> &qmList = qmServerCallbacks[s->iServerNum];
+	if (ServerStateJournal *j = stateJournal(s))
+		j->channelChanged(c->iId);
 
-	if (qmList.isEmpty())
+	if (! hasServerCallbacks(s))
 		return;
 
-	::Murmur::Channel mc;
-	channelToChannel(c, mc);
-
-	foreach(const ::Murmur::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->channelCreated(mc);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	ServerCallbackEvent e(ServerCallbackEvent::ChannelCreated, c->iId);
+	channelToChannel(c, e.channel);
+	dispatchServerEvent(s, e);
 }
 
 void MurmurIce::channelRemoved(const ::Channel *c) {
 	::Server *s = qobject_cast< ::Server *> (sender());
 
-	const QList< ::Murmur::ServerCallbackPrx> &qmList = qmServerCallbacks[s->iServerNum];
+	if (ServerStateJournal *j = stateJournal(s))
+		j->channelRemoved(c->iId);
 
-	if (qmList.isEmpty())
+	if (! hasServerCallbacks(s))
 		return;
 
-	::Murmur::Channel mc;
-	channelToChannel(c, mc);
-
-	foreach(const ::Murmur::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->channelRemoved(mc);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	ServerCallbackEvent e(ServerCallbackEvent::ChannelRemoved, c->iId);
+	channelToChannel(c, e.channel);
+	dispatchServerEvent(s, e);
 }
 
 void MurmurIce::channelStateChanged(const ::Channel *c) {
 	::Server *s = qobject_cast< ::Server *> (sender());
 
-	const QList< ::Murmur::ServerCallbackPrx> &qmList = qmServerCallbacks[s->iServerNum];
+	if (ServerStateJournal *j = stateJournal(s))
+		j->channelChanged(c->iId);
 
-	if (qmList.isEmpty())
+	if (! hasServerCallbacks(s))
 		return;
 
-	::Murmur::Channel mc;
-	channelToChannel(c, mc);
-
-	foreach(const ::Murmur::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->channelStateChanged(mc);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	ServerCallbackEvent e(ServerCallbackEvent::ChannelStateChanged, c->iId);
+	channelToChannel(c, e.channel);
+	dispatchServerEvent(s, e);
 }
 
 void MurmurIce::contextAction(const ::User *pSrc, const QString &action, unsigned int session, int iChannel) {
 	::Server *s = qobject_cast< ::Server *> (sender());
 
-	QMap<int, QMap<int, QMap<QString, ::Murmur::ServerContextCallbackPrx> > > &qmAll = qmServerContextCallbacks;
-	if (! qmAll.contains(s->iServerNum))
-		return;
-
-	QMap<int, QMap<QString, ::Murmur::ServerContextCallbackPrx> > &qmServer = qmAll[s->iServerNum];
-	if (! qmServer.contains(pSrc->uiSession))
-		return;
-
-	QMap<QString, ::Murmur::ServerContextCallbackPrx> &qmUser = qmServer[pSrc->uiSession];
-	if (! qmUser.contains(action))
+	const ::Murmur::ServerContextCallbackPrx prx = getServerContextCallbacks(s).value(pSrc->uiSession).value(action);
+	if (! prx)
 		return;
 
-	const ::Murmur::ServerContextCallbackPrx &prx = qmUser[action];
-
 	::Murmur::User mp;
 	userToUser(pSrc, mp);
 
@@ -782,7 +1056,7 @@ Ice::ObjectPtr ServerLocator::locate(const Ice::Current &, Ice::LocalObjectPtr &
 }
 
 #define FIND_SERVER \
-	::Server *server = meta->qhServers.value(server_id);
+	::Server *server = meta->server(server_id);
 
 #define NEED_SERVER_EXISTS \
 	FIND_SERVER \
@@ -970,30 +1244,69 @@ static void impl_Server_getLogLen(const ::Murmur::AMD_Server_getLogLenPtr cb, in
 	cb->ice_response(len);
 }
 
+/// Returns the journal of a running server, or scratch for a server that
+/// is starting or stopping, so nothing is cached past its lifetime.
+static ServerStateJournal &journalOf(const ::Server *server, ServerStateJournal &scratch) {
+	ServerStateJournal *j = mi->stateJournal(server);
+	return j ? *j : scratch;
+}
+
+static const ::Murmur::UserMap &cachedUsers(::Server *server, ServerStateJournal &j) {
+
+	if (j.bUsersValid) {
+		// Only the statistics can have changed.
+		for (::Murmur::UserMap::iterator i = j.umUsers.begin(); i != j.umUsers.end(); ++i) {
+			const ::User *p = server->qhUsers.value((*i).first);
+			if (! p) {
+				j.bUsersValid = false;
+				break;
+			}
+			userStatsToUser(p, (*i).second);
+		}
+	}
+
+	if (! j.bUsersValid) {
+		j.umUsers.clear();
+		foreach(const ::User *p, server->qhUsers) {
+			::Murmur::User mp;
+			if (static_cast<const ServerUser *>(p)->sState == ::ServerUser::Authenticated) {
+				userToUser(p, mp);
+				j.umUsers[p->uiSession] = mp;
+			}
+		}
+		j.bUsersValid = true;
+	}
+
+	return j.umUsers;
+}
+
+static const ::Murmur::ChannelMap &cachedChannels(::Server *server, ServerStateJournal &j) {
+
+	if (! j.bChannelsValid) {
+		j.cmChannels.clear();
+		foreach(const ::Channel *c, server->qhChannels) {
+			::Murmur::Channel mc;
+			channelToChannel(c, mc);
+			j.cmChannels[c->iId] = mc;
+		}
+		j.bChannelsValid = true;
+	}
+
+	return j.cmChannels;
+}
+
 #define ACCESS_Server_getUsers_READ
 static void impl_Server_getUsers(const ::Murmur::AMD_Server_getUsersPtr cb, int server_id) {
 	NEED_SERVER;
-	::Murmur::UserMap pm;
-	foreach(const ::User *p, server->qhUsers) {
-		::Murmur::User mp;
-		if (static_cast<const ServerUser *>(p)->sState == ::ServerUser::Authenticated) {
-			userToUser(p, mp);
-			pm[p->uiSession] = mp;
-		}
-	}
-	cb->ice_response(pm);
+	ServerStateJournal scratch;
+	cb->ice_response(cachedUsers(server, journalOf(server, scratch)));
 }
 
 #define ACCESS_Server_getChannels_READ
 static void impl_Server_getChannels(const ::Murmur::AMD_Server_getChannelsPtr cb, int server_id) {
 	NEED_SERVER;
-	::Murmur::ChannelMap cm;
-	foreach(const ::Channel *c, server->qhChannels) {
-		::Murmur::Channel mc;
-		channelToChannel(c, mc);
-		cm[c->iId] = mc;
-	}
-	cb->ice_response(cm);
+	ServerStateJournal scratch;
+	cb->ice_response(cachedChannels(server, journalOf(server, scratch)));
 }
 
 static bool userSort(const ::User *a, const ::User *b) {
@@ -1026,10 +1339,77 @@ TreePtr recurseTree(const ::Channel *c) {
 	return t;
 }
 
+static void refreshTree(const ::Server *server, const TreePtr &t) {
+	for (UserList::iterator i = t->users.begin(); i != t->users.end(); ++i) {
+		const ::User *p = server->qhUsers.value(i->session);
+		if (p)
+			userStatsToUser(p, *i);
+	}
+
+	for (TreeList::const_iterator i = t->children.begin(); i != t->children.end(); ++i)
+		refreshTree(server, *i);
+}
+
 #define ACCESS_Server_getTree_READ
 static void impl_Server_getTree(const ::Murmur::AMD_Server_getTreePtr cb, int server_id) {
 	NEED_SERVER;
-	cb->ice_response(recurseTree(server->qhChannels.value(0)));
+	ServerStateJournal scratch;
+	ServerStateJournal &j = journalOf(server, scratch);
+
+	if (j.bTreeValid) {
+		refreshTree(server, j.tpTree);
+	} else {
+		j.tpTree = recurseTree(server->qhChannels.value(0));
+		j.bTreeValid = true;
+	}
+
+	cb->ice_response(j.tpTree);
+}
+
+#define ACCESS_Server_getChangesSince_READ
+static void impl_Server_getChangesSince(const ::Murmur::AMD_Server_getChangesSincePtr cb, int server_id, ::Ice::Long sequence) {
+	NEED_SERVER;
+	ServerStateJournal scratch;
+	ServerStateJournal &j = journalOf(server, scratch);
+
+	::Murmur::StateChanges sc;
+	sc.sequence = static_cast< ::Ice::Long>(j.uiSequence);
+
+	const quint64 since = static_cast<quint64>(sequence);
+	sc.full = (sequence <= 0) || (since < j.uiForgotten) || (since > j.uiSequence);
+
+	if (sc.full) {
+		sc.users = cachedUsers(server, j);
+		sc.channels = cachedChannels(server, j);
+		cb->ice_response(sc);
+		return;
+	}
+
+	QMap<quint64, int>::const_iterator i;
+
+	for (i = j.eUsers.qmChanged.upperBound(since); i != j.eUsers.qmChanged.constEnd(); ++i) {
+		const ::User *p = server->qhUsers.value(i.value());
+		if (p && (static_cast<const ServerUser *>(p)->sState == ::ServerUser::Authenticated)) {
+			::Murmur::User mp;
+			userToUser(p, mp);
+			sc.users[p->uiSession] = mp;
+		}
+	}
+	for (i = j.eUsers.qmRemoved.upperBound(since); i != j.eUsers.qmRemoved.constEnd(); ++i)
+		sc.removedUsers.push_back(i.value());
+
+	for (i = j.eChannels.qmChanged.upperBound(since); i != j.eChannels.qmChanged.constEnd(); ++i) {
+		const ::Channel *c = server->qhChannels.value(i.value());
+		if (c) {
+			::Murmur::Channel mc;
+			channelToChannel(c, mc);
+			sc.channels[c->iId] = mc;
+		}
+	}
+	for (i = j.eChannels.qmRemoved.upperBound(since); i != j.eChannels.qmRemoved.constEnd(); ++i)
+		sc.removedChannels.push_back(i.value());
+
+	cb->ice_response(sc);
 }
 
 #define ACCESS_Server_getCertificateList_READ
@@ -1276,6 +1656,10 @@ static void impl_Server_addChannel(const ::Murmur::AMD_Server_addChannelPtr cb,
 	server->updateChannel(nc);
 	int newid = nc->iId;
 
+	// This path does not emit channelCreated, so record it here.
+	if (ServerStateJournal *j = mi->stateJournal(server))
+		j->channelChanged(newid);
+
 	MumbleProto::ChannelState mpcs;
 	mpcs.set_channel_id(newid);
 	mpcs.set_parent(parent);
@@ -1691,4 +2075,10 @@ static void impl_Meta_getUptime(const ::Murmur::AMD_Meta_getUptimePtr cb, const
 	cb->ice_response(static_cast<int>(meta->tUptime.elapsed()/1000000LL));
 }
 
+#define ACCESS_Meta_getMetrics_READ
+static void impl_Meta_getMetrics(const ::Murmur::AMD_Meta_getMetricsPtr cb, const Ice::ObjectAdapterPtr) {
+	const QByteArray &qba = Metrics::prometheus();
+	cb->ice_response(std::string(qba.constData(), qba.size()));
+}
+
 #include "MurmurIceWrapper.cpp"
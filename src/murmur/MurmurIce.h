@@ -32,22 +32,127 @@
 #ifndef MUMBLE_MURMUR_MURMURICE_H_
 #define MUMBLE_MURMUR_MURMURICE_H_
 
+#include <QtCore/QHash>
 #include <QtCore/QList>
 #include <QtCore/QMap>
 #include <QtCore/QMutex>
 #include <QtCore/QObject>
+#include <QtCore/QThread>
 #include <QtCore/QWaitCondition>
 #include <QtNetwork/QSslCertificate>
 
 #include "MurmurI.h"
+#include "Timer.h"
 
 class Channel;
 class Server;
 class User;
 struct TextMessage;
 
+/// A pending ServerCallback invocation.
+struct ServerCallbackEvent {
+	enum Type { UserConnected, UserDisconnected, UserStateChanged, UserTextMessage, ChannelCreated, ChannelRemoved, ChannelStateChanged };
+
+	Type type;
+	/// Session or channel id the event is about.
+	int id;
+	::Murmur::User user;
+	::Murmur::Channel channel;
+	::Murmur::TextMessage message;
+	/// Time the event was queued, from ServerCallbackQueue::tTimer.
+	quint64 uiQueued;
+
+	ServerCallbackEvent(Type t, int i);
+};
+
+/// Outbound event queue for one ServerCallback.
+///
+/// Events are queued from the main thread and delivered by the queue's own
+/// thread, so a slow or hung listener only ever delays itself. Pending state
+/// changes for the same user or channel are coalesced into the latest one.
+class ServerCallbackQueue : public QThread {
+	private:
+		Q_DISABLE_COPY(ServerCallbackQueue);
+	protected:
+		const int iServerNum;
+		const ::Murmur::ServerCallbackPrx prx;
+
+		QMutex qmQueue;
+		QWaitCondition qwcQueue;
+		QList<ServerCallbackEvent> qlEvents;
+		bool bRunning;
+		bool bFailed;
+
+		Timer tTimer;
+		quint64 uiDelivered, uiCoalesced;
+		quint64 uiLatencySum, uiLatencyMax;
+
+		void deliver(const ServerCallbackEvent &e);
+	public:
+		/// Maximum number of undelivered events before the listener is considered hung.
+		static const int iMaxEvents = 1000;
+
+		ServerCallbackQueue(int server_id, const ::Murmur::ServerCallbackPrx &proxy);
+
+		const ::Murmur::ServerCallbackPrx &proxy() const;
+
+		/// Queues an event. Returns false if the queue is full.
+		bool enqueue(ServerCallbackEvent e);
+		/// Makes the thread exit once the current call returns. Undelivered events are discarded.
+		void stop();
+		/// Human readable delivery statistics.
+		QString statistics();
+
+		void run() Q_DECL_OVERRIDE;
+};
+
+/// Change journal and snapshot cache for the users and channels of one server.
+///
+/// Every change seen through the server's signals gets a new sequence number,
+/// so Ice clients can fetch only what changed with getChangesSince(). The
+/// getUsers/getChannels/getTree snapshots are only rebuilt after a change.
+class ServerStateJournal {
+	public:
+		/// Changes and removals of one kind of object, by id and by sequence.
+		/// An id is never in both at the same time.
+		struct Entries {
+			QHash<int, quint64> qhChanged;
+			QMap<quint64, int> qmChanged;
+			QHash<int, quint64> qhRemoved;
+			QMap<quint64, int> qmRemoved;
+
+			void change(int id, quint64 seq);
+			void remove(int id, quint64 seq);
+			/// Forgets the oldest removals beyond max and returns the newest sequence forgotten, or 0.
+			quint64 prune(int max);
+		};
+
+		/// Number of removals remembered before getChangesSince() falls back to the full state.
+		static const int iMaxRemovals = 10000;
+
+		quint64 uiSequence;
+		/// Changes up to this sequence are not fully known anymore.
+		quint64 uiForgotten;
+
+		Entries eUsers;
+		Entries eChannels;
+
+		bool bUsersValid, bChannelsValid, bTreeValid;
+		::Murmur::UserMap umUsers;
+		::Murmur::ChannelMap cmChannels;
+		::Murmur::TreePtr tpTree;
+
+		ServerStateJournal();
+
+		void userChanged(int session);
+		void userRemoved(int session);
+		void channelChanged(int id);
+		void channelRemoved(int id);
+};
+
 class MurmurIce : public QObject {
 		friend class MurmurLocker;
+		friend class ServerCallbackQueue;
 		Q_OBJECT;
 	protected:
 		int count;
@@ -56,9 +161,21 @@ class MurmurIce : public QObject {
 		void customEvent(QEvent *evt);
 		void badMetaProxy(const ::Murmur::MetaCallbackPrx &prx);
 		void badServerProxy(const ::Murmur::ServerCallbackPrx &prx, const ::Server* server);
+		void badServerCallback(int server_id, const ::Murmur::ServerCallbackPrx &prx);
 		void badAuthenticator(::Server *);
+		void dispatchServerEvent(const ::Server *server, const ServerCallbackEvent &e);
+		bool hasServerCallbacks(const ::Server *server) const;
+		void releaseServerCallbackQueue(ServerCallbackQueue *q);
 		QList< ::Murmur::MetaCallbackPrx> qlMetaCallbacks;
-		QMap<int, QList< ::Murmur::ServerCallbackPrx> > qmServerCallbacks;
+		/// Protects the per-server maps below. Servers running in their own
+		/// thread call the listener and authenticator slots from there, and
+		/// their Ice calls are executed there as well. Never held while
+		/// calling into a server or an Ice proxy.
+		mutable QMutex qmServerState;
+		QMap<int, QList<ServerCallbackQueue *> > qmServerCallbacks;
+		/// Stopped queues whose thread may not have exited yet.
+		QList<ServerCallbackQueue *> qlReleasedCallbacks;
+		QMap<int, ServerStateJournal> qmStateJournals;
 		QMap<int, QMap<int, QMap<QString, ::Murmur::ServerContextCallbackPrx> > > qmServerContextCallbacks;
 		QMap<int, ::Murmur::ServerAuthenticatorPrx> qmServerAuthenticator;
 		QMap<int, ::Murmur::ServerUpdatingAuthenticatorPrx> qmServerUpdatingAuthenticator;
@@ -82,6 +199,7 @@ class MurmurIce : public QObject {
 		void setServerUpdatingAuthenticator(const ::Server* server, const ::Murmur::ServerUpdatingAuthenticatorPrx& prx);
 		const ::Murmur::ServerUpdatingAuthenticatorPrx getServerUpdatingAuthenticator(const ::Server* server) const;
 		void removeServerUpdatingAuthenticator(const ::Server* server);
+		ServerStateJournal *stateJournal(const ::Server* server);
 
 	public slots:
 		void started(Server *);
@@ -131,6 +131,7 @@ bool Server::setChannelState(Channel *cChannel, Channel *cParent, const QString
 
 		cChannel->cParent->removeChannel(cChannel);
 		cParent->addChannel(cChannel);
+		invalidateChannelTour();
 
 		mpcs.set_parent(cParent->iId);
 
@@ -202,24 +203,17 @@ void Server::sendTextMessage(Channel *cChannel, ServerUser *pUser, bool tree, co
 		else
 			mptm.add_channel_id(cChannel->iId);
 
-		QSet<Channel *> chans;
-		QQueue<Channel *> q;
-		q << cChannel;
-		chans.insert(cChannel);
-		Channel *c;
-
+		QSet<ServerUser *> users;
 		if (tree) {
-			while (! q.isEmpty()) {
-				c = q.dequeue();
-				chans.insert(c);
-				foreach(c, c->qlChannels)
-					q.enqueue(c);
-			}
-		}
-		foreach(c, chans) {
-			foreach(User *p, c->qlUsers)
-				sendMessage(static_cast<ServerUser *>(p), mptm);
+			addTreeRecipients(NULL, cChannel, users);
+		} else {
+			foreach(User *p, cChannel->qlUsers)
+				users.insert(static_cast<ServerUser *>(p));
 		}
+
+		QByteArray cache;
+		foreach(ServerUser *u, users)
+			u->sendMessage(mptm, MessageHandler::TextMessage, cache);
 	}
 }
 
@@ -282,17 +276,20 @@ void Server::clearTempGroups(User *user, Channel *cChannel, bool recurse) {
 	clearACLCache(user);
 }
 
+/// Authenticators and listeners are always called directly, even when the
+/// server runs in its own thread, as they get pointers into the server state
+/// and some return results through reference arguments.
 void Server::connectAuthenticator(QObject *obj) {
-	connect(this, SIGNAL(registerUserSig(int &, const QMap<int, QString> &)), obj, SLOT(registerUserSlot(int &, const QMap<int, QString> &)));
-	connect(this, SIGNAL(unregisterUserSig(int &, int)), obj, SLOT(unregisterUserSlot(int &, int)));
-	connect(this, SIGNAL(getRegisteredUsersSig(const QString &, QMap<int, QString> &)), obj, SLOT(getRegisteredUsersSlot(const QString &, QMap<int, QString> &)));
-	connect(this, SIGNAL(getRegistrationSig(int &, int, QMap<int, QString> &)), obj, SLOT(getRegistrationSlot(int &, int, QMap<int, QString> &)));
-	connect(this, SIGNAL(authenticateSig(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)), obj, SLOT(authenticateSlot(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)));
-	connect(this, SIGNAL(setInfoSig(int &, int, const QMap<int, QString> &)), obj, SLOT(setInfoSlot(int &, int, const QMap<int, QString> &)));
-	connect(this, SIGNAL(setTextureSig(int &, int, const QByteArray &)), obj, SLOT(setTextureSlot(int &, int, const QByteArray &)));
-	connect(this, SIGNAL(idToNameSig(QString &, int)), obj, SLOT(idToNameSlot(QString &, int)));
-	connect(this, SIGNAL(nameToIdSig(int &, const QString &)), obj, SLOT(nameToIdSlot(int &, const QString &)));
-	connect(this, SIGNAL(idToTextureSig(QByteArray &, int)), obj, SLOT(idToTextureSlot(QByteArray &, int)));
+	connect(this, SIGNAL(registerUserSig(int &, const QMap<int, QString> &)), obj, SLOT(registerUserSlot(int &, const QMap<int, QString> &)), Qt::DirectConnection);
+	connect(this, SIGNAL(unregisterUserSig(int &, int)), obj, SLOT(unregisterUserSlot(int &, int)), Qt::DirectConnection);
+	connect(this, SIGNAL(getRegisteredUsersSig(const QString &, QMap<int, QString> &)), obj, SLOT(getRegisteredUsersSlot(const QString &, QMap<int, QString> &)), Qt::DirectConnection);
+	connect(this, SIGNAL(getRegistrationSig(int &, int, QMap<int, QString> &)), obj, SLOT(getRegistrationSlot(int &, int, QMap<int, QString> &)), Qt::DirectConnection);
+	connect(this, SIGNAL(authenticateSig(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)), obj, SLOT(authenticateSlot(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)), Qt::DirectConnection);
+	connect(this, SIGNAL(setInfoSig(int &, int, const QMap<int, QString> &)), obj, SLOT(setInfoSlot(int &, int, const QMap<int, QString> &)), Qt::DirectConnection);
+	connect(this, SIGNAL(setTextureSig(int &, int, const QByteArray &)), obj, SLOT(setTextureSlot(int &, int, const QByteArray &)), Qt::DirectConnection);
+	connect(this, SIGNAL(idToNameSig(QString &, int)), obj, SLOT(idToNameSlot(QString &, int)), Qt::DirectConnection);
+	connect(this, SIGNAL(nameToIdSig(int &, const QString &)), obj, SLOT(nameToIdSlot(int &, const QString &)), Qt::DirectConnection);
+	connect(this, SIGNAL(idToTextureSig(QByteArray &, int)), obj, SLOT(idToTextureSlot(QByteArray &, int)), Qt::DirectConnection);
 }
 
 void Server::disconnectAuthenticator(QObject *obj) {
@@ -309,13 +306,13 @@ void Server::disconnectAuthenticator(QObject *obj) {
 }
 
 void Server::connectListener(QObject *obj) {
-	connect(this, SIGNAL(userStateChanged(const User *)), obj, SLOT(userStateChanged(const User *)));
-	connect(this, SIGNAL(userTextMessage(const User *, const TextMessage &)), obj, SLOT(userTextMessage(const User *, const TextMessage &)));
-	connect(this, SIGNAL(userConnected(const User *)), obj, SLOT(userConnected(const User *)));
-	connect(this, SIGNAL(userDisconnected(const User *)), obj, SLOT(userDisconnected(const User *)));
-	connect(this, SIGNAL(channelStateChanged(const Channel *)), obj, SLOT(channelStateChanged(const Channel *)));
-	connect(this, SIGNAL(channelCreated(const Channel *)), obj, SLOT(channelCreated(const Channel *)));
-	connect(this, SIGNAL(channelRemoved(const Channel *)), obj, SLOT(channelRemoved(const Channel *)));
+	connect(this, SIGNAL(userStateChanged(const User *)), obj, SLOT(userStateChanged(const User *)), Qt::DirectConnection);
+	connect(this, SIGNAL(userTextMessage(const User *, const TextMessage &)), obj, SLOT(userTextMessage(const User *, const TextMessage &)), Qt::DirectConnection);
+	connect(this, SIGNAL(userConnected(const User *)), obj, SLOT(userConnected(const User *)), Qt::DirectConnection);
+	connect(this, SIGNAL(userDisconnected(const User *)), obj, SLOT(userDisconnected(const User *)), Qt::DirectConnection);
+	connect(this, SIGNAL(channelStateChanged(const Channel *)), obj, SLOT(channelStateChanged(const Channel *)), Qt::DirectConnection);
+	connect(this, SIGNAL(channelCreated(const Channel *)), obj, SLOT(channelCreated(const Channel *)), Qt::DirectConnection);
+	connect(this, SIGNAL(channelRemoved(const Channel *)), obj, SLOT(channelRemoved(const Channel *)), Qt::DirectConnection);
 }
 
 void Server::disconnectListener(QObject *obj) {
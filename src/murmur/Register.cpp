@@ -36,6 +36,8 @@
 #include "OSInfo.h"
 
 void Server::initRegister() {
+	// Parented so it moves along if the server gets its own thread.
+	qtTick.setParent(this);
 	connect(&qtTick, SIGNAL(timeout()), this, SLOT(update()));
 
 	if (! qsRegName.isEmpty()) {
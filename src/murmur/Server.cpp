@@ -36,10 +36,12 @@
 #include "ACL.h"
 #include "Connection.h"
 #include "Group.h"
+#include "HTMLFilter.h"
 #include "User.h"
 #include "Channel.h"
 #include "Message.h"
 #include "Meta.h"
+#include "Metrics.h"
 #include "PacketDataStream.h"
 #include "ServerDB.h"
 #include "ServerUser.h"
@@ -63,12 +65,22 @@ void LogEmitter::addLogEntry(const QString &msg) {
 	emit newLogEntry(msg);
 };
 
-ExecEvent::ExecEvent(boost::function<void ()> f) : QEvent(static_cast<QEvent::Type>(EXEC_QEVENT)) {
+ExecEvent::ExecEvent(boost::function<void ()> f, int server_id, const char *name) : QEvent(static_cast<QEvent::Type>(EXEC_QEVENT)), iServerNum(server_id), cName(name) {
 	func = f;
 }
 
 void ExecEvent::execute() {
-	func();
+	if (cName) {
+		HandlerTimer ht(Metrics::label(Metrics::IceCall, cName), iServerNum);
+		func();
+	} else {
+		func();
+	}
+}
+
+/// Returns a copy to post to another object; events can't be posted twice.
+ExecEvent *ExecEvent::forward() const {
+	return new ExecEvent(func, iServerNum, cName);
 }
 
 SslServer::SslServer(QObject *p) : QTcpServer(p) {
@@ -143,6 +155,8 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	bPreferAlpha = false;
 	bOpus = true;
 
+	bChannelTourValid = false;
+
 	qnamNetwork = NULL;
 
 	readParams();
@@ -358,6 +372,10 @@ Server::~Server() {
 #endif
 	clearACLCache();
 
+	foreach(Channel *c, qhChannels)
+		if (! c->qbaDescHash.isEmpty())
+			meta->bsBlobs.release(c->qbaDescHash);
+
 	log("Stopped");
 }
 
@@ -425,6 +443,7 @@ void Server::readParams() {
 	qvSuggestPositional = Meta::mp.qvSuggestPositional;
 	qvSuggestPushToTalk = Meta::mp.qvSuggestPushToTalk;
 	iOpusThreshold = Meta::mp.iOpusThreshold;
+	iAudibleRadius = Meta::mp.iAudibleRadius;
 	iChannelNestingLimit = Meta::mp.iChannelNestingLimit;
 
 	QString qsHost = getConf("host", QString()).toString();
@@ -491,6 +510,8 @@ void Server::readParams() {
 
 	iOpusThreshold = getConf("opusthreshold", iOpusThreshold).toInt();
 
+	iAudibleRadius = qMax(0, getConf("audibleradius", iAudibleRadius).toInt());
+
 	iChannelNestingLimit = getConf("channelnestinglimit", iChannelNestingLimit).toInt();
 
 	qrUserName=QRegExp(getConf("username", qrUserName.pattern()).toString());
@@ -609,6 +630,8 @@ void Server::setLiveConf(const QString &key, const QString &value) {
 		qvSuggestPushToTalk = ! v.isNull() ? (v.isEmpty() ? QVariant() : v) : Meta::mp.qvSuggestPushToTalk;
 	else if (key == "opusthreshold")
 		iOpusThreshold = (i >= 0 && !v.isNull()) ? qBound(0, i, 100) : Meta::mp.iOpusThreshold;
+	else if (key == "audibleradius")
+		iAudibleRadius = (i >= 0 && !v.isNull()) ? i : Meta::mp.iAudibleRadius;
 	else if (key =="channelnestinglimit")
 		iChannelNestingLimit = (i >= 0 && !v.isNull()) ? i : Meta::mp.iChannelNestingLimit;
 }
@@ -637,6 +660,12 @@ void Server::customEvent(QEvent *evt) {
 		static_cast<ExecEvent *>(evt)->execute();
 }
 
+/// Moves a server running in its own thread back to the main thread so it
+/// can be destroyed there. Objects can only be pushed away by their own thread.
+void Server::returnToMainThread() {
+	moveToThread(QCoreApplication::instance()->thread());
+}
+
 void Server::udpActivated(int socket) {
 	qint32 len;
 	char encrypt[UDP_PACKET_SIZE];
@@ -811,6 +840,8 @@ void Server::run() {
 					continue;
 				}
 
+				Metrics::add(Metrics::UdpPacketsIn);
+
 				QReadLocker rl(&qrwlUsers);
 
 				quint32 *ping = reinterpret_cast<quint32 *>(encrypt);
@@ -828,6 +859,7 @@ void Server::run() {
 #else
 					::sendto(sock, encrypt, 6 * sizeof(quint32), 0, reinterpret_cast<struct sockaddr *>(&from), fromlen);
 #endif
+					Metrics::add(Metrics::UdpPacketsOut);
 					continue;
 				}
 
@@ -840,6 +872,7 @@ void Server::run() {
 				ServerUser *u = qhPeerUsers.value(key);
 				if (u) {
 					if (! checkDecrypt(u, encrypt, buffer, len)) {
+						Metrics::add(Metrics::DecryptFailures);
 						continue;
 					}
 				} else {
@@ -866,6 +899,7 @@ void Server::run() {
 						}
 					}
 					if (! u) {
+						Metrics::add(Metrics::DecryptFailures);
 						continue;
 					}
 				}
@@ -973,6 +1007,7 @@ void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &c
 #else
 		::sendto(u->sUdpSocket, buffer, len+4, 0, reinterpret_cast<struct sockaddr *>(& u->saiUdpAddress), (u->saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
 #endif
+		Metrics::add(Metrics::UdpPacketsOut);
 #ifdef Q_OS_WIN
 		if (Meta::hQoS && dwFlow)
 			QOSRemoveSocketFromFlow(Meta::hQoS, 0, dwFlow, 0);
@@ -982,11 +1017,30 @@ void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &c
 		if (cache.isEmpty())
 			cache = QByteArray(data, len);
 		emit tcpTransmit(cache,u->uiSession);
+		Metrics::add(Metrics::TunnelPacketsOut);
 	}
 }
 
+// Listener positions older than this (in microseconds) are no longer
+// trusted for culling; clients only send coordinates while talking.
+#define POSITION_TIMEOUT Q_UINT64_C(5000000)
+
+// Whether a same-context listener is known to be farther than the audible
+// radius from the speaker. Listeners without a recent position are never
+// culled. The coordinates may be updated concurrently by the listener's own
+// voice packets, which at worst misroutes a single packet.
+static inline bool outOfEarshot(const ServerUser *u, const ServerUser *pDst, float radius2) {
+	if (! pDst->bPositioned || (pDst->ssContext != u->ssContext) || (pDst->tPosition.elapsed() > POSITION_TIMEOUT))
+		return false;
+	const float dx = pDst->fPosition[0] - u->fPosition[0];
+	const float dy = pDst->fPosition[1] - u->fPosition[1];
+	const float dz = pDst->fPosition[2] - u->fPosition[2];
+	return (dx * dx + dy * dy + dz * dz) > radius2;
+}
+
 #define SENDTO \
 		if ((!pDst->bDeaf) && (!pDst->bSelfDeaf) && (pDst != u)) { \
+			++fanout; \
 			if ((poslen > 0) && (pDst->ssContext == u->ssContext)) \
 				sendMessage(pDst, buffer, len, qba); \
 			else \
@@ -997,6 +1051,8 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 	if (u->sState != ServerUser::Authenticated || u->bMute || u->bSuppress || u->bSelfMute)
 		return;
 
+	MetricsTimer mt(Metrics::ProcessMsgDuration);
+	int fanout = 0;
 	User *p;
 	BandwidthRecord *bw = & u->bwr;
 	Channel *c = u->cChannel;
@@ -1036,6 +1092,15 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 	// Save location of the positional audio data.
 	poslen = pdi.left();
 
+	// Remember where the speaker is, both to cull its listeners and to
+	// cull it when it listens to others.
+	if ((iAudibleRadius > 0) && (poslen > 0) && ! u->ssContext.empty()) {
+		PacketDataStream pdp(data + len - poslen, poslen);
+		pdp >> u->fPosition[0] >> u->fPosition[1] >> u->fPosition[2];
+		u->bPositioned = pdp.isValid();
+		u->tPosition.restart();
+	}
+
 	// Append session id to the new output stream.
 	pds << u->uiSession;
 	// Copy all voice and positional audio data to the output stream.
@@ -1046,11 +1111,22 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 	if (target == 0x1f) { // Server loopback
 		buffer[0] = static_cast<char>(type | 0);
 		sendMessage(u, buffer, len, qba);
+		Metrics::observe(Metrics::VoiceFanout, 1);
 		return;
 	} else if (target == 0) { // Normal speech
 		buffer[0] = static_cast<char>(type | 0);
+
+		// Whispers are deliberate and always delivered; only plain
+		// positional speech is culled by distance.
+		const bool cull = (iAudibleRadius > 0) && (poslen > 0) && u->bPositioned;
+		const float radius2 = static_cast<float>(iAudibleRadius) * static_cast<float>(iAudibleRadius);
+
 		foreach(p, c->qlUsers) {
 			ServerUser *pDst = static_cast<ServerUser *>(p);
+			if (cull && outOfEarshot(u, pDst, radius2)) {
+				Metrics::add(Metrics::VoiceCulled);
+				continue;
+			}
 			SENDTO;
 		}
 
@@ -1064,6 +1140,10 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 				if (ChanACL::hasPermission(u, l, ChanACL::Speak, &acCache)) {
 					foreach(p, l->qlUsers) {
 						ServerUser *pDst = static_cast<ServerUser *>(p);
+						if (cull && outOfEarshot(u, pDst, radius2)) {
+							Metrics::add(Metrics::VoiceCulled);
+							continue;
+						}
 						SENDTO;
 					}
 				}
@@ -1154,6 +1234,8 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 			}
 		}
 	}
+
+	Metrics::observe(Metrics::VoiceFanout, fanout);
 }
 
 void Server::log(ServerUser *u, const QString &str) const {
@@ -1228,6 +1310,7 @@ void Server::newClient() {
 
 		ServerUser *u = new ServerUser(this, sock);
 		u->uiSession = qqIds.dequeue();
+		Metrics::add(Metrics::TlsHandshakes);
 		u->haAddress = ha;
 		HostAddress(sock->localAddress()).toSockaddr(& u->saiTcpLocalAddress);
 
@@ -1263,6 +1346,8 @@ void Server::newClient() {
 
 void Server::encrypted() {
 	ServerUser *uSource = qobject_cast<ServerUser *>(sender());
+	// The bandwidth record starts out with the connection.
+	Metrics::observe(Metrics::TlsHandshakeDuration, uSource->bwr.tFirst.elapsed());
 	int major, minor, patch;
 	QString release;
 
@@ -1342,10 +1427,12 @@ void Server::sslError(const QList<QSslError> &errors) {
 		}
 	}
 
-	if (ok)
+	if (ok) {
 		u->proceedAnyway();
-	else
+	} else {
+		Metrics::add(Metrics::TlsHandshakeFailures);
 		u->disconnectSocket(true);
+	}
 }
 
 void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &reason) {
@@ -1441,6 +1528,8 @@ void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *
 
 #ifdef QT_NO_DEBUG
 #define MUMBLE_MH_MSG(x) case MessageHandler:: x : { \
+		static const int label = Metrics::label(Metrics::ControlMessage, #x); \
+		HandlerTimer ht(label, iServerNum, u); \
 		MumbleProto:: x msg; \
 		if (msg.ParseFromArray(qbaMsg.constData(), qbaMsg.size())) { \
 			msg.DiscardUnknownFields(); \
@@ -1450,6 +1539,8 @@ void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *
 	}
 #else
 #define MUMBLE_MH_MSG(x) case MessageHandler:: x : { \
+		static const int label = Metrics::label(Metrics::ControlMessage, #x); \
+		HandlerTimer ht(label, iServerNum, u); \
 		MumbleProto:: x msg; \
 		if (msg.ParseFromArray(qbaMsg.constData(), qbaMsg.size())) { \
 			if (uiType != MessageHandler::Ping) { \
@@ -1539,7 +1630,10 @@ void Server::removeChannel(Channel *chan, Channel *dest) {
 	if (dest == NULL)
 		dest = chan->cParent;
 
+	const QList<Channel *> linked = chan->qhLinks.keys();
 	chan->unlink(NULL);
+	foreach(c, linked)
+		emit channelStateChanged(c);
 
 	foreach(c, chan->qlChannels) {
 		removeChannel(c, dest);
@@ -1567,10 +1661,14 @@ void Server::removeChannel(Channel *chan, Channel *dest) {
 	removeChannelDB(chan);
 	emit channelRemoved(chan);
 
+	if (! chan->qbaDescHash.isEmpty())
+		meta->bsBlobs.release(chan->qbaDescHash);
+
 	if (chan->cParent) {
 		QWriteLocker wl(&qrwlUsers);
 		chan->cParent->removeChannel(chan);
 	}
+	invalidateChannelTour();
 
 	delete chan;
 }
@@ -1611,6 +1709,7 @@ bool Server::unregisterUser(int id) {
 			sendAll(mpus);
 
 			u->iId = -1;
+			emit userStateChanged(u);
 			break;
 		}
 	}
@@ -1872,19 +1971,24 @@ void Server::recheckCodecVersions(ServerUser *connectingUser) {
 }
 
 void Server::hashAssign(QString &dest, QByteArray &hash, const QString &src) {
+	QByteArray newhash;
 	dest = src;
 	if (src.length() >= 128)
-		hash = sha1(src);
-	else
-		hash = QByteArray();
+		newhash = meta->bsBlobs.intern(dest);
+	// Intern before releasing, so reassigning the same blob never evicts it.
+	if (! hash.isEmpty())
+		meta->bsBlobs.release(hash);
+	hash = newhash;
 }
 
 void Server::hashAssign(QByteArray &dest, QByteArray &hash, const QByteArray &src) {
+	QByteArray newhash;
 	dest = src;
 	if (src.length() >= 128)
-		hash = sha1(src);
-	else
-		hash = QByteArray();
+		newhash = meta->bsBlobs.intern(dest);
+	if (! hash.isEmpty())
+		meta->bsBlobs.release(hash);
+	hash = newhash;
 }
 
 bool Server::isTextAllowed(QString &text, bool &changed) {
@@ -1894,24 +1998,10 @@ bool Server::isTextAllowed(QString &text, bool &changed) {
 		if (! text.contains(QLatin1Char('<'))) {
 			text = text.simplified();
 		} else {
-			QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
 			QString qs;
-			while (! qxsr.atEnd()) {
-				switch (qxsr.readNext()) {
-					case QXmlStreamReader::Invalid:
-						return false;
-					case QXmlStreamReader::Characters:
-						qs += qxsr.text();
-						break;
-					case QXmlStreamReader::EndElement:
-						if ((qxsr.name() == QLatin1String("br")) || (qxsr.name() == QLatin1String("p")))
-							qs += "\n";
-						break;
-					default:
-						break;
-				}
-			}
-			text = qs.simplified();
+			if (! HTMLFilter::toPlainText(text, qs))
+				return false;
+			text = qs;
 		}
 		changed = true;
 		return ((iMaxTextMessageLength == 0) || (text.length() <= iMaxTextMessageLength));
@@ -1934,35 +2024,73 @@ bool Server::isTextAllowed(QString &text, bool &changed) {
 		if (! text.contains(QLatin1Char('<')))
 			return false;
 
-		// Strip value from <img>s src attributes to check text-length only -
+		// Don't count the src attributes of <img>s towards the text length -
 		// we already ensured the img-length requirement is met
-		QString qsOut;
-		QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
-		QXmlStreamWriter qxsw(&qsOut);
-		while (! qxsr.atEnd()) {
-			switch (qxsr.readNext()) {
-				case QXmlStreamReader::Invalid:
-					return false;
-				case QXmlStreamReader::StartElement: {
-						if (qxsr.name() == QLatin1String("img")) {
-							qxsw.writeStartElement(qxsr.namespaceUri().toString(), qxsr.name().toString());
-							foreach(const QXmlStreamAttribute &a, qxsr.attributes())
-								if (a.name() != QLatin1String("src"))
-									qxsw.writeAttribute(a);
-						} else {
-							qxsw.writeCurrentToken(qxsr);
-						}
-					}
-					break;
-				default:
-					qxsw.writeCurrentToken(qxsr);
-					break;
-			}
-		}
+		length = HTMLFilter::textLength(text);
+
+		return (length >= 0) && (length <= iMaxTextMessageLength);
+	}
+}
+
+void Server::invalidateChannelTour() {
+	bChannelTourValid = false;
+}
 
-		length = qsOut.length();
+void Server::buildChannelTour(Channel *c) {
+	const int idx = qvChannelTour.count();
+	qhChannelTourIndex.insert(c, idx);
+	qvChannelTour.append(c);
+	qvChannelTourEnd.append(idx + 1);
+
+	foreach(Channel *sub, c->qlChannels)
+		buildChannelTour(sub);
+
+	qvChannelTourEnd[idx] = qvChannelTour.count();
+}
+
+/// Adds the users of @p c and all its subchannels that @p uSource may send
+/// text messages to. Like the per-channel checks, a channel without the
+/// TextMessage permission (which includes every channel the user can't
+/// traverse to) excludes its whole subtree. Subtrees without any users are
+/// skipped without checking permissions at all. Without a @p uSource, as for
+/// messages sent by the server itself, no permissions are checked.
+void Server::addTreeRecipients(ServerUser *uSource, Channel *c, QSet<ServerUser *> &users) {
+	if (! bChannelTourValid) {
+		qvChannelTour.clear();
+		qvChannelTourEnd.clear();
+		qhChannelTourIndex.clear();
+		Channel *root = qhChannels.value(0);
+		if (root)
+			buildChannelTour(root);
+		bChannelTourValid = true;
+	}
+
+	QHash<const Channel *, int>::const_iterator it = qhChannelTourIndex.constFind(c);
+	if (it == qhChannelTourIndex.constEnd())
+		return;
+
+	const int start = it.value();
+	const int end = qvChannelTourEnd.at(start);
+
+	// usercount[i - start] is the number of users in the channels before i.
+	QVarLengthArray<int, 1024> usercount(end - start + 1);
+	usercount[0] = 0;
+	for (int i = start; i < end; ++i)
+		usercount[i - start + 1] = usercount[i - start] + qvChannelTour.at(i)->qlUsers.count();
+
+	int i = start;
+	while (i < end) {
+		Channel *ch = qvChannelTour.at(i);
+		const int subend = qvChannelTourEnd.at(i);
+
+		if ((usercount[subend - start] == usercount[i - start]) || (uSource && ! ChanACL::hasPermission(uSource, ch, ChanACL::TextMessage, &acCache))) {
+			i = subend;
+			continue;
+		}
 
-		return (length <= iMaxTextMessageLength);
+		foreach(User *p, ch->qlUsers)
+			users.insert(static_cast<ServerUser *>(p));
+		++i;
 	}
 }
 
@@ -114,8 +114,15 @@ class ExecEvent : public QEvent {
 	protected:
 		boost::function<void ()> func;
 	public:
-		ExecEvent(boost::function<void ()>);
+		/// Server the call is for, or -1. Calls for a server running in its
+		/// own thread are executed there.
+		const int iServerNum;
+		/// Name of the RPC call this executes, if any. Named calls are
+		/// timed and logged if slow.
+		const char * const cName;
+		ExecEvent(boost::function<void ()>, int server_id = -1, const char *name = NULL);
 		void execute();
+		ExecEvent *forward() const;
 };
 
 class Server : public QThread {
@@ -147,6 +154,7 @@ class Server : public QThread {
 		int iMaxTextMessageLength;
 		int iMaxImageMessageLength;
 		int iOpusThreshold;
+		int iAudibleRadius;
 		bool bAllowHTML;
 		QString qsPassword;
 		QString qsWelcomeText;
@@ -219,6 +227,7 @@ class Server : public QThread {
 		void doSync(unsigned int);
 		void encrypted();
 		void udpActivated(int);
+		void returnToMainThread();
 	signals:
 		void reqSync(unsigned int);
 		void tcpTransmit(QByteArray, unsigned int id);
@@ -242,6 +251,13 @@ class Server : public QThread {
 		QHash<QPair<HostAddress, quint16>, ServerUser *> qhPeerUsers;
 		QHash<HostAddress, QSet<ServerUser *> > qhHostUsers;
 		QHash<unsigned int, Channel *> qhChannels;
+		/// Channels in depth-first order. The subtree of qvChannelTour[i]
+		/// spans the indices up to qvChannelTourEnd[i]. Rebuilt on demand
+		/// after the channel tree changes.
+		QVector<Channel *> qvChannelTour;
+		QVector<int> qvChannelTourEnd;
+		QHash<const Channel *, int> qhChannelTourIndex;
+		bool bChannelTourValid;
 		QReadWriteLock qrwlUsers;
 		ChanACL::ACLCache acCache;
 		QMutex qmCache;
@@ -265,6 +281,10 @@ class Server : public QThread {
 		void flushClientPermissionCache(ServerUser *u, MumbleProto::PermissionQuery &mpqq);
 		void clearACLCache(User *p = NULL);
 
+		void invalidateChannelTour();
+		void buildChannelTour(Channel *c);
+		void addTreeRecipients(ServerUser *uSource, Channel *c, QSet<ServerUser *> &users);
+
 		void sendProtoAll(const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int minversion);
 		void sendProtoExcept(ServerUser *, const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int minversion);
 		void sendProtoMessage(ServerUser *, const ::google::protobuf::Message &msg, unsigned int msgType);
@@ -352,6 +372,7 @@ class Server : public QThread {
 		int getUserID(const QString &name);
 		QString getUserName(int id);
 		QByteArray getUserTexture(int id);
+		void setTextureHash(int id, const QByteArray &texture);
 		QMap<int, QString> getRegistration(int id);
 		int registerUser(const QMap<int, QString> &info);
 		bool unregisterUserDB(int id);
@@ -38,6 +38,7 @@
 #include "DBus.h"
 #include "Group.h"
 #include "Meta.h"
+#include "Metrics.h"
 #include "Server.h"
 #include "ServerUser.h"
 #include "User.h"
@@ -53,27 +54,72 @@
 
 class TransactionHolder {
 	public:
+		QSqlDatabase *qsdDatabase;
 		QSqlQuery *qsqQuery;
 		TransactionHolder() {
-			ServerDB::db->transaction();
-			qsqQuery = new QSqlQuery();
+			if (ServerDB::bSerializeTransactions)
+				ServerDB::qmTransaction.lock();
+			qsdDatabase = ServerDB::connection();
+			qsdDatabase->transaction();
+			qsqQuery = new QSqlQuery(*qsdDatabase);
 		}
 
 		~TransactionHolder() {
 			qsqQuery->clear();
 			delete qsqQuery;
-			ServerDB::db->commit();
+			qsdDatabase->commit();
+			if (ServerDB::bSerializeTransactions)
+				ServerDB::qmTransaction.unlock();
 		}
 		TransactionHolder(const TransactionHolder & other) {
-			ServerDB::db->transaction();
+			if (ServerDB::bSerializeTransactions)
+				ServerDB::qmTransaction.lock();
+			qsdDatabase = other.qsdDatabase;
+			qsdDatabase->transaction();
 			qsqQuery = other.qsqQuery ? new QSqlQuery(*other.qsqQuery) : 0;
 		}
 };
 
+/// Database connection of a thread other than the main thread. Qt
+/// connections may only be used by the thread that created them, so every
+/// server thread gets its own clone of the main connection.
+class ThreadConnection {
+	public:
+		QString qsName;
+		QSqlDatabase *qsdDatabase;
+		ThreadConnection();
+		~ThreadConnection();
+};
+
+ThreadConnection::ThreadConnection() {
+	qsName = QString::fromLatin1("murmur-thread-%1").arg(reinterpret_cast<quintptr>(QThread::currentThread()), 0, 16);
+	qsdDatabase = new QSqlDatabase(QSqlDatabase::cloneDatabase(*ServerDB::db, qsName));
+	if (! qsdDatabase->open())
+		qFatal("ServerDB: Failed to open thread connection: %s", qPrintable(qsdDatabase->lastError().text()));
+}
+
+ThreadConnection::~ThreadConnection() {
+	qsdDatabase->close();
+	delete qsdDatabase;
+	QSqlDatabase::removeDatabase(qsName);
+}
+
+static QThreadStorage<ThreadConnection *> qtsConnections;
+
 QSqlDatabase *ServerDB::db = NULL;
+QMutex ServerDB::qmTransaction(QMutex::Recursive);
+bool ServerDB::bSerializeTransactions = false;
 Timer ServerDB::tLogClean;
 QString ServerDB::qsUpgradeSuffix;
 
+QSqlDatabase *ServerDB::connection() {
+	if (QThread::currentThread() == QCoreApplication::instance()->thread())
+		return db;
+	if (! qtsConnections.hasLocalData())
+		qtsConnections.setLocalData(new ThreadConnection());
+	return qtsConnections.localData()->qsdDatabase;
+}
+
 void ServerDB::loadOrSetupMetaPKBDF2IterationsCount(QSqlQuery &query) {
 	if (!Meta::mp.legacyPasswordHash) {
 		if (Meta::mp.kdfIterations <= 0) {
@@ -111,6 +157,7 @@ ServerDB::ServerDB() {
 		qFatal("ServerDB has already been instantiated!");
 	}
 	db = new QSqlDatabase(QSqlDatabase::addDatabase(Meta::mp.qsDBDriver));
+	bSerializeTransactions = (Meta::mp.qsDBDriver == "QSQLITE") && (Meta::mp.iServerThreads > 0);
 
 	qsUpgradeSuffix = QString::fromLatin1("_old_%1").arg(QDateTime::currentDateTime().toTime_t());
 
@@ -508,7 +555,8 @@ ServerDB::~ServerDB() {
 }
 
 bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool warn) {
-	if (! db->isValid()) {
+	QSqlDatabase *cdb = connection();
+	if (! cdb->isValid()) {
 		qWarning("SQL [%s] rejected: Database is gone", qPrintable(str));
 		return false;
 	}
@@ -525,11 +573,11 @@ bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool wa
 	if (query.prepare(q)) {
 		return true;
 	} else {
-		db->close();
-		if (! db->open()) {
-			qFatal("Lost connection to SQL Database: Reconnect: %s", qPrintable(db->lastError().text()));
+		cdb->close();
+		if (! cdb->open()) {
+			qFatal("Lost connection to SQL Database: Reconnect: %s", qPrintable(cdb->lastError().text()));
 		}
-		query = QSqlQuery();
+		query = QSqlQuery(*cdb);
 		if (query.prepare(q)) {
 			qWarning("SQL Connection lost, reconnection OK");
 			return true;
@@ -545,10 +593,22 @@ bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool wa
 	}
 }
 
+/// Runs a prepared query, recording how long it took.
+static bool timedExec(QSqlQuery &query, bool batch) {
+	Timer t;
+	bool ok = batch ? query.execBatch() : query.exec();
+	quint64 us = t.elapsed();
+
+	Metrics::observe(Metrics::DatabaseQueryDuration, us);
+	if (Metrics::isSlow(us))
+		qWarning("Slow SQL query took %llu ms: %s", us / 1000ULL, qPrintable(query.lastQuery()));
+	return ok;
+}
+
 bool ServerDB::exec(QSqlQuery &query, const QString &str, bool fatal, bool warn) {
 	if (! str.isEmpty())
 		prepare(query, str, fatal, warn);
-	if (query.exec()) {
+	if (timedExec(query, false)) {
 		return true;
 	} else {
 
@@ -565,7 +625,7 @@ bool ServerDB::exec(QSqlQuery &query, const QString &str, bool fatal, bool warn)
 bool ServerDB::execBatch(QSqlQuery &query, const QString &str, bool fatal) {
 	if (! str.isEmpty())
 		prepare(query, str, fatal);
-	if (query.execBatch()) {
+	if (timedExec(query, true)) {
 		return true;
 	} else {
 
@@ -866,6 +926,8 @@ QMap<int, QString> Server::getRegistration(int id) {
 		SQLEXEC();
 		while (query.next()) {
 			const int key = query.value(0).toInt();
+			if (key == ServerDB::User_TextureHash)
+				continue;
 			if (!info.contains(key))
 				info.insert(key, query.value(1).toString());
 		}
@@ -1150,6 +1212,8 @@ bool Server::setTexture(int id, const QByteArray &texture) {
 	query.addBindValue(id);
 	SQLEXEC();
 
+	setTextureHash(id, tex);
+
 	return true;
 }
 
@@ -1257,6 +1321,20 @@ QByteArray Server::getUserTexture(int id) {
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
+
+	// If the blob store still holds the texture, there is no need to read it back.
+	QByteArray hash;
+	SQLPREP("SELECT `value` FROM `%1user_info` WHERE `server_id` = ? AND `user_id` = ? AND `key` = ?");
+	query.addBindValue(iServerNum);
+	query.addBindValue(id);
+	query.addBindValue(ServerDB::User_TextureHash);
+	SQLEXEC();
+	if (query.next()) {
+		hash = QByteArray::fromHex(query.value(0).toString().toLatin1());
+		if (meta->bsBlobs.value(hash, qba))
+			return qba;
+	}
+
 	SQLPREP("SELECT `texture` FROM `%1users` WHERE `server_id` = ? AND `user_id` = ?");
 	query.addBindValue(iServerNum);
 	query.addBindValue(id);
@@ -1267,11 +1345,37 @@ QByteArray Server::getUserTexture(int id) {
 			if (qba.size() == 600 * 60 * 4)
 				qba = qCompress(qba);
 	}
+
+	// Textures stored before hashes were recorded get theirs on first load.
+	if (hash.isEmpty() && (qba.length() >= 128))
+		setTextureHash(id, qba);
+
 	return qba;
 }
 
+void Server::setTextureHash(int id, const QByteArray &texture) {
+	TransactionHolder th;
+
+	QSqlQuery &query = *th.qsqQuery;
+	if (texture.length() >= 128) {
+		SQLPREP("REPLACE INTO `%1user_info` (`server_id`, `user_id`, `key`, `value`) VALUES (?,?,?,?)");
+		query.addBindValue(iServerNum);
+		query.addBindValue(id);
+		query.addBindValue(ServerDB::User_TextureHash);
+		query.addBindValue(QString::fromLatin1(sha1(texture).toHex()));
+	} else {
+		SQLPREP("DELETE FROM `%1user_info` WHERE `server_id` = ? AND `user_id` = ? AND `key` = ?");
+		query.addBindValue(iServerNum);
+		query.addBindValue(id);
+		query.addBindValue(ServerDB::User_TextureHash);
+	}
+	SQLEXEC();
+}
+
 void Server::addLink(Channel *c, Channel *l) {
 	c->link(l);
+	// The caller announces c; l changed just as much.
+	emit channelStateChanged(l);
 
 	if (c->bTemporary || l->bTemporary)
 		return;
@@ -1292,6 +1396,7 @@ void Server::addLink(Channel *c, Channel *l) {
 
 void Server::removeLink(Channel *c, Channel *l) {
 	c->unlink(l);
+	emit channelStateChanged(l);
 
 	if (c->bTemporary || l->bTemporary)
 		return;
@@ -1362,6 +1467,7 @@ Channel *Server::addChannel(Channel *p, const QString &name, bool temporary, int
 	c->iPosition = position;
 	c->uiMaxUsers = maxUsers;
 	qhChannels.insert(id, c);
+	invalidateChannelTour();
 	return c;
 }
 
@@ -1542,7 +1648,7 @@ void Server::readChannelPrivs(Channel *c) {
 void Server::readChannels(Channel *p) {
 	QList<Channel *> kids;
 	Channel *c;
-	QSqlQuery query;
+	QSqlQuery query(*ServerDB::connection());
 	int parentid = -1;
 
 	if (p) {
@@ -1567,6 +1673,7 @@ void Server::readChannels(Channel *p) {
 			if (! p)
 				c->setParent(this);
 			qhChannels.insert(c->iId, c);
+			invalidateChannelTour();
 			c->bInheritACL = query.value(2).toBool();
 			kids << c;
 		}
@@ -31,6 +31,7 @@
 #ifndef MUMBLE_MURMUR_DATABASE_H_
 #define MUMBLE_MURMUR_DATABASE_H_
 
+#include <QtCore/QMutex>
 #include <QtCore/QVariant>
 
 #include "Timer.h"
@@ -44,13 +45,18 @@ class QSqlQuery;
 class ServerDB {
 	public:
 		enum ChannelInfo { Channel_Description, Channel_Position, Channel_Max_Users };
-		enum UserInfo { User_Name, User_Email, User_Comment, User_Hash, User_Password, User_LastActive, User_KDFIterations };
+		enum UserInfo { User_Name, User_Email, User_Comment, User_Hash, User_Password, User_LastActive, User_KDFIterations, User_TextureHash };
 		ServerDB();
 		~ServerDB();
 		typedef QPair<unsigned int, QString> LogRecord;
 		static Timer tLogClean;
 		static QSqlDatabase *db;
+		/// Held for the duration of each transaction on SQLite, which fails
+		/// writes from concurrent transactions instead of waiting for them.
+		static QMutex qmTransaction;
+		static bool bSerializeTransactions;
 		static QString qsUpgradeSuffix;
+		static QSqlDatabase *connection();
 		static void setSUPW(int iServNum, const QString &pw);
 		static QList<int> getBootServers();
 		static QList<int> getAllServers();
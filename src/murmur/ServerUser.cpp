@@ -52,6 +52,16 @@ ServerUser::ServerUser(Server *p, QSslSocket *socket) : Connection(p, socket), U
 	iLastPermissionCheck = -1;
 	
 	bOpus = false;
+
+	fPosition[0] = fPosition[1] = fPosition[2] = 0.0f;
+	bPositioned = false;
+}
+
+ServerUser::~ServerUser() {
+	if (! qbaTextureHash.isEmpty())
+		meta->bsBlobs.release(qbaTextureHash);
+	if (! qbaCommentHash.isEmpty())
+		meta->bsBlobs.release(qbaCommentHash);
 }
 
 
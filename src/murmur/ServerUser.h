@@ -103,6 +103,13 @@ class ServerUser : public Connection, public User {
 		std::string ssContext;
 		QString qsIdentity;
 
+		/// Coordinates carried by the last positional voice packet, valid
+		/// for ssContext while bPositioned is set. Used to cull listeners
+		/// beyond Server::iAudibleRadius.
+		float fPosition[3];
+		bool bPositioned;
+		Timer tPosition;
+
 		bool bVerified;
 		QStringList qslEmail;
 
@@ -129,7 +136,14 @@ class ServerUser : public Connection, public User {
 		BandwidthRecord bwr;
 		struct sockaddr_storage saiUdpAddress;
 		struct sockaddr_storage saiTcpLocalAddress;
+
+		/// Serialized UserState answers to RequestBlob, together with the
+		/// blob hash they were built for.
+		QByteArray qbaTexturePacket, qbaTexturePacketHash;
+		QByteArray qbaCommentPacket, qbaCommentPacketHash;
+
 		ServerUser(Server *parent, QSslSocket *socket);
+		~ServerUser();
 };
 
 #endif
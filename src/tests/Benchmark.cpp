@@ -1,117 +1,390 @@
 /**
- * Provided a target address spawns a specified number of senders/speakers,
- * UDP-listeners and TCP-listeners.
+ * Voice load generator for murmur.
+ *
+ * Connects any number of simulated clients to a server, spread over a few
+ * worker threads. Every worker runs its clients' TLS connections in its own
+ * event loop and waits for all their UDP sockets at once (through a single
+ * epoll descriptor on Linux).
+ *
+ * Speakers alternate between talk spurts and pauses of exponentially
+ * distributed length and send Opus sized packets while talking, optionally
+ * with positional data or to a whisper target. Clients can be made to move
+ * between channels and to reconnect at random intervals.
+ *
+ * Every voice packet carries its send time, so listeners in this process
+ * measure the end-to-end latency through the server. The report shows sent
+ * and delivered packets per second, the observed fan-out, latency and
+ * connect time percentiles and, given the server's metrics address, the
+ * server-side fan-out and routing time.
  */
 
 #include <QtCore>
 #include <QtNetwork>
 
-#ifndef Q_OS_WIN
-#include <unistd.h>
-#endif
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <sys/types.h>
-#ifndef Q_OS_WIN
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <netinet/ip.h>
+#include <sys/resource.h>
 #include <sys/utsname.h>
-#endif
+#include <netinet/in.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#ifdef Q_OS_LINUX
+#include <sys/epoll.h>
+#endif
 
 #include "PacketDataStream.h"
 #include "Timer.h"
 #include "Message.h"
 #include "CryptState.h"
+#include "Version.h"
 #include "Mumble.pb.h"
 
-class Client : public QThread {
+// Shared clock for the send timestamps.
+static Timer tEpoch;
+
+static const quint32 uiMagic = 0x4d424e43;
+
+struct Options {
+	QHostAddress qhaServer;
+	unsigned short usPort;
+	QString qsPassword;
+	int iClients;
+	int iSpeakers;
+	int iTcpOnly;
+	int iThreads;
+	int iConnectRate;
+	int iBitrate;
+	int iFrames;
+	bool bPositional;
+	double dWhisper;
+	double dTalk;
+	double dPause;
+	double dMove;
+	double dReconnect;
+	int iDuration;
+	int iReport;
+	QString qsMetrics;
+
+	Options();
+};
+
+Options::Options() {
+	usPort = 64738;
+	iClients = 100;
+	iSpeakers = 10;
+	iTcpOnly = 0;
+	iThreads = qMax(QThread::idealThreadCount(), 1);
+	iConnectRate = 200;
+	iBitrate = 40000;
+	iFrames = 2;
+	bPositional = false;
+	dWhisper = 0.0;
+	// ITU-T P.59 conversational speech: 1.0s talk spurts, 1.6s pauses.
+	dTalk = 1.004;
+	dPause = 1.587;
+	dMove = 0.0;
+	dReconnect = 0.0;
+	iDuration = 60;
+	iReport = 5;
+}
+
+static Options opt;
+
+/// Microsecond latency histogram with 1us resolution up to 1ms, 100us up
+/// to 100ms and 10ms up to 10s.
+class Histogram {
+	public:
+		enum { Bins = 1000 + 990 + 990 + 1 };
+		quint64 bins[Bins];
+		quint64 count;
+		quint64 sum;
+
+		Histogram() {
+			clear();
+		}
+		void clear() {
+			memset(bins, 0, sizeof(bins));
+			count = sum = 0;
+		}
+		static int bin(quint64 us) {
+			if (us < 1000ULL)
+				return static_cast<int>(us);
+			if (us < 100000ULL)
+				return 1000 + static_cast<int>((us - 1000ULL) / 100ULL);
+			if (us < 10000000ULL)
+				return 1990 + static_cast<int>((us - 100000ULL) / 10000ULL);
+			return Bins - 1;
+		}
+		static quint64 value(int b) {
+			if (b < 1000)
+				return b;
+			if (b < 1990)
+				return 1000ULL + (b - 1000) * 100ULL;
+			if (b < Bins - 1)
+				return 100000ULL + (b - 1990) * 10000ULL;
+			return 10000000ULL;
+		}
+		void add(quint64 us) {
+			++bins[bin(us)];
+			++count;
+			sum += us;
+		}
+		void merge(const Histogram &o) {
+			for (int i = 0; i < Bins; ++i)
+				bins[i] += o.bins[i];
+			count += o.count;
+			sum += o.sum;
+		}
+		quint64 percentile(double p) const {
+			if (! count)
+				return 0;
+			quint64 want = static_cast<quint64>(ceil(p * static_cast<double>(count)));
+			quint64 seen = 0;
+			for (int i = 0; i < Bins; ++i) {
+				seen += bins[i];
+				if (seen >= want)
+					return value(i);
+			}
+			return value(Bins - 1);
+		}
+};
+
+struct Stats {
+	quint64 sent;
+	quint64 received;
+	quint64 decryptFailures;
+	quint64 connects;
+	quint64 disconnects;
+	quint64 moves;
+	Histogram latency;
+	Histogram connectTime;
+
+	Stats() {
+		clear();
+	}
+	void clear() {
+		sent = received = decryptFailures = connects = disconnects = moves = 0;
+		latency.clear();
+		connectTime.clear();
+	}
+	void merge(const Stats &o) {
+		sent += o.sent;
+		received += o.received;
+		decryptFailures += o.decryptFailures;
+		connects += o.connects;
+		disconnects += o.disconnects;
+		moves += o.moves;
+		latency.merge(o.latency);
+		connectTime.merge(o.connectTime);
+	}
+};
+
+/// Exponentially distributed delay in microseconds.
+static quint64 expDelay(double mean) {
+	double u = (qrand() + 1.0) / (RAND_MAX + 2.0);
+	return static_cast<quint64>(-log(u) * mean * 1000000.0);
+}
+
+class Worker;
+
+class Client : public QObject {
 		Q_OBJECT
+		Q_DISABLE_COPY(Client)
 	public:
-		bool udp;
-		bool sender;
-		struct sockaddr_in srv;
-		unsigned int uiSession;
-		CryptState crypt;
-		int rcvd;
-		int socket;
-		int seq;
-		void run();
-		void ping();
-		void sendVoice();
-		int numbytes;
-		int ptype;
+		Worker *w;
+		int iIndex;
+		int iGeneration;
+		bool bSpeaker;
+		bool bTcpOnly;
+		bool bWhisper;
+		bool bSynced;
+
 		QSslSocket *ssl;
-		Client(QObject *parent, QHostAddress srvaddr, unsigned short prt, bool send, bool tcponly);
-		void doUdp(const unsigned char *buffer, int size);
-		void sendMessage(const ::google::protobuf::Message &msg, unsigned int msgType);
+		QByteArray qbaIn;
+		int sock;
+		CryptState crypt;
+		unsigned int uiSession;
+		unsigned int uiChannel;
+
+		bool bTalking;
+		quint64 uiNextToggle;
+		quint64 uiNextPacket;
+		quint64 uiNextPing;
+		quint64 uiNextMove;
+		quint64 uiNextReconnect;
+		unsigned int uiSequence;
+		float fPos[3];
+		Timer tConnect;
+
+		Client(Worker *w, int index, bool speaker, bool tcponly);
 		~Client();
+		void connectToServer();
+		void closeUdp();
+		void sendMessage(const ::google::protobuf::Message &msg, unsigned int msgType);
+		void sendUdp(const unsigned char *buffer, int size);
+		void sendVoice(quint64 now, bool last);
+		void ping(quint64 now);
+		void move();
+		void tick(quint64 now);
+		void handleVoice(const unsigned char *data, int len);
+		void readUdp();
+		void handleMessage(unsigned int type, const char *data, int len);
 	public slots:
+		void encrypted();
 		void readyRead();
 		void disconnected();
+		void error(QAbstractSocket::SocketError);
+		void reconnect();
 };
 
-Client::Client(QObject *p, QHostAddress qha, unsigned short prt, bool send, bool tcponly) : QThread(p) {
-	srv.sin_family = AF_INET;
-	srv.sin_addr.s_addr = htonl(qha.toIPv4Address());
-	srv.sin_port = htons(prt);
-
-	udp = ! tcponly;
-	sender = send;
+class Worker : public QObject {
+		Q_OBJECT
+		Q_DISABLE_COPY(Worker)
+	public:
+		QList<Client *> qlClients;
+		QList<unsigned int> qlChannels;
+		QMutex qmStats;
+		Stats sStats;
+		QTimer *qtTick;
+#ifdef Q_OS_LINUX
+		int epfd;
+		QSocketNotifier *qsnEpoll;
+#endif
 
-	ssl = new QSslSocket(this);
+		Worker();
+		~Worker();
+		void watch(Client *c);
+		void unwatch(Client *c);
+		void takeStats(Stats &s);
+	public slots:
+		void spawn(int index, bool speaker, bool tcponly);
+		void tick();
+		void udpReady();
+};
 
-	connect(ssl, SIGNAL(readyRead()), this, SLOT(readyRead()));
-	connect(ssl, SIGNAL(disconnected()), this, SLOT(disconnected()));
+Client::Client(Worker *wk, int index, bool speaker, bool tcponly) : QObject(wk), w(wk), iIndex(index), iGeneration(0), bSpeaker(speaker), bTcpOnly(tcponly) {
+	ssl = NULL;
+	sock = -1;
+	bWhisper = speaker && (qrand() < opt.dWhisper * RAND_MAX);
+	for (int i = 0; i < 3; ++i)
+		fPos[i] = static_cast<float>(qrand() % 100);
+	connectToServer();
+}
 
-	ssl->setProtocol(QSsl::TlsV1);
-	ssl->connectToHostEncrypted(qha.toString(), prt);
-	ssl->ignoreSslErrors();
-	if (! ssl->waitForEncrypted())
-		qFatal("Connection failure");
+Client::~Client() {
+	closeUdp();
+}
 
-	static int ctr = 1;
+void Client::closeUdp() {
+	if (sock != -1) {
+		w->unwatch(this);
+		::close(sock);
+		sock = -1;
+	}
+}
 
-#ifdef Q_OS_WIN
-	DWORD pid = GetCurrentProcessId();
-	wchar_t buf[64];
-	DWORD bufsize = 64;
-	GetComputerName(buf, &bufsize);
+void Client::connectToServer() {
+	bSynced = false;
+	bTalking = false;
+	uiSession = 0;
+	uiChannel = 0;
+	uiSequence = 0;
+	qbaIn.clear();
+	crypt.bInit = false;
+	tConnect.restart();
+
+	quint64 now = tEpoch.elapsed();
+	uiNextToggle = now + expDelay(opt.dPause);
+	uiNextPing = now + 5000000ULL;
+	uiNextMove = (opt.dMove > 0.0) ? now + expDelay(opt.dMove) : 0;
+	uiNextReconnect = (opt.dReconnect > 0.0) ? now + expDelay(opt.dReconnect) : 0;
+
+	if (! bTcpOnly) {
+		sockaddr_storage srv;
+		socklen_t srvlen;
+		memset(&srv, 0, sizeof(srv));
+		if (opt.qhaServer.protocol() == QAbstractSocket::IPv6Protocol) {
+			sockaddr_in6 *s6 = reinterpret_cast<sockaddr_in6 *>(&srv);
+			Q_IPV6ADDR a = opt.qhaServer.toIPv6Address();
+			s6->sin6_family = AF_INET6;
+			s6->sin6_port = htons(opt.usPort);
+			memcpy(&s6->sin6_addr, &a, sizeof(a));
+			srvlen = sizeof(sockaddr_in6);
+		} else {
+			sockaddr_in *s4 = reinterpret_cast<sockaddr_in *>(&srv);
+			s4->sin_family = AF_INET;
+			s4->sin_port = htons(opt.usPort);
+			s4->sin_addr.s_addr = htonl(opt.qhaServer.toIPv4Address());
+			srvlen = sizeof(sockaddr_in);
+		}
 
-	QString name = QString("%1.%2").arg(QString::fromWCharArray(buf)).arg(pid * 1000 + ctr);
-#else
-	struct utsname uts;
-	uname(&uts);
+		sock = ::socket(srv.ss_family, SOCK_DGRAM, 0);
+		if (sock == -1)
+			qFatal("Failed to create UDP socket: %s", strerror(errno));
+		::fcntl(sock, F_SETFL, ::fcntl(sock, F_GETFL) | O_NONBLOCK);
+		if (::connect(sock, reinterpret_cast<sockaddr *>(&srv), srvlen) != 0)
+			qFatal("Failed to connect UDP socket: %s", strerror(errno));
+		w->watch(this);
+	}
 
-	QString name = QString("%1.%2").arg(uts.nodename).arg(getpid() * 1000 + ctr);
-#endif
+	ssl = new QSslSocket(this);
+	ssl->setPeerVerifyMode(QSslSocket::VerifyNone);
+	connect(ssl, SIGNAL(encrypted()), this, SLOT(encrypted()));
+	connect(ssl, SIGNAL(readyRead()), this, SLOT(readyRead()));
+	connect(ssl, SIGNAL(disconnected()), this, SLOT(disconnected()));
+	connect(ssl, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(error(QAbstractSocket::SocketError)));
+	ssl->connectToHostEncrypted(opt.qhaServer.toString(), opt.usPort);
+}
 
-	ctr++;
+void Client::encrypted() {
+	static QString host;
+	if (host.isEmpty()) {
+		struct utsname uts;
+		uname(&uts);
+		host = QString::fromLatin1(uts.nodename);
+	}
 
 	MumbleProto::Version mpv;
-	mpv.set_release(u8(QLatin1String("1.2.1 Benchmark")));
-	mpv.set_version(0x010203);
-
+	mpv.set_release("Benchmark");
+	mpv.set_version(MumbleVersion::getRaw());
 	sendMessage(mpv, MessageHandler::Version);
 
 	MumbleProto::Authenticate mpa;
-	mpa.set_username(u8(name));
-
+	mpa.set_username(u8(QString::fromLatin1("%1.%2.%3.%4").arg(host).arg(getpid()).arg(iIndex).arg(iGeneration)));
+	if (! opt.qsPassword.isEmpty())
+		mpa.set_password(u8(opt.qsPassword));
+	mpa.set_opus(true);
 	sendMessage(mpa, MessageHandler::Authenticate);
+}
 
-	if (udp)
-		socket = ::socket(PF_INET, SOCK_DGRAM, 0);
+void Client::error(QAbstractSocket::SocketError) {
+	// Failed connection attempts never emit disconnected().
+	if (ssl && sender() == ssl && ssl->state() == QAbstractSocket::UnconnectedState)
+		disconnected();
+}
 
-	seq = 0;
-	rcvd = 0;
-	numbytes = -1;
+void Client::disconnected() {
+	if (! ssl || sender() != ssl)
+		return;
+
+	QMutexLocker lock(&w->qmStats);
+	++w->sStats.disconnects;
+	lock.unlock();
+
+	closeUdp();
+	ssl->deleteLater();
+	ssl = NULL;
+
+	// Back off if the server refused us rather than hammering it.
+	QTimer::singleShot(bSynced ? 0 : 1000, this, SLOT(reconnect()));
+	bSynced = false;
 }
 
-Client::~Client() {
-	terminate();
-	wait();
+void Client::reconnect() {
+	++iGeneration;
+	connectToServer();
 }
 
 void Client::sendMessage(const ::google::protobuf::Message &msg, unsigned int msgType) {
@@ -127,269 +400,577 @@ void Client::sendMessage(const ::google::protobuf::Message &msg, unsigned int ms
 	ssl->write(reinterpret_cast<const char *>(uc), len + 6);
 }
 
-void Client::ping() {
-	unsigned char buffer[256];
-	buffer[0] = MessageHandler::UDPPing << 5;
-	PacketDataStream pds(buffer + 1, 255);
-	pds << 123;
+void Client::sendUdp(const unsigned char *buffer, int size) {
+	if (bTcpOnly || ! crypt.isValid()) {
+		unsigned char uc[2048];
+		* reinterpret_cast<quint16 *>(& uc[0]) = qToBigEndian(static_cast<quint16>(MessageHandler::UDPTunnel));
+		* reinterpret_cast<quint32 *>(& uc[2]) = qToBigEndian(static_cast<quint32>(size));
+		memcpy(uc + 6, buffer, size);
+		ssl->write(reinterpret_cast<const char *>(uc), size + 6);
+		return;
+	}
 
-	doUdp(buffer, pds.size() + 1);
+	unsigned char crypted[2048];
+	crypt.encrypt(buffer, crypted, size);
+	::send(sock, reinterpret_cast<const char *>(crypted), size + 4, 0);
+}
 
+void Client::ping(quint64 now) {
 	MumbleProto::Ping mpp;
-	mpp.set_timestamp(123);
+	mpp.set_timestamp(now);
 	sendMessage(mpp, MessageHandler::Ping);
+
+	if (! bTcpOnly && crypt.isValid()) {
+		unsigned char buffer[64];
+		buffer[0] = MessageHandler::UDPPing << 5;
+		PacketDataStream pds(buffer + 1, 63);
+		pds << now;
+		sendUdp(buffer, pds.size() + 1);
+	}
 }
 
-void Client::sendVoice() {
+void Client::sendVoice(quint64 now, bool last) {
 	unsigned char buffer[1024];
-	int len = 32 + (qrand() & 0x3f);
 
-	// Regular voice, nothing special
-	buffer[0] = 0;
+	// Opus at the given bitrate, give or take 10%.
+	int len = opt.iBitrate * opt.iFrames / 800;
+	len += (qrand() % (len / 5 + 1)) - len / 10;
+	len = qBound(16, len, 900);
+
+	buffer[0] = static_cast<unsigned char>((MessageHandler::UDPVoiceOpus << 5) | (bWhisper ? 1 : 0));
+	PacketDataStream pds(buffer + 1, 1023);
+	pds << uiSequence;
+	pds << static_cast<unsigned int>(last ? (len | 0x2000) : len);
+
+	unsigned char payload[1024];
+	memset(payload, 0, len);
+	* reinterpret_cast<quint32 *>(& payload[0]) = uiMagic;
+	memcpy(& payload[4], &now, sizeof(now));
+	pds.append(reinterpret_cast<const char *>(payload), len);
+
+	if (opt.bPositional) {
+		for (int i = 0; i < 3; ++i)
+			fPos[i] += static_cast<float>((qrand() % 3) - 1) * 0.1f;
+		pds << fPos[0];
+		pds << fPos[1];
+		pds << fPos[2];
+	}
 
-	PacketDataStream ods(buffer + 1, 1024);
-	ods << 1;
-	ods.append(len);
-	ods.skip(len);
+	uiSequence += opt.iFrames;
+	sendUdp(buffer, pds.size() + 1);
 
-	doUdp(buffer, ods.size() + 1);
+	QMutexLocker lock(&w->qmStats);
+	++w->sStats.sent;
 }
 
-void Client::doUdp(const unsigned char *buffer, int size) {
-	if (! udp || ! crypt.isValid())
+void Client::move() {
+	if (w->qlChannels.isEmpty())
 		return;
 
-	unsigned char crypted[2048];
+	MumbleProto::UserState mpus;
+	mpus.set_session(uiSession);
+	mpus.set_channel_id(w->qlChannels.at(qrand() % w->qlChannels.count()));
+	sendMessage(mpus, MessageHandler::UserState);
 
-	crypt.encrypt(reinterpret_cast<const unsigned char *>(buffer), crypted, size);
-	::sendto(socket, reinterpret_cast<const char *>(crypted), size+4, 0, reinterpret_cast<struct sockaddr *>(&srv), sizeof(srv));
+	QMutexLocker lock(&w->qmStats);
+	++w->sStats.moves;
 }
 
+void Client::tick(quint64 now) {
+	if (! bSynced)
+		return;
 
-void Client::run() {
-	unsigned char buffer[1024];
-	struct sockaddr_in addr;
-	socklen_t sz;
-	int len;
+	if (now >= uiNextPing) {
+		ping(now);
+		uiNextPing = now + 5000000ULL;
+	}
 
-	if (! udp)
+	if (uiNextReconnect && now >= uiNextReconnect) {
+		uiNextReconnect = 0;
+		ssl->disconnectFromHost();
 		return;
+	}
+
+	if (uiNextMove && now >= uiNextMove) {
+		move();
+		uiNextMove = now + expDelay(opt.dMove);
+	}
+
+	if (! bSpeaker)
+		return;
+
+	if (now >= uiNextToggle) {
+		if (bTalking) {
+			sendVoice(now, true);
+			bTalking = false;
+			uiNextToggle = now + expDelay(opt.dPause);
+		} else {
+			bTalking = true;
+			uiNextPacket = now;
+			uiNextToggle = now + expDelay(opt.dTalk);
+		}
+	}
+
+	const quint64 interval = opt.iFrames * 10000ULL;
+	while (bTalking && now >= uiNextPacket) {
+		sendVoice(now, false);
+		uiNextPacket += interval;
+	}
+}
+
+void Client::handleVoice(const unsigned char *data, int len) {
+	unsigned int type = (data[0] >> 5) & 0x7;
+	if (type != MessageHandler::UDPVoiceOpus)
+		return;
+
+	PacketDataStream pds(data + 1, len - 1);
+	unsigned int session, sequence, size;
+	pds >> session;
+	pds >> sequence;
+	pds >> size;
+	size &= 0x1fff;
+	if (! pds.isValid() || size < 12 || pds.left() < size)
+		return;
+
+	const unsigned char *payload = pds.dataPtr();
+	if (* reinterpret_cast<const quint32 *>(payload) != uiMagic)
+		return;
+
+	quint64 sent;
+	memcpy(&sent, payload + 4, sizeof(sent));
+	quint64 now = tEpoch.elapsed();
+
+	QMutexLocker lock(&w->qmStats);
+	++w->sStats.received;
+	w->sStats.latency.add(now > sent ? now - sent : 0);
+}
+
+void Client::readUdp() {
+	unsigned char buffer[2048];
+	unsigned char plain[2048];
 
 	forever {
-		sz = sizeof(addr);
-		len = ::recvfrom(socket, reinterpret_cast<char *>(buffer), 1024, 0, reinterpret_cast<struct sockaddr *>(&addr), &sz);
+		ssize_t len = ::recv(sock, reinterpret_cast<char *>(buffer), sizeof(buffer), 0);
 		if (len <= 0)
 			break;
-		if (len >= 32)
-			rcvd++;
+		if (len < 5)
+			continue;
+		if (! crypt.isValid() || ! crypt.decrypt(buffer, plain, static_cast<unsigned int>(len))) {
+			QMutexLocker lock(&w->qmStats);
+			++w->sStats.decryptFailures;
+			continue;
+		}
+		handleVoice(plain, static_cast<int>(len) - 4);
 	}
 }
 
 void Client::readyRead() {
-	forever {
-		int avail = ssl->bytesAvailable();
-		if (numbytes == -1) {
-			if (avail < 6)
+	qbaIn.append(ssl->readAll());
+
+	int offset = 0;
+	while (qbaIn.size() - offset >= 6) {
+		const unsigned char *hdr = reinterpret_cast<const unsigned char *>(qbaIn.constData() + offset);
+		unsigned int type = qFromBigEndian(* reinterpret_cast<const quint16 *>(& hdr[0]));
+		int len = static_cast<int>(qFromBigEndian(* reinterpret_cast<const quint32 *>(& hdr[2])));
+		if (qbaIn.size() - offset - 6 < len)
+			break;
+		handleMessage(type, qbaIn.constData() + offset + 6, len);
+		offset += 6 + len;
+		if (! ssl)
+			return;
+	}
+	qbaIn.remove(0, offset);
+}
+
+void Client::handleMessage(unsigned int type, const char *data, int len) {
+	switch (type) {
+		case MessageHandler::UDPTunnel:
+			if (len > 0)
+				handleVoice(reinterpret_cast<const unsigned char *>(data), len);
+			break;
+		case MessageHandler::CryptSetup: {
+				MumbleProto::CryptSetup msg;
+				if (! msg.ParseFromArray(data, len))
+					break;
+				if (msg.has_key() && msg.has_client_nonce() && msg.has_server_nonce()) {
+					const std::string &key = msg.key();
+					const std::string &client_nonce = msg.client_nonce();
+					const std::string &server_nonce = msg.server_nonce();
+					if (key.size() == AES_BLOCK_SIZE && client_nonce.size() == AES_BLOCK_SIZE && server_nonce.size() == AES_BLOCK_SIZE)
+						crypt.setKey(reinterpret_cast<const unsigned char *>(key.data()), reinterpret_cast<const unsigned char *>(client_nonce.data()), reinterpret_cast<const unsigned char *>(server_nonce.data()));
+				} else if (msg.has_server_nonce()) {
+					const std::string &server_nonce = msg.server_nonce();
+					if (server_nonce.size() == AES_BLOCK_SIZE) {
+						crypt.uiResync++;
+						memcpy(crypt.decrypt_iv, server_nonce.data(), AES_BLOCK_SIZE);
+					}
+				} else {
+					MumbleProto::CryptSetup mpcs;
+					mpcs.set_client_nonce(std::string(reinterpret_cast<const char *>(crypt.encrypt_iv), AES_BLOCK_SIZE));
+					sendMessage(mpcs, MessageHandler::CryptSetup);
+				}
+				break;
+			}
+		case MessageHandler::ChannelState: {
+				MumbleProto::ChannelState msg;
+				if (msg.ParseFromArray(data, len) && msg.has_channel_id() && ! w->qlChannels.contains(msg.channel_id()))
+					w->qlChannels << msg.channel_id();
+				break;
+			}
+		case MessageHandler::ChannelRemove: {
+				MumbleProto::ChannelRemove msg;
+				if (msg.ParseFromArray(data, len))
+					w->qlChannels.removeAll(msg.channel_id());
+				break;
+			}
+		case MessageHandler::UserState: {
+				MumbleProto::UserState msg;
+				if (msg.ParseFromArray(data, len) && msg.session() == uiSession && msg.has_channel_id())
+					uiChannel = msg.channel_id();
 				break;
-			unsigned char b[6];
-			ssl->read(reinterpret_cast<char *>(b), 6);
+			}
+		case MessageHandler::ServerSync: {
+				MumbleProto::ServerSync msg;
+				if (! msg.ParseFromArray(data, len))
+					break;
+				uiSession = msg.session();
+				bSynced = true;
+
+				if (bWhisper && ! w->qlChannels.isEmpty()) {
+					MumbleProto::VoiceTarget mpvt;
+					mpvt.set_id(1);
+					MumbleProto::VoiceTarget_Target *t = mpvt.add_targets();
+					t->set_channel_id(w->qlChannels.at(qrand() % w->qlChannels.count()));
+					t->set_children(true);
+					sendMessage(mpvt, MessageHandler::VoiceTarget);
+				}
 
-			ptype = qFromBigEndian(* reinterpret_cast<quint16 *>(& b[0]));
-			numbytes = qFromBigEndian(* reinterpret_cast<quint32 *>(& b[2]));
+				// Spread the clients over the channels before they talk.
+				move();
 
-			avail = ssl->bytesAvailable();
-		}
-		if ((numbytes >= 0) && (avail >= numbytes)) {
-			int want = numbytes;
-			numbytes = -1;
-			unsigned char buff[65536];
-			Q_ASSERT(want < 65536);
-			ssl->read(reinterpret_cast<char *>(buff), want);
-
-
-			avail = ssl->bytesAvailable();
-
-			switch (ptype) {
-				case MessageHandler::CryptSetup: {
-						MumbleProto::CryptSetup msg;
-						if (! msg.ParseFromArray(buff, want))
-							qFatal("Failed parse crypt");
-
-						if (msg.has_key() && msg.has_client_nonce() && msg.has_server_nonce()) {
-							const std::string &key = msg.key();
-							const std::string &client_nonce = msg.client_nonce();
-							const std::string &server_nonce = msg.server_nonce();
-							if (key.size() == AES_BLOCK_SIZE && client_nonce.size() == AES_BLOCK_SIZE && server_nonce.size() == AES_BLOCK_SIZE)
-								crypt.setKey(reinterpret_cast<const unsigned char *>(key.data()), reinterpret_cast<const unsigned char *>(client_nonce.data()), reinterpret_cast<const unsigned char *>(server_nonce.data()));
-						} else if (msg.has_server_nonce()) {
-							const std::string &server_nonce = msg.server_nonce();
-							if (server_nonce.size() == AES_BLOCK_SIZE) {
-								crypt.uiResync++;
-								memcpy(crypt.decrypt_iv, server_nonce.data(), AES_BLOCK_SIZE);
-							}
-						} else {
-							MumbleProto::CryptSetup mpcs;
-							mpcs.set_client_nonce(std::string(reinterpret_cast<const char *>(crypt.encrypt_iv), AES_BLOCK_SIZE));
-							sendMessage(mpcs, MessageHandler::CryptSetup);
-						}
-						break;
-					}
-				case MessageHandler::ServerSync: {
-						MumbleProto::ServerSync msg;
-						if (! msg.ParseFromArray(buff, want))
-							qFatal("Failed parse sync");
-						uiSession = msg.session();
-						break;
-					}
-				case MessageHandler::UDPTunnel: {
-						unsigned int msgUDPType = (buff[0] >> 5) & 0x7;
-						if (msgUDPType == MessageHandler::UDPVoiceCELTAlpha)
-							rcvd++;
-						break;
-					}
+				quint64 now = tEpoch.elapsed();
+				ping(now);
+
+				QMutexLocker lock(&w->qmStats);
+				++w->sStats.connects;
+				w->sStats.connectTime.add(tConnect.elapsed());
+				break;
 			}
-		} else {
+		case MessageHandler::Reject: {
+				MumbleProto::Reject msg;
+				msg.ParseFromArray(data, len);
+				qWarning("Client %d rejected: %s", iIndex, msg.reason().c_str());
+				break;
+			}
+		default:
 			break;
-		}
 	}
 }
 
-void Client::disconnected() {
-	qWarning("SSL Socket disconnected");
-	QCoreApplication::instance()->quit();
+Worker::Worker() {
+#ifdef Q_OS_LINUX
+	epfd = ::epoll_create(1024);
+	if (epfd == -1)
+		qFatal("epoll_create failed: %s", strerror(errno));
+	qsnEpoll = NULL;
+#endif
+	qtTick = NULL;
 }
 
-class Container : public QObject {
-		Q_OBJECT
-	public:
-		int sent;
-		int numsender, numudplistener, numtcplistener;
-		int isender, iudplistener, itcplistener;
-		bool live, forceping;
-		QHostAddress qha;
-		unsigned short port;
-		QTimer qtTick;
-		Timer tickPing, tickVoice, tickGo, tickSpawn;
-		QList<Client *> speakers;
-		QList<Client *> clients;
-		Container(QHostAddress srvaddr, unsigned short port, int nsend, int nudp, int ntcp);
-	public slots:
-		void tick();
-		void go();
-};
+Worker::~Worker() {
+#ifdef Q_OS_LINUX
+	::close(epfd);
+#endif
+}
 
-Container::Container(QHostAddress qha, unsigned short port, int numsend, int numudp, int numtcp) {
-	isender = iudplistener = itcplistener = 0;
-	live = false;
-	forceping = false;
-	sent = 0;
+void Worker::watch(Client *c) {
+#ifdef Q_OS_LINUX
+	if (! qsnEpoll) {
+		qsnEpoll = new QSocketNotifier(epfd, QSocketNotifier::Read, this);
+		connect(qsnEpoll, SIGNAL(activated(int)), this, SLOT(udpReady()));
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	::epoll_ctl(epfd, EPOLL_CTL_ADD, c->sock, &ev);
+#else
+	QSocketNotifier *qsn = new QSocketNotifier(c->sock, QSocketNotifier::Read, c);
+	qsn->setObjectName(QLatin1String("udp"));
+	connect(qsn, SIGNAL(activated(int)), this, SLOT(udpReady()));
+#endif
+}
 
-	Timer t;
+void Worker::unwatch(Client *c) {
+#ifdef Q_OS_LINUX
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	::epoll_ctl(epfd, EPOLL_CTL_DEL, c->sock, &ev);
+#else
+	delete c->findChild<QSocketNotifier *>(QLatin1String("udp"));
+#endif
+}
 
-	qWarning("Spawning %d speakers and %d listeners (%d UDP, %d TCP)", numsend, numudp+numtcp, numudp, numtcp);
+void Worker::udpReady() {
+#ifdef Q_OS_LINUX
+	struct epoll_event events[256];
+	int n;
+	do {
+		n = ::epoll_wait(epfd, events, 256, 0);
+		for (int i = 0; i < n; ++i)
+			static_cast<Client *>(events[i].data.ptr)->readUdp();
+	} while (n == 256);
+#else
+	QSocketNotifier *qsn = qobject_cast<QSocketNotifier *>(sender());
+	if (qsn)
+		static_cast<Client *>(qsn->parent())->readUdp();
+#endif
+}
+
+void Worker::spawn(int index, bool speaker, bool tcponly) {
+	if (! qtTick) {
+		// qrand() is seeded per thread.
+		qsrand(static_cast<uint>(getpid()) ^ static_cast<uint>(index));
+		qtTick = new QTimer(this);
+		connect(qtTick, SIGNAL(timeout()), this, SLOT(tick()));
+		qtTick->start(5);
+	}
+	qlClients << new Client(this, index, speaker, tcponly);
+}
 
-	this->qha = qha;
-	this->port = port;
+void Worker::tick() {
+	quint64 now = tEpoch.elapsed();
+	foreach(Client *c, qlClients)
+		c->tick(now);
+}
+
+void Worker::takeStats(Stats &s) {
+	QMutexLocker lock(&qmStats);
+	s.merge(sStats);
+	sStats.clear();
+}
+
+class Controller : public QObject {
+		Q_OBJECT
+		Q_DISABLE_COPY(Controller)
+	public:
+		QList<QThread *> qlThreads;
+		QList<Worker *> qlWorkers;
+		int iSpawned;
+		Timer tRun;
+		Timer tReport;
+		Stats sTotal;
+		QMap<QByteArray, double> qmLastMetrics;
+
+		Controller();
+		~Controller();
+		bool scrape(QMap<QByteArray, double> &values);
+	public slots:
+		void spawn();
+		void report();
+};
 
-	numsender = numsend;
-	numudplistener = numudp;
-	numtcplistener = numtcp;
+Controller::Controller() {
+	iSpawned = 0;
+
+	for (int i = 0; i < opt.iThreads; ++i) {
+		QThread *t = new QThread(this);
+		Worker *w = new Worker();
+		w->moveToThread(t);
+		connect(t, SIGNAL(finished()), w, SLOT(deleteLater()), Qt::DirectConnection);
+		t->start();
+		qlThreads << t;
+		qlWorkers << w;
+	}
 
+	QTimer *qt = new QTimer(this);
+	connect(qt, SIGNAL(timeout()), this, SLOT(spawn()));
+	qt->start(10);
 
-	connect(&qtTick, SIGNAL(timeout()), this, SLOT(tick()));
-	qtTick.start(0);
+	qt = new QTimer(this);
+	connect(qt, SIGNAL(timeout()), this, SLOT(report()));
+	qt->start(opt.iReport * 1000);
 
-	tickSpawn.restart();
+	if (! opt.qsMetrics.isEmpty())
+		scrape(qmLastMetrics);
 }
 
-void Container::tick() {
-	if (forceping || tickPing.isElapsed(5000000ULL)) {
-		forceping = false;
+Controller::~Controller() {
+	foreach(QThread *t, qlThreads) {
+		t->quit();
+		t->wait();
+	}
+}
 
-		foreach(Client *c, clients)
-			c->ping();
+void Controller::spawn() {
+	int want = qMin(opt.iClients, static_cast<int>(tRun.elapsed() * opt.iConnectRate / 1000000ULL) + 1);
+	for (; iSpawned < want; ++iSpawned) {
+		bool speaker = iSpawned < opt.iSpeakers;
+		bool tcponly = iSpawned >= opt.iClients - opt.iTcpOnly;
+		QMetaObject::invokeMethod(qlWorkers.at(iSpawned % qlWorkers.count()), "spawn", Qt::QueuedConnection, Q_ARG(int, iSpawned), Q_ARG(bool, speaker), Q_ARG(bool, tcponly));
+	}
+}
 
-		if (live) {
+/// Fetches the server's Prometheus metrics and sums every series by name.
+bool Controller::scrape(QMap<QByteArray, double> &values) {
+	QTcpSocket s;
+	int idx = opt.qsMetrics.lastIndexOf(QLatin1Char(':'));
+	s.connectToHost(opt.qsMetrics.left(idx), opt.qsMetrics.mid(idx + 1).toUShort());
+	if (! s.waitForConnected(1000))
+		return false;
+	s.write("GET /metrics HTTP/1.0\r\n\r\n");
+	while (s.waitForReadyRead(1000)) {
+	}
 
-			int lost = 0;
-			quint64 totrcv = 0;
-			int nrcv = 0;
-			foreach(Client *c, clients) {
-				if (! c->sender) {
-					totrcv += c->rcvd;
-					lost += sent - c->rcvd;
-					nrcv++;
-				}
-			}
-			qWarning("Sent: %8d  Rcvd: %8lld  Lost: %8d   BW: %6.1fMbit/s", sent, totrcv / nrcv, (lost + nrcv - 1) / nrcv, (totrcv * 8.0 * 123.0) / (tickGo.elapsed() * 1.0));
-		} else {
-			qWarning("Spawned %3d/%3d", isender + iudplistener + itcplistener, numsender + numudplistener + numtcplistener);
-		}
+	values.clear();
+	foreach(const QByteArray &line, s.readAll().split('\n')) {
+		if (line.isEmpty() || line.startsWith('#'))
+			continue;
+		int sp = line.lastIndexOf(' ');
+		int brace = line.indexOf('{');
+		QByteArray name = line.left((brace >= 0 && brace < sp) ? brace : sp);
+		values[name] += line.mid(sp + 1).toDouble();
 	}
+	return ! values.isEmpty();
+}
 
-	if (live && tickVoice.isElapsed(10000ULL)) {
-		foreach(Client *c, speakers) {
-			sent++;
-			c->sendVoice();
-		}
+void Controller::report() {
+	Stats s;
+	foreach(Worker *w, qlWorkers)
+		w->takeStats(s);
+	sTotal.merge(s);
+
+	double secs = static_cast<double>(tReport.restart()) / 1000000.0;
+
+	qWarning("%5llds  clients %5d  sent %8.0f/s  delivered %9.0f/s  fan-out %6.1f  latency p50 %6.2fms p99 %6.2fms p99.9 %6.2fms",
+	         static_cast<long long>(tRun.elapsed() / 1000000ULL), iSpawned,
+	         s.sent / secs, s.received / secs, s.sent ? static_cast<double>(s.received) / s.sent : 0.0,
+	         s.latency.percentile(0.5) / 1000.0, s.latency.percentile(0.99) / 1000.0, s.latency.percentile(0.999) / 1000.0);
+	qWarning("        connects %6llu  connect p50 %7.2fms p99 %7.2fms  disconnects %6llu  moves %6llu  decrypt failures %llu",
+	         s.connects, s.connectTime.percentile(0.5) / 1000.0, s.connectTime.percentile(0.99) / 1000.0,
+	         s.disconnects, s.moves, s.decryptFailures);
+
+	QMap<QByteArray, double> m;
+	if (! opt.qsMetrics.isEmpty() && scrape(m)) {
+		double packets = m.value("murmur_voice_fanout_count") - qmLastMetrics.value("murmur_voice_fanout_count");
+		double fanout = m.value("murmur_voice_fanout_sum") - qmLastMetrics.value("murmur_voice_fanout_sum");
+		double routing = m.value("murmur_process_msg_duration_seconds_sum") - qmLastMetrics.value("murmur_process_msg_duration_seconds_sum");
+		double udpout = m.value("murmur_udp_packets_sent_total") - qmLastMetrics.value("murmur_udp_packets_sent_total");
+		double tcpout = m.value("murmur_tunnel_packets_sent_total") - qmLastMetrics.value("murmur_tunnel_packets_sent_total");
+		qWarning("        server  routed %8.0f/s  fan-out %6.1f  routing %7.2fus/packet  sent %9.0f/s UDP %8.0f/s TCP",
+		         packets / secs, packets ? fanout / packets : 0.0, packets ? routing * 1000000.0 / packets : 0.0, udpout / secs, tcpout / secs);
+		qmLastMetrics = m;
 	}
-	if (! live) {
-		if (isender < numsender) {
-			// Spawn a sender
-			Client *c = new Client(this, qha, port, true, false);
-			speakers << c;
-			c->start();
-			clients << c;
-			isender++;
-		} else if (iudplistener < numudplistener) {
-			// Spawn a listener which uses UDP
-			Client *c = new Client(this, qha, port, false, false);
-			c->start();
-			clients << c;
-			iudplistener++;
-		} else if (itcplistener < numtcplistener) {
-			// Spawn a listener which uses TCP-only
-			Client *c = new Client(this, qha, port, false, true);
-			c->start();
-			clients << c;
-			itcplistener++;
-		} else {
-			live = true;
-			quint64 elapsed = tickSpawn.elapsed();
-			qWarning("Spawning took %lld ms (%lld us per client)", elapsed / 1000ULL, elapsed / (numsender+numudplistener+numtcplistener));
-			foreach(Client *c, clients)
-				c->rcvd = 0;
-			sent = 0;
-			forceping = true;
-			qtTick.start(10);
-		}
+
+	if (tRun.elapsed() >= opt.iDuration * 1000000ULL) {
+		qWarning("Total: sent %llu  delivered %llu  latency p50 %.2fms p90 %.2fms p99 %.2fms p99.9 %.2fms max %.2fms",
+		         sTotal.sent, sTotal.received,
+		         sTotal.latency.percentile(0.5) / 1000.0, sTotal.latency.percentile(0.9) / 1000.0,
+		         sTotal.latency.percentile(0.99) / 1000.0, sTotal.latency.percentile(0.999) / 1000.0,
+		         sTotal.latency.percentile(1.0) / 1000.0);
+		QCoreApplication::instance()->quit();
 	}
 }
 
-void Container::go() {
-	foreach(Client *c, clients)
-		c->start();
-	qtTick.start(10);
-	tickGo.restart();
+static void usage() {
+	qFatal("Usage: Benchmark [options] <host address> [port]\n"
+	       "  --clients N        Clients to connect (100)\n"
+	       "  --speakers N       Clients that talk (10)\n"
+	       "  --tcponly N        Clients that only use TCP (0)\n"
+	       "  --threads N        Worker threads (number of cores)\n"
+	       "  --rate N           Connections per second while ramping up (200)\n"
+	       "  --bitrate N        Opus bitrate in bit/s (40000)\n"
+	       "  --frames N         10ms frames per packet (2)\n"
+	       "  --talk S           Mean talk spurt length in seconds (1.004)\n"
+	       "  --pause S          Mean pause length in seconds (1.587)\n"
+	       "  --positional       Send positional data\n"
+	       "  --whisper F        Fraction of speakers whispering to a channel tree (0)\n"
+	       "  --move S           Mean seconds between channel moves per client (off)\n"
+	       "  --reconnect S      Mean seconds between reconnects per client (off)\n"
+	       "  --password PW      Server password\n"
+	       "  --duration S       Run time in seconds (60)\n"
+	       "  --report S         Report interval in seconds (5)\n"
+	       "  --metrics HOST:PORT  Server metrics endpoint for server-side fan-out\n"
+	       "The server needs users set to at least the number of clients and\n"
+	       "autobanAttempts=0, or it bans the load generator.");
 }
 
 int main(int argc, char **argv) {
 	QCoreApplication a(argc, argv);
 
-	qWarning("Maximum # sockets is %d", FD_SETSIZE);
+	QStringList args = a.arguments();
+	args.removeFirst();
 
-	if (argc != 6)
-		qFatal("Invalid number of arguments. These need to be passed: <host address> <port> <numsend> <numudp> <numtcp>");
+	QStringList positional;
+	while (! args.isEmpty()) {
+		const QString arg = args.takeFirst();
+		if (! arg.startsWith(QLatin1String("--"))) {
+			positional << arg;
+			continue;
+		}
+		if (arg == QLatin1String("--positional")) {
+			opt.bPositional = true;
+			continue;
+		}
+		if (args.isEmpty())
+			usage();
+		const QString value = args.takeFirst();
+		if (arg == QLatin1String("--clients"))
+			opt.iClients = value.toInt();
+		else if (arg == QLatin1String("--speakers"))
+			opt.iSpeakers = value.toInt();
+		else if (arg == QLatin1String("--tcponly"))
+			opt.iTcpOnly = value.toInt();
+		else if (arg == QLatin1String("--threads"))
+			opt.iThreads = qMax(value.toInt(), 1);
+		else if (arg == QLatin1String("--rate"))
+			opt.iConnectRate = qMax(value.toInt(), 1);
+		else if (arg == QLatin1String("--bitrate"))
+			opt.iBitrate = value.toInt();
+		else if (arg == QLatin1String("--frames"))
+			opt.iFrames = qBound(1, value.toInt(), 6);
+		else if (arg == QLatin1String("--talk"))
+			opt.dTalk = value.toDouble();
+		else if (arg == QLatin1String("--pause"))
+			opt.dPause = value.toDouble();
+		else if (arg == QLatin1String("--whisper"))
+			opt.dWhisper = value.toDouble();
+		else if (arg == QLatin1String("--move"))
+			opt.dMove = value.toDouble();
+		else if (arg == QLatin1String("--reconnect"))
+			opt.dReconnect = value.toDouble();
+		else if (arg == QLatin1String("--password"))
+			opt.qsPassword = value;
+		else if (arg == QLatin1String("--duration"))
+			opt.iDuration = value.toInt();
+		else if (arg == QLatin1String("--report"))
+			opt.iReport = qMax(value.toInt(), 1);
+		else if (arg == QLatin1String("--metrics"))
+			opt.qsMetrics = value;
+		else
+			usage();
+	}
+
+	if (positional.isEmpty() || positional.count() > 2)
+		usage();
+	opt.qhaServer = QHostAddress(positional.at(0));
+	if (positional.count() > 1)
+		opt.usPort = positional.at(1).toUShort();
+
+	// Two descriptors per client.
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if (rl.rlim_cur < static_cast<rlim_t>(opt.iClients * 2 + 64))
+			qWarning("Only %llu file descriptors available", static_cast<unsigned long long>(rl.rlim_cur));
+	}
 
-	QHostAddress qha = QHostAddress(argv[1]);
-	int port = atoi(argv[2]);
-	int numsender = atoi(argv[3]);
-	int numudplistener = atoi(argv[4]);
-	int numtcplistener = atoi(argv[5]);
+	qWarning("Connecting %d clients (%d speakers, %d TCP only) to %s:%d with %d threads",
+	         opt.iClients, opt.iSpeakers, opt.iTcpOnly, qPrintable(opt.qhaServer.toString()), opt.usPort, opt.iThreads);
 
-	Container c(qha, port, numsender, numudplistener, numtcplistener);
-	c.go();
-	a.exec();
+	Controller c;
+	return a.exec();
 }
 
 #include "Benchmark.moc"
@@ -0,0 +1,119 @@
+/**
+ * Microphone front-end benchmark.
+ *
+ * Compares the per-frame cost of the old scalar capture path in AudioInput
+ * (downmix, s16 conversion and separate level passes) with the fused
+ * AudioKernels versions.
+ */
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+
+#include <QtCore>
+
+#include "AudioKernels.h"
+#include "Timer.h"
+
+#define ITER 100000
+
+static const unsigned int iFrameSize = 480;
+
+static void legacyMixFloat(float *buffer, const float *input, unsigned int nsamp, unsigned int channels) {
+	const float m = 1.0f / static_cast<float>(channels);
+	for (unsigned int i=0;i<nsamp;++i) {
+		float v = 0.0f;
+		for (unsigned int j=0;j<channels;++j)
+			v += input[i*channels+j];
+		buffer[i] = v * m;
+	}
+}
+
+static void legacyMixShort(float *buffer, const short *input, unsigned int nsamp, unsigned int channels) {
+	const float m = 1.0f / (32768.f * static_cast<float>(channels));
+	for (unsigned int i=0;i<nsamp;++i) {
+		float v = 0.0f;
+		for (unsigned int j=0;j<channels;++j)
+			v += static_cast<float>(input[i*channels+j]);
+		buffer[i] = v * m;
+	}
+}
+
+static float legacyLevels(const short *ps, short &max) {
+	float sum = 1.0f;
+	max = 1;
+	for (unsigned int i=0;i<iFrameSize;i++) {
+		sum += static_cast<float>(ps[i] * ps[i]);
+		max = std::max(static_cast<short>(abs(ps[i])), max);
+	}
+	return sum;
+}
+
+static void bench(unsigned int channels, bool useShort) {
+	float *pfFloatIn = new float[iFrameSize * channels];
+	short *psShortIn = new short[iFrameSize * channels];
+	float *pfMic = new float[iFrameSize];
+	short *psMic = new short[iFrameSize];
+	short *psSpeaker = new short[iFrameSize];
+
+	for (unsigned int i=0;i<iFrameSize * channels;++i) {
+		pfFloatIn[i] = 0.8f * sinf(static_cast<float>(M_PI * i * 20) / static_cast<float>(iFrameSize));
+		psShortIn[i] = static_cast<short>(pfFloatIn[i] * 32767.f);
+	}
+	for (unsigned int i=0;i<iFrameSize;++i)
+		psSpeaker[i] = psShortIn[i];
+
+	volatile float sink = 0.0f;
+	short max;
+	float sum;
+
+	Timer t;
+	for (int n=0;n<ITER;++n) {
+		if (useShort)
+			legacyMixShort(pfMic, psShortIn, iFrameSize, channels);
+		else
+			legacyMixFloat(pfMic, pfFloatIn, iFrameSize, channels);
+		for (unsigned int j=0;j<iFrameSize;++j)
+			psMic[j] = static_cast<short>(qBound(-32768.f, (pfMic[j] * 32768.f), 32767.f));
+		sink += legacyLevels(psMic, max);
+		sink += legacyLevels(psSpeaker, max);
+		sink += legacyLevels(psMic, max);
+	}
+	const quint64 legacy = t.elapsed();
+
+	t.restart();
+	for (int n=0;n<ITER;++n) {
+		if (useShort)
+			AudioKernels::downmixShort(pfMic, psShortIn, iFrameSize, channels);
+		else
+			AudioKernels::downmixFloat(pfMic, pfFloatIn, iFrameSize, channels);
+		AudioKernels::floatToShortLevels(psMic, pfMic, iFrameSize, max, sum);
+		sink += sum;
+		AudioKernels::shortLevels(psSpeaker, iFrameSize, max, sum);
+		sink += sum;
+		AudioKernels::shortLevels(psMic, iFrameSize, max, sum);
+		sink += sum;
+	}
+	const quint64 fused = t.elapsed();
+
+	qWarning("%u channel %s: legacy %.3f us/frame, kernels %.3f us/frame (%.1fx)", channels, useShort ? "s16" : "float",
+	         static_cast<double>(legacy) / ITER, static_cast<double>(fused) / ITER,
+	         static_cast<double>(legacy) / static_cast<double>(qMax<quint64>(fused, 1)));
+
+	delete [] pfFloatIn;
+	delete [] psShortIn;
+	delete [] pfMic;
+	delete [] psMic;
+	delete [] psSpeaker;
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	for (unsigned int channels = 1; channels <= 2; ++channels) {
+		bench(channels, false);
+		bench(channels, true);
+	}
+	bench(6, false);
+
+	return 0;
+}
@@ -0,0 +1,11 @@
+include(../../compiler.pri)
+
+TEMPLATE = app
+CONFIG += qt thread warn_on release console
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = CaptureKernels
+HEADERS = Timer.h ../mumble/AudioKernels.h
+SOURCES = CaptureKernels.cpp Timer.cpp ../mumble/AudioKernels.cpp
+VPATH += ..
+INCLUDEPATH += .. ../murmur ../mumble ../../3rdparty/celt-0.7.0-src/libcelt ../../3rdparty/speex-src/include
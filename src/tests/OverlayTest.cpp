@@ -30,12 +30,25 @@ class OverlayWidget : public QWidget {
 		unsigned int iFrameCount;
 		int iLastFpsUpdate;
 
+		// The frame buffer we own, and the sequence number of its frame.
+		unsigned int uiFront;
+		unsigned int uiFrame;
+
+		// Shared memory bytes and rectangles blitted, frames taken and
+		// frames skipped since the last report.
+		quint64 uiBlitBytes;
+		unsigned int uiBlitRects;
+		unsigned int uiFrames;
+		unsigned int uiSkipped;
+
 		unsigned int uiWidth, uiHeight;
 
 		void resizeEvent(QResizeEvent *);
 		void paintEvent(QPaintEvent *);
 		void init(const QSize &);
 		void detach();
+		void checkFrame();
+		void blit(const unsigned char *buffer, unsigned int x, unsigned int y, unsigned int w, unsigned int h);
 
 		void keyPressEvent(QKeyEvent *);
 	protected slots:
@@ -52,6 +65,10 @@ OverlayWidget::OverlayWidget(QWidget *p) : QWidget(p) {
 	qlsSocket = NULL;
 	smMem = NULL;
 	uiWidth = uiHeight = 0;
+	uiFront = uiFrame = 0;
+	uiBlitBytes = 0;
+	uiBlitRects = 0;
+	uiFrames = uiSkipped = 0;
 
 	setFocusPolicy(Qt::StrongFocus);
 	setFocus();
@@ -103,6 +120,9 @@ void OverlayWidget::init(const QSize &sz) {
 	qtWall.start();
 	iFrameCount = 0;
 	iLastFpsUpdate = 0;
+	uiBlitBytes = 0;
+	uiBlitRects = 0;
+	uiFrames = uiSkipped = 0;
 
 	OverlayMsg m;
 	m.omh.uiMagic = OVERLAY_MAGIC_NUMBER;
@@ -111,6 +131,14 @@ void OverlayWidget::init(const QSize &sz) {
 	m.omi.uiWidth = sz.width();
 	m.omi.uiHeight = sz.height();
 
+	// The segment Mumble set up for the old size is of no use anymore.
+	if (smMem) {
+		delete smMem;
+		smMem = NULL;
+	}
+	uiWidth = sz.width();
+	uiHeight = sz.height();
+
 	if (qlsSocket && qlsSocket->state() == QLocalSocket::ConnectedState)
 		qlsSocket->write(m.headerbuffer, sizeof(OverlayMsgHeader) + sizeof(OverlayMsgInit));
 
@@ -128,6 +156,69 @@ void OverlayWidget::detach() {
 	}
 }
 
+/**
+ * Takes the newest frame from shared memory, checking that Mumble sticks to
+ * the buffer handoff described in overlay.h.
+ */
+void OverlayWidget::checkFrame() {
+	if (! smMem)
+		return;
+
+	OverlayShmemHeader *osh = reinterpret_cast<OverlayShmemHeader *>(smMem->data());
+	if (! (osh->uiLatest & OVERLAY_SHMEM_DIRTY))
+		return;
+
+	unsigned int latest = overlayExchange(&osh->uiLatest, uiFront) & OVERLAY_SHMEM_INDEX;
+	if ((latest >= OVERLAY_SHMEM_BUFFERS) || (latest == uiFront)) {
+		qWarning() << "PROTOCOL: Got buffer" << latest << "while holding" << uiFront;
+		detach();
+		return;
+	}
+	uiFront = latest;
+
+	const OverlayShmemFrame &osf = osh->osf[uiFront];
+	if (osf.uiFrame <= uiFrame) {
+		qWarning() << "PROTOCOL: Frame" << osf.uiFrame << "is not newer than" << uiFrame;
+		detach();
+		return;
+	}
+	if (osf.uiRects > OVERLAY_SHMEM_MAX_RECTS) {
+		qWarning() << "PROTOCOL: Frame" << osf.uiFrame << "has" << osf.uiRects << "rects";
+		detach();
+		return;
+	}
+
+	const unsigned char *buffer = OVERLAY_SHMEM_BUFFER(smMem->data(), uiFront, uiWidth, uiHeight);
+	if (osf.uiFrame == uiFrame + 1) {
+		for (unsigned int i = 0; i < osf.uiRects; ++i) {
+			const OverlayShmemRect &r = osf.osr[i];
+			if (((r.x + r.w) > uiWidth) || ((r.y + r.h) > uiHeight)) {
+				qWarning() << "PROTOCOL: Rect" << r.x << r.y << r.w << r.h << "is out of bounds";
+				detach();
+				return;
+			}
+			blit(buffer, r.x, r.y, r.w, r.h);
+		}
+	} else {
+		uiSkipped += osf.uiFrame - uiFrame - 1;
+		blit(buffer, 0, 0, uiWidth, uiHeight);
+	}
+	uiFrame = osf.uiFrame;
+	++uiFrames;
+
+	QWidget::update();
+}
+
+void OverlayWidget::blit(const unsigned char *buffer, unsigned int x, unsigned int y, unsigned int w, unsigned int h) {
+	for (unsigned int row = 0; row < h; ++row) {
+		const unsigned char *src = buffer + 4 * (uiWidth * (row + y) + x);
+		unsigned char *dst = img.scanLine(row + y) + x * 4;
+		memcpy(dst, src, w * 4);
+	}
+	uiBlitBytes += 4ULL * w * h;
+	++uiBlitRects;
+}
+
 void OverlayWidget::connected() {
 	qWarning() << "connected";
 
@@ -164,6 +255,8 @@ void OverlayWidget::error(QLocalSocket::LocalSocketError) {
 void OverlayWidget::update() {
 	++iFrameCount;
 
+	checkFrame();
+
 	clock_t t = clock();
 	float elapsed = static_cast<float>(qtWall.elapsed() - iLastFpsUpdate) / 1000.0f;
 
@@ -178,8 +271,13 @@ void OverlayWidget::update() {
 			qlsSocket->write(reinterpret_cast<char*>(&om), sizeof(OverlayMsgHeader) + om.omh.iLength);
 		}
 
+		qWarning() << "Touched" << (uiBlitBytes / iFrameCount) << "bytes in" << (static_cast<float>(uiBlitRects) / static_cast<float>(iFrameCount)) << "rects per frame;" << uiFrames << "frames taken," << uiSkipped << "skipped";
+
 		iFrameCount = 0;
 		iLastFpsUpdate = 0;
+		uiBlitBytes = 0;
+		uiBlitRects = 0;
+		uiFrames = uiSkipped = 0;
 		qtWall.start();
 	}
 
@@ -224,37 +322,25 @@ void OverlayWidget::readyRead() {
 						qWarning() << "SHMAT" << key;
 						if (smMem)
 							delete smMem;
-						smMem = new SharedMemory2(this, width() * height() * 4, key);
+						smMem = new SharedMemory2(this, OVERLAY_SHMEM_SIZE(uiWidth, uiHeight), key);
 						if (! smMem->data()) {
 							qWarning() << "SHMEM FAIL";
 							delete smMem;
 							smMem = NULL;
-						} else {
-							qWarning() << "SHMEM" << smMem->size();
-						}
-					}
-					break;
-				case OVERLAY_MSGTYPE_BLIT: {
-						OverlayMsgBlit *omb = & om.omb;
-						length -= sizeof(OverlayMsgBlit);
-
-						qWarning() << "BLIT" << omb->x << omb->y << omb->w << omb->h;
-
-						if (! smMem)
 							break;
+						}
 
-						if (((omb->x + omb->w) > img.width()) ||
-						        ((omb->y + omb->h) > img.height()))
+						const OverlayShmemHeader *osh = reinterpret_cast<const OverlayShmemHeader *>(smMem->data());
+						if ((osh->uiMagic != OVERLAY_MAGIC_NUMBER) || (osh->uiWidth != uiWidth) || (osh->uiHeight != uiHeight)) {
+							qWarning() << "PROTOCOL: Header is for" << osh->uiWidth << osh->uiHeight << "with magic" << osh->uiMagic;
+							delete smMem;
+							smMem = NULL;
 							break;
-
-
-						for (int y = 0; y < omb->h; ++y) {
-							unsigned char *src = reinterpret_cast<unsigned char *>(smMem->data()) + 4 * (width() * (y + omb->y) + omb->x);
-							unsigned char *dst = img.scanLine(y + omb->y) + omb->x * 4;
-							memcpy(dst, src, omb->w * 4);
 						}
 
-						update();
+						qWarning() << "SHMEM" << smMem->size();
+						uiFront = 0;
+						uiFrame = 0;
 					}
 					break;
 				case OVERLAY_MSGTYPE_ACTIVE: {
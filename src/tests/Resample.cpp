@@ -1,122 +1,131 @@
 /**
- * Speex resampling test / information.
+ * Resampler benchmark.
+ *
+ * Runs every Resampler quality mode, and Speex at the matching quality for
+ * comparison, over the sample rate conversions Mumble performs. For each it
+ * reports the time per 10ms frame, the filter latency and the THD+N of a
+ * 1kHz sine.
  */
 
 #define _USE_MATH_DEFINES
 #include <cmath>
-#include <QtCore>
-#include <ipp.h>
-#include <windows.h>
-#include "Timer.h"
 
-#define ITER 1000
-
-#include <speex/speex_resampler.h>
-
-int main(int argc, char **argv) {
-	ippStaticInit();
-	ippSetNumThreads(1);
+#include <QtCore>
 
 #ifdef Q_OS_WIN
-	if (!SetPriorityClass(GetCurrentProcess(),HIGH_PRIORITY_CLASS))
-		qWarning("Application: Failed to set priority!");
+#include <windows.h>
 #endif
 
-	QCoreApplication a(argc, argv);
-
-	SpeexResamplerState *srs;
-
-	int iMicFreq = 44100;
-	int iSampleRate = 48000;
-	int iFrameSize = iSampleRate / 100;
-	int err = 0;
-
-	srs = speex_resampler_init(1, iMicFreq, iSampleRate, 3, &err);
-
-	int iMicLength = (iFrameSize * iMicFreq) / iSampleRate;
-
-	qWarning() << iMicFreq << iSampleRate << iFrameSize << iMicLength;
+#include "Resampler.h"
+#include "Timer.h"
 
-	float *pfInput = new float[iMicLength];
-	float *pfOutput = new float[iFrameSize];
+#define ITER 2000
 
-	for (int i=0;i<iMicLength;++i) {
-		pfInput[i] = sinf((M_PI * i * 20) / iMicLength);
+static const char *qualityName(Resampler::Quality q) {
+	switch (q) {
+		case Resampler::LowLatency:
+			return "lowlatency";
+		case Resampler::HighQuality:
+			return "highquality";
+		default:
+			return "balanced";
 	}
+}
 
-	for (int i=0;i<iFrameSize;++i)
-		pfOutput[i] = 0;
-
-	qWarning() << "speex resampler latency: " << speex_resampler_get_input_latency(srs);
-
-
-	Timer t;
-
-	for (int i=0;i<ITER;++i) {
-		spx_uint32_t inlen = iMicLength;
-		spx_uint32_t outlen = iFrameSize;
-		speex_resampler_process_float(srs, 0, pfInput, &inlen, pfOutput, &outlen);
+// Fits a sine of the given frequency to the signal and returns the power of
+// the residual relative to the fitted sine, in dB.
+static double thdn(const float *data, unsigned int n, double freq, unsigned int rate) {
+	double s = 0.0, c = 0.0;
+	for (unsigned int i=0;i<n;++i) {
+		const double w = 2.0 * M_PI * freq * i / rate;
+		s += data[i] * sin(w);
+		c += data[i] * cos(w);
 	}
-
-	quint64 e = t.elapsed();
-
-	qWarning() << "speex us per iteration: " << (e / ITER);
-
-	float min = 0.0;
-	float max = 0.0;
-
-	for (int i=0;i<iFrameSize;++i) {
-		min = qMin(min, pfOutput[i]);
-		max = qMax(max, pfOutput[i]);
+	s *= 2.0 / n;
+	c *= 2.0 / n;
+
+	double err = 0.0;
+	for (unsigned int i=0;i<n;++i) {
+		const double w = 2.0 * M_PI * freq * i / rate;
+		const double d = data[i] - s * sin(w) - c * cos(w);
+		err += d * d;
 	}
 
-	qWarning() << "Speex bounds" << min << max;
-
-	delete [] pfOutput;
-
-	int history=24;
-	int lastread = history;
-	double time = history;
-	int olen = 0;
-
-	float *inBuf = ippsMalloc_32f(iMicLength+history*2+2);
-	ippsZero_32f(inBuf, iMicLength+history*2+2);
-
-	pfOutput = ippsMalloc_32f(iFrameSize+2);
-
-	for (int i=0;i<iFrameSize;++i)
-		pfOutput[i] = 0;
+	const double signal = (s * s + c * c) / 2.0;
+	return 10.0 * log10((err / n) / signal);
+}
 
+static void run(unsigned int inrate, unsigned int outrate, Resampler::Quality q, bool speex) {
+	const unsigned int inframe = inrate / 100;
+	const unsigned int outframe = outrate / 100;
+	const unsigned int frames = 100;
 
-	IppsResamplingPolyphaseFixed_32f *pSpec = NULL;
-	ippsResamplePolyphaseFixedInitAlloc_32f(&pSpec, iMicFreq, iSampleRate, 2*history, 0.90f, 8.0f, ippAlgHintFast);
+	Resampler *r = Resampler::create(1, inrate, outrate, inframe, q, speex);
 
-	t.restart();
+	// One second of input, fed in 10ms chunks
+	float *pfInput = new float[inframe * frames];
+	for (unsigned int i=0;i<inframe * frames;++i)
+		pfInput[i] = 0.5f * static_cast<float>(sin(2.0 * M_PI * 1000.0 * i / inrate));
 
-	for (int i=0;i<ITER;++i) {
-		ippsCopy_32f(pfInput, inBuf + history, iMicLength);
+	float *pfOutput = new float[(outframe + 16) * frames];
+	unsigned int filled = 0;
 
-		ippsResamplePolyphaseFixed_32f(pSpec, inBuf, iMicLength, pfOutput, .99f, &time, &olen);
+	for (unsigned int f=0;f<frames;++f) {
+		unsigned int inlen = inframe;
+		unsigned int outlen = outframe + 16;
+		r->process(pfInput + f * inframe, inlen, pfOutput + filled, outlen);
+		filled += outlen;
+	}
 
-		time -= iMicLength;
+	// Skip the first half, so neither the startup transient nor the
+	// filter latency affects the measurement.
+	const double quality = thdn(pfOutput + filled / 2, filled - filled / 2, 1000.0, outrate);
 
-		ippsMove_32f(inBuf + history, inBuf, history);
+	float *pfFrame = new float[outframe + 16];
+	Timer t;
+	for (unsigned int i=0;i<ITER;++i) {
+		unsigned int inlen = inframe;
+		unsigned int outlen = outframe + 16;
+		r->process(pfInput + (i % frames) * inframe, inlen, pfFrame, outlen);
 	}
+	const quint64 e = t.elapsed();
 
-	e = t.elapsed();
-	qWarning() << "ipp us per iteration: " << (e / ITER);
+	qWarning("%6u -> %6u  %-9s %-11s  %7.2f us/frame  latency %5.2f ms  THD+N %7.1f dB",
+	         inrate, outrate, r->name(), qualityName(q),
+	         static_cast<double>(e) / ITER,
+	         r->inputLatency() * 1000.0 / inrate,
+	         quality);
 
-	min = 0.0;
-	max = 0.0;
+	delete [] pfFrame;
+	delete [] pfOutput;
+	delete [] pfInput;
+	delete r;
+}
 
-	for (int i=0;i<iFrameSize;++i) {
-		min = qMin(min, pfOutput[i]);
-		max = qMax(max, pfOutput[i]);
-	}
+int main(int argc, char **argv) {
+#ifdef Q_OS_WIN
+	if (!SetPriorityClass(GetCurrentProcess(),HIGH_PRIORITY_CLASS))
+		qWarning("Application: Failed to set priority!");
+#endif
 
-	qWarning() << "IPP bounds" << min << max;
+	QCoreApplication a(argc, argv);
 
-	delete [] pfInput;
+	static const unsigned int rates[][2] = {
+		{ 44100, 48000 },
+		{ 48000, 44100 },
+		{ 96000, 48000 },
+		{ 48000, 96000 },
+		{ 32000, 48000 },
+		{ 16000, 48000 },
+		{ 48000, 16000 },
+	};
+
+	for (unsigned int i=0;i<sizeof(rates)/sizeof(rates[0]);++i) {
+		for (int q=Resampler::LowLatency;q<=Resampler::HighQuality;++q) {
+			run(rates[i][0], rates[i][1], static_cast<Resampler::Quality>(q), false);
+			run(rates[i][0], rates[i][1], static_cast<Resampler::Quality>(q), true);
+		}
+	}
 
 	return 0;
 }
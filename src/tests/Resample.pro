@@ -1,23 +1,21 @@
 include(../../compiler.pri)
+
 TEMPLATE = app
-CONFIG += qt thread warn_on release qtestlib no_keywords console
+CONFIG += qt thread warn_on release console
 CONFIG -= app_bundle
 LANGUAGE = C++
 TARGET = Resample
-SOURCES = Resample.cpp Timer.cpp
-HEADERS = Timer.h
+HEADERS = Timer.h ../mumble/AudioKernels.h ../mumble/Resampler.h
+SOURCES = Resample.cpp Timer.cpp ../mumble/AudioKernels.cpp ../mumble/Resampler.cpp
 VPATH += ..
-INCLUDEPATH	*= .. ../../3rdparty/speex-src/include ../../3rdparty/speex-src/libspeex ../../3rdparty/speex-build
-LIBS 		*= -lspeex
+INCLUDEPATH *= .. ../murmur ../mumble ../../3rdparty/celt-0.7.0-src/libcelt ../../3rdparty/speex-src/include ../../3rdparty/speex-src/libspeex ../../3rdparty/speex-build
+LIBS *= -lspeex
 
-win32 {
-  CONFIG(intelcpp) {
-    LIBS	*= -l"\Program Files (x86)\Intel/Compiler\11.0\075\cpp\ipp\ia32\lib\ippsemerged"
-    LIBS	*= -l"\Program Files (x86)\Intel/Compiler\11.0\075\cpp\ipp\ia32\lib\ippsmerged"
-    LIBS	*= -l"\Program Files (x86)\Intel/Compiler\11.0\075\cpp\ipp\ia32\lib\ippsremerged"
-    LIBS	*= -l"\Program Files (x86)\Intel/Compiler\11.0\075\cpp\ipp\ia32\lib\ippsrmerged"
-    LIBS	*= -l"\Program Files (x86)\Intel/Compiler\11.0\075\cpp\ipp\ia32\lib\ippcorel"
-  }
+# Make Q_DECL_OVERRIDE and Q_DECL_FINAL no-ops
+# for Qt 4, as mumble.pri does.
+isEqual(QT_MAJOR_VERSION, 4) {
+	DEFINES *= Q_DECL_OVERRIDE=
+	DEFINES *= Q_DECL_FINAL=
 }
 
 CONFIG(debug, debug|release) {
@@ -0,0 +1,103 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "RingBuffer.h"
+
+class TestRingBuffer : public QObject {
+		Q_OBJECT
+	private slots:
+		void capacity();
+		void wraparound();
+		void overflow();
+		void threaded();
+};
+
+void TestRingBuffer::capacity() {
+	RingBuffer<short> rb(1000);
+
+	QCOMPARE(rb.capacity(), 1024U);
+	QCOMPARE(rb.available(), 0U);
+	QCOMPARE(rb.space(), 1024U);
+}
+
+void TestRingBuffer::wraparound() {
+	RingBuffer<int> rb(16);
+	int in[10], out[10];
+	int next = 0, expect = 0;
+
+	for (int round = 0; round < 100; ++round) {
+		for (int i = 0; i < 10; ++i)
+			in[i] = next++;
+		QVERIFY(rb.write(in, 10));
+		QCOMPARE(rb.available(), 10U);
+
+		QVERIFY(rb.read(out, 10));
+		for (int i = 0; i < 10; ++i)
+			QCOMPARE(out[i], expect++);
+	}
+
+	QVERIFY(rb.writeZero(7));
+	QCOMPARE(rb.skip(3), 3U);
+	QVERIFY(rb.read(out, 4));
+	for (int i = 0; i < 4; ++i)
+		QCOMPARE(out[i], 0);
+}
+
+void TestRingBuffer::overflow() {
+	RingBuffer<int> rb(8);
+	int buf[8];
+	memset(buf, 0, sizeof(buf));
+
+	QVERIFY(rb.write(buf, 6));
+	QVERIFY(! rb.write(buf, 3));
+	QCOMPARE(rb.available(), 6U);
+
+	QVERIFY(! rb.read(buf, 7));
+	QCOMPARE(rb.available(), 6U);
+
+	QCOMPARE(rb.skip(100), 6U);
+	QCOMPARE(rb.available(), 0U);
+}
+
+class RingBufferWriter : public QThread {
+	public:
+		RingBuffer<unsigned int> *rb;
+		unsigned int count;
+		void run() {
+			unsigned int next = 0;
+			unsigned int frame[3];
+			while (next < count) {
+				for (int i = 0; i < 3; ++i)
+					frame[i] = next + i;
+				if (rb->write(frame, 3))
+					next += 3;
+				else
+					yieldCurrentThread();
+			}
+		}
+};
+
+void TestRingBuffer::threaded() {
+	RingBuffer<unsigned int> rb(32);
+	RingBufferWriter w;
+	w.rb = &rb;
+	w.count = 300000;
+	w.start();
+
+	unsigned int expect = 0;
+	unsigned int frame[3];
+	while (expect < w.count) {
+		if (rb.read(frame, 3)) {
+			for (int i = 0; i < 3; ++i)
+				QCOMPARE(frame[i], expect++);
+		} else {
+			QThread::yieldCurrentThread();
+		}
+	}
+
+	w.wait();
+	QCOMPARE(rb.available(), 0U);
+}
+
+QTEST_MAIN(TestRingBuffer)
+#include "TestRingBuffer.moc"
@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += qt thread warn_on qtestlib
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TestRingBuffer
+SOURCES = TestRingBuffer.cpp
+HEADERS = RingBuffer.h
+VPATH += .. ../mumble
+INCLUDEPATH += .. ../murmur ../mumble
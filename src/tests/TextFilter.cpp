@@ -0,0 +1,179 @@
+/**
+ * Text message filter benchmark.
+ *
+ * Runs HTMLFilter and the QXmlStreamReader based checks it replaced over a
+ * corpus of messages, reports the time per message for both and verifies
+ * that they agree. Messages are read one per line from the files given on
+ * the command line; without arguments a built-in sample is used.
+ */
+
+#include <QtCore>
+#include <QtXml>
+
+#include "HTMLFilter.h"
+#include "Timer.h"
+
+#define ITER 200
+
+static bool referencePlainText(const QString &text, QString &out) {
+	QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
+	QString qs;
+	while (! qxsr.atEnd()) {
+		switch (qxsr.readNext()) {
+			case QXmlStreamReader::Invalid:
+				return false;
+			case QXmlStreamReader::Characters:
+				qs += qxsr.text();
+				break;
+			case QXmlStreamReader::EndElement:
+				if ((qxsr.name() == QLatin1String("br")) || (qxsr.name() == QLatin1String("p")))
+					qs += "\n";
+				break;
+			default:
+				break;
+		}
+	}
+	out = qs.simplified();
+	return true;
+}
+
+static int referenceTextLength(const QString &text) {
+	QString qsOut;
+	QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
+	QXmlStreamWriter qxsw(&qsOut);
+	while (! qxsr.atEnd()) {
+		switch (qxsr.readNext()) {
+			case QXmlStreamReader::Invalid:
+				return -1;
+			case QXmlStreamReader::StartElement: {
+					if (qxsr.name() == QLatin1String("img")) {
+						qxsw.writeStartElement(qxsr.namespaceUri().toString(), qxsr.name().toString());
+						foreach(const QXmlStreamAttribute &a, qxsr.attributes())
+							if (a.name() != QLatin1String("src"))
+								qxsw.writeAttribute(a);
+					} else {
+						qxsw.writeCurrentToken(qxsr);
+					}
+				}
+				break;
+			default:
+				qxsw.writeCurrentToken(qxsr);
+				break;
+		}
+	}
+	return qsOut.length();
+}
+
+static QStringList sampleCorpus() {
+	QStringList corpus;
+
+	corpus << QLatin1String("brb");
+	corpus << QLatin1String("anyone up for a round of ranked? &lt;3");
+	corpus << QLatin1String("<b>Server restart</b> in 5 minutes, please reconnect afterwards.");
+	corpus << QLatin1String("<a href=\"https://example.com/watch?v=abc&amp;t=42\">https://example.com/watch?v=abc&amp;t=42</a>");
+	corpus << QLatin1String("<p>Rules:</p><ul><li>Be nice</li><li>No <i>spam</i></li></ul><p>Have fun!<br/>-- Admins</p>");
+	corpus << QLatin1String("<span style=\"color:#ff0000;\">red</span> and <span style=\"font-weight:600;\">bold</span> &amp; &#9731;");
+	corpus << QLatin1String("unbalanced <b>bold text");
+
+	// Well-formedness corner cases both implementations have to reject, or
+	// accept, alike.
+	corpus << QLatin1String("<span style=\"color:red\" style=\"color:blue\">duplicate attribute</span>");
+	corpus << QLatin1String("<o:p>undeclared element prefix</o:p>");
+	corpus << QLatin1String("<span o:title=\"x\">undeclared attribute prefix</span>");
+	corpus << QLatin1String("<o:p xmlns:o=\"urn:o\"><o:b o:x=\"1\">declared prefixes</o:b></o:p>");
+	corpus << QLatin1String("<br xmlns:o=\"urn:o\"/><o:p>prefix out of scope</o:p>");
+	corpus << QLatin1String("arrays: a[b[0]]> 1");
+	corpus << QLatin1String("<![CDATA[a[b[0]] > 1]]> in a CDATA section");
+
+	// An inline screenshot, the way the client embeds pasted images.
+	QByteArray img(96 * 1024, '\0');
+	for (int i=0;i<img.size();++i)
+		img[i] = static_cast<char>((i * 7919) >> 3);
+	corpus << QString::fromLatin1("look at this: <br /><img src=\"data:image/jpeg;base64,%1\" />").arg(QLatin1String(img.toBase64()));
+
+	return corpus;
+}
+
+static QStringList loadCorpus(const QStringList &files) {
+	QStringList corpus;
+	foreach(const QString &fname, files) {
+		QFile f(fname);
+		if (! f.open(QIODevice::ReadOnly)) {
+			qWarning("Failed to open %s", qPrintable(fname));
+			continue;
+		}
+		while (! f.atEnd()) {
+			const QString &line = QString::fromUtf8(f.readLine()).trimmed();
+			if (! line.isEmpty())
+				corpus << line;
+		}
+	}
+	return corpus;
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	QStringList args = a.arguments();
+	args.removeFirst();
+
+	const QStringList &corpus = args.isEmpty() ? sampleCorpus() : loadCorpus(args);
+	if (corpus.isEmpty())
+		qFatal("Empty corpus");
+
+	int mismatches = 0;
+	qint64 bytes = 0;
+
+	foreach(const QString &msg, corpus) {
+		bytes += msg.length();
+
+		QString ref, out;
+		const bool refok = referencePlainText(msg, ref);
+		const bool ok = HTMLFilter::toPlainText(msg, out);
+		if ((ok != refok) || (ok && (out != ref))) {
+			qWarning("Plain text mismatch: %s", qPrintable(msg.left(80)));
+			++mismatches;
+		}
+
+		// The reference re-serializes the document, so only validity and the
+		// effect of stripping images are comparable.
+		const int reflen = referenceTextLength(msg);
+		const int len = HTMLFilter::textLength(msg);
+		if ((reflen < 0) != (len < 0)) {
+			qWarning("Validity mismatch: %s", qPrintable(msg.left(80)));
+			++mismatches;
+		}
+	}
+
+	quint64 elapsed[4];
+	int sink = 0;
+
+	Timer t;
+	for (int i=0;i<ITER;++i)
+		foreach(const QString &msg, corpus) {
+			QString out;
+			sink += referencePlainText(msg, out) ? out.length() : 0;
+		}
+	elapsed[0] = t.restart();
+	for (int i=0;i<ITER;++i)
+		foreach(const QString &msg, corpus) {
+			QString out;
+			sink += HTMLFilter::toPlainText(msg, out) ? out.length() : 0;
+		}
+	elapsed[1] = t.restart();
+	for (int i=0;i<ITER;++i)
+		foreach(const QString &msg, corpus)
+			sink += referenceTextLength(msg);
+	elapsed[2] = t.restart();
+	for (int i=0;i<ITER;++i)
+		foreach(const QString &msg, corpus)
+			sink += HTMLFilter::textLength(msg);
+	elapsed[3] = t.restart();
+
+	const double n = static_cast<double>(ITER) * corpus.count();
+	qWarning("%d messages, %lld characters, %d mismatches (%d)", corpus.count(), bytes, mismatches, sink & 1);
+	qWarning("plain text   QXmlStreamReader %9.2f us/msg  HTMLFilter %9.2f us/msg", elapsed[0] / n, elapsed[1] / n);
+	qWarning("text length  QXmlStreamReader %9.2f us/msg  HTMLFilter %9.2f us/msg", elapsed[2] / n, elapsed[3] / n);
+
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+include(../../compiler.pri)
+
+TEMPLATE = app
+QT += network sql xml
+CONFIG += qt thread warn_on release console
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TextFilter
+HEADERS = Timer.h ../murmur/HTMLFilter.h
+SOURCES = TextFilter.cpp Timer.cpp ../murmur/HTMLFilter.cpp
+VPATH += ..
+INCLUDEPATH *= .. ../murmur
+
+CONFIG(debug, debug|release) {
+  LIBPATH	+= ../../debug
+  DESTDIR	= ../../debug
+}
+
+CONFIG(release, debug|release) {
+  LIBPATH	+= ../../release
+  DESTDIR	= ../../release
+}